@@ -59,7 +59,7 @@ void *ksbrk_page(int n)
     uint32_t p_addr;
     int i;
 
-    if ((g_kernel_heap + (n * PAGESIZE_4K)) > (char *) KERN_HEAP_END) {
+    if ((g_kernel_heap + (n * PAGESIZE_4K)) > (char *) KERN_TEMPORARY_MAP_AREA) {
         //Screen_PrintF("ERROR: ksbrk(): no virtual memory left for kernel heap !\n");
         return (char *) -1;
     }
@@ -189,6 +189,13 @@ static void sbrk_page(Process* proc, int page_count)
                 return;
             }
 
+            if (IS_PAGEFRAME_USED(proc->mmapped_virtual_memory, PAGE_INDEX_4K((uint32_t)proc->brk_next_unallocated_page_begin)))
+            {
+                //Already backed, e.g. by shared pages of the executable image
+                proc->brk_next_unallocated_page_begin += PAGESIZE_4K;
+                continue;
+            }
+
             uint32_t p_addr = vmm_acquire_page_frame_4k();
 
             if ((int)(p_addr) < 0)
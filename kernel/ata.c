@@ -0,0 +1,837 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include "ata.h"
+#include "alloc.h"
+#include "device.h"
+#include "devfs.h"
+#include "fs.h"
+#include "isr.h"
+#include "log.h"
+#include "pci.h"
+#include "process.h"
+#include "timer.h"
+#include "vmm.h"
+
+/*
+ *  ATA disks on the IDE controller. Each disk is registered as /dev/hda../dev/hdd and every MBR primary partition on it as a
+ *  separate block device (/dev/hda1../dev/hda4) that addresses sectors relative to the partition start.
+ *  Transfers use bus-master DMA when the controller and the disk support it and the calling thread sleeps until the completion
+ *  interrupt. Otherwise, or if a DMA transfer fails, the data goes through the data port (PIO) with the disk's interrupt masked.
+ */
+
+#define ATA_REG_DATA 0
+#define ATA_REG_SECTOR_COUNT 2
+#define ATA_REG_LBA_LOW 3
+#define ATA_REG_LBA_MID 4
+#define ATA_REG_LBA_HIGH 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+#define ATA_CONTROL_NIEN 0x02
+
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_DF 0x20
+#define ATA_STATUS_BSY 0x80
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_READ_PIO_EXT 0x24
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define BM_REG_COMMAND 0
+#define BM_REG_STATUS 2
+#define BM_REG_PRDT 4
+
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_READ 0x08
+#define BM_STATUS_ERROR 0x02
+#define BM_STATUS_IRQ 0x04
+
+#define PRD_END_OF_TABLE 0x8000
+
+#define ATA_SECTOR_SIZE 512
+#define ATA_DMA_MAX_SECTORS 128 //64KB, at most 17 table entries
+#define ATA_PIO_MAX_SECTORS 256
+#define ATA_LBA28_LIMIT 0x0FFFFFFF
+#define ATA_TIMEOUT_MS 5000
+#define ATA_POLL_LIMIT 1000000
+
+#define ATA_CHANNEL_COUNT 2
+
+typedef struct AtaPrd
+{
+    uint32_t address;
+    uint16_t byte_count;
+    uint16_t flags;
+} __attribute__((packed)) AtaPrd;
+
+typedef struct AtaChannel
+{
+    uint16_t base;
+    uint16_t control;
+    uint16_t bus_master; //0 without DMA
+    uint8_t interrupt;
+    AtaPrd* prdt;
+    uint32_t prdt_physical;
+    volatile BOOL busy;
+    volatile BOOL dma_active;
+    volatile BOOL dma_done;
+    Thread* waiter;
+} AtaChannel;
+
+typedef struct AtaDrive
+{
+    AtaChannel* channel;
+    uint8_t slave;
+    BOOL lba48;
+    BOOL dma;
+    BOOL unflushed; //written since the last cache flush
+    uint32_t sector_count;
+} AtaDrive;
+
+//A whole disk or a partition of it
+typedef struct AtaDevice
+{
+    AtaDrive* drive;
+    uint32_t lba_start;
+    uint32_t sector_count;
+} AtaDevice;
+
+static AtaChannel g_channels[ATA_CHANNEL_COUNT];
+
+static BOOL ata_open(File *file, uint32_t flags);
+static void ata_close(File *file);
+static int32_t ata_read_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer);
+static int32_t ata_write_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer);
+static int32_t ata_flush_blocks(filesystem_node* node);
+static int32_t ata_ioctl(File *file, int32_t request, void * argp);
+
+static const filesystem_ops g_ata_ops =
+{
+    .open = ata_open,
+    .close = ata_close,
+    .read_block = ata_read_block,
+    .write_block = ata_write_block,
+    .flush_blocks = ata_flush_blocks,
+    .ioctl = ata_ioctl
+};
+
+//Reading the alternate status register takes about 100ns, the drive needs 400ns after a select
+static void delay_400ns(AtaChannel* channel)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        inb(channel->control);
+    }
+}
+
+static uint8_t wait_not_busy(AtaChannel* channel)
+{
+    uint8_t status = inb(channel->base + ATA_REG_STATUS);
+
+    for (uint32_t i = 0; (status & ATA_STATUS_BSY) && i < ATA_POLL_LIMIT; ++i)
+    {
+        status = inb(channel->base + ATA_REG_STATUS);
+    }
+
+    return status;
+}
+
+//Waits until the drive asks for data, returns FALSE on error or timeout
+static BOOL wait_data_request(AtaChannel* channel)
+{
+    for (uint32_t i = 0; i < ATA_POLL_LIMIT; ++i)
+    {
+        uint8_t status = inb(channel->base + ATA_REG_STATUS);
+
+        if (status & ATA_STATUS_BSY)
+        {
+            continue;
+        }
+
+        if (status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+        {
+            return FALSE;
+        }
+
+        if (status & ATA_STATUS_DRQ)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void lock_channel(AtaChannel* channel)
+{
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    disable_interrupts();
+
+    while (channel->busy)
+    {
+        //Another thread sleeps until this channel's transfer completes
+        enable_interrupts();
+        halt();
+        disable_interrupts();
+    }
+
+    channel->busy = TRUE;
+
+    //Killed while owning the channel, it would stay busy for good
+    thread_defer_kill();
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+}
+
+static void unlock_channel(AtaChannel* channel)
+{
+    channel->busy = FALSE;
+
+    thread_allow_kill();
+}
+
+static void select_sectors(AtaDrive* drive, uint32_t lba, uint32_t count)
+{
+    AtaChannel* channel = drive->channel;
+
+    if (drive->lba48)
+    {
+        outb(channel->base + ATA_REG_DRIVE, 0x40 | (drive->slave << 4));
+        delay_400ns(channel);
+        wait_not_busy(channel);
+
+        //High order bytes first, the registers are two deep FIFOs
+        outb(channel->base + ATA_REG_SECTOR_COUNT, (count >> 8) & 0xFF);
+        outb(channel->base + ATA_REG_LBA_LOW, (lba >> 24) & 0xFF);
+        outb(channel->base + ATA_REG_LBA_MID, 0);
+        outb(channel->base + ATA_REG_LBA_HIGH, 0);
+    }
+    else
+    {
+        outb(channel->base + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+        delay_400ns(channel);
+        wait_not_busy(channel);
+    }
+
+    outb(channel->base + ATA_REG_SECTOR_COUNT, count & 0xFF);
+    outb(channel->base + ATA_REG_LBA_LOW, lba & 0xFF);
+    outb(channel->base + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
+    outb(channel->base + ATA_REG_LBA_HIGH, (lba >> 16) & 0xFF);
+}
+
+static int32_t transfer_pio(AtaDrive* drive, uint32_t lba, uint32_t count, uint8_t* buffer, BOOL write)
+{
+    AtaChannel* channel = drive->channel;
+
+    outb(channel->control, ATA_CONTROL_NIEN);
+
+    select_sectors(drive, lba, count);
+
+    if (write)
+    {
+        outb(channel->base + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO);
+    }
+    else
+    {
+        outb(channel->base + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
+    }
+
+    uint16_t* words = (uint16_t*)buffer;
+
+    for (uint32_t sector = 0; sector < count; ++sector)
+    {
+        delay_400ns(channel);
+
+        if (!wait_data_request(channel))
+        {
+            return -1;
+        }
+
+        for (uint32_t i = 0; i < ATA_SECTOR_SIZE / 2; ++i)
+        {
+            if (write)
+            {
+                outw(channel->base + ATA_REG_DATA, *words++);
+            }
+            else
+            {
+                *words++ = inw(channel->base + ATA_REG_DATA);
+            }
+        }
+    }
+
+    uint8_t status = wait_not_busy(channel);
+
+    return (status & (ATA_STATUS_BSY | ATA_STATUS_ERR | ATA_STATUS_DF)) ? -1 : 0;
+}
+
+//Makes the drive write its cache to the media, written data is only safe after this
+static int32_t flush_cache(AtaDrive* drive)
+{
+    AtaChannel* channel = drive->channel;
+
+    outb(channel->control, ATA_CONTROL_NIEN);
+
+    outb(channel->base + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4));
+    delay_400ns(channel);
+
+    outb(channel->base + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
+    delay_400ns(channel);
+
+    uint8_t status = wait_not_busy(channel);
+
+    return (status & (ATA_STATUS_BSY | ATA_STATUS_ERR | ATA_STATUS_DF)) ? -1 : 0;
+}
+
+//Fills the channel's descriptor table with the physical pieces of the buffer. The buffer may be in any mapped memory, a
+//piece never crosses a page, so it never crosses the 64KB boundary a descriptor must stay in.
+static BOOL build_prdt(AtaChannel* channel, uint8_t* buffer, uint32_t size)
+{
+    if ((uint32_t)buffer & 1)
+    {
+        return FALSE;
+    }
+
+    uint32_t index = 0;
+    uint32_t done = 0;
+
+    while (done < size)
+    {
+        uint32_t address = (uint32_t)buffer + done;
+        uint32_t chunk = MIN(PAGESIZE_4K - address % PAGESIZE_4K, size - done);
+
+        uint32_t physical = vmm_get_physical_address(address);
+        if (0 == physical)
+        {
+            return FALSE;
+        }
+
+        channel->prdt[index].address = physical;
+        channel->prdt[index].byte_count = chunk;
+        channel->prdt[index].flags = 0;
+
+        ++index;
+        done += chunk;
+    }
+
+    channel->prdt[index - 1].flags = PRD_END_OF_TABLE;
+
+    return TRUE;
+}
+
+//Sleeps until the completion interrupt, the deadline wakes the thread if the interrupt never comes
+static BOOL wait_for_dma(AtaChannel* channel)
+{
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    Thread* thread = thread_get_current();
+
+    uint32_t deadline = get_uptime_milliseconds() + ATA_TIMEOUT_MS;
+
+    disable_interrupts();
+
+    while (!channel->dma_done && (int32_t)(deadline - get_uptime_milliseconds()) > 0)
+    {
+        if (thread)
+        {
+            channel->waiter = thread;
+            thread_change_state(thread, TS_SLEEP, (void*)deadline);
+        }
+
+        enable_interrupts();
+        halt();
+        disable_interrupts();
+    }
+
+    channel->waiter = NULL;
+
+    if (thread && thread->state == TS_SLEEP)
+    {
+        thread_resume(thread);
+    }
+
+    BOOL result = channel->dma_done;
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+
+    return result;
+}
+
+static int32_t transfer_dma(AtaDrive* drive, uint32_t lba, uint32_t count, BOOL write)
+{
+    AtaChannel* channel = drive->channel;
+
+    uint8_t direction = write ? 0 : BM_COMMAND_READ;
+
+    outb(channel->bus_master + BM_REG_COMMAND, direction);
+    outl(channel->bus_master + BM_REG_PRDT, channel->prdt_physical);
+    outb(channel->bus_master + BM_REG_STATUS, inb(channel->bus_master + BM_REG_STATUS) | BM_STATUS_IRQ | BM_STATUS_ERROR);
+
+    channel->dma_done = FALSE;
+    channel->dma_active = TRUE;
+
+    outb(channel->control, 0);
+
+    select_sectors(drive, lba, count);
+
+    if (write)
+    {
+        outb(channel->base + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA);
+    }
+    else
+    {
+        outb(channel->base + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+    }
+
+    outb(channel->bus_master + BM_REG_COMMAND, direction | BM_COMMAND_START);
+
+    BOOL completed = wait_for_dma(channel);
+
+    outb(channel->bus_master + BM_REG_COMMAND, direction);
+
+    channel->dma_active = FALSE;
+
+    uint8_t bus_master_status = inb(channel->bus_master + BM_REG_STATUS);
+    uint8_t status = wait_not_busy(channel);
+
+    outb(channel->bus_master + BM_REG_STATUS, BM_STATUS_IRQ | BM_STATUS_ERROR);
+
+    if (!completed || (bus_master_status & BM_STATUS_ERROR) || (status & (ATA_STATUS_BSY | ATA_STATUS_ERR | ATA_STATUS_DF)))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int32_t transfer(AtaDevice* device, uint32_t block_number, uint32_t count, uint8_t* buffer, BOOL write)
+{
+    if (block_number >= device->sector_count || count > device->sector_count - block_number)
+    {
+        return -1;
+    }
+
+    AtaDrive* drive = device->drive;
+    AtaChannel* channel = drive->channel;
+
+    uint32_t lba = device->lba_start + block_number;
+
+    lock_channel(channel);
+
+    int32_t result = 0;
+
+    while (count > 0 && result == 0)
+    {
+        uint32_t chunk = MIN(count, drive->dma ? ATA_DMA_MAX_SECTORS : ATA_PIO_MAX_SECTORS);
+
+        if (!drive->lba48 && lba + chunk > ATA_LBA28_LIMIT)
+        {
+            result = -1;
+            break;
+        }
+
+        result = -1;
+
+        if (drive->dma && build_prdt(channel, buffer, chunk * ATA_SECTOR_SIZE))
+        {
+            result = transfer_dma(drive, lba, chunk, write);
+
+            if (result < 0)
+            {
+                log_printf("ATA: DMA transfer failed at %d, using PIO\r\n", lba);
+                drive->dma = FALSE;
+            }
+        }
+
+        if (result < 0)
+        {
+            result = transfer_pio(drive, lba, chunk, buffer, write);
+        }
+
+        lba += chunk;
+        buffer += chunk * ATA_SECTOR_SIZE;
+        count -= chunk;
+    }
+
+    //The drive's write cache is flushed by ata_flush_blocks, which the block cache calls on fsync and sync
+    if (write)
+    {
+        drive->unflushed = TRUE;
+    }
+
+    unlock_channel(channel);
+
+    return result;
+}
+
+static void handle_ata_interrupt(Registers *regs)
+{
+    for (int i = 0; i < ATA_CHANNEL_COUNT; ++i)
+    {
+        AtaChannel* channel = &g_channels[i];
+
+        if (channel->interrupt != regs->interruptNumber || !channel->dma_active)
+        {
+            continue;
+        }
+
+        uint8_t bus_master_status = inb(channel->bus_master + BM_REG_STATUS);
+        if (!(bus_master_status & BM_STATUS_IRQ))
+        {
+            //The interrupt line is shared and this channel did not raise it
+            continue;
+        }
+
+        //Reading the status register acknowledges the drive's interrupt
+        inb(channel->base + ATA_REG_STATUS);
+        outb(channel->bus_master + BM_REG_STATUS, BM_STATUS_IRQ);
+
+        channel->dma_done = TRUE;
+
+        if (channel->waiter && thread_is_valid(channel->waiter) && channel->waiter->state == TS_SLEEP)
+        {
+            thread_resume(channel->waiter);
+        }
+    }
+}
+
+static BOOL identify(AtaDrive* drive)
+{
+    AtaChannel* channel = drive->channel;
+
+    outb(channel->base + ATA_REG_DRIVE, 0xA0 | (drive->slave << 4));
+    delay_400ns(channel);
+
+    outb(channel->base + ATA_REG_SECTOR_COUNT, 0);
+    outb(channel->base + ATA_REG_LBA_LOW, 0);
+    outb(channel->base + ATA_REG_LBA_MID, 0);
+    outb(channel->base + ATA_REG_LBA_HIGH, 0);
+    outb(channel->base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    delay_400ns(channel);
+
+    uint8_t status = inb(channel->base + ATA_REG_STATUS);
+    if (status == 0 || status == 0xFF)
+    {
+        //No drive
+        return FALSE;
+    }
+
+    status = wait_not_busy(channel);
+    if (status & ATA_STATUS_BSY)
+    {
+        return FALSE;
+    }
+
+    if (inb(channel->base + ATA_REG_LBA_MID) || inb(channel->base + ATA_REG_LBA_HIGH))
+    {
+        //ATAPI and SATA devices answer with a signature instead
+        return FALSE;
+    }
+
+    if (!wait_data_request(channel))
+    {
+        return FALSE;
+    }
+
+    uint16_t data[256];
+    for (int i = 0; i < 256; ++i)
+    {
+        data[i] = inw(channel->base + ATA_REG_DATA);
+    }
+
+    drive->lba48 = (data[83] & (1 << 10)) != 0;
+
+    if (drive->lba48)
+    {
+        //Sector numbers are 32 bit in the block interface
+        drive->sector_count = (data[102] || data[103]) ? 0xFFFFFFFF : (data[100] | ((uint32_t)data[101] << 16));
+    }
+    else
+    {
+        drive->sector_count = data[60] | ((uint32_t)data[61] << 16);
+    }
+
+    drive->dma = channel->bus_master != 0 && (data[49] & (1 << 8)) != 0;
+
+    return drive->sector_count > 0;
+}
+
+static BOOL register_device(AtaDrive* drive, const char* name, uint32_t lba_start, uint32_t sector_count)
+{
+    AtaDevice* ata_device = (AtaDevice*)kmalloc(sizeof(AtaDevice));
+    ata_device->drive = drive;
+    ata_device->lba_start = lba_start;
+    ata_device->sector_count = sector_count;
+
+    Device device;
+    memset((uint8_t*)&device, 0, sizeof(Device));
+    strcpy(device.name, name);
+    device.device_type = FT_BLOCK_DEVICE;
+    device.ops = &g_ata_ops;
+    device.private_data = ata_device;
+
+    if (devfs_register_device(&device))
+    {
+        log_printf("ATA: /dev/%s %d sectors at %d\r\n", name, sector_count, lba_start);
+        return TRUE;
+    }
+
+    kfree(ata_device);
+
+    return FALSE;
+}
+
+static uint32_t read32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//Registers the primary partitions of an MBR. Extended and GPT partitions are not looked into.
+static void register_partitions(AtaDrive* drive, const char* name)
+{
+    AtaDevice whole;
+    whole.drive = drive;
+    whole.lba_start = 0;
+    whole.sector_count = drive->sector_count;
+
+    uint8_t* mbr = (uint8_t*)kmalloc(ATA_SECTOR_SIZE);
+
+    if (transfer(&whole, 0, 1, mbr, FALSE) == 0 && mbr[510] == 0x55 && mbr[511] == 0xAA)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            const uint8_t* entry = mbr + 0x1BE + i * 16;
+
+            uint8_t boot_flag = entry[0];
+            uint8_t type = entry[4];
+            uint32_t start = read32(entry + 8);
+            uint32_t count = read32(entry + 12);
+
+            //A volume boot record without a partition table has code here, which rarely passes these checks
+            if ((boot_flag != 0x00 && boot_flag != 0x80) || type == 0 || count == 0 || start == 0 ||
+                start >= drive->sector_count || count > drive->sector_count - start)
+            {
+                continue;
+            }
+
+            if (type == 0x05 || type == 0x0F || type == 0x85 || type == 0xEE)
+            {
+                continue;
+            }
+
+            char partition_name[8];
+            strcpy(partition_name, name);
+            partition_name[3] = '1' + i;
+            partition_name[4] = '\0';
+
+            register_device(drive, partition_name, start, count);
+        }
+    }
+
+    kfree(mbr);
+}
+
+static void initialize_channel(AtaChannel* channel, uint16_t base, uint16_t control, uint8_t interrupt, uint16_t bus_master)
+{
+    memset((uint8_t*)channel, 0, sizeof(AtaChannel));
+    channel->base = base;
+    channel->control = control;
+    channel->interrupt = interrupt;
+    channel->bus_master = bus_master;
+
+    //Drive interrupts are only unmasked while a DMA transfer waits for one
+    outb(channel->control, ATA_CONTROL_NIEN);
+
+    if (bus_master)
+    {
+        //The table must not cross a 64KB boundary, a page aligned one never does
+        uint8_t* memory = (uint8_t*)kmalloc(PAGESIZE_4K * 2);
+        channel->prdt = (AtaPrd*)(((uint32_t)memory + PAGESIZE_4K - 1) & ~(PAGESIZE_4K - 1));
+        channel->prdt_physical = vmm_get_physical_address((uint32_t)channel->prdt);
+    }
+}
+
+void ata_initialize()
+{
+    uint16_t bases[ATA_CHANNEL_COUNT] = {0x1F0, 0x170};
+    uint16_t controls[ATA_CHANNEL_COUNT] = {0x3F6, 0x376};
+    uint8_t interrupts[ATA_CHANNEL_COUNT] = {IRQ14, IRQ15};
+    uint16_t bus_master = 0;
+
+    PciDevice* pci = pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE, 0);
+    if (pci)
+    {
+        for (int i = 0; i < ATA_CHANNEL_COUNT; ++i)
+        {
+            //Channels in native mode take their ports and interrupt from PCI, compatibility mode ones use the ISA ones
+            if (pci->prog_if & (1 << (i * 2)))
+            {
+                bases[i] = pci_get_bar(pci, i * 2) & ~3;
+                controls[i] = (pci_get_bar(pci, i * 2 + 1) & ~3) + 2;
+                interrupts[i] = IRQ0 + pci->interrupt_line;
+            }
+        }
+
+        uint32_t bar4 = pci_get_bar(pci, 4);
+        if ((pci->prog_if & 0x80) && (bar4 & 1))
+        {
+            bus_master = bar4 & ~3;
+            pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+        }
+    }
+
+    for (int i = 0; i < ATA_CHANNEL_COUNT; ++i)
+    {
+        AtaChannel* channel = &g_channels[i];
+
+        initialize_channel(channel, bases[i], controls[i], interrupts[i], bus_master ? bus_master + i * 8 : 0);
+
+        if (inb(channel->base + ATA_REG_STATUS) == 0xFF)
+        {
+            //Floating bus, nothing is attached
+            continue;
+        }
+
+        //In native mode the line may be shared with other PCI devices
+        if (!interrupt_register_shared(channel->interrupt, handle_ata_interrupt))
+        {
+            log_printf("ATA: interrupt %d is taken, channel %d is not used\r\n", channel->interrupt - IRQ0, i);
+            continue;
+        }
+
+        for (uint8_t slave = 0; slave < 2; ++slave)
+        {
+            AtaDrive* drive = (AtaDrive*)kmalloc(sizeof(AtaDrive));
+            memset((uint8_t*)drive, 0, sizeof(AtaDrive));
+            drive->channel = channel;
+            drive->slave = slave;
+
+            if (!identify(drive))
+            {
+                kfree(drive);
+                continue;
+            }
+
+            char name[8];
+            strcpy(name, "hda");
+            name[2] = 'a' + i * 2 + slave;
+
+            if (register_device(drive, name, 0, drive->sector_count))
+            {
+                register_partitions(drive, name);
+            }
+        }
+    }
+}
+
+static BOOL ata_open(File *file, uint32_t flags)
+{
+    return TRUE;
+}
+
+static void ata_close(File *file)
+{
+}
+
+static int32_t ata_read_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
+{
+    return transfer((AtaDevice*)node->private_node_data, block_number, count, buffer, FALSE);
+}
+
+static int32_t ata_write_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
+{
+    return transfer((AtaDevice*)node->private_node_data, block_number, count, buffer, TRUE);
+}
+
+static int32_t ata_flush_blocks(filesystem_node* node)
+{
+    AtaDrive* drive = ((AtaDevice*)node->private_node_data)->drive;
+
+    lock_channel(drive->channel);
+
+    int32_t result = 0;
+
+    if (drive->unflushed)
+    {
+        result = flush_cache(drive);
+
+        if (0 == result)
+        {
+            drive->unflushed = FALSE;
+        }
+    }
+
+    unlock_channel(drive->channel);
+
+    return result;
+}
+
+static int32_t ata_ioctl(File *file, int32_t request, void * argp)
+{
+    AtaDevice* ata_device = (AtaDevice*)file->node->private_node_data;
+
+    uint32_t* result = (uint32_t*)argp;
+
+    switch (request)
+    {
+    case IC_GET_SECTOR_COUNT:
+        *result = ata_device->sector_count;
+        return 0;
+        break;
+    case IC_GET_SECTOR_SIZE_BYTES:
+        *result = ATA_SECTOR_SIZE;
+        return 0;
+        break;
+    default:
+        break;
+    }
+
+    return -1;
+}
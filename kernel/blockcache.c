@@ -0,0 +1,815 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include "blockcache.h"
+#include "alloc.h"
+#include "list.h"
+#include "spinlock.h"
+#include "log.h"
+#include "blockqueue.h"
+#include "process.h"
+#include "sleep.h"
+#include "timer.h"
+#include "filemapping.h"
+#include "errno.h"
+
+/*
+ *  Buffer cache for block devices. Every FT_BLOCK_DEVICE registered through devfs gets a copy of its driver's operations table with `read_block` and
+ *  `write_block` replaced by the cached versions below, the driver's own table is kept in the CachedDevice. Blocks are found through hash chains keyed by (device, block number) and kept in an LRU list.
+ *  Written blocks stay dirty in the cache until they are evicted or their device is flushed. A block whose write back failed stays dirty
+ *  and is retried later, eviction takes a clean block instead. The failure is remembered per device and reported by the next flush of it.
+ *  The driver is reached through the device's request queue (blockqueue.c). A flush queues all dirty blocks before unplugging,
+ *  so dirty neighbours go to the driver as one write.
+ *  Dirty blocks remember when they became dirty and which file wrote them (BLOCKCACHE_METADATA for everything else), so fsync can write back
+ *  a single file and its metadata. The flusher thread writes back blocks that stayed dirty for BLOCKCACHE_DIRTY_EXPIRE_MS and keeps the
+ *  dirty count under BLOCKCACHE_DIRTY_BACKGROUND_RATIO, writers only wait for the disk once BLOCKCACHE_DIRTY_RATIO is exceeded.
+ *  Only the flushes fsync and sync ask for end with the driver's flush_blocks, write backs of the flusher and of eviction leave the
+ *  data in the drive's write cache.
+ */
+
+#define BLOCKCACHE_BUCKET_COUNT 1024
+
+typedef struct CachedDevice
+{
+    filesystem_node* node;
+    const filesystem_ops* driver_ops;
+    filesystem_ops ops;//what the node dispatches through while attached
+    BlockQueue* queue;
+    BOOL write_error; //a write back failed since the last flush reported it
+} CachedDevice;
+
+typedef struct BlockBuffer
+{
+    CachedDevice* device;
+    uint32_t block_number;
+    BOOL dirty;
+    void* owner; //file that dirtied the block or BLOCKCACHE_METADATA
+    uint32_t dirty_since; //uptime in ms
+    struct BlockBuffer* hash_next;
+    struct BlockBuffer* lru_previous; //more recently used
+    struct BlockBuffer* lru_next; //less recently used
+    uint8_t data[BLOCKCACHE_BLOCK_SIZE];
+} BlockBuffer;
+
+static List* g_cached_devices = NULL;
+static BlockBuffer* g_buckets[BLOCKCACHE_BUCKET_COUNT];
+static BlockBuffer* g_lru_first = NULL; //most recently used
+static BlockBuffer* g_lru_last = NULL; //next to be evicted
+static BlockCacheStats g_stats;
+static Spinlock g_blockcache_lock;
+
+//Selects the dirty blocks a flush writes back
+typedef struct FlushSelection
+{
+    filesystem_node* node; //NULL for all devices
+    BOOL by_owner;
+    void* owner;
+    BOOL with_metadata; //BLOCKCACHE_METADATA blocks are selected too when selecting by owner
+    BOOL expired_only;
+    uint32_t limit; //most blocks to write back
+} FlushSelection;
+
+static int32_t cached_read_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer);
+static int32_t cached_write_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer);
+static int32_t cached_write_block_owned(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer, void* owner);
+static int32_t cached_fsync(File* file, BOOL data_only);
+static void flush_to_ratio(uint32_t ratio, uint32_t* written);
+
+void blockcache_initialize()
+{
+    g_cached_devices = list_create();
+
+    memset((uint8_t*)g_buckets, 0, sizeof(g_buckets));
+
+    memset((uint8_t*)&g_stats, 0, sizeof(g_stats));
+    g_stats.capacity = BLOCKCACHE_DEFAULT_CAPACITY;
+
+    spinlock_init(&g_blockcache_lock);
+}
+
+//The lock is held while waiting for devices. Waiters let interrupts in (system calls run without them), so the holder gets scheduled.
+static void lock_cache()
+{
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    while (!spinlock_try_lock(&g_blockcache_lock))
+    {
+        enable_interrupts();
+        halt();
+        disable_interrupts();
+    }
+
+    //The lock is held across device I/O, a holder killed meanwhile would leave it taken
+    thread_defer_kill();
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+}
+
+static void unlock_cache()
+{
+    spinlock_unlock(&g_blockcache_lock);
+
+    thread_allow_kill();
+}
+
+//Puts the cache in front of the node's block functions
+void blockcache_attach(filesystem_node* node)
+{
+    if (NULL == node->ops->read_block)
+    {
+        return;
+    }
+
+    CachedDevice* device = (CachedDevice*)kmalloc(sizeof(CachedDevice));
+    device->node = node;
+    device->driver_ops = node->ops;
+    device->ops = *node->ops;
+    device->ops.read_block = cached_read_block;
+    device->ops.write_block = cached_write_block;
+    device->ops.write_block_owned = cached_write_block_owned;
+    device->ops.fsync = cached_fsync;
+    device->queue = blockqueue_create(node, device->driver_ops);
+    device->write_error = FALSE;
+
+    lock_cache();
+
+    list_append(g_cached_devices, device);
+
+    unlock_cache();
+
+    node->ops = &device->ops;
+}
+
+static CachedDevice* find_device(filesystem_node* node)
+{
+    list_foreach (n, g_cached_devices)
+    {
+        CachedDevice* device = (CachedDevice*)n->data;
+
+        if (device->node == node)
+        {
+            return device;
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t get_bucket_index(CachedDevice* device, uint32_t block_number)
+{
+    //consecutive blocks land in consecutive buckets
+    return (((uint32_t)device >> 4) + block_number) % BLOCKCACHE_BUCKET_COUNT;
+}
+
+static BlockBuffer* lookup(CachedDevice* device, uint32_t block_number)
+{
+    BlockBuffer* buffer = g_buckets[get_bucket_index(device, block_number)];
+
+    while (buffer)
+    {
+        if (buffer->device == device && buffer->block_number == block_number)
+        {
+            return buffer;
+        }
+
+        buffer = buffer->hash_next;
+    }
+
+    return NULL;
+}
+
+static void hash_insert(BlockBuffer* buffer)
+{
+    uint32_t index = get_bucket_index(buffer->device, buffer->block_number);
+
+    buffer->hash_next = g_buckets[index];
+    g_buckets[index] = buffer;
+}
+
+static void hash_remove(BlockBuffer* buffer)
+{
+    BlockBuffer** link = &g_buckets[get_bucket_index(buffer->device, buffer->block_number)];
+
+    while (*link)
+    {
+        if (*link == buffer)
+        {
+            *link = buffer->hash_next;
+            buffer->hash_next = NULL;
+            return;
+        }
+
+        link = &(*link)->hash_next;
+    }
+}
+
+static void lru_remove(BlockBuffer* buffer)
+{
+    if (buffer->lru_previous)
+    {
+        buffer->lru_previous->lru_next = buffer->lru_next;
+    }
+    else
+    {
+        g_lru_first = buffer->lru_next;
+    }
+
+    if (buffer->lru_next)
+    {
+        buffer->lru_next->lru_previous = buffer->lru_previous;
+    }
+    else
+    {
+        g_lru_last = buffer->lru_previous;
+    }
+
+    buffer->lru_previous = NULL;
+    buffer->lru_next = NULL;
+}
+
+static void lru_push_front(BlockBuffer* buffer)
+{
+    buffer->lru_previous = NULL;
+    buffer->lru_next = g_lru_first;
+
+    if (g_lru_first)
+    {
+        g_lru_first->lru_previous = buffer;
+    }
+    else
+    {
+        g_lru_last = buffer;
+    }
+
+    g_lru_first = buffer;
+}
+
+static void touch(BlockBuffer* buffer)
+{
+    if (g_lru_first != buffer)
+    {
+        lru_remove(buffer);
+        lru_push_front(buffer);
+    }
+}
+
+static void mark_dirty(BlockBuffer* buffer, void* owner)
+{
+    buffer->owner = owner;
+
+    if (!buffer->dirty)
+    {
+        buffer->dirty = TRUE;
+        buffer->dirty_since = get_uptime_milliseconds();
+        g_stats.dirty_count++;
+    }
+}
+
+static void written_back(BlockRequest* request, int32_t result)
+{
+    BlockBuffer* buffer = (BlockBuffer*)request->context;
+
+    if (result < 0)
+    {
+        log_printf("blockcache: write back failed for block %d of %s\r\n", buffer->block_number, buffer->device->node->name);
+
+        //The block stays dirty
+        buffer->device->write_error = TRUE;
+        return;
+    }
+
+    buffer->dirty = FALSE;
+
+    g_stats.dirty_count--;
+    g_stats.writebacks++;
+}
+
+static void prepare_write_back(BlockRequest* request, BlockBuffer* buffer)
+{
+    memset((uint8_t*)request, 0, sizeof(BlockRequest));
+    request->block_number = buffer->block_number;
+    request->count = 1;
+    request->buffer = buffer->data;
+    request->write = TRUE;
+    request->callback = written_back;
+    request->context = buffer;
+}
+
+static int32_t write_back(BlockBuffer* buffer)
+{
+    if (!buffer->dirty)
+    {
+        return 0;
+    }
+
+    BlockRequest request;
+    prepare_write_back(&request, buffer);
+
+    blockqueue_submit(buffer->device->queue, &request);
+    blockqueue_unplug(buffer->device->queue);
+    blockqueue_wait(&request);
+
+    return request.result;
+}
+
+//Removes the least recently used block from the cache, writing it back first if it is dirty.
+//Returns NULL if the write back failed and there is no clean block to take instead.
+static BlockBuffer* evict()
+{
+    BlockBuffer* buffer = g_lru_last;
+
+    if (NULL == buffer)
+    {
+        return NULL;
+    }
+
+    if (write_back(buffer) < 0)
+    {
+        //Keep the data, take the coldest clean block instead
+        do
+        {
+            buffer = buffer->lru_previous;
+        } while (NULL != buffer && buffer->dirty);
+
+        if (NULL == buffer)
+        {
+            return NULL;
+        }
+    }
+
+    lru_remove(buffer);
+    hash_remove(buffer);
+
+    g_stats.evictions++;
+
+    return buffer;
+}
+
+static BlockBuffer* insert(CachedDevice* device, uint32_t block_number, uint8_t* data)
+{
+    BlockBuffer* buffer = NULL;
+
+    if (g_stats.block_count >= g_stats.capacity)
+    {
+        buffer = evict();
+    }
+
+    //Below capacity, or everything is dirty and can't be written back. Then the cache grows until writes succeed again.
+    if (NULL == buffer)
+    {
+        buffer = (BlockBuffer*)kmalloc(sizeof(BlockBuffer));
+        g_stats.block_count++;
+    }
+
+    buffer->device = device;
+    buffer->block_number = block_number;
+    buffer->dirty = FALSE;
+    buffer->owner = BLOCKCACHE_METADATA;
+    buffer->hash_next = NULL;
+    memcpy(buffer->data, data, BLOCKCACHE_BLOCK_SIZE);
+
+    hash_insert(buffer);
+    lru_push_front(buffer);
+
+    return buffer;
+}
+
+static int32_t cached_read_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
+{
+    int32_t result = 0;
+
+    lock_cache();
+
+    CachedDevice* device = find_device(node);
+    if (NULL == device)
+    {
+        unlock_cache();
+        return -1;
+    }
+
+    uint32_t i = 0;
+    while (i < count)
+    {
+        BlockBuffer* cached = lookup(device, block_number + i);
+        if (cached)
+        {
+            memcpy(buffer + i * BLOCKCACHE_BLOCK_SIZE, cached->data, BLOCKCACHE_BLOCK_SIZE);
+
+            touch(cached);
+
+            g_stats.hits++;
+
+            ++i;
+            continue;
+        }
+
+        //Read the whole run of missing blocks with a single device request
+        uint32_t run = 1;
+        while (i + run < count && NULL == lookup(device, block_number + i + run))
+        {
+            ++run;
+        }
+
+        result = blockqueue_transfer(device->queue, block_number + i, run, buffer + i * BLOCKCACHE_BLOCK_SIZE, FALSE);
+        if (result < 0)
+        {
+            break;
+        }
+
+        g_stats.misses += run;
+
+        for (uint32_t j = 0; j < run; ++j)
+        {
+            insert(device, block_number + i + j, buffer + (i + j) * BLOCKCACHE_BLOCK_SIZE);
+        }
+
+        i += run;
+    }
+
+    unlock_cache();
+
+    return result < 0 ? result : 0;
+}
+
+static int32_t cached_write_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
+{
+    return cached_write_block_owned(node, block_number, count, buffer, BLOCKCACHE_METADATA);
+}
+
+static int32_t cached_write_block_owned(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer, void* owner)
+{
+    lock_cache();
+
+    CachedDevice* device = find_device(node);
+    if (NULL == device || NULL == device->driver_ops->write_block)
+    {
+        unlock_cache();
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint8_t* data = buffer + i * BLOCKCACHE_BLOCK_SIZE;
+
+        BlockBuffer* cached = lookup(device, block_number + i);
+        if (cached)
+        {
+            memcpy(cached->data, data, BLOCKCACHE_BLOCK_SIZE);
+
+            mark_dirty(cached, owner);
+
+            touch(cached);
+        }
+        else
+        {
+            //Whole blocks are written, no need to read them first
+            mark_dirty(insert(device, block_number + i, data), owner);
+        }
+    }
+
+    //Too much to write back in the background, the writer catches up
+    if (g_stats.dirty_count > g_stats.capacity * BLOCKCACHE_DIRTY_RATIO / 100)
+    {
+        g_stats.throttled_writes++;
+
+        flush_to_ratio(BLOCKCACHE_DIRTY_BACKGROUND_RATIO, NULL);
+    }
+
+    unlock_cache();
+
+    return 0;
+}
+
+static BOOL is_selected(BlockBuffer* buffer, const FlushSelection* selection, uint32_t now)
+{
+    if (!buffer->dirty)
+    {
+        return FALSE;
+    }
+
+    if (selection->node && buffer->device->node != selection->node)
+    {
+        return FALSE;
+    }
+
+    if (selection->by_owner && buffer->owner != selection->owner &&
+            !(selection->with_metadata && buffer->owner == BLOCKCACHE_METADATA))
+    {
+        return FALSE;
+    }
+
+    if (selection->expired_only && now - buffer->dirty_since < BLOCKCACHE_DIRTY_EXPIRE_MS)
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//Writes back the selected blocks, least recently used first. The lock must be held.
+static int32_t flush_selected(const FlushSelection* selection, uint32_t* written)
+{
+    int32_t result = 0;
+
+    uint32_t request_count = 0;
+    BlockRequest* requests = NULL;
+
+    if (g_stats.dirty_count > 0 && selection->limit > 0)
+    {
+        requests = (BlockRequest*)kmalloc(MIN(g_stats.dirty_count, selection->limit) * sizeof(BlockRequest));
+    }
+
+    uint32_t now = get_uptime_milliseconds();
+
+    //Everything is queued first, so the queue can sort and merge the writes
+    for (BlockBuffer* buffer = g_lru_last; NULL != buffer && requests && request_count < selection->limit; buffer = buffer->lru_previous)
+    {
+        if (is_selected(buffer, selection, now))
+        {
+            BlockRequest* request = &requests[request_count++];
+
+            prepare_write_back(request, buffer);
+
+            blockqueue_submit(buffer->device->queue, request);
+        }
+    }
+
+    list_foreach (n, g_cached_devices)
+    {
+        CachedDevice* device = (CachedDevice*)n->data;
+
+        if (NULL == selection->node || device->node == selection->node)
+        {
+            blockqueue_unplug(device->queue);
+        }
+    }
+
+    for (uint32_t i = 0; i < request_count; ++i)
+    {
+        blockqueue_wait(&requests[i]);
+
+        if (requests[i].result < 0)
+        {
+            result = -EIO;
+        }
+        else if (written)
+        {
+            (*written)++;
+        }
+    }
+
+    if (requests)
+    {
+        kfree(requests);
+    }
+
+    return result;
+}
+
+//Writes back the coldest dirty blocks until at most `ratio` percent of the capacity is dirty. The lock must be held.
+static void flush_to_ratio(uint32_t ratio, uint32_t* written)
+{
+    uint32_t limit = g_stats.capacity * ratio / 100;
+
+    if (g_stats.dirty_count > limit)
+    {
+        FlushSelection selection;
+        memset((uint8_t*)&selection, 0, sizeof(selection));
+        selection.limit = g_stats.dirty_count - limit;
+
+        flush_selected(&selection, written);
+    }
+}
+
+//Reports and forgets the write back failures of the device, or of all devices if `node` is NULL. The lock must be held.
+static int32_t take_write_error(filesystem_node* node)
+{
+    int32_t result = 0;
+
+    list_foreach (n, g_cached_devices)
+    {
+        CachedDevice* device = (CachedDevice*)n->data;
+
+        if ((NULL == node || device->node == node) && device->write_error)
+        {
+            device->write_error = FALSE;
+            result = -EIO;
+        }
+    }
+
+    return result;
+}
+
+//Has the drivers of the device, or of all devices if `node` is NULL, put what was written on the media. The lock must be held.
+static int32_t flush_drivers(filesystem_node* node)
+{
+    int32_t result = 0;
+
+    list_foreach (n, g_cached_devices)
+    {
+        CachedDevice* device = (CachedDevice*)n->data;
+
+        if ((NULL == node || device->node == node) && device->driver_ops->flush_blocks)
+        {
+            if (device->driver_ops->flush_blocks(device->node) < 0)
+            {
+                result = -EIO;
+            }
+        }
+    }
+
+    return result;
+}
+
+//Writes back the dirty blocks of the device, or of all devices if `node` is NULL.
+//Returns -EIO if this or an earlier write back (e.g. by the flusher) failed since the last flush.
+int32_t blockcache_flush(filesystem_node* node)
+{
+    FlushSelection selection;
+    memset((uint8_t*)&selection, 0, sizeof(selection));
+    selection.node = node;
+    selection.limit = 0xFFFFFFFF;
+
+    lock_cache();
+
+    int32_t result = flush_selected(&selection, NULL);
+
+    if (take_write_error(node) < 0 || flush_drivers(node) < 0)
+    {
+        result = -EIO;
+    }
+
+    unlock_cache();
+
+    return result;
+}
+
+//Writes back the blocks the owner dirtied on the device, with or without the device's BLOCKCACHE_METADATA blocks
+int32_t blockcache_flush_owner(filesystem_node* node, void* owner, BOOL with_metadata)
+{
+    FlushSelection selection;
+    memset((uint8_t*)&selection, 0, sizeof(selection));
+    selection.node = node;
+    selection.by_owner = TRUE;
+    selection.owner = owner;
+    selection.with_metadata = with_metadata;
+    selection.limit = 0xFFFFFFFF;
+
+    lock_cache();
+
+    int32_t result = flush_selected(&selection, NULL);
+
+    if (take_write_error(node) < 0 || flush_drivers(node) < 0)
+    {
+        result = -EIO;
+    }
+
+    unlock_cache();
+
+    return result;
+}
+
+//Drops the device's blocks from `first_block` on, dirty ones without writing them back (the device got smaller)
+void blockcache_invalidate(filesystem_node* node, uint32_t first_block)
+{
+    lock_cache();
+
+    BlockBuffer* buffer = g_lru_first;
+    while (buffer)
+    {
+        BlockBuffer* next = buffer->lru_next;
+
+        if (buffer->device->node == node && buffer->block_number >= first_block)
+        {
+            if (buffer->dirty)
+            {
+                g_stats.dirty_count--;
+            }
+
+            lru_remove(buffer);
+            hash_remove(buffer);
+
+            kfree(buffer);
+
+            g_stats.block_count--;
+        }
+
+        buffer = next;
+    }
+
+    unlock_cache();
+}
+
+//fsync on the device file itself
+static int32_t cached_fsync(File* file, BOOL data_only)
+{
+    return blockcache_flush(file->node);
+}
+
+static void flusher()
+{
+    Thread* thread = thread_get_current();
+
+    while (TRUE)
+    {
+        sleep_ms(thread, BLOCKCACHE_FLUSH_INTERVAL_MS);
+
+        //Like a system call from here on, interrupts are only enabled while waiting for the devices
+        disable_interrupts();
+
+        //Dirty pages of mappings left by exited processes go to the file systems first
+        filemapping_write_pending();
+
+        lock_cache();
+
+        uint32_t written = 0;
+
+        FlushSelection selection;
+        memset((uint8_t*)&selection, 0, sizeof(selection));
+        selection.expired_only = TRUE;
+        selection.limit = 0xFFFFFFFF;
+
+        flush_selected(&selection, &written);
+
+        flush_to_ratio(BLOCKCACHE_DIRTY_BACKGROUND_RATIO, &written);
+
+        g_stats.flusher_writebacks += written;
+
+        unlock_cache();
+    }
+}
+
+void blockcache_start_flusher()
+{
+    thread_create_kthread(flusher);
+}
+
+void blockcache_set_capacity(uint32_t capacity)
+{
+    if (capacity < BLOCKCACHE_MINIMUM_CAPACITY)
+    {
+        capacity = BLOCKCACHE_MINIMUM_CAPACITY;
+    }
+
+    lock_cache();
+
+    g_stats.capacity = capacity;
+
+    while (g_stats.block_count > g_stats.capacity)
+    {
+        BlockBuffer* buffer = evict();
+        if (NULL == buffer)
+        {
+            //The rest is dirty and can't be written back now
+            break;
+        }
+
+        kfree(buffer);
+
+        g_stats.block_count--;
+    }
+
+    unlock_cache();
+}
+
+void blockcache_get_stats(BlockCacheStats* stats)
+{
+    lock_cache();
+
+    memcpy((uint8_t*)stats, (uint8_t*)&g_stats, sizeof(BlockCacheStats));
+
+    unlock_cache();
+}
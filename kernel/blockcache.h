@@ -0,0 +1,69 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#pragma once
+
+#include "common.h"
+#include "fs.h"
+
+#define BLOCKCACHE_BLOCK_SIZE 512 //FatFs sector size (FF_MAX_SS)
+#define BLOCKCACHE_DEFAULT_CAPACITY 2048 //blocks, 1MB
+#define BLOCKCACHE_MINIMUM_CAPACITY 16
+
+#define BLOCKCACHE_METADATA NULL //owner of dirty blocks that don't belong to a single file
+#define BLOCKCACHE_FLUSH_INTERVAL_MS 1000 //how often the flusher thread wakes up
+#define BLOCKCACHE_DIRTY_EXPIRE_MS 5000 //blocks dirty for longer are written back by the flusher
+#define BLOCKCACHE_DIRTY_BACKGROUND_RATIO 10 //percent of capacity, above it the flusher writes back regardless of age
+#define BLOCKCACHE_DIRTY_RATIO 40 //percent of capacity, above it writers write back themselves
+
+typedef struct BlockCacheStats
+{
+    uint32_t capacity;
+    uint32_t block_count;
+    uint32_t dirty_count;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;
+    uint32_t flusher_writebacks; //part of writebacks done by the flusher thread
+    uint32_t throttled_writes; //writes that had to write back because of BLOCKCACHE_DIRTY_RATIO
+} BlockCacheStats;
+
+void blockcache_initialize();
+void blockcache_attach(filesystem_node* node);
+void blockcache_start_flusher();
+int32_t blockcache_flush(filesystem_node* node);
+int32_t blockcache_flush_owner(filesystem_node* node, void* owner, BOOL with_metadata);
+void blockcache_invalidate(filesystem_node* node, uint32_t first_block);
+void blockcache_set_capacity(uint32_t capacity);
+void blockcache_get_stats(BlockCacheStats* stats);
@@ -0,0 +1,391 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include "blockqueue.h"
+#include "alloc.h"
+#include "timer.h"
+#include "process.h"
+
+/*
+ *  Request queue in front of a block driver. Submitted requests are only queued (the queue is plugged) until the submitter
+ *  unplugs it or it gets BLOCKQUEUE_MAX_DEPTH deep. Dispatching then goes through the queue in block order, one sweep upwards
+ *  from where the last request ended and then again from the lowest block (C-LOOK), unless the oldest request is past its
+ *  deadline, which is served first. Neighbouring requests in the same direction are merged into one driver call, through a
+ *  bounce buffer when their buffers are not contiguous. The callback of every request runs right after its driver call.
+ *  One thread dispatches a queue at a time, the others queue their requests and wait.
+ */
+
+struct BlockQueue
+{
+    filesystem_node* node;
+    const filesystem_ops* driver_ops;
+    BlockRequest* sorted_first; //by block number
+    BlockRequest* fifo_first; //by submission
+    BlockRequest* fifo_last;
+    uint32_t depth;
+    uint32_t head_position; //block after the last dispatched one
+    BOOL dispatching;
+};
+
+static BlockQueueStats g_stats;
+
+BlockQueue* blockqueue_create(filesystem_node* node, const filesystem_ops* driver_ops)
+{
+    BlockQueue* queue = (BlockQueue*)kmalloc(sizeof(BlockQueue));
+    memset((uint8_t*)queue, 0, sizeof(BlockQueue));
+    queue->node = node;
+    queue->driver_ops = driver_ops;
+
+    return queue;
+}
+
+static BOOL overlaps(BlockRequest* a, BlockRequest* b)
+{
+    return a->block_number < b->block_number + b->count && b->block_number < a->block_number + a->count;
+}
+
+//Interrupts must be disabled for the queue functions below
+static void enqueue(BlockQueue* queue, BlockRequest* request)
+{
+    BlockRequest** link = &queue->sorted_first;
+    while (*link && (*link)->block_number <= request->block_number)
+    {
+        link = &(*link)->sorted_next;
+    }
+    request->sorted_next = *link;
+    *link = request;
+
+    request->fifo_next = NULL;
+    if (queue->fifo_last)
+    {
+        queue->fifo_last->fifo_next = request;
+    }
+    else
+    {
+        queue->fifo_first = request;
+    }
+    queue->fifo_last = request;
+
+    queue->depth++;
+    g_stats.depth++;
+    g_stats.max_depth = MAX(g_stats.max_depth, g_stats.depth);
+}
+
+static void dequeue(BlockQueue* queue, BlockRequest* request)
+{
+    BlockRequest** link = &queue->sorted_first;
+    while (*link != request)
+    {
+        link = &(*link)->sorted_next;
+    }
+    *link = request->sorted_next;
+
+    BlockRequest* previous = NULL;
+    link = &queue->fifo_first;
+    while (*link != request)
+    {
+        previous = *link;
+        link = &(*link)->fifo_next;
+    }
+    *link = request->fifo_next;
+    if (queue->fifo_last == request)
+    {
+        queue->fifo_last = previous;
+    }
+
+    queue->depth--;
+    g_stats.depth--;
+}
+
+static BlockRequest* choose(BlockQueue* queue)
+{
+    BlockRequest* oldest = queue->fifo_first;
+
+    if ((int32_t)(get_uptime_milliseconds() - oldest->deadline) >= 0)
+    {
+        return oldest;
+    }
+
+    for (BlockRequest* request = queue->sorted_first; request; request = request->sorted_next)
+    {
+        if (request->block_number >= queue->head_position)
+        {
+            return request;
+        }
+    }
+
+    //Sweep again from the lowest block
+    return queue->sorted_first;
+}
+
+static int32_t execute(BlockQueue* queue, BlockRequest* first, uint32_t request_count, uint32_t block_count)
+{
+    int32_t (*driver_function)(filesystem_node*, uint32_t, uint32_t, uint8_t*) =
+        first->write ? queue->driver_ops->write_block : queue->driver_ops->read_block;
+
+    if (NULL == driver_function)
+    {
+        return -1;
+    }
+
+    g_stats.dispatched++;
+
+    BOOL contiguous = TRUE;
+    BlockRequest* request = first;
+    for (uint32_t i = 1; i < request_count; ++i)
+    {
+        if (request->sorted_next->buffer != request->buffer + request->count * BLOCKQUEUE_BLOCK_SIZE)
+        {
+            contiguous = FALSE;
+            break;
+        }
+        request = request->sorted_next;
+    }
+
+    if (contiguous)
+    {
+        return driver_function(queue->node, first->block_number, block_count, first->buffer);
+    }
+
+    uint8_t* bounce = (uint8_t*)kmalloc(block_count * BLOCKQUEUE_BLOCK_SIZE);
+
+    uint32_t offset = 0;
+    request = first;
+    for (uint32_t i = 0; i < request_count && first->write; ++i)
+    {
+        memcpy(bounce + offset, request->buffer, request->count * BLOCKQUEUE_BLOCK_SIZE);
+        offset += request->count * BLOCKQUEUE_BLOCK_SIZE;
+        request = request->sorted_next;
+    }
+
+    int32_t result = driver_function(queue->node, first->block_number, block_count, bounce);
+
+    offset = 0;
+    request = first;
+    for (uint32_t i = 0; i < request_count && !first->write && result >= 0; ++i)
+    {
+        memcpy(request->buffer, bounce + offset, request->count * BLOCKQUEUE_BLOCK_SIZE);
+        offset += request->count * BLOCKQUEUE_BLOCK_SIZE;
+        request = request->sorted_next;
+    }
+
+    kfree(bounce);
+
+    return result;
+}
+
+static void dispatch(BlockQueue* queue)
+{
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    disable_interrupts();
+
+    if (queue->dispatching)
+    {
+        //The dispatching thread takes the new requests too
+        if (interrupts_were_enabled)
+        {
+            enable_interrupts();
+        }
+        return;
+    }
+
+    queue->dispatching = TRUE;
+
+    //Other threads wait for the requests this one dispatches
+    thread_defer_kill();
+
+    while (queue->sorted_first)
+    {
+        BlockRequest* first = choose(queue);
+
+        //Collect the neighbours that can go in the same driver call
+        uint32_t request_count = 1;
+        uint32_t block_count = first->count;
+        BlockRequest* last = first;
+
+        while (last->sorted_next &&
+            last->sorted_next->write == first->write &&
+            last->sorted_next->block_number == last->block_number + last->count &&
+            block_count + last->sorted_next->count <= BLOCKQUEUE_MAX_MERGE_BLOCKS)
+        {
+            last = last->sorted_next;
+            block_count += last->count;
+            request_count++;
+        }
+
+        g_stats.merged += request_count - 1;
+        queue->head_position = first->block_number + block_count;
+
+        //Taken off the queue before the driver call as other threads can queue meanwhile.
+        //The taken requests keep their sorted_next links to each other.
+        BlockRequest* request = first;
+        for (uint32_t i = 0; i < request_count; ++i)
+        {
+            dequeue(queue, request);
+            request = request->sorted_next;
+        }
+
+        if (interrupts_were_enabled)
+        {
+            enable_interrupts();
+        }
+
+        int32_t result = execute(queue, first, request_count, block_count);
+
+        disable_interrupts();
+
+        request = first;
+        for (uint32_t i = 0; i < request_count; ++i)
+        {
+            BlockRequest* next = request->sorted_next;
+
+            request->result = result < 0 ? result : 0;
+
+            if (request->callback)
+            {
+                request->callback(request, request->result);
+            }
+
+            //The request can be gone once it is done
+            request->done = TRUE;
+
+            request = next;
+        }
+    }
+
+    queue->dispatching = FALSE;
+
+    thread_allow_kill();
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+}
+
+void blockqueue_submit(BlockQueue* queue, BlockRequest* request)
+{
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    disable_interrupts();
+
+    request->done = FALSE;
+    request->result = 0;
+    request->deadline = get_uptime_milliseconds() + (request->write ? BLOCKQUEUE_WRITE_DEADLINE_MS : BLOCKQUEUE_READ_DEADLINE_MS);
+
+    g_stats.submitted++;
+
+    BOOL conflict = FALSE;
+    for (BlockRequest* queued = queue->sorted_first; queued; queued = queued->sorted_next)
+    {
+        if (overlaps(queued, request) && (queued->write || request->write))
+        {
+            conflict = TRUE;
+            break;
+        }
+    }
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+
+    if (conflict)
+    {
+        //Reordering must not move a request across an overlapping write
+        dispatch(queue);
+    }
+
+    disable_interrupts();
+
+    enqueue(queue, request);
+
+    BOOL full = queue->depth >= BLOCKQUEUE_MAX_DEPTH;
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+
+    if (full)
+    {
+        dispatch(queue);
+    }
+}
+
+void blockqueue_unplug(BlockQueue* queue)
+{
+    dispatch(queue);
+}
+
+//Waits for a request that another thread is dispatching
+void blockqueue_wait(BlockRequest* request)
+{
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    disable_interrupts();
+
+    while (!request->done)
+    {
+        enable_interrupts();
+        halt();
+        disable_interrupts();
+    }
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+}
+
+int32_t blockqueue_transfer(BlockQueue* queue, uint32_t block_number, uint32_t count, uint8_t* buffer, BOOL write)
+{
+    BlockRequest request;
+    memset((uint8_t*)&request, 0, sizeof(BlockRequest));
+    request.block_number = block_number;
+    request.count = count;
+    request.buffer = buffer;
+    request.write = write;
+
+    blockqueue_submit(queue, &request);
+    blockqueue_unplug(queue);
+    blockqueue_wait(&request);
+
+    return request.result;
+}
+
+void blockqueue_get_stats(BlockQueueStats* stats)
+{
+    memcpy((uint8_t*)stats, (uint8_t*)&g_stats, sizeof(BlockQueueStats));
+}
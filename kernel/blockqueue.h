@@ -0,0 +1,81 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#pragma once
+
+#include "common.h"
+#include "fs.h"
+
+#define BLOCKQUEUE_BLOCK_SIZE 512
+#define BLOCKQUEUE_MAX_MERGE_BLOCKS 128 //64KB in one driver call
+#define BLOCKQUEUE_MAX_DEPTH 512 //a queue this deep is dispatched right away
+#define BLOCKQUEUE_READ_DEADLINE_MS 500
+#define BLOCKQUEUE_WRITE_DEADLINE_MS 5000
+
+typedef struct BlockQueue BlockQueue;
+typedef struct BlockRequest BlockRequest;
+
+typedef void (*BlockRequestCallback)(BlockRequest* request, int32_t result);
+
+struct BlockRequest
+{
+    uint32_t block_number;
+    uint32_t count;
+    uint8_t* buffer;
+    BOOL write;
+    BlockRequestCallback callback; //called once the request is done, can be NULL
+    void* context;
+
+    //Set by the queue
+    uint32_t deadline;
+    BlockRequest* sorted_next;
+    BlockRequest* fifo_next;
+    volatile BOOL done;
+    int32_t result;
+};
+
+typedef struct BlockQueueStats
+{
+    uint32_t submitted;
+    uint32_t merged;
+    uint32_t dispatched;
+    uint32_t depth;
+    uint32_t max_depth;
+} BlockQueueStats;
+
+BlockQueue* blockqueue_create(filesystem_node* node, const filesystem_ops* driver_ops);
+void blockqueue_submit(BlockQueue* queue, BlockRequest* request);
+void blockqueue_unplug(BlockQueue* queue);
+int32_t blockqueue_transfer(BlockQueue* queue, uint32_t block_number, uint32_t count, uint8_t* buffer, BOOL write);
+void blockqueue_wait(BlockRequest* request);
+void blockqueue_get_stats(BlockQueueStats* stats);
@@ -46,7 +46,7 @@
 static BOOL g_interrupts_were_enabled = FALSE;
 
 /*
- *  The following functions `outb`, `outw`, `inb`, and `inw` are used to communicate with hardware from the CPU. Very useful if we want
+ *  The following functions `outb`, `outw`, `outl`, `inb`, `inw`, and `inl` are used to communicate with hardware from the CPU. Very useful if we want
  *  to create drivers, and other stuff.
  */
 
@@ -60,6 +60,11 @@ void outw(uint16_t port, uint16_t value)
     asm volatile ("outw %1, %0" : : "dN" (port), "a" (value));
 }
 
+void outl(uint16_t port, uint32_t value)
+{
+    asm volatile ("outl %1, %0" : : "dN" (port), "a" (value));
+}
+
 uint8_t inb(uint16_t port)
 {
     uint8_t ret;
@@ -74,6 +79,13 @@ uint16_t inw(uint16_t port)
     return ret;
 }
 
+uint32_t inl(uint16_t port)
+{
+    uint32_t ret;
+    asm volatile ("inl %1, %0" : "=a" (ret) : "dN" (port));
+    return ret;
+}
+
 /*
  *  The following functions `memcpy`, `memset`, `memmove`, `memcmp`, `strcmp`, `strncmp`, `strcpy`, `strcpy_nonnull`, `strncpy`,
  *  `strncpy_null`, `strcat`, `strlen`, and `str_first_index_of`, are used for manipulating (NOT managing) chunks of memory, and
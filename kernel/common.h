@@ -64,14 +64,18 @@
 
 #define KERN_HEAP_BEGIN 0x02000000 //32 mb
 #define KERN_HEAP_END 0x40000000 // 1 gb
+#define KERN_TEMPORARY_MAP_AREA (KERN_HEAP_END - PAGESIZE_4M) //Last 4M below KERN_HEAP_END is not heap, it is the window of vmm_map_temporary
 
 #define	PAGING_FLAG 0x80000000	// CR0 - bit 31
 #define PSE_FLAG 0x00000010	// CR4 - bit 4 //For 4M page support.
+#define WRITE_PROTECT_FLAG 0x00010000	// CR0 - bit 16 //Read-only pages are read-only for the kernel too.
 #define PG_PRESENT 0x00000001	// page directory / table
 #define PG_WRITE 0x00000002
 #define PG_USER 0x00000004
+#define PG_DIRTY 0x00000040	// set by the CPU on write
 #define PG_4MB 0x00000080
 #define PG_OWNED 0x00000200  // We use 9th bit for bookkeeping of owned pages (9-11th bits are available for OS)
+#define PG_READONLY 0x00000400  // 10th bit asks vmm_add_page_to_pd to leave PG_WRITE off (shared executable text, read-only file mappings)
 #define	PAGESIZE_4K 0x00001000
 #define	PAGESIZE_4M 0x00400000
 #define	RAM_AS_4K_PAGES 0x100000
@@ -92,11 +96,15 @@
 #define	SIZE_2MB 0x200000 //2MB
 
 #define	USER_STACK 0xF0000000
+#define	USER_STACK_RESERVE 0x800000 //8MB of address space below USER_STACK is kept for the main stack, this is also the hard RLIMIT_STACK
+#define	USER_STACK_INITIAL_PAGES 4 //Mapped at process start, the rest of the stack is mapped on demand by the page fault handler
 
 void outb(uint16_t port, uint8_t value);
 void outw(uint16_t port, uint16_t value);
+void outl(uint16_t port, uint32_t value);
 uint8_t inb(uint16_t port);
 uint16_t inw(uint16_t port);
+uint32_t inl(uint16_t port);
 
 #define PANIC(msg) panic(msg, __FILE__, __LINE__);
 #define WARNING(msg) warning(msg, __FILE__, __LINE__);
@@ -60,6 +60,13 @@ static int32_t console_ioctl(File *file, int32_t request, void * argp);
 static uint8_t get_character_for_scancode(KeyModifier modifier, uint8_t scancode);
 static void process_scancode(uint8_t scancode);
 
+static const filesystem_ops g_console_ops =
+{
+    .open = console_open,
+    .close = console_close,
+    .ioctl = console_ioctl
+};
+
 /*
  *  Initialize the console, and then register a character device that represents it.
  */
@@ -84,9 +91,7 @@ void console_initialize(BOOL graphicMode)
     Device device;
     memset((uint8_t*)&device, 0, sizeof(Device));
     device.device_type = FT_CHARACTER_DEVICE;
-    device.open = console_open;
-    device.close = console_close;
-    device.ioctl = console_ioctl;
+    device.ops = &g_console_ops;
     devfs_register_device(&device);
 }
 
@@ -0,0 +1,355 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+
+#include "dcache.h"
+#include "alloc.h"
+#include "spinlock.h"
+
+/*
+ *  Directory entry cache. Maps (parent node, name) to the child node, or to NULL for names known not to exist (negative entries).
+ *  Filesystems add entries from their finddir, fs_finddir and fs_get_node consult the cache before calling the filesystem.
+ *  Entries are removed on unlink and mkdir, everything is dropped on mount. The oldest entries are evicted when the cache is full.
+ *  Entries are also chained by their parent and by their node, so dropping the entries of an evicted node only visits those.
+ */
+
+#define DCACHE_BUCKET_COUNT 1024
+
+typedef struct DirectoryEntry
+{
+    filesystem_node* parent;
+    filesystem_node* node; //NULL for a negative entry
+    uint32_t hash;
+    struct DirectoryEntry* hash_next;
+    struct DirectoryEntry* parent_next; //same bucket of g_parent_buckets
+    struct DirectoryEntry* node_next; //same bucket of g_node_buckets, not linked for a negative entry
+    struct DirectoryEntry* lru_previous; //more recently used
+    struct DirectoryEntry* lru_next; //less recently used
+    uint32_t name_length;
+    char name[];
+} DirectoryEntry;
+
+static DirectoryEntry* g_buckets[DCACHE_BUCKET_COUNT];
+static DirectoryEntry* g_parent_buckets[DCACHE_BUCKET_COUNT]; //by parent
+static DirectoryEntry* g_node_buckets[DCACHE_BUCKET_COUNT]; //by node
+static DirectoryEntry* g_lru_first = NULL; //most recently used
+static DirectoryEntry* g_lru_last = NULL; //next to be evicted
+static uint32_t g_entry_count = 0;
+static Spinlock g_dcache_lock;
+
+void dcache_initialize()
+{
+    memset((uint8_t*)g_buckets, 0, sizeof(g_buckets));
+    memset((uint8_t*)g_parent_buckets, 0, sizeof(g_parent_buckets));
+    memset((uint8_t*)g_node_buckets, 0, sizeof(g_node_buckets));
+
+    g_lru_first = NULL;
+    g_lru_last = NULL;
+    g_entry_count = 0;
+
+    spinlock_init(&g_dcache_lock);
+}
+
+//FNV-1a of the name mixed with the parent
+static uint32_t get_hash(filesystem_node* parent, const char* name, uint32_t name_length)
+{
+    uint32_t hash = 2166136261u ^ ((uint32_t)parent >> 4);
+
+    for (uint32_t i = 0; i < name_length; ++i)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static uint32_t get_node_bucket_index(filesystem_node* node)
+{
+    return ((uint32_t)node >> 4) % DCACHE_BUCKET_COUNT;
+}
+
+static void link_node(DirectoryEntry* entry)
+{
+    if (entry->node)
+    {
+        uint32_t index = get_node_bucket_index(entry->node);
+
+        entry->node_next = g_node_buckets[index];
+        g_node_buckets[index] = entry;
+    }
+}
+
+static void unlink_node(DirectoryEntry* entry)
+{
+    if (entry->node)
+    {
+        DirectoryEntry** link = &g_node_buckets[get_node_bucket_index(entry->node)];
+
+        while (*link != entry)
+        {
+            link = &(*link)->node_next;
+        }
+
+        *link = entry->node_next;
+        entry->node_next = NULL;
+    }
+}
+
+static void lru_remove(DirectoryEntry* entry)
+{
+    if (entry->lru_previous)
+    {
+        entry->lru_previous->lru_next = entry->lru_next;
+    }
+    else
+    {
+        g_lru_first = entry->lru_next;
+    }
+
+    if (entry->lru_next)
+    {
+        entry->lru_next->lru_previous = entry->lru_previous;
+    }
+    else
+    {
+        g_lru_last = entry->lru_previous;
+    }
+
+    entry->lru_previous = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push_front(DirectoryEntry* entry)
+{
+    entry->lru_previous = NULL;
+    entry->lru_next = g_lru_first;
+
+    if (g_lru_first)
+    {
+        g_lru_first->lru_previous = entry;
+    }
+    else
+    {
+        g_lru_last = entry;
+    }
+
+    g_lru_first = entry;
+}
+
+static DirectoryEntry* find(filesystem_node* parent, const char* name, uint32_t name_length, uint32_t hash)
+{
+    for (DirectoryEntry* entry = g_buckets[hash % DCACHE_BUCKET_COUNT]; NULL != entry; entry = entry->hash_next)
+    {
+        if (entry->hash == hash &&
+            entry->parent == parent &&
+            entry->name_length == name_length &&
+            strncmp(entry->name, name, name_length) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void destroy_entry(DirectoryEntry* entry)
+{
+    DirectoryEntry** link = &g_buckets[entry->hash % DCACHE_BUCKET_COUNT];
+
+    while (*link != entry)
+    {
+        link = &(*link)->hash_next;
+    }
+
+    *link = entry->hash_next;
+
+    link = &g_parent_buckets[get_node_bucket_index(entry->parent)];
+
+    while (*link != entry)
+    {
+        link = &(*link)->parent_next;
+    }
+
+    *link = entry->parent_next;
+
+    unlink_node(entry);
+
+    lru_remove(entry);
+
+    g_entry_count--;
+
+    kfree(entry);
+}
+
+//Returns TRUE if the name is in the cache, then *node is the child or NULL if the name does not exist
+BOOL dcache_lookup(filesystem_node* parent, const char* name, uint32_t name_length, filesystem_node** node)
+{
+    BOOL result = FALSE;
+
+    spinlock_lock(&g_dcache_lock);
+
+    DirectoryEntry* entry = find(parent, name, name_length, get_hash(parent, name, name_length));
+
+    if (entry)
+    {
+        if (g_lru_first != entry)
+        {
+            lru_remove(entry);
+            lru_push_front(entry);
+        }
+
+        *node = entry->node;
+
+        result = TRUE;
+    }
+
+    spinlock_unlock(&g_dcache_lock);
+
+    return result;
+}
+
+//Adds or replaces the entry, `node` is NULL for a name that does not exist
+void dcache_insert(filesystem_node* parent, const char* name, filesystem_node* node)
+{
+    uint32_t name_length = strlen(name);
+    uint32_t hash = get_hash(parent, name, name_length);
+
+    spinlock_lock(&g_dcache_lock);
+
+    DirectoryEntry* entry = find(parent, name, name_length, hash);
+
+    if (entry)
+    {
+        unlink_node(entry);
+
+        entry->node = node;
+
+        link_node(entry);
+
+        spinlock_unlock(&g_dcache_lock);
+        return;
+    }
+
+    if (g_entry_count >= DCACHE_CAPACITY && g_lru_last)
+    {
+        destroy_entry(g_lru_last);
+    }
+
+    entry = (DirectoryEntry*)kmalloc(sizeof(DirectoryEntry) + name_length + 1);
+    memset((uint8_t*)entry, 0, sizeof(DirectoryEntry));
+    entry->parent = parent;
+    entry->node = node;
+    entry->hash = hash;
+    entry->name_length = name_length;
+    memcpy((uint8_t*)entry->name, (uint8_t*)name, name_length + 1);
+
+    entry->hash_next = g_buckets[hash % DCACHE_BUCKET_COUNT];
+    g_buckets[hash % DCACHE_BUCKET_COUNT] = entry;
+
+    uint32_t parent_index = get_node_bucket_index(parent);
+    entry->parent_next = g_parent_buckets[parent_index];
+    g_parent_buckets[parent_index] = entry;
+
+    link_node(entry);
+
+    lru_push_front(entry);
+
+    g_entry_count++;
+
+    spinlock_unlock(&g_dcache_lock);
+}
+
+void dcache_remove(filesystem_node* parent, const char* name)
+{
+    uint32_t name_length = strlen(name);
+
+    spinlock_lock(&g_dcache_lock);
+
+    DirectoryEntry* entry = find(parent, name, name_length, get_hash(parent, name, name_length));
+
+    if (entry)
+    {
+        destroy_entry(entry);
+    }
+
+    spinlock_unlock(&g_dcache_lock);
+}
+
+//Removes the entries leading to the node and the entries of its children
+void dcache_remove_node(filesystem_node* node)
+{
+    spinlock_lock(&g_dcache_lock);
+
+    uint32_t index = get_node_bucket_index(node);
+
+    DirectoryEntry* entry = g_parent_buckets[index];
+    while (NULL != entry)
+    {
+        DirectoryEntry* next = entry->parent_next;
+
+        if (entry->parent == node)
+        {
+            destroy_entry(entry);
+        }
+
+        entry = next;
+    }
+
+    entry = g_node_buckets[index];
+    while (NULL != entry)
+    {
+        DirectoryEntry* next = entry->node_next;
+
+        if (entry->node == node)
+        {
+            destroy_entry(entry);
+        }
+
+        entry = next;
+    }
+
+    spinlock_unlock(&g_dcache_lock);
+}
+
+void dcache_clear()
+{
+    spinlock_lock(&g_dcache_lock);
+
+    while (g_lru_first)
+    {
+        destroy_entry(g_lru_first);
+    }
+
+    spinlock_unlock(&g_dcache_lock);
+}
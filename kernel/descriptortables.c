@@ -98,12 +98,18 @@ static void gdt_initialize()
     uint32_t tss_limit = sizeof(g_tss);
     set_gdt_entry(5, tss_base, tss_limit, 0xE9, 0x00);
 
-    set_gdt_entry(6, 0, 0xFFFFFFFF, 0x80, 0xCF); // Thread Local Storage pointer segment
+    set_gdt_entry(GDT_TLS_ENTRY, 0, 0xFFFFFFFF, 0xF2, 0xCF); // 0x30 Thread Local Storage pointer segment (user mode data, base changes per thread)
 
     flush_gdt((uint32_t)&g_gdt_pointer);
     flush_tss();
 }
 
+//Called on every context switch, the base takes effect when the thread's segment registers are reloaded.
+void descriptor_tables_set_tls_base(uint32_t base)
+{
+    set_gdt_entry(GDT_TLS_ENTRY, base, 0xFFFFFFFF, 0xF2, 0xCF);
+}
+
 // Set the value of one GDT entry.
 static void set_gdt_entry(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran)
 {
@@ -35,7 +35,10 @@
 
 #include "common.h"
 
+#define GDT_TLS_ENTRY 6
+
 void descriptor_tables_initialize();
+void descriptor_tables_set_tls_base(uint32_t base);
 
 
 struct GdtEntry
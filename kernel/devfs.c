@@ -38,6 +38,7 @@
 #include "device.h"
 #include "list.h"
 #include "spinlock.h"
+#include "blockcache.h"
 
 /*
  *  DevFS, also known as device filesystem, allows processes and/or the user to send data and/or recieve data from files in the `/dev` directory, which contains
@@ -53,36 +54,36 @@ static BOOL devfs_open(File *node, uint32_t flags);
 static filesystem_dirent *devfs_readdir(filesystem_node *node, uint32_t index);
 static filesystem_node *devfs_finddir(filesystem_node *node, char *name);
 
+static const filesystem_ops g_devfs_ops =
+{
+    .open = devfs_open,
+    .readdir = devfs_readdir,
+    .finddir = devfs_finddir
+};
+
 static filesystem_dirent g_dirent;
 
 /* Initialize DevFS, and create the `/dev` directory. If the directory isn't created, then make a kernel panic... */
 void devfs_initialize()
 {
-    g_dev_root = kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)g_dev_root, 0, sizeof(filesystem_node));
-
-    g_dev_root->node_type = FT_DIRECTORY;
-
     filesystem_node* root_node = fs_get_root_node();
 
     filesystem_node* dev_node = fs_finddir(root_node, "dev");
 
     if (dev_node)
     {
+        g_dev_root = fs_create_node(dev_node->name, &g_devfs_ops);
+        g_dev_root->node_type = FT_DIRECTORY;
+
         dev_node->node_type |= FT_MOUNT_POINT;
         dev_node->mount_point = g_dev_root;
         g_dev_root->parent = dev_node->parent;
-        strcpy(g_dev_root->name, dev_node->name);
     }
     else
     {
         PANIC("/dev does not exist!");
     }
 
-    g_dev_root->open = devfs_open;
-    g_dev_root->finddir = devfs_finddir;
-    g_dev_root->readdir = devfs_readdir;
-
     g_device_list = list_create();
     spinlock_init(&g_device_list_lock);
 }
@@ -159,25 +160,16 @@ filesystem_node* devfs_register_device(Device* device)
         }
     }
 
-    filesystem_node* device_node = (filesystem_node*)kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)device_node, 0, sizeof(filesystem_node));
-    strcpy(device_node->name, device->name);
+    filesystem_node* device_node = fs_create_node(device->name, device->ops);
     device_node->node_type = device->device_type;
-    device_node->open = device->open;
-    device_node->close = device->close;
-    device_node->read_block = device->read_block;
-    device_node->write_block = device->write_block;
-    device_node->read = device->read;
-    device_node->write = device->write;
-    device_node->read_test_ready = device->read_test_ready;
-    device_node->write_test_ready = device->write_test_ready;
-    device_node->ioctl = device->ioctl;
-    device_node->ftruncate = device->ftruncate;
-    device_node->mmap = device->mmap;
-    device_node->munmap = device->munmap;
     device_node->private_node_data = device->private_data;
     device_node->parent = g_dev_root;
 
+    if (device->device_type == FT_BLOCK_DEVICE)
+    {
+        blockcache_attach(device_node);
+    }
+
     list_append(g_device_list, device_node);
 
     spinlock_unlock(&g_device_list_lock);
@@ -40,17 +40,6 @@ typedef struct Device
 {
     char name[16];
     FileType device_type;
-    ReadWriteBlockFunction read_block;
-    ReadWriteBlockFunction write_block;
-    ReadWriteFunction read;
-    ReadWriteFunction write;
-    ReadWriteTestFunction read_test_ready;
-    ReadWriteTestFunction write_test_ready;
-    OpenFunction open;
-    CloseFunction close;
-    IoctlFunction ioctl;
-    FtruncateFunction ftruncate;
-    MmapFunction mmap;
-    MunmapFunction munmap;
+    const filesystem_ops* ops;//shared by every node registered for the device
     void * private_data;
 } Device;
\ No newline at end of file
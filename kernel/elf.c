@@ -55,7 +55,53 @@ BOOL elf_is_valid(const char *elf_data)
     return FALSE;
 }
 
-uint32_t elf_load(const char *elf_data)
+/*
+ *  A segment can be backed by physical pages shared between processes when it is loaded, read-only, starts on a page boundary and none of its
+ *  pages are also touched by a writable segment. Our userland linker script page-aligns `.text`, so in practice this is the code segment.
+ */
+BOOL elf_is_segment_shareable(const char *elf_data, Elf32_Phdr *segment)
+{
+    if (segment->p_type != PT_LOAD || (segment->p_flags & PF_W) == PF_W)
+    {
+        return FALSE;
+    }
+
+    uint32_t v_begin = segment->p_vaddr;
+    uint32_t v_end = segment->p_vaddr + segment->p_memsz;
+
+    if ((v_begin & 0xFFF) != 0 || v_begin < USER_OFFSET || v_end > USER_STACK || segment->p_memsz == 0)
+    {
+        return FALSE;
+    }
+
+    //Round up to the page that holds the last byte
+    v_end = (v_end + PAGESIZE_4K - 1) & 0xFFFFF000;
+
+    Elf32_Ehdr *hdr = (Elf32_Ehdr *) elf_data;
+    Elf32_Phdr *p_entry = (Elf32_Phdr *) (elf_data + hdr->e_phoff);
+
+    for (int pe = 0; pe < hdr->e_phnum; pe++, p_entry++)
+    {
+        if (p_entry->p_type == PT_LOAD && (p_entry->p_flags & PF_W) == PF_W)
+        {
+            uint32_t other_begin = p_entry->p_vaddr & 0xFFFFF000;
+            uint32_t other_end = p_entry->p_vaddr + p_entry->p_memsz;
+
+            if (other_begin < v_end && other_end > v_begin)
+            {
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ *  Copy the loadable segments into the current address space and return the entry point. If `skip_shareable` is set, segments that
+ *  `elf_is_segment_shareable` accepts are expected to be mapped already (see `imagecache.c`) and are left untouched.
+ */
+uint32_t elf_load(const char *elf_data, BOOL skip_shareable)
 {
     uint32_t v_begin, v_end;
     Elf32_Ehdr *hdr;
@@ -99,6 +145,11 @@ uint32_t elf_load(const char *elf_data)
 
             //kprintf("ELF: entry flags: %x (%d)\n", p_entry->p_flags, p_entry->p_flags);
 
+            if (skip_shareable && elf_is_segment_shareable(elf_data, p_entry))
+            {
+                continue;
+            }
+
 
             memcpy((uint8_t *) v_begin, (uint8_t *) (elf_data + p_entry->p_offset), p_entry->p_filesz);
             if (p_entry->p_memsz > p_entry->p_filesz)
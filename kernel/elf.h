@@ -279,5 +279,6 @@ typedef struct {
 #define AUX_CNT 38
 
 BOOL elf_is_valid(const char *elfData);
-uint32_t elf_load(const char *elfData);
+BOOL elf_is_segment_shareable(const char *elfData, Elf32_Phdr *segment);
+uint32_t elf_load(const char *elfData, BOOL skip_shareable);
 uint32_t elf_get_end_in_memory(const char *elfData);
\ No newline at end of file
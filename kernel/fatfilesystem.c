@@ -37,6 +37,14 @@
 #include "alloc.h"
 #include "fatfs_ff.h"
 #include "fatfs_diskio.h"
+#include "blockcache.h"
+#include "dcache.h"
+#include "pagecache.h"
+#include "imagecache.h"
+#include "list.h"
+#include "errno.h"
+#include "spinlock.h"
+#include "process.h"
 
 #define SEEK_SET	0	/* Seek from beginning of file.  */
 #define SEEK_CUR	1	/* Seek from current position.  */
@@ -45,17 +53,103 @@
 static BOOL mount(const char* source_path, const char* target_path, uint32_t flags, void *data);
 static BOOL checkMount(const char* sourcePath, const char* targetPath, uint32_t flags, void *data);
 static filesystem_dirent* readdir(filesystem_node *node, uint32_t index);
+static int32_t getdents(File *file, uint32_t index, filesystem_dirent* entries, uint32_t count);
 static filesystem_node* finddir(filesystem_node *node, char *name);
 static int32_t read(File *file, uint32_t size, uint8_t *buffer);
 static int32_t write(File *file, uint32_t size, uint8_t *buffer);
+static int32_t writev(File *file, const struct iovec* iovs, uint32_t count, int32_t offset);
+static int32_t read_pages(File *file, uint32_t offset, uint32_t count, uint8_t *buffer);
 static int32_t lseek(File *file, int32_t offset, int32_t whence);
 static int32_t stat(filesystem_node *node, struct stat* buf);
 static BOOL open(File *file, uint32_t flags);
 static void close(File *file);
+static int32_t fsync(File *file, BOOL data_only);
+static void sync();
+
+static const filesystem_ops g_root_ops =
+{
+    .open = open,
+    .close = close,
+    .readdir = readdir,
+    .getdents = getdents,
+    .finddir = finddir,
+    .lseek = lseek,
+    .fsync = fsync
+};
+
+static const filesystem_ops g_directory_ops =
+{
+    .open = open,
+    .close = close,
+    .read = read,
+    .write = write,
+    .readdir = readdir,
+    .getdents = getdents,
+    .finddir = finddir,
+    .lseek = lseek,
+    .fsync = fsync,
+    .stat = stat
+};
+
+//Same as directories, plus read_pages so reads go through the page cache and writev for gathered and positioned writes
+static const filesystem_ops g_file_ops =
+{
+    .open = open,
+    .close = close,
+    .read = read,
+    .write = write,
+    .writev = writev,
+    .read_pages = read_pages,
+    .readdir = readdir,
+    .getdents = getdents,
+    .finddir = finddir,
+    .lseek = lseek,
+    .fsync = fsync,
+    .stat = stat
+};
 
 static filesystem_dirent g_fs_dirent;
 
+//private_data of an opened directory
+typedef struct FatDirectory
+{
+    DIR dir;
+    uint32_t index; //index of the entry f_readdir returns next
+} FatDirectory;
+
 static filesystem_node* g_mounted_block_devices[FF_VOLUMES];
+static FATFS* g_mounted_fatfs[FF_VOLUMES];
+static Spinlock g_volume_locks[FF_VOLUMES]; //FatFs takes them around its calls, see ff_req_grant
+
+/*
+ *  Dirty sectors stay in the block cache, FatFs' CTRL_SYNC doesn't write them back. The cache is told which file each written sector belongs to:
+ *  sectors written from FatFs' window are FAT and directory sectors (metadata), sectors written from a FIL's buffer belong to that file and
+ *  multi sector writes straight from the caller's buffer belong to the file whose current cluster they are in. Clusters aren't shared
+ *  between files and the volume lock lets only one f_write run, so that is the file being written.
+ *  fsync writes back the file's sectors and the volume's metadata, fdatasync leaves out the metadata unless the file size changed.
+ */
+
+static List* g_open_files = NULL; //regular files, for sync
+
+/*
+ *  Nodes of files and directories are created on first lookup and hung under their parent. Parent's child list
+ *  (and the dentry cache) is the index, a FatNode in private_node_data keeps the node in an LRU list.
+ *  When there are more than FAT_NODE_CAPACITY nodes, least recently used ones without references and without children are freed.
+ */
+
+#define FAT_NODE_CAPACITY 1024
+
+typedef struct FatNode
+{
+    filesystem_node* node;
+    struct FatNode* lru_previous; //more recently used
+    struct FatNode* lru_next; //less recently used
+    BOOL size_changed; //since the last fsync, fdatasync has to write the directory entry too
+} FatNode;
+
+static FatNode* g_node_lru_first = NULL;
+static FatNode* g_node_lru_last = NULL;
+static uint32_t g_node_count = 0;
 
 
 void fatfs_initialize()
@@ -65,13 +159,17 @@ void fatfs_initialize()
     strcpy(fs.name, "fat");
     fs.mount = mount;
     fs.check_mount = checkMount;
+    fs.sync = sync;
 
     fs_register(&fs);
 
     for (int i = 0; i < FF_VOLUMES; ++i)
     {
         g_mounted_block_devices[i] = NULL;
+        g_mounted_fatfs[i] = NULL;
     }
+
+    g_open_files = list_create();
 }
 
 static BOOL mount(const char* source_path, const char* target_path, uint32_t flags, void *data)
@@ -103,14 +201,9 @@ static BOOL mount(const char* source_path, const char* target_path, uint32_t fla
                     return FALSE;
                 }
 
-                filesystem_node* new_node = kmalloc(sizeof(filesystem_node));
+                filesystem_node* new_node = fs_create_node(target_node->name, &g_root_ops);
 
-                memset((uint8_t*)new_node, 0, sizeof(filesystem_node));
-                strcpy(new_node->name, target_node->name);
                 new_node->node_type = FT_DIRECTORY;
-                new_node->open = open;
-                new_node->readdir = readdir;
-                new_node->finddir = finddir;
                 new_node->parent = target_node->parent;
                 new_node->mount_source = node;
                 new_node->private_node_data = (void*)volume;
@@ -128,6 +221,8 @@ static BOOL mount(const char* source_path, const char* target_path, uint32_t fla
 
                 if (FR_OK == fr)
                 {
+                    g_mounted_fatfs[volume] = fatFs;
+
                     target_node->node_type |= FT_MOUNT_POINT;
                     target_node->mount_point = new_node;
 
@@ -166,6 +261,20 @@ static BOOL checkMount(const char* source_path, const char* target_path, uint32_
     return FALSE;
 }
 
+static void fill_dirent(filesystem_dirent* dirent, FILINFO* file_info)
+{
+    dirent->inode = 0;
+    strcpy(dirent->name, file_info->fname);
+    if ((file_info->fattrib & AM_DIR) == AM_DIR)
+    {
+        dirent->file_type = FT_DIRECTORY;
+    }
+    else
+    {
+        dirent->file_type = FT_FILE;
+    }
+}
+
 static filesystem_dirent* readdir(filesystem_node *node, uint32_t index)
 {
     //when node is the root of mounted filesystem,
@@ -230,23 +339,191 @@ static filesystem_dirent* readdir(filesystem_node *node, uint32_t index)
             }
         }
 
-        g_fs_dirent.inode = 0;
-        strcpy(g_fs_dirent.name, fileInfo.fname);
-        if ((fileInfo.fattrib & AM_DIR) == AM_DIR)
+        fill_dirent(&g_fs_dirent, &fileInfo);
+
+        f_closedir(&dir);
+
+        return &g_fs_dirent;
+    }
+
+    return NULL;
+}
+
+//Reads with the DIR kept open in the File, sequential calls do not rescan the directory
+static int32_t getdents(File *file, uint32_t index, filesystem_dirent* entries, uint32_t count)
+{
+    FatDirectory* directory = (FatDirectory*)file->private_data;
+
+    if (NULL == directory || file->node->node_type != FT_DIRECTORY)
+    {
+        return -1;
+    }
+
+    FILINFO file_info;
+
+    if (index < directory->index)
+    {
+        //rewind
+        if (FR_OK != f_readdir(&directory->dir, NULL))
+        {
+            return -1;
+        }
+
+        directory->index = 0;
+    }
+
+    while (directory->index < index)
+    {
+        memset((uint8_t*)&file_info, 0, sizeof(FILINFO));
+        if (FR_OK != f_readdir(&directory->dir, &file_info) || file_info.fname[0] == '\0')
         {
-            g_fs_dirent.file_type = FT_DIRECTORY;
+            return 0;
         }
-        else
+
+        directory->index++;
+    }
+
+    uint32_t i = 0;
+    while (i < count)
+    {
+        memset((uint8_t*)&file_info, 0, sizeof(FILINFO));
+        FRESULT fr = f_readdir(&directory->dir, &file_info);
+
+        if (FR_OK != fr)
         {
-            g_fs_dirent.file_type = FT_FILE;
+            return i > 0 ? (int32_t)i : -1;
         }
 
-        f_closedir(&dir);
+        if (file_info.fname[0] == '\0')
+        {
+            //end of directory
+            break;
+        }
 
-        return &g_fs_dirent;
+        directory->index++;
+
+        fill_dirent(&entries[i], &file_info);
+
+        ++i;
     }
 
-    return NULL;
+    return i;
+}
+
+static void node_lru_remove(FatNode* fat_node)
+{
+    if (fat_node->lru_previous)
+    {
+        fat_node->lru_previous->lru_next = fat_node->lru_next;
+    }
+    else
+    {
+        g_node_lru_first = fat_node->lru_next;
+    }
+
+    if (fat_node->lru_next)
+    {
+        fat_node->lru_next->lru_previous = fat_node->lru_previous;
+    }
+    else
+    {
+        g_node_lru_last = fat_node->lru_previous;
+    }
+
+    fat_node->lru_previous = NULL;
+    fat_node->lru_next = NULL;
+}
+
+static void node_lru_push_front(FatNode* fat_node)
+{
+    fat_node->lru_previous = NULL;
+    fat_node->lru_next = g_node_lru_first;
+
+    if (g_node_lru_first)
+    {
+        g_node_lru_first->lru_previous = fat_node;
+    }
+    else
+    {
+        g_node_lru_last = fat_node;
+    }
+
+    g_node_lru_first = fat_node;
+}
+
+static void touch_node(filesystem_node* node)
+{
+    //the root of the volume has no FatNode, it keeps the volume number there
+    if (node->mount_source)
+    {
+        return;
+    }
+
+    FatNode* fat_node = (FatNode*)node->private_node_data;
+
+    if (fat_node && g_node_lru_first != fat_node)
+    {
+        node_lru_remove(fat_node);
+        node_lru_push_front(fat_node);
+    }
+}
+
+static void destroy_node(FatNode* fat_node)
+{
+    filesystem_node* node = fat_node->node;
+    filesystem_node* parent = node->parent;
+
+    if (parent->first_child == node)
+    {
+        parent->first_child = node->next_sibling;
+    }
+    else
+    {
+        filesystem_node* child = parent->first_child;
+        while (NULL != child && child->next_sibling != node)
+        {
+            child = child->next_sibling;
+        }
+
+        if (child)
+        {
+            child->next_sibling = node->next_sibling;
+        }
+    }
+
+    //Nothing may keep the address, a new node can be allocated there
+    dcache_remove_node(node);
+    pagecache_invalidate(node);
+    imagecache_invalidate(node);
+
+    node_lru_remove(fat_node);
+    g_node_count--;
+
+    kfree(fat_node);
+    kfree(node);
+}
+
+//Frees least recently used nodes that are not in use. Directories having child nodes are kept, their children go first.
+static void evict_nodes(filesystem_node* keep)
+{
+    FatNode* fat_node = g_node_lru_last;
+
+    while (g_node_count > FAT_NODE_CAPACITY && NULL != fat_node)
+    {
+        FatNode* previous = fat_node->lru_previous;
+
+        filesystem_node* node = fat_node->node;
+
+        if (node != keep &&
+            0 == node->reference_count &&
+            NULL == node->first_child &&
+            (node->node_type & FT_MOUNT_POINT) == 0)
+        {
+            destroy_node(fat_node);
+        }
+
+        fat_node = previous;
+    }
 }
 
 static filesystem_node* finddir(filesystem_node *node, char *name)
@@ -261,6 +538,10 @@ static filesystem_node* finddir(filesystem_node *node, char *name)
     {
         if (strcmp(name, child->name) == 0)
         {
+            dcache_insert(node, name, child);
+
+            touch_node(child);
+
             return child;
         }
 
@@ -318,47 +599,38 @@ static filesystem_node* finddir(filesystem_node *node, char *name)
     FRESULT fr = f_stat((TCHAR*)target, &file_info);
     if (FR_OK == fr)
     {
-        filesystem_node* new_node = kmalloc(sizeof(filesystem_node));
+        BOOL is_directory = (file_info.fattrib & AM_DIR) == AM_DIR;
+
+        filesystem_node* new_node = fs_create_node(name, is_directory ? &g_directory_ops : &g_file_ops);
 
-        memset((uint8_t*)new_node, 0, sizeof(filesystem_node));
-        strcpy(new_node->name, name);
         new_node->parent = node;
-        new_node->readdir = readdir;
-        new_node->finddir = finddir;
-        new_node->open = open;
-        new_node->close = close;
-        new_node->read = read;
-        new_node->write = write;
-        new_node->lseek = lseek;
-        new_node->stat = stat;
         new_node->length = file_info.fsize;
+        new_node->node_type = is_directory ? FT_DIRECTORY : FT_FILE;
 
-        if ((file_info.fattrib & AM_DIR) == AM_DIR)
-        {
-            new_node->node_type = FT_DIRECTORY;
-        }
-        else
-        {
-            new_node->node_type = FT_FILE;
-        }
+        new_node->next_sibling = node->first_child;
+        node->first_child = new_node;
 
-        if (NULL == node->first_child)
-        {
-            node->first_child = new_node;
-        }
-        else
-        {
-            filesystem_node* child = node->first_child;
-            while (NULL != child->next_sibling)
-            {
-                child = child->next_sibling;
-            }
-            child->next_sibling = new_node;
-        }
+        FatNode* fat_node = (FatNode*)kmalloc(sizeof(FatNode));
+        memset((uint8_t*)fat_node, 0, sizeof(FatNode));
+        fat_node->node = new_node;
+        new_node->private_node_data = fat_node;
+
+        node_lru_push_front(fat_node);
+        g_node_count++;
+
+        //Parent has a child now, so the whole path stays
+        evict_nodes(new_node);
+
+        dcache_insert(node, name, new_node);
 
         //Screen_PrintF("finddir: returning [%s]\n", name);
         return new_node;
     }
+    else if (FR_NO_FILE == fr)
+    {
+        //Remember that it does not exist
+        dcache_insert(node, name, NULL);
+    }
     else
     {
         //Screen_PrintF("finddir error: fr: %d]\n", fr);
@@ -367,15 +639,73 @@ static filesystem_node* finddir(filesystem_node *node, char *name)
     return NULL;
 }
 
+/*
+ *  Files opened read-only and at least FAT_FASTSEEK_MIN_SIZE long get a cluster link map (FatFs fast seek) on their first
+ *  non-sequential seek. The map has two items per fragment of the file, so seeks cost O(fragments) instead of a FAT chain walk.
+ */
+
+#define FAT_FASTSEEK_MIN_SIZE (256 * 1024)
+#define FAT_FASTSEEK_FIRST_TABLE_ITEMS 16 //enough for 7 fragments, larger tables are allocated to the size FatFs reports
+
+static void create_link_map(FIL* f)
+{
+    uint32_t items = FAT_FASTSEEK_FIRST_TABLE_ITEMS;
+
+    DWORD* table = (DWORD*)kmalloc(items * sizeof(DWORD));
+    table[0] = items;
+    f->cltbl = table;
+
+    FRESULT fr = f_lseek(f, CREATE_LINKMAP);
+
+    if (FR_NOT_ENOUGH_CORE == fr)
+    {
+        //table[0] is the required size now
+        items = table[0];
+        kfree(table);
+
+        table = (DWORD*)kmalloc(items * sizeof(DWORD));
+        table[0] = items;
+        f->cltbl = table;
+
+        fr = f_lseek(f, CREATE_LINKMAP);
+    }
+
+    if (FR_OK != fr)
+    {
+        f->cltbl = NULL;
+        kfree(table);
+    }
+}
+
+static FRESULT seek(FIL* f, FSIZE_t offset)
+{
+    if (NULL == f->cltbl &&
+        offset != f->fptr &&
+        0 == (f->flag & FA_WRITE) &&
+        f_size(f) >= FAT_FASTSEEK_MIN_SIZE)
+    {
+        //Writes could need the chain extended, which fast seek mode does not do
+        create_link_map(f);
+    }
+
+    return f_lseek(f, offset);
+}
+
 static int32_t read(File *file, uint32_t size, uint8_t *buffer)
 {
-    if (file->private_data == NULL)
+    if (file->private_data == NULL || file->node->node_type == FT_DIRECTORY)
     {
         return -1;
     }
 
     FIL* f = (FIL*)file->private_data;
 
+    //file->offset is the position of the File, the FIL may have been moved by read_pages
+    if (f->fptr != (FSIZE_t)file->offset && FR_OK != seek(f, file->offset))
+    {
+        return -1;
+    }
+
     UINT br = 0;
     FRESULT fr = f_read(f, buffer, size, &br);
     file->offset = f->fptr;
@@ -388,21 +718,89 @@ static int32_t read(File *file, uint32_t size, uint8_t *buffer)
     return -1;
 }
 
+//All buffers go through one seek and one FatFs write session, file->offset is only used and advanced for FS_OFFSET_CURRENT
+static int32_t writev(File *file, const struct iovec* iovs, uint32_t count, int32_t offset)
+{
+    if (file->private_data == NULL || file->node->node_type == FT_DIRECTORY)
+    {
+        return -1;
+    }
+
+    FIL* f = (FIL*)file->private_data;
+
+    FSIZE_t position = (FS_OFFSET_CURRENT == offset) ? (FSIZE_t)file->offset : (FSIZE_t)offset;
+
+    //O_APPEND writes go to the end, wherever the position is
+    if (FS_OFFSET_CURRENT == offset && (file->flags & O_APPEND) == O_APPEND)
+    {
+        position = f_size(f);
+    }
+
+    if (f->fptr != position && FR_OK != f_lseek(f, position))
+    {
+        return -1;
+    }
+
+    FSIZE_t old_size = f_size(f);
+
+    uint32_t written = 0;
+    FRESULT fr = FR_OK;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        UINT bw = 0;
+        fr = f_write(f, iovs[i].iov_base, iovs[i].iov_len, &bw);
+        written += bw;
+
+        if (FR_OK != fr || bw < iovs[i].iov_len)
+        {
+            //Volume full
+            break;
+        }
+    }
+    if (FS_OFFSET_CURRENT == offset)
+    {
+        file->offset = f->fptr;
+    }
+    file->node->length = f_size(f);
+    if (f_size(f) != old_size)
+    {
+        ((FatNode*)file->node->private_node_data)->size_changed = TRUE;
+    }
+    if (FR_OK == fr || written > 0)
+    {
+        return written;
+    }
+
+    return -1;
+}
+
 static int32_t write(File *file, uint32_t size, uint8_t *buffer)
 {
-    if (file->private_data == NULL)
+    struct iovec iov = {buffer, size};
+
+    return writev(file, &iov, 1, FS_OFFSET_CURRENT);
+}
+
+//Fills page cache pages, file->offset is not changed
+static int32_t read_pages(File *file, uint32_t offset, uint32_t count, uint8_t *buffer)
+{
+    if (file->private_data == NULL || file->node->node_type == FT_DIRECTORY)
     {
         return -1;
     }
 
     FIL* f = (FIL*)file->private_data;
 
-    UINT bw = 0;
-    FRESULT fr = f_write(f, buffer, size, &bw);
-    file->offset = f->fptr;
+    if (FR_OK != seek(f, offset))
+    {
+        return -1;
+    }
+
+    UINT br = 0;
+    FRESULT fr = f_read(f, buffer, count * PAGESIZE_4K, &br);
     if (FR_OK == fr)
     {
-        return bw;
+        return br;
     }
 
     return -1;
@@ -415,6 +813,23 @@ static int32_t lseek(File *file, int32_t offset, int32_t whence)
         return -1;
     }
 
+    if (file->node->node_type == FT_DIRECTORY)
+    {
+        //The offset of a directory is an entry index for getdents
+        if (SEEK_SET == whence && offset >= 0)
+        {
+            file->offset = offset;
+            return file->offset;
+        }
+        else if (SEEK_CUR == whence && file->offset + offset >= 0)
+        {
+            file->offset += offset;
+            return file->offset;
+        }
+
+        return -1;
+    }
+
     FIL* f = (FIL*)file->private_data;
 
     FRESULT fr = FR_INVALID_OBJECT;
@@ -422,13 +837,13 @@ static int32_t lseek(File *file, int32_t offset, int32_t whence)
     switch (whence)
     {
     case SEEK_SET:
-        fr = f_lseek(f, offset);
+        fr = seek(f, offset);
         break;
     case SEEK_CUR:
-        fr = f_lseek(f, f_tell(f) + offset);
+        fr = seek(f, file->offset + offset);
         break;
     case SEEK_END:
-        fr = f_lseek(f, f_size(f) + offset);
+        fr = seek(f, f_size(f) + offset);
         break;
     default:
         break;
@@ -515,10 +930,7 @@ static BOOL open(File *file, uint32_t flags)
 
     filesystem_node *node = file->node;
 
-    if (node->node_type == FT_DIRECTORY)
-    {
-        return TRUE;
-    }
+    touch_node(node);
 
     uint8_t target_path[128];
 
@@ -558,9 +970,27 @@ static BOOL open(File *file, uint32_t flags)
 
     //Screen_PrintF("fat open %s\n", target);
 
+    if (node->node_type == FT_DIRECTORY)
+    {
+        FatDirectory* directory = (FatDirectory*)kmalloc(sizeof(FatDirectory));
+        memset((uint8_t*)directory, 0, sizeof(FatDirectory));
+
+        if (FR_OK != f_opendir(&directory->dir, (TCHAR*)target))
+        {
+            kfree(directory);
+
+            return FALSE;
+        }
+
+        file->offset = 0;
+        file->private_data = directory;
+
+        return TRUE;
+    }
+
     int fatfs_mode = FA_READ;
 
-    switch (flags)
+    switch (flags & O_ACCMODE)
     {
     case O_RDONLY:
         fatfs_mode = FA_READ;
@@ -571,22 +1001,46 @@ static BOOL open(File *file, uint32_t flags)
     case O_RDWR:
         fatfs_mode = (FA_READ | FA_WRITE);
         break;
-        //TODO: append, create
     default:
         break;
     }
 
+    //The node exists already (O_CREAT is handled by create), so only truncation and the append position are left
+    BOOL truncate = (flags & O_TRUNC) == O_TRUNC && (fatfs_mode & FA_WRITE);
+    if (truncate)
+    {
+        fatfs_mode |= FA_CREATE_ALWAYS;
+    }
+    else if ((flags & O_APPEND) == O_APPEND)
+    {
+        //Only the starting position, writev appends each write
+        fatfs_mode |= FA_OPEN_APPEND;
+    }
+
     FIL* f = (FIL*)kmalloc(sizeof(FIL));
     FRESULT fr = f_open(f, (TCHAR*)target, fatfs_mode);
     if (FR_OK == fr)
     {
+        if (truncate)
+        {
+            pagecache_invalidate(node);
+            imagecache_invalidate(node);
+
+            ((FatNode*)node->private_node_data)->size_changed = TRUE;
+        }
+
         file->offset = f->fptr;
+        node->length = f_size(f);
 
         file->private_data = f;
 
+        list_append(g_open_files, file);
+
         return TRUE;
     }
 
+    kfree(f);
+
     return FALSE;
 }
 
@@ -597,15 +1051,129 @@ static void close(File *file)
         return;
     }
 
+    if (file->node->node_type == FT_DIRECTORY)
+    {
+        FatDirectory* directory = (FatDirectory*)file->private_data;
+
+        f_closedir(&directory->dir);
+
+        kfree(directory);
+
+        file->private_data = NULL;
+
+        return;
+    }
+
     FIL* f = (FIL*)file->private_data;
 
+    list_remove_first_occurrence(g_open_files, file);
+
     f_close(f);
 
+    if (f->cltbl)
+    {
+        kfree(f->cltbl);
+    }
+
     kfree(f);
 
     file->private_data = NULL;
 }
 
+static int32_t fsync(File *file, BOOL data_only)
+{
+    if (file->private_data == NULL)
+    {
+        return -EBADF;
+    }
+
+    if (file->node->node_type & FT_DIRECTORY)
+    {
+        FatDirectory* directory = (FatDirectory*)file->private_data;
+
+        //Directory entries are metadata
+        filesystem_node* device = g_mounted_block_devices[directory->dir.obj.fs->pdrv];
+
+        return blockcache_flush_owner(device, BLOCKCACHE_METADATA, TRUE) < 0 ? -EIO : 0;
+    }
+
+    FIL* f = (FIL*)file->private_data;
+    FatNode* fat_node = (FatNode*)file->node->private_node_data;
+    filesystem_node* device = g_mounted_block_devices[f->obj.fs->pdrv];
+
+    //Moves the FIL's buffer and the directory entry into the block cache
+    if (FR_OK != f_sync(f))
+    {
+        return -EIO;
+    }
+
+    BOOL with_metadata = !data_only || fat_node->size_changed;
+
+    if (blockcache_flush_owner(device, file->node, with_metadata) < 0)
+    {
+        return -EIO;
+    }
+
+    if (with_metadata)
+    {
+        fat_node->size_changed = FALSE;
+    }
+
+    return 0;
+}
+
+//Moves what FatFs keeps in FILs into the block cache
+static void sync()
+{
+    list_foreach (n, g_open_files)
+    {
+        File* file = (File*)n->data;
+
+        f_sync((FIL*)file->private_data);
+    }
+}
+
+//The file the sectors written from `buffer` belong to, see the comment on g_open_files
+static void* get_sector_owner(BYTE pdrv, const BYTE* buffer, DWORD sector)
+{
+    FATFS* fs = g_mounted_fatfs[pdrv];
+
+    if (NULL == fs || buffer == fs->win)
+    {
+        return BLOCKCACHE_METADATA;
+    }
+
+    list_foreach (n, g_open_files)
+    {
+        File* file = (File*)n->data;
+
+        if (buffer == ((FIL*)file->private_data)->buf)
+        {
+            return file->node;
+        }
+    }
+
+    list_foreach (n, g_open_files)
+    {
+        File* file = (File*)n->data;
+        FIL* f = (FIL*)file->private_data;
+
+        if (f->obj.fs != fs || f->clust < 2)
+        {
+            continue;
+        }
+
+        DWORD first = fs->database + fs->csize * (f->clust - 2);
+
+        if (sector >= first && sector < first + fs->csize)
+        {
+            return file->node;
+        }
+    }
+
+    return BLOCKCACHE_METADATA;
+}
+
 DSTATUS disk_initialize(
         BYTE pdrv		//Physical drive nmuber
 )
@@ -631,7 +1199,10 @@ DRESULT disk_read (
 
     //if (sector >= RamDiskSize) return RES_PARERR;
 
-    g_mounted_block_devices[pdrv]->read_block(g_mounted_block_devices[pdrv], (uint32_t)sector, count, buff);
+    if (g_mounted_block_devices[pdrv]->ops->read_block(g_mounted_block_devices[pdrv], (uint32_t)sector, count, buff) < 0)
+    {
+        return RES_ERROR;
+    }
 
     return RES_OK;
 }
@@ -647,7 +1218,23 @@ DRESULT disk_write (
 
     //if (sector >= RamDiskSize) return RES_PARERR;
 
-    g_mounted_block_devices[pdrv]->write_block(g_mounted_block_devices[pdrv], (uint32_t)sector, count, (uint8_t*)buff);
+    filesystem_node* device = g_mounted_block_devices[pdrv];
+
+    int32_t result = 0;
+
+    if (device->ops->write_block_owned)
+    {
+        result = device->ops->write_block_owned(device, (uint32_t)sector, count, (uint8_t*)buff, get_sector_owner(pdrv, buff, sector));
+    }
+    else
+    {
+        result = device->ops->write_block(device, (uint32_t)sector, count, (uint8_t*)buff);
+    }
+
+    if (result < 0)
+    {
+        return RES_ERROR;
+    }
 
     return RES_OK;
 }
@@ -669,6 +1256,7 @@ DRESULT disk_ioctl (
     switch (ctrl)
     {
     case CTRL_SYNC:
+        //FatFs syncs on every f_sync, f_close and directory change. Sectors are left to the flusher, fsync writes them back.
         dr = RES_OK;
         break;
     case GET_SECTOR_COUNT:
@@ -698,3 +1286,49 @@ DRESULT disk_ioctl (
     }
     return dr;
 }
+
+/*
+ *  FatFs keeps the volume's window and FAT state in the FATFS, so it takes the volume's lock around each of its calls.
+ *  Device reads and writes sleep with the lock held, waiters let interrupts in (system calls run without them) so the holder gets to finish.
+ */
+int ff_cre_syncobj(BYTE vol, FF_SYNC_t* sobj)
+{
+    spinlock_init(&g_volume_locks[vol]);
+
+    *sobj = &g_volume_locks[vol];
+
+    return 1;
+}
+
+int ff_req_grant(FF_SYNC_t sobj)
+{
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    while (!spinlock_try_lock((Spinlock*)sobj))
+    {
+        enable_interrupts();
+        halt();
+        disable_interrupts();
+    }
+
+    thread_defer_kill();
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+
+    return 1;
+}
+
+void ff_rel_grant(FF_SYNC_t sobj)
+{
+    spinlock_unlock((Spinlock*)sobj);
+
+    thread_allow_kill();
+}
+
+int ff_del_syncobj(FF_SYNC_t sobj)
+{
+    return 1;
+}
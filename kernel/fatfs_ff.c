@@ -3756,6 +3756,12 @@ FRESULT f_read (
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
 				}
+				while (btr / SS(fs) > cc) {		/* Extend the read over following clusters while they are contiguous on the volume */
+					clst = get_fat(&fp->obj, fp->clust);
+					if (clst != fp->clust + 1) break;
+					fp->clust = clst;
+					cc += (btr / SS(fs) - cc > fs->csize) ? fs->csize : btr / SS(fs) - cc;
+				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
@@ -131,29 +131,30 @@ int32_t fifobuffer_dequeue(FifoBuffer* fifo_buffer, uint8_t* data, uint32_t size
 
 int32_t fifobuffer_enqueue_from_other(FifoBuffer* fifo_buffer, FifoBuffer* other)
 {
-    uint32_t otherSize = fifobuffer_get_size(other);
+    return fifobuffer_move(fifo_buffer, other, fifobuffer_get_size(other));
+}
 
-    if (otherSize == 0)
+//Moves up to `size` bytes from the other buffer to this one, in pieces that are contiguous in both
+int32_t fifobuffer_move(FifoBuffer* fifo_buffer, FifoBuffer* other, uint32_t size)
+{
+    uint32_t moved = 0;
+    while (moved < size && fifo_buffer->used_bytes < fifo_buffer->capacity && other->used_bytes > 0)
     {
-        return 0;
-    }
+        uint32_t chunk = MIN(size - moved, other->used_bytes);
+        chunk = MIN(chunk, other->capacity - other->read_index);
+        chunk = MIN(chunk, fifo_buffer->capacity - fifo_buffer->used_bytes);
+        chunk = MIN(chunk, fifo_buffer->capacity - fifo_buffer->write_index);
 
-    uint32_t bytes_available = fifo_buffer->capacity - fifo_buffer->used_bytes;
+        memcpy(fifo_buffer->data + fifo_buffer->write_index, other->data + other->read_index, chunk);
 
-    uint32_t i = 0;
-    while (fifo_buffer->used_bytes < fifo_buffer->capacity && other->used_bytes > 0)
-    {
-        fifo_buffer->data[fifo_buffer->write_index] = other->data[other->read_index];
-        fifo_buffer->used_bytes++;
-        fifo_buffer->write_index++;
-        fifo_buffer->write_index %= fifo_buffer->capacity;
+        fifo_buffer->used_bytes += chunk;
+        fifo_buffer->write_index = (fifo_buffer->write_index + chunk) % fifo_buffer->capacity;
 
-        other->used_bytes--;
-        other->read_index++;
-        other->read_index %= other->capacity;
+        other->used_bytes -= chunk;
+        other->read_index = (other->read_index + chunk) % other->capacity;
 
-        i++;
+        moved += chunk;
     }
 
-    return (int32_t)i;
-}
\ No newline at end of file
+    return (int32_t)moved;
+}
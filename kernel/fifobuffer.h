@@ -53,4 +53,5 @@ uint32_t fifobuffer_get_capacity(FifoBuffer* fifo_buffer);
 uint32_t fifobuffer_get_free(FifoBuffer* fifo_buffer);
 int32_t fifobuffer_enqueue(FifoBuffer* fifo_buffer, uint8_t* data, uint32_t size);
 int32_t fifobuffer_dequeue(FifoBuffer* fifo_buffer, uint8_t* data, uint32_t size);
-int32_t fifobuffer_enqueue_from_other(FifoBuffer* fifo_buffer, FifoBuffer* other);
\ No newline at end of file
+int32_t fifobuffer_enqueue_from_other(FifoBuffer* fifo_buffer, FifoBuffer* other);
+int32_t fifobuffer_move(FifoBuffer* fifo_buffer, FifoBuffer* other, uint32_t size);
\ No newline at end of file
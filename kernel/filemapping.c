@@ -0,0 +1,442 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+
+#include "filemapping.h"
+#include "pagecache.h"
+#include "alloc.h"
+#include "vmm.h"
+#include "list.h"
+#include "process.h"
+#include "errno.h"
+
+/*
+ *  mmap of regular files. A mapping only reserves its virtual pages, they are mapped on page fault from the page cache.
+ *  MAP_SHARED maps the cache page itself and keeps a reference on it, so all processes and read/write see the same data. Dirty pages
+ *  (the CPU sets the dirty bit of the page table entry) are written back to the file on msync and munmap. Process exit runs where the disk
+ *  can't be waited for, so the dirty pages are only collected then and written back later by the block cache flusher.
+ *  Read-only mappings are mapped without PG_WRITE, with CR0.WP set even system calls can't change the cache pages through them.
+ *  Writable MAP_PRIVATE mappings get a private copy of the page on first access. Read-only MAP_PRIVATE mappings share the cache page.
+ *  Each mapping opens its own File on the node, so closing the descriptor does not affect it.
+ */
+
+typedef struct FileMapping
+{
+    Process* process;
+    File* file;
+    uint32_t v_address;
+    uint32_t page_count;
+    uint32_t first_page; //file page index at v_address
+    uint32_t flags;
+    uint32_t protection;
+    CachedPage** pages; //cache pages mapped into the process, NULL if not faulted in yet or privately copied
+} FileMapping;
+
+//A dirty page of a mapping whose process exited
+typedef struct PendingWriteback
+{
+    File* file; //referenced
+    CachedPage* page; //referenced
+    uint32_t file_offset;
+} PendingWriteback;
+
+static List* g_file_mappings = NULL;
+static Queue* g_pending_writebacks = NULL;
+
+void filemapping_initialize()
+{
+    g_file_mappings = list_create();
+    g_pending_writebacks = queue_create();
+}
+
+static FileMapping* find_mapping(Process* process, uint32_t address)
+{
+    list_foreach (n, g_file_mappings)
+    {
+        FileMapping* mapping = (FileMapping*)n->data;
+
+        if (mapping->process == process &&
+            address >= mapping->v_address &&
+            address < mapping->v_address + mapping->page_count * PAGESIZE_4K)
+        {
+            return mapping;
+        }
+    }
+
+    return NULL;
+}
+
+void* filemapping_map(Process* process, File* file, uint32_t v_address_hint, uint32_t size, uint32_t offset, uint32_t flags, uint32_t protection)
+{
+    filesystem_node* node = file->node;
+
+    if (0 == size || (offset & (PAGESIZE_4K - 1)) != 0 || NULL == node->ops->read_pages || NULL == node->ops->open)
+    {
+        return (void*)-EINVAL;
+    }
+
+    uint32_t sharing = flags & (MAP_SHARED | MAP_PRIVATE);
+    if (sharing != MAP_SHARED && sharing != MAP_PRIVATE)
+    {
+        return (void*)-EINVAL;
+    }
+
+    uint32_t access_mode = file->flags & O_ACCMODE;
+
+    if (CHECK_ACCESS(access_mode, O_WRONLY))
+    {
+        return (void*)-EACCES;
+    }
+
+    if (sharing == MAP_SHARED && (protection & PROT_WRITE) && !CHECK_ACCESS(access_mode, O_RDWR))
+    {
+        return (void*)-EACCES;
+    }
+
+    File* own_file = (File*)kmalloc(sizeof(File));
+    memset((uint8_t*)own_file, 0, sizeof(File));
+    own_file->node = node;
+    own_file->process = process;
+    own_file->thread = file->thread;
+    own_file->fd = -1;
+    own_file->flags = access_mode;
+    own_file->reference_count = 1;
+
+    if (!node->ops->open(own_file, access_mode))
+    {
+        kfree(own_file);
+
+        return (void*)-EACCES;
+    }
+
+    fs_acquire_node(node);
+
+    uint32_t page_count = PAGE_COUNT(size);
+
+    void* v_address = vmm_reserve_memory(process, v_address_hint, page_count);
+
+    if (NULL == v_address)
+    {
+        node->ops->close(own_file);
+        fs_release_node(node);
+        kfree(own_file);
+
+        return (void*)-ENOMEM;
+    }
+
+    FileMapping* mapping = (FileMapping*)kmalloc(sizeof(FileMapping));
+    memset((uint8_t*)mapping, 0, sizeof(FileMapping));
+    mapping->process = process;
+    mapping->file = own_file;
+    mapping->v_address = (uint32_t)v_address;
+    mapping->page_count = page_count;
+    mapping->first_page = offset / PAGESIZE_4K;
+    mapping->flags = flags;
+    mapping->protection = protection;
+    mapping->pages = (CachedPage**)kmalloc(page_count * sizeof(CachedPage*));
+    memset((uint8_t*)mapping->pages, 0, page_count * sizeof(CachedPage*));
+
+    list_append(g_file_mappings, mapping);
+
+    return v_address;
+}
+
+//Works for active Page Directory!
+BOOL filemapping_handle_fault(Process* process, uint32_t address)
+{
+    FileMapping* mapping = find_mapping(process, address);
+
+    if (NULL == mapping)
+    {
+        return FALSE;
+    }
+
+    uint32_t index = (address - mapping->v_address) / PAGESIZE_4K;
+    uint32_t v_page = mapping->v_address + index * PAGESIZE_4K;
+
+    if (vmm_get_physical_address(v_page) != 0)
+    {
+        return FALSE;
+    }
+
+    //Beyond the end of file fails and the process gets SIGSEGV
+    CachedPage* page = pagecache_get_page(mapping->file, mapping->first_page + index);
+
+    if (NULL == page)
+    {
+        return FALSE;
+    }
+
+    if ((mapping->flags & MAP_PRIVATE) && (mapping->protection & PROT_WRITE))
+    {
+        uint32_t p_addr = vmm_acquire_page_frame_4k();
+
+        vmm_add_page_to_pd((char*)v_page, p_addr, PG_USER | PG_OWNED);
+
+        uint8_t* data = (uint8_t*)vmm_map_temporary(pagecache_get_physical_address(page));
+        if (data)
+        {
+            memcpy((uint8_t*)v_page, data, PAGESIZE_4K);
+
+            vmm_unmap_temporary(data);
+        }
+        else
+        {
+            memset((uint8_t*)v_page, 0, PAGESIZE_4K);
+        }
+
+        pagecache_put_page(page);
+
+        return TRUE;
+    }
+
+    int flags = PG_USER;
+    if ((mapping->protection & PROT_WRITE) == 0)
+    {
+        flags |= PG_READONLY;
+    }
+
+    vmm_add_page_to_pd((char*)v_page, pagecache_get_physical_address(page), flags);
+
+    mapping->pages[index] = page;
+
+    return TRUE;
+}
+
+//Writes the dirty pages in [first_index, end_index) back to the file.
+//Works for active Page Directory!
+static int32_t write_back(FileMapping* mapping, uint32_t first_index, uint32_t end_index)
+{
+    if ((mapping->flags & MAP_SHARED) == 0 || (mapping->protection & PROT_WRITE) == 0)
+    {
+        return 0;
+    }
+
+    int32_t result = 0;
+
+    for (uint32_t i = first_index; i < end_index && i < mapping->page_count; ++i)
+    {
+        if (NULL == mapping->pages[i])
+        {
+            continue;
+        }
+
+        uint32_t v_page = mapping->v_address + i * PAGESIZE_4K;
+
+        if (!vmm_clear_page_dirty(v_page))
+        {
+            continue;
+        }
+
+        uint32_t file_offset = (mapping->first_page + i) * PAGESIZE_4K;
+        uint32_t length = mapping->file->node->length;
+
+        //Mappings do not extend the file
+        if (file_offset >= length)
+        {
+            continue;
+        }
+
+        uint32_t size = MIN(PAGESIZE_4K, length - file_offset);
+
+        if (fs_pwrite(mapping->file, size, (uint8_t*)v_page, file_offset) != (int32_t)size)
+        {
+            result = -EIO;
+        }
+    }
+
+    return result;
+}
+
+//Takes the dirty pages for the flusher, nothing is written here.
+//Works for active Page Directory!
+static void collect_dirty_pages(FileMapping* mapping)
+{
+    if ((mapping->flags & MAP_SHARED) == 0 || (mapping->protection & PROT_WRITE) == 0)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < mapping->page_count; ++i)
+    {
+        if (NULL == mapping->pages[i] || !vmm_clear_page_dirty(mapping->v_address + i * PAGESIZE_4K))
+        {
+            continue;
+        }
+
+        PendingWriteback* pending = (PendingWriteback*)kmalloc(sizeof(PendingWriteback));
+        pending->file = mapping->file;
+        pending->page = mapping->pages[i];
+        pending->file_offset = (mapping->first_page + i) * PAGESIZE_4K;
+
+        //The mapping drops its own references when it is destroyed
+        fs_acquire_file(pending->file);
+        mapping->pages[i] = NULL;
+
+        queue_enqueue(g_pending_writebacks, pending);
+    }
+}
+
+//Writes the pages collected at process exit, from the block cache flusher and sync
+void filemapping_write_pending()
+{
+    while (TRUE)
+    {
+        begin_critical_section();
+        PendingWriteback* pending = (PendingWriteback*)queue_dequeue(g_pending_writebacks);
+        end_critical_section();
+
+        if (NULL == pending)
+        {
+            break;
+        }
+
+        uint32_t length = pending->file->node->length;
+
+        //Mappings do not extend the file
+        if (pending->file_offset < length)
+        {
+            uint8_t* data = (uint8_t*)vmm_map_temporary(pagecache_get_physical_address(pending->page));
+            if (data)
+            {
+                fs_pwrite(pending->file, MIN(PAGESIZE_4K, length - pending->file_offset), data, pending->file_offset);
+
+                vmm_unmap_temporary(data);
+            }
+        }
+
+        pagecache_put_page(pending->page);
+        fs_release_file(pending->file);
+        kfree(pending);
+    }
+}
+
+static void destroy_mapping(FileMapping* mapping)
+{
+    list_remove_first_occurrence(g_file_mappings, mapping);
+
+    for (uint32_t i = 0; i < mapping->page_count; ++i)
+    {
+        if (mapping->pages[i])
+        {
+            pagecache_put_page(mapping->pages[i]);
+        }
+    }
+
+    fs_release_file(mapping->file);
+
+    kfree(mapping->pages);
+    kfree(mapping);
+}
+
+//Returns FALSE if there is no file mapping starting at v_address.
+//Works for active Page Directory!
+BOOL filemapping_unmap(Process* process, uint32_t v_address)
+{
+    FileMapping* mapping = find_mapping(process, v_address);
+
+    if (NULL == mapping || mapping->v_address != v_address)
+    {
+        return FALSE;
+    }
+
+    write_back(mapping, 0, mapping->page_count);
+
+    //Shared pages are not owned so only private copies are released here, the cache pages are released below
+    vmm_unmap_memory(process, mapping->v_address, mapping->page_count);
+
+    destroy_mapping(mapping);
+
+    return TRUE;
+}
+
+//Works for active Page Directory!
+int32_t filemapping_sync(Process* process, uint32_t v_address, uint32_t size)
+{
+    int32_t result = -ENOMEM;
+
+    uint32_t end = v_address + size;
+
+    list_foreach (n, g_file_mappings)
+    {
+        FileMapping* mapping = (FileMapping*)n->data;
+
+        uint32_t mapping_end = mapping->v_address + mapping->page_count * PAGESIZE_4K;
+
+        if (mapping->process != process || end <= mapping->v_address || v_address >= mapping_end)
+        {
+            continue;
+        }
+
+        uint32_t first = v_address > mapping->v_address ? (v_address - mapping->v_address) / PAGESIZE_4K : 0;
+        uint32_t last = end < mapping_end ? PAGE_COUNT(end - mapping->v_address) : mapping->page_count;
+
+        if (result == -ENOMEM)
+        {
+            result = 0;
+        }
+
+        if (write_back(mapping, first, last) < 0)
+        {
+            result = -EIO;
+        }
+    }
+
+    return result;
+}
+
+//Called while the process is destroyed, its page directory may not be the active one
+void filemapping_unmap_for_process_all(Process* process)
+{
+    uint32_t cr3 = read_cr3();
+
+    CHANGE_PD(process->pd);
+
+    ListNode* n = g_file_mappings->head;
+    while (NULL != n)
+    {
+        FileMapping* mapping = (FileMapping*)n->data;
+
+        n = n->next;
+
+        if (mapping->process == process)
+        {
+            collect_dirty_pages(mapping);
+
+            //The page directory is destroyed with the process
+            destroy_mapping(mapping);
+        }
+    }
+
+    CHANGE_PD(cr3);
+}
@@ -44,12 +44,22 @@ static BOOL fb_open(File *file, uint32_t flags);
 static int32_t fb_read(File *file, uint32_t size, uint8_t *buffer);
 static int32_t fb_write(File *file, uint32_t size, uint8_t *buffer);
 static int32_t fb_ioctl(File *node, int32_t request, void * argp);
-static void* fb_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags);
+static void* fb_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags, uint32_t protection);
 static BOOL fb_munmap(File* file, void* address, uint32_t size);
 
 static uint8_t* g_fb_physical = 0;
 static uint8_t* g_fb_virtual = 0;
 
+static const filesystem_ops g_framebuffer_ops =
+{
+    .open = fb_open,
+    .read = fb_read,
+    .write = fb_write,
+    .ioctl = fb_ioctl,
+    .mmap = fb_mmap,
+    .munmap = fb_munmap
+};
+
 void framebuffer_initialize(uint8_t* p_address, uint8_t* v_address)
 {
     g_fb_physical = p_address;
@@ -59,12 +69,7 @@ void framebuffer_initialize(uint8_t* p_address, uint8_t* v_address)
     memset((uint8_t*)&device, 0, sizeof(Device));
     strcpy(device.name, "fb0");
     device.device_type = FT_CHARACTER_DEVICE;
-    device.open = fb_open;
-    device.read = fb_read;
-    device.write = fb_write;
-    device.ioctl = fb_ioctl;
-    device.mmap = fb_mmap;
-    device.munmap = fb_munmap;
+    device.ops = &g_framebuffer_ops;
 
     devfs_register_device(&device);
 }
@@ -131,7 +136,7 @@ static int32_t fb_ioctl(File *node, int32_t request, void * argp)
     return result;
 }
 
-static void* fb_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags)
+static void* fb_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags, uint32_t protection)
 {
     uint32_t page_count = PAGE_COUNT(size);
     uint32_t* physical_pages_array = (uint32_t*)kmalloc(page_count * sizeof(uint32_t));
@@ -143,7 +148,7 @@ static void* fb_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags)
         physical_pages_array[i] = (uint32_t)(g_fb_physical) + i * PAGESIZE_4K;
     }
 
-    void* result = vmm_map_memory(file->thread->owner, USER_MMAP_START, physical_pages_array, page_count, FALSE);
+    void* result = vmm_map_memory(thread_get_current()->owner, USER_MMAP_START, physical_pages_array, page_count, FALSE);
 
     kfree(physical_pages_array);
 
@@ -152,5 +157,5 @@ static void* fb_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags)
 
 static BOOL fb_munmap(File* file, void* address, uint32_t size)
 {
-    return vmm_unmap_memory(file->thread->owner, (uint32_t)address, PAGE_COUNT(size));
+    return vmm_unmap_memory(thread_get_current()->owner, (uint32_t)address, PAGE_COUNT(size));
 }
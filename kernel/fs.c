@@ -34,18 +34,28 @@
 #include "fs.h"
 #include "alloc.h"
 #include "rootfs.h"
+#include "imagecache.h"
+#include "pagecache.h"
+#include "dcache.h"
+#include "errno.h"
 
 filesystem_node *g_fs_root = NULL; // The root of the filesystem.
 
 #define FILESYSTEM_CAPACITY 10
 
+#define SEEK_SET	0	/* Seek from beginning of file.  */
+
 static FileSystem g_registered_filesystems[FILESYSTEM_CAPACITY];
 static int g_next_filesystem_index = 0;
 
+static const filesystem_ops g_empty_ops;
+
 void fs_initialize()
 {
     memset((uint8_t*)g_registered_filesystems, 0, sizeof(g_registered_filesystems));
 
+    dcache_initialize();
+
     g_fs_root = rootfs_initialize();
 
     /*
@@ -58,6 +68,32 @@ void fs_initialize()
      *  Create a directory which contains basic userland binaries like a shell, a test program & a logger...
      */
     fs_mkdir(g_fs_root, "initrd", 0);
+
+    /*
+     *  Mount point of the tmpfs for temporary files.
+     */
+    fs_mkdir(g_fs_root, "tmp", 0);
+}
+
+//The node and its name are a single allocation, so kfree on the node releases both
+filesystem_node* fs_create_node(const char* name, const filesystem_ops* ops)
+{
+    if (NULL == name)
+    {
+        name = "";
+    }
+
+    uint32_t name_size = strlen(name) + 1;
+
+    filesystem_node* node = (filesystem_node*)kmalloc(sizeof(filesystem_node) + name_size);
+    memset((uint8_t*)node, 0, sizeof(filesystem_node));
+
+    node->name = (char*)(node + 1);
+    memcpy((uint8_t*)node->name, (uint8_t*)name, name_size);
+
+    node->ops = ops ? ops : &g_empty_ops;
+
+    return node;
 }
 
 filesystem_node* fs_get_root_node()
@@ -215,9 +251,20 @@ BOOL fs_resolve_path(const char* path, char* buffer, int buffer_size)
 
 uint32_t fs_read(File *file, uint32_t size, uint8_t *buffer)
 {
-    if (file->node->read != 0)
+    if (file->node->node_type == FT_FILE && file->node->ops->read_pages != NULL)
+    {
+        //The driver isn't asked, pages other openers cached must not reach a write-only File
+        if (CHECK_ACCESS(file->flags, O_WRONLY))
+        {
+            return -EBADF;
+        }
+
+        return pagecache_read(file, size, buffer);
+    }
+
+    if (file->node->ops->read != 0)
     {
-        return file->node->read(file, size, buffer);
+        return file->node->ops->read(file, size, buffer);
     }
 
     return -1;
@@ -225,20 +272,273 @@ uint32_t fs_read(File *file, uint32_t size, uint8_t *buffer)
 
 uint32_t fs_write(File *file, uint32_t size, uint8_t *buffer)
 {
-    if (file->node->write != 0)
+    if (file->node->ops->write != 0)
     {
-        return file->node->write(file, size, buffer);
+        if (file->node->node_type == FT_FILE)
+        {
+            imagecache_invalidate(file->node);
+
+            //O_APPEND writes land at the end
+            int32_t offset = ((file->flags & O_APPEND) == O_APPEND) ? (int32_t)file->node->length : file->offset;
+
+            int32_t written = file->node->ops->write(file, size, buffer);
+
+            if (written > 0 && offset >= 0)
+            {
+                pagecache_update(file->node, offset, written, buffer);
+            }
+
+            return written;
+        }
+
+        return file->node->ops->write(file, size, buffer);
     }
 
     return -1;
 }
 
+//Bytes of all buffers, or -EINVAL when they do not fit a return value
+static int32_t get_vector_length(const struct iovec* iovs, uint32_t count)
+{
+    uint32_t length = 0;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (iovs[i].iov_len > 0x7FFFFFFF - length)
+        {
+            return -EINVAL;
+        }
+
+        length += iovs[i].iov_len;
+    }
+
+    return length;
+}
+
+typedef struct VectorCursor
+{
+    const struct iovec* iovs;
+    uint32_t count;
+    uint32_t index;
+    uint32_t used;//bytes of iovs[index] already filled
+} VectorCursor;
+
+//PageCacheConsumer scattering cached data over the buffers
+static int32_t copy_to_vector(void* context, uint32_t done, uint8_t* data, uint32_t size)
+{
+    VectorCursor* cursor = (VectorCursor*)context;
+
+    uint32_t copied = 0;
+    while (copied < size && cursor->index < cursor->count)
+    {
+        const struct iovec* iov = cursor->iovs + cursor->index;
+
+        uint32_t chunk = MIN(iov->iov_len - cursor->used, size - copied);
+
+        memcpy((uint8_t*)iov->iov_base + cursor->used, data + copied, chunk);
+
+        copied += chunk;
+        cursor->used += chunk;
+
+        if (cursor->used == iov->iov_len)
+        {
+            cursor->index++;
+            cursor->used = 0;
+        }
+    }
+
+    return copied;
+}
+
+//For drivers without vector functions: one fs_read or fs_write per buffer at the file position.
+//Positioned transfers would have to borrow the position other threads sharing the File use, so they are not supported.
+static int32_t transfer_each(File* file, const struct iovec* iovs, uint32_t count, int32_t offset, BOOL write)
+{
+    if (offset != FS_OFFSET_CURRENT)
+    {
+        return -ESPIPE;
+    }
+
+    int32_t done = 0;
+    int32_t error = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (0 == iovs[i].iov_len)
+        {
+            continue;
+        }
+
+        int32_t bytes = 0;
+        if (write)
+        {
+            bytes = (int32_t)fs_write(file, iovs[i].iov_len, (uint8_t*)iovs[i].iov_base);
+        }
+        else
+        {
+            bytes = (int32_t)fs_read(file, iovs[i].iov_len, (uint8_t*)iovs[i].iov_base);
+        }
+
+        if (bytes < 0)
+        {
+            error = bytes;
+            break;
+        }
+
+        done += bytes;
+
+        if ((uint32_t)bytes < iovs[i].iov_len)
+        {
+            break;
+        }
+    }
+
+    if (0 == done && error < 0)
+    {
+        return error;
+    }
+
+    return done;
+}
+
+/*
+ *  Reads into all buffers in order. With an offset (anything but FS_OFFSET_CURRENT) the read starts there and file->offset
+ *  is left alone, so threads sharing a File do not need to agree on its position. Page cached files serve both kinds from
+ *  the cache, drivers with readv get the whole vector in one call, the rest get one read per buffer and no offset (-ESPIPE).
+ */
+int32_t fs_readv(File* file, const struct iovec* iovs, uint32_t count, int32_t offset)
+{
+    filesystem_node* node = file->node;
+
+    int32_t length = get_vector_length(iovs, count);
+    if (length <= 0)
+    {
+        return length;
+    }
+
+    if (offset != FS_OFFSET_CURRENT)
+    {
+        if (NULL == node->ops->lseek)
+        {
+            return -ESPIPE;
+        }
+
+        if (offset < 0)
+        {
+            return -EINVAL;
+        }
+    }
+
+    if (node->node_type == FT_FILE && node->ops->read_pages != NULL)
+    {
+        if (CHECK_ACCESS(file->flags, O_WRONLY))
+        {
+            return -EBADF;
+        }
+
+        VectorCursor cursor = {iovs, count, 0, 0};
+
+        if (FS_OFFSET_CURRENT == offset)
+        {
+            return pagecache_read_to(file, length, copy_to_vector, &cursor);
+        }
+
+        return pagecache_read_at(file, offset, length, copy_to_vector, &cursor);
+    }
+
+    if (node->ops->readv != NULL)
+    {
+        return node->ops->readv(file, iovs, count, offset);
+    }
+
+    return transfer_each(file, iovs, count, offset, FALSE);
+}
+
+//Writes all buffers in order, the offset works like in fs_readv
+int32_t fs_writev(File* file, const struct iovec* iovs, uint32_t count, int32_t offset)
+{
+    filesystem_node* node = file->node;
+
+    int32_t length = get_vector_length(iovs, count);
+    if (length <= 0)
+    {
+        return length;
+    }
+
+    if (offset != FS_OFFSET_CURRENT)
+    {
+        if (NULL == node->ops->lseek)
+        {
+            return -ESPIPE;
+        }
+
+        if (offset < 0)
+        {
+            return -EINVAL;
+        }
+    }
+
+    if (NULL == node->ops->writev)
+    {
+        return transfer_each(file, iovs, count, offset, TRUE);
+    }
+
+    if (node->node_type != FT_FILE)
+    {
+        return node->ops->writev(file, iovs, count, offset);
+    }
+
+    imagecache_invalidate(node);
+
+    int32_t start = offset;
+    if (FS_OFFSET_CURRENT == offset)
+    {
+        start = ((file->flags & O_APPEND) == O_APPEND) ? (int32_t)node->length : file->offset;
+    }
+
+    int32_t written = node->ops->writev(file, iovs, count, offset);
+
+    //Cached pages get what reached the file, buffer by buffer
+    for (uint32_t i = 0, done = 0; i < count && start >= 0 && written > 0 && done < (uint32_t)written; ++i)
+    {
+        uint32_t chunk = MIN(iovs[i].iov_len, (uint32_t)written - done);
+
+        if (chunk > 0)
+        {
+            pagecache_update(node, start + done, chunk, (uint8_t*)iovs[i].iov_base);
+        }
+
+        done += chunk;
+    }
+
+    return written;
+}
+
+int32_t fs_pread(File* file, uint32_t size, uint8_t* buffer, int32_t offset)
+{
+    struct iovec iov = {buffer, size};
+
+    return fs_readv(file, &iov, 1, offset);
+}
+
+int32_t fs_pwrite(File* file, uint32_t size, uint8_t* buffer, int32_t offset)
+{
+    struct iovec iov = {buffer, size};
+
+    return fs_writev(file, &iov, 1, offset);
+}
+
 File *fs_open(filesystem_node *node, uint32_t flags)
 {
     return fs_open_for_process(thread_get_current(), node, flags);
 }
 
 File *fs_open_for_process(Thread* thread, filesystem_node *node, uint32_t flags)
+{
+    return fs_open_for_process_at(thread, node, flags, -1);
+}
+
+//Opens the node into descriptor `fd` of the thread's process, or into the lowest free descriptor if `fd` is negative
+File *fs_open_for_process_at(Thread* thread, filesystem_node *node, uint32_t flags, int32_t fd)
 {
     Process* process = NULL;
     if (thread)
@@ -251,7 +551,7 @@ File *fs_open_for_process(Thread* thread, filesystem_node *node, uint32_t flags)
         node = node->mount_point;
     }
 
-    if (node->open != NULL)
+    if (node->ops->open != NULL)
     {
         File* file = kmalloc(sizeof(File));
         memset((uint8_t*)file, 0, sizeof(File));
@@ -259,20 +559,34 @@ File *fs_open_for_process(Thread* thread, filesystem_node *node, uint32_t flags)
         file->process = process;
         file->thread = thread;
         file->flags = flags;
+        file->reference_count = 1;
 
-        BOOL success = node->open(file, flags);
+        BOOL success = node->ops->open(file, flags);
 
         if (success)
         {
             //Screen_PrintF("Opened:%s\n", file->node->name);
-            int32_t fd = process_add_file(file->process, file);
+            if (fd < 0)
+            {
+                fd = process_add_file(file->process, file);
+            }
+            else
+            {
+                fd = process_add_file_at(file->process, file, fd);
+            }
+
+            //Descriptor in the opening process, other processes may get the File at another one (spawn's dup2)
+            file->fd = fd;
+
+            fs_acquire_node(node);
 
             if (fd < 0)
             {
                 //TODO: sett errno max files opened already
                 kprintf("Maxfiles opened already!!\n");
 
-                fs_close(file);
+                //Not installed anywhere, only the opening reference is left
+                fs_release_file(file);
                 file = NULL;
             }
         }
@@ -288,23 +602,132 @@ File *fs_open_for_process(Thread* thread, filesystem_node *node, uint32_t flags)
     return NULL;
 }
 
+//Removes the descriptor from the opening process, the driver closes the File once nothing else references it
 void fs_close(File *file)
 {
-    if (file->node->close != NULL)
+    if (file->process)
+    {
+        //A close() of the descriptor or the exit of the opener already dropped the descriptor's reference
+        if (!process_is_valid(file->process) || process_remove_file(file->process, file) < 0)
+        {
+            return;
+        }
+    }
+
+    fs_release_file(file);
+}
+
+//Closes descriptor `fd` of the process. The File may be installed at other descriptors too, the driver closes it with the last one.
+int32_t fs_close_descriptor(Process* process, int32_t fd)
+{
+    if (fd < 0 || fd >= ASTERISK_MAX_OPENED_FILES)
+    {
+        return -EBADF;
+    }
+
+    begin_critical_section();
+
+    File* file = process->fd[fd];
+    process->fd[fd] = NULL;
+
+    end_critical_section();
+
+    if (NULL == file)
+    {
+        return -EBADF;
+    }
+
+    fs_release_file(file);
+
+    return 0;
+}
+
+//Returns the File at descriptor `fd` with a reference, or NULL. Threads share the descriptors, the reference keeps the File alive
+//across a close from another thread. The caller drops it with fs_release_file.
+File* fs_get_file(Process* process, int32_t fd)
+{
+    if (fd < 0 || fd >= ASTERISK_MAX_OPENED_FILES)
+    {
+        return NULL;
+    }
+
+    begin_critical_section();
+
+    File* file = process->fd[fd];
+
+    if (file)
+    {
+        file->reference_count++;
+    }
+
+    end_critical_section();
+
+    return file;
+}
+
+//Keeps the File usable after its descriptor is closed, for work that runs beyond the system call
+void fs_acquire_file(File* file)
+{
+    begin_critical_section();
+
+    file->reference_count++;
+
+    end_critical_section();
+}
+
+void fs_release_file(File* file)
+{
+    begin_critical_section();
+
+    BOOL last = (--file->reference_count == 0);
+
+    end_critical_section();
+
+    if (!last)
     {
-        file->node->close(file);
+        return;
     }
 
-    process_remove_file(file->process, file);
+    //Released first so the driver sees whether this was the last reference, it may free the node in close
+    fs_release_node(file->node);
+
+    if (file->node->ops->close != NULL)
+    {
+        file->node->ops->close(file);
+    }
 
     kfree(file);
 }
 
+//References keep a node from being evicted by its filesystem while it is in use
+void fs_acquire_node(filesystem_node* node)
+{
+    if (node)
+    {
+        ++node->reference_count;
+    }
+}
+
+void fs_release_node(filesystem_node* node)
+{
+    if (node && node->reference_count > 0)
+    {
+        --node->reference_count;
+    }
+}
+
 int32_t fs_unlink(filesystem_node* node, uint32_t flags)
 {
-    if (node->unlink)
+    if (node->ops->unlink)
     {
-        return node->unlink(node, flags);
+        int32_t result = node->ops->unlink(node, flags);
+
+        if (result >= 0)
+        {
+            dcache_remove_node(node);
+        }
+
+        return result;
     }
 
     return -1;
@@ -312,9 +735,9 @@ int32_t fs_unlink(filesystem_node* node, uint32_t flags)
 
 int32_t fs_ioctl(File *file, int32_t request, void * argp)
 {
-    if (file->node->ioctl != NULL)
+    if (file->node->ops->ioctl != NULL)
     {
-        return file->node->ioctl(file, request, argp);
+        return file->node->ops->ioctl(file, request, argp);
     }
 
     return 0;
@@ -322,9 +745,9 @@ int32_t fs_ioctl(File *file, int32_t request, void * argp)
 
 int32_t fs_lseek(File *file, int32_t offset, int32_t whence)
 {
-    if (file->node->lseek != NULL)
+    if (file->node->ops->lseek != NULL)
     {
-        return file->node->lseek(file, offset, whence);
+        return file->node->ops->lseek(file, offset, whence);
     }
 
     return 0;
@@ -332,14 +755,36 @@ int32_t fs_lseek(File *file, int32_t offset, int32_t whence)
 
 int32_t fs_ftruncate(File* file, int32_t length)
 {
-    if (file->node->ftruncate != NULL)
+    if (file->node->ops->ftruncate != NULL)
     {
-        return file->node->ftruncate(file, length);
+        if (file->node->node_type == FT_FILE)
+        {
+            imagecache_invalidate(file->node);
+            pagecache_invalidate(file->node);
+        }
+
+        return file->node->ops->ftruncate(file, length);
     }
 
     return -1;
 }
 
+int32_t fs_fsync(File* file, BOOL data_only)
+{
+    if (file->node->ops->fsync != NULL)
+    {
+        return file->node->ops->fsync(file, data_only);
+    }
+
+    //Nothing is kept for a device below these
+    if (file->node->node_type == FT_FILE || (file->node->node_type & FT_DIRECTORY) == FT_DIRECTORY)
+    {
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
 int32_t fs_stat(filesystem_node *node, struct stat *buf)
 {
 #define	__S_IFDIR	0040000	/* Directory.  */
@@ -350,9 +795,9 @@ int32_t fs_stat(filesystem_node *node, struct stat *buf)
 #define	__S_IFLNK	0120000	/* Symbolic link.  */
 #define	__S_IFSOCK	0140000	/* Socket.  */
 
-    if (node->stat != NULL)
+    if (node->ops->stat != NULL)
     {
-        int32_t val = node->stat(node, buf);
+        int32_t val = node->ops->stat(node, buf);
 
         if (val == 1)
         {
@@ -402,68 +847,133 @@ filesystem_dirent *fs_readdir(filesystem_node *node, uint32_t index)
 
     if ( (node->node_type & FT_MOUNT_POINT) == FT_MOUNT_POINT && node->mount_point != NULL )
     {
-        if (NULL == node->mount_point->readdir)
+        if (NULL == node->mount_point->ops->readdir)
         {
             WARNING("mounted fs does not have readdir!\n");
         }
         else
         {
-            return node->mount_point->readdir(node->mount_point, index);
+            return node->mount_point->ops->readdir(node->mount_point, index);
         }
     }
-    else if ( (node->node_type & FT_DIRECTORY) == FT_DIRECTORY && node->readdir != NULL )
+    else if ( (node->node_type & FT_DIRECTORY) == FT_DIRECTORY && node->ops->readdir != NULL )
     {
-        return node->readdir(node, index);
+        return node->ops->readdir(node, index);
     }
 
     return NULL;
 }
 
+//Reads up to `count` entries starting at entry `index` of the opened directory. Returns the number of entries read, 0 at the end.
+int32_t fs_getdents(File* file, uint32_t index, filesystem_dirent* entries, uint32_t count)
+{
+    filesystem_node* node = file->node;
+
+    if ( (node->node_type & FT_DIRECTORY) != FT_DIRECTORY && (node->node_type & FT_MOUNT_POINT) != FT_MOUNT_POINT )
+    {
+        return -1;
+    }
+
+    if (node->ops->getdents != NULL)
+    {
+        return node->ops->getdents(file, index, entries, count);
+    }
+
+    uint32_t result = 0;
+
+    while (result < count)
+    {
+        filesystem_dirent* dirent = fs_readdir(node, index + result);
+
+        if (NULL == dirent)
+        {
+            break;
+        }
+
+        memcpy((uint8_t*)&entries[result], (uint8_t*)dirent, sizeof(filesystem_dirent));
+
+        ++result;
+    }
+
+    return result;
+}
+
 filesystem_node *fs_finddir(filesystem_node *node, char *name)
 {
     //Screen_PrintF("fs_finddir: name:%s\n", name);
 
+    filesystem_node* directory = node;
+
     if ( (node->node_type & FT_MOUNT_POINT) == FT_MOUNT_POINT && node->mount_point != NULL )
     {
-        if (NULL == node->mount_point->finddir)
+        directory = node->mount_point;
+
+        if (NULL == directory->ops->finddir)
         {
             WARNING("mounted fs does not have finddir!\n");
-        }
-        else
-        {
-            return node->mount_point->finddir(node->mount_point, name);
+
+            return NULL;
         }
     }
-    else if ( (node->node_type & FT_DIRECTORY) == FT_DIRECTORY && node->finddir != NULL )
+    else if ( (node->node_type & FT_DIRECTORY) != FT_DIRECTORY || node->ops->finddir == NULL )
     {
-        return node->finddir(node, name);
+        return NULL;
     }
 
-    return NULL;
+    filesystem_node* cached = NULL;
+    if (dcache_lookup(directory, name, strlen(name), &cached))
+    {
+        return cached;
+    }
+
+    return directory->ops->finddir(directory, name);
 }
 
 BOOL fs_mkdir(filesystem_node *node, const char *name, uint32_t flags)
 {
     if ( (node->node_type & FT_MOUNT_POINT) == FT_MOUNT_POINT && node->mount_point != NULL )
     {
-        if (node->mount_point->mkdir)
+        if (node->mount_point->ops->mkdir)
         {
-            return node->mount_point->mkdir(node->mount_point, name, flags);
+            //a negative entry may exist for the name
+            dcache_remove(node->mount_point, name);
+
+            return node->mount_point->ops->mkdir(node->mount_point, name, flags);
         }
     }
-    else if ( (node->node_type & FT_DIRECTORY) == FT_DIRECTORY && node->mkdir != NULL )
+    else if ( (node->node_type & FT_DIRECTORY) == FT_DIRECTORY && node->ops->mkdir != NULL )
     {
-        return node->mkdir(node, name, flags);
+        dcache_remove(node, name);
+
+        return node->ops->mkdir(node, name, flags);
     }
 
     return FALSE;
 }
 
-void* fs_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags)
+filesystem_node* fs_create(filesystem_node *node, const char* name, uint32_t flags)
+{
+    if ( (node->node_type & FT_MOUNT_POINT) == FT_MOUNT_POINT && node->mount_point != NULL )
+    {
+        node = node->mount_point;
+    }
+
+    if ( (node->node_type & FT_DIRECTORY) == FT_DIRECTORY && node->ops->create != NULL )
+    {
+        //a negative entry may exist for the name
+        dcache_remove(node, name);
+
+        return node->ops->create(node, name, flags);
+    }
+
+    return NULL;
+}
+
+void* fs_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags, uint32_t protection)
 {
-    if (file->node->mmap)
+    if (file->node->ops->mmap)
     {
-        return file->node->mmap(file, size, offset, flags);
+        return file->node->ops->mmap(file, size, offset, flags, protection);
     }
 
     return NULL;
@@ -471,98 +981,134 @@ void* fs_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags)
 
 BOOL fs_munmap(File* file, void* address, uint32_t size)
 {
-    if (file->node->munmap)
+    if (file->node->ops->munmap)
     {
-        return file->node->munmap(file, address, size);
+        return file->node->ops->munmap(file, address, size);
     }
 
     return FALSE;
 }
 
-filesystem_node *fs_get_node(const char *path)
+//Returns FALSE if the path has "." or ".." components or successive slashes, such paths need fs_resolve_path
+static BOOL is_path_resolved(const char* path)
 {
-    //Screen_PrintF("fs_get_node:%s *0\n", path);
+    const char* component = path;
 
-    if (path[0] != '/')
+    while (*component != '\0')
     {
-        //We require absolute path!
-        return NULL;
+        //component points to a slash
+        const char* name = component + 1;
+
+        if (*name == '/')
+        {
+            return FALSE;
+        }
+
+        if (name[0] == '.' && (name[1] == '/' || name[1] == '\0'))
+        {
+            return FALSE;
+        }
+
+        if (name[0] == '.' && name[1] == '.' && (name[2] == '/' || name[2] == '\0'))
+        {
+            return FALSE;
+        }
+
+        component = name;
+        while (*component != '\0' && *component != '/')
+        {
+            ++component;
+        }
     }
 
+    return TRUE;
+}
 
-    char real_path[256];
+//Looks the component up in the dentry cache before going through fs_finddir, which needs a terminated name
+static filesystem_node* find_child(filesystem_node* node, const char* name, uint32_t name_length)
+{
+    filesystem_node* directory = node;
 
-    BOOL resolved = fs_resolve_path(path, real_path, 256);
+    if ( (node->node_type & FT_MOUNT_POINT) == FT_MOUNT_POINT && node->mount_point != NULL )
+    {
+        directory = node->mount_point;
+    }
 
-    if (FALSE == resolved)
+    filesystem_node* cached = NULL;
+    if (dcache_lookup(directory, name, name_length, &cached))
     {
-        return NULL;
+        return cached;
     }
 
-    const char* input_path = real_path;
-    int path_length = strlen(input_path);
+    char buffer[128];
 
-    if (path_length < 1)
+    if (name_length >= sizeof(buffer))
     {
         return NULL;
     }
 
+    strncpy(buffer, name, name_length);
+    buffer[name_length] = '\0';
 
+    return fs_finddir(node, buffer);
+}
 
-    //Screen_PrintF("fs_get_node:%s *1\n", path);
-
-    filesystem_node* root = fs_get_root_node();
+filesystem_node *fs_get_node(const char *path)
+{
+    //Screen_PrintF("fs_get_node:%s *0\n", path);
 
-    if (path_length == 1)
+    if (path[0] != '/')
     {
-        return root;
+        //We require absolute path!
+        return NULL;
     }
 
-    int next_index = 0;
+    char real_path[256];
 
-    filesystem_node* node = root;
+    //Paths that are already resolved are walked in place, mostly through the dentry cache
+    if (FALSE == is_path_resolved(path))
+    {
+        BOOL resolved = fs_resolve_path(path, real_path, 256);
 
-    //Screen_PrintF("fs_get_node:%s *2\n", path);
+        if (FALSE == resolved)
+        {
+            return NULL;
+        }
 
-    char buffer[64];
+        path = real_path;
+    }
 
-    do
-    {
-        do_start:
-        input_path = input_path + next_index + 1;
-        next_index = str_first_index_of(input_path, '/');
+    filesystem_node* node = fs_get_root_node();
 
-        if (next_index == 0)
+    const char* component = path;
+
+    while (TRUE)
+    {
+        while (*component == '/')
         {
-            //detected successive slash
-            goto do_start;
+            ++component;
         }
 
-        if (next_index > 0)
+        if (*component == '\0')
         {
-            int token_size = next_index;
-
-            strncpy(buffer, input_path, token_size);
-            buffer[token_size] = '\0';
+            break;
         }
-        else
+
+        uint32_t length = 0;
+        while (component[length] != '\0' && component[length] != '/')
         {
-            //Last part
-            strcpy(buffer, input_path);
+            ++length;
         }
 
-        //Screen_PrintF("fs_get_node:%s *3\n", path);
-
-        node = fs_finddir(node, buffer);
-
-        //Screen_PrintF("fs_get_node:%s *4\n", path);
+        node = find_child(node, component, length);
 
         if (NULL == node)
         {
             return NULL;
         }
 
-    } while (next_index > 0);
+        component += length;
+    }
 
     return node;
 }
@@ -638,6 +1184,17 @@ BOOL fs_register(FileSystem* fs)
     return TRUE;
 }
 
+void fs_sync()
+{
+    for (int i = 0; i < g_next_filesystem_index; ++i)
+    {
+        if (g_registered_filesystems[i].sync)
+        {
+            g_registered_filesystems[i].sync();
+        }
+    }
+}
+
 BOOL fs_mount(const char *source, const char *target, const char *fsType, uint32_t flags, void *data)
 {
     FileSystem* fs = NULL;
@@ -656,7 +1213,15 @@ BOOL fs_mount(const char *source, const char *target, const char *fsType, uint32
         return FALSE;
     }
 
-    return fs->mount(source, target, flags, data);
+    BOOL result = fs->mount(source, target, flags, data);
+
+    if (result)
+    {
+        //The mounted filesystem hides what was under the target
+        dcache_clear();
+    }
+
+    return result;
 }
 
 BOOL fs_check_mount(const char *source, const char *target, const char *fsType, uint32_t flags, void *data)
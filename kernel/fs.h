@@ -39,8 +39,13 @@
 #define O_RDONLY    00
 #define O_WRONLY    01
 #define O_RDWR      02
+#define O_APPEND    0x0008
+#define O_CREAT     0x0200
+#define O_TRUNC     0x0400
 #define CHECK_ACCESS(flags, test) ((flags & O_ACCMODE) == test)
 
+#define FS_OFFSET_CURRENT -1 //vector functions use and advance the file position instead of an offset
+
 typedef enum FileType
 {
     FT_FILE               = 1,
@@ -57,6 +62,7 @@ typedef enum IoctlCommand
 {
     IC_GET_SECTOR_SIZE_BYTES,
     IC_GET_SECTOR_COUNT,
+    IC_SET_SECTOR_COUNT,
 } IoctlCommand;
 
 typedef struct FileSystem FileSystem;
@@ -65,47 +71,63 @@ typedef struct filesystem_dirent filesystem_dirent;
 typedef struct Process Process;
 typedef struct Thread Thread;
 typedef struct File File;
+typedef struct PageCache PageCache;
 
 struct stat;
 
+struct iovec {
+               void  *iov_base;    /* Starting address */
+               size_t iov_len;     /* Number of bytes to transfer */
+           };
+
+#define IOV_MAX 1024 //most buffers a vectored transfer takes
+
 typedef int32_t (*ReadWriteFunction)(File* file, uint32_t size, uint8_t* buffer);
+typedef int32_t (*ReadWriteVectorFunction)(File* file, const struct iovec* iovs, uint32_t count, int32_t offset);
 typedef BOOL (*ReadWriteTestFunction)(File* file);
+typedef int32_t (*ReadPagesFunction)(File* file, uint32_t offset, uint32_t count, uint8_t* buffer);
 typedef int32_t (*ReadWriteBlockFunction)(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer);
+typedef int32_t (*WriteBlockOwnedFunction)(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer, void* owner);
+typedef int32_t (*FlushBlocksFunction)(filesystem_node* node);
 typedef BOOL (*OpenFunction)(File* file, uint32_t flags);
 typedef void (*CloseFunction)(File* file);
 typedef int32_t (*UnlinkFunction)(filesystem_node* node, uint32_t flags);
 typedef int32_t (*IoctlFunction)(File *file, int32_t request, void * argp);
 typedef int32_t (*LseekFunction)(File *file, int32_t offset, int32_t whence);
 typedef int32_t (*FtruncateFunction)(File *file, int32_t length);
+typedef int32_t (*FsyncFunction)(File *file, BOOL data_only);
 typedef int32_t (*StatFunction)(filesystem_node *node, struct stat *buf);
 typedef filesystem_dirent * (*ReadDirFunction)(filesystem_node*,uint32_t);
+typedef int32_t (*GetDentsFunction)(File* file, uint32_t index, filesystem_dirent* entries, uint32_t count);
 typedef filesystem_node * (*FindDirFunction)(filesystem_node*,char *name);
 typedef BOOL (*MkDirFunction)(filesystem_node* node, const char *name, uint32_t flags);
-typedef void* (*MmapFunction)(File* file, uint32_t size, uint32_t offset, uint32_t flags);
+typedef filesystem_node* (*CreateFunction)(filesystem_node* node, const char *name, uint32_t flags);
+typedef void* (*MmapFunction)(File* file, uint32_t size, uint32_t offset, uint32_t flags, uint32_t protection);//flags and protection as given to mmap (MAP_*, PROT_*)
 typedef BOOL (*MunmapFunction)(File* file, void* address, uint32_t size);
 
 typedef BOOL (*MountFunction)(const char* source_path, const char* target_path, uint32_t flags, void *data);
+typedef void (*SyncFunction)();
 
 typedef struct FileSystem
 {
     char name[32];
     MountFunction check_mount;
     MountFunction mount;
+    SyncFunction sync;//writes what the file system keeps in memory to its devices, optional
 } FileSystem;
 
-typedef struct filesystem_node
+//Shared by every node of a filesystem or driver, members left NULL are not supported
+typedef struct filesystem_ops
 {
-    char name[128];
-    uint32_t mask;
-    uint32_t user_id;
-    uint32_t group_id;
-    uint32_t node_type;
-    uint32_t inode;
-    uint32_t length;
     ReadWriteBlockFunction read_block;
     ReadWriteBlockFunction write_block;
+    WriteBlockOwnedFunction write_block_owned;//optional, write_block telling the block cache which file the blocks belong to
+    FlushBlocksFunction flush_blocks;//optional, makes the device put the blocks written so far on the media (e.g. its write cache)
     ReadWriteFunction read;
     ReadWriteFunction write;
+    ReadWriteVectorFunction readv;//optional, transfers all buffers in one call, at the offset without touching file->offset
+    ReadWriteVectorFunction writev;//optional, same for writes
+    ReadPagesFunction read_pages;//reads count 4K pages starting at the offset, regular files having this are read through the page cache
     ReadWriteTestFunction read_test_ready;
     ReadWriteTestFunction write_test_ready;
     OpenFunction open;
@@ -114,18 +136,35 @@ typedef struct filesystem_node
     IoctlFunction ioctl;
     LseekFunction lseek;
     FtruncateFunction ftruncate;
+    FsyncFunction fsync;//writes the file's dirty data (and its metadata unless data_only) to the device
     StatFunction stat;
     ReadDirFunction readdir;
+    GetDentsFunction getdents;//reads a batch of entries using a cursor kept in the File, optional
     FindDirFunction finddir;
     MkDirFunction mkdir;
+    CreateFunction create;//creates a regular file in the directory
     MmapFunction mmap;
     MunmapFunction munmap;
+} filesystem_ops;
+
+typedef struct filesystem_node
+{
+    char* name;//stored right after the node, see fs_create_node
+    uint32_t mask;
+    uint32_t user_id;
+    uint32_t group_id;
+    uint32_t node_type;
+    uint32_t inode;
+    uint32_t length;
+    const filesystem_ops* ops;
     filesystem_node *first_child;
     filesystem_node *next_sibling;
     filesystem_node *parent;
     filesystem_node *mount_point;//only used in mounts
     filesystem_node *mount_source;//only used in mounts
     void* private_node_data;
+    PageCache* page_cache;
+    uint32_t reference_count;//open Files and working directories, filesystems may evict nodes without references
 } filesystem_node;
 
 typedef struct filesystem_dirent
@@ -139,12 +178,15 @@ typedef struct filesystem_dirent
 typedef struct File
 {
     filesystem_node* node;
-    Process* process;
+    Process* process; //the opener, spawn's dup2 shares the File with other processes so drivers use the calling thread
     Thread* thread;
-    int32_t fd;
+    int32_t fd; //descriptor in the opener
     uint32_t flags;
     int32_t offset;
     void* private_data;
+    uint32_t readahead_next_page;//page index a sequential read would continue from
+    uint32_t readahead_window;//page count, grows on sequential reads
+    uint32_t reference_count;//the descriptor plus users that must outlive a close, see fs_acquire_file
 } File;
 
 struct stat
@@ -170,20 +212,36 @@ struct stat
 };
 
 
+filesystem_node* fs_create_node(const char* name, const filesystem_ops* ops);
 uint32_t fs_read(File* file, uint32_t size, uint8_t* buffer);
 uint32_t fs_write(File* file, uint32_t size, uint8_t* buffer);
+int32_t fs_pread(File* file, uint32_t size, uint8_t* buffer, int32_t offset);
+int32_t fs_pwrite(File* file, uint32_t size, uint8_t* buffer, int32_t offset);
+int32_t fs_readv(File* file, const struct iovec* iovs, uint32_t count, int32_t offset);
+int32_t fs_writev(File* file, const struct iovec* iovs, uint32_t count, int32_t offset);
 File* fs_open(filesystem_node* node, uint32_t flags);
 File* fs_open_for_process(Thread* thread, filesystem_node* node, uint32_t flags);
+File* fs_open_for_process_at(Thread* thread, filesystem_node* node, uint32_t flags, int32_t fd);
 void fs_close(File* file);
+int32_t fs_close_descriptor(Process* process, int32_t fd);
+File* fs_get_file(Process* process, int32_t fd);
+void fs_acquire_file(File* file);
+void fs_release_file(File* file);
+void fs_acquire_node(filesystem_node* node);
+void fs_release_node(filesystem_node* node);
 int32_t fs_unlink(filesystem_node* node, uint32_t flags);
 int32_t fs_ioctl(File* file, int32_t request, void* argp);
 int32_t fs_lseek(File* file, int32_t offset, int32_t whence);
 int32_t fs_ftruncate(File* file, int32_t length);
+int32_t fs_fsync(File* file, BOOL data_only);
+void fs_sync();
 int32_t fs_stat(filesystem_node *node, struct stat *buf);
 filesystem_dirent* fs_readdir(filesystem_node* node, uint32_t index);
+int32_t fs_getdents(File* file, uint32_t index, filesystem_dirent* entries, uint32_t count);
 filesystem_node* fs_finddir(filesystem_node* node, char* name);
 BOOL fs_mkdir(filesystem_node *node, const char* name, uint32_t flags);
-void* fs_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags);
+filesystem_node* fs_create(filesystem_node *node, const char* name, uint32_t flags);
+void* fs_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags, uint32_t protection);
 BOOL fs_munmap(File* file, void* address, uint32_t size);
 int fs_get_node_path(filesystem_node* node, char* buffer, uint32_t buffer_size);
 BOOL fs_resolve_path(const char* path, char* buffer, int buffer_size);
@@ -0,0 +1,267 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include "futex.h"
+#include "list.h"
+#include "alloc.h"
+#include "vmm.h"
+#include "timer.h"
+#include "errno.h"
+
+/*
+ *  Futex waiters are kept in hashed buckets keyed by the physical address of the futex word, so processes that map the same shared memory page at different
+ *  virtual addresses still meet in the same bucket. Everything here runs with interrupts disabled (system calls and the scheduler), which is what protects the
+ *  buckets on this uniprocessor kernel.
+ */
+
+#define FUTEX_BUCKET_COUNT 64
+
+#define FUTEX_BUCKET(key) g_futex_buckets[((key) >> 2) % FUTEX_BUCKET_COUNT]
+
+typedef struct FutexWaiter
+{
+    Thread* thread;
+    uint32_t key;
+    uint64_t target_time;
+    BOOL woken;
+} FutexWaiter;
+
+static List* g_futex_buckets[FUTEX_BUCKET_COUNT];
+
+void futex_initialize()
+{
+    for (int i = 0; i < FUTEX_BUCKET_COUNT; ++i)
+    {
+        g_futex_buckets[i] = list_create();
+    }
+}
+
+//Demand-paged words (file mappings, the growing stack) are brought in first, they have no physical address before
+static uint32_t get_key(uint32_t* address)
+{
+    if (!vmm_fault_in(thread_get_current()->owner, (uint32_t)address))
+    {
+        return 0;
+    }
+
+    return vmm_get_physical_address((uint32_t)address);
+}
+
+//Must be called in the page directory of the process owning `thread`
+int32_t futex_wait(Thread* thread, uint32_t* address, uint32_t value, int32_t timeout_ms)
+{
+    uint32_t key = get_key(address);
+
+    if (0 == key)
+    {
+        return -EFAULT;
+    }
+
+    if (*address != value)
+    {
+        return -EAGAIN;
+    }
+
+    FutexWaiter waiter;
+    waiter.thread = thread;
+    waiter.key = key;
+    waiter.target_time = 0;
+    waiter.woken = FALSE;
+
+    if (timeout_ms >= 0)
+    {
+        //never zero, zero means no timeout
+        waiter.target_time = get_uptime_milliseconds64() + timeout_ms + 1;
+    }
+
+    List* bucket = FUTEX_BUCKET(key);
+
+    list_append(bucket, &waiter);
+
+    thread_change_state(thread, TS_FUTEX, &waiter);
+
+    while (thread->state == TS_FUTEX)
+    {
+        enable_interrupts();
+
+        halt();
+    }
+
+    disable_interrupts();
+
+    if (waiter.woken)
+    {
+        return 0;
+    }
+
+    //Still queued if a signal got us out. Requeue may have moved us to another bucket.
+    list_remove_first_occurrence(FUTEX_BUCKET(waiter.key), &waiter);
+
+    if (waiter.target_time != 0 && get_uptime_milliseconds64() >= waiter.target_time)
+    {
+        return -ETIMEDOUT;
+    }
+
+    return -EINTR;
+}
+
+static void wake_waiter(List* bucket, ListNode* node)
+{
+    FutexWaiter* waiter = (FutexWaiter*)node->data;
+
+    list_remove_node(bucket, node);
+
+    waiter->woken = TRUE;
+
+    thread_resume(waiter->thread);
+}
+
+int32_t futex_wake(uint32_t* address, uint32_t count)
+{
+    uint32_t key = get_key(address);
+
+    if (0 == key)
+    {
+        return -EFAULT;
+    }
+
+    List* bucket = FUTEX_BUCKET(key);
+
+    int32_t woken_count = 0;
+
+    ListNode* node = bucket->head;
+    while (NULL != node && (uint32_t)woken_count < count)
+    {
+        ListNode* next = node->next;
+
+        FutexWaiter* waiter = (FutexWaiter*)node->data;
+
+        if (waiter->key == key)
+        {
+            wake_waiter(bucket, node);
+
+            woken_count++;
+        }
+
+        node = next;
+    }
+
+    return woken_count;
+}
+
+/*
+ *  Wakes up to `wake_count` waiters of `address` and moves up to `requeue_count` of the rest to `address2` without waking them, so that waking all waiters
+ *  of a condition variable doesn't make them all race for the mutex. Returns the number of waiters woken plus requeued.
+ */
+int32_t futex_requeue(uint32_t* address, uint32_t wake_count, uint32_t requeue_count, uint32_t* address2)
+{
+    uint32_t key = get_key(address);
+    uint32_t key2 = get_key(address2);
+
+    if (0 == key || 0 == key2)
+    {
+        return -EFAULT;
+    }
+
+    List* bucket = FUTEX_BUCKET(key);
+    List* bucket2 = FUTEX_BUCKET(key2);
+
+    uint32_t woken_count = 0;
+    uint32_t requeued_count = 0;
+
+    ListNode* node = bucket->head;
+    while (NULL != node && (woken_count < wake_count || requeued_count < requeue_count))
+    {
+        ListNode* next = node->next;
+
+        FutexWaiter* waiter = (FutexWaiter*)node->data;
+
+        if (waiter->key == key)
+        {
+            if (woken_count < wake_count)
+            {
+                wake_waiter(bucket, node);
+
+                woken_count++;
+            }
+            else if (key != key2)
+            {
+                list_remove_node(bucket, node);
+
+                waiter->key = key2;
+
+                //When both keys share a bucket, the waiter is appended behind us and skipped due to its new key
+                list_append(bucket2, waiter);
+
+                requeued_count++;
+            }
+            else
+            {
+                requeued_count++;
+            }
+        }
+
+        node = next;
+    }
+
+    return woken_count + requeued_count;
+}
+
+//Called by the scheduler for threads in TS_FUTEX state to handle timeouts
+void futex_update(Thread* thread)
+{
+    FutexWaiter* waiter = (FutexWaiter*)thread->state_privateData;
+
+    if (waiter && waiter->target_time != 0 && get_uptime_milliseconds64() >= waiter->target_time)
+    {
+        list_remove_first_occurrence(FUTEX_BUCKET(waiter->key), waiter);
+
+        thread_resume(thread);
+    }
+}
+
+//Removes a waiting thread from its bucket, used when the thread is destroyed while waiting
+void futex_cancel(Thread* thread)
+{
+    if (thread->state == TS_FUTEX)
+    {
+        FutexWaiter* waiter = (FutexWaiter*)thread->state_privateData;
+
+        if (waiter)
+        {
+            list_remove_first_occurrence(FUTEX_BUCKET(waiter->key), waiter);
+        }
+
+        thread_resume(thread);
+    }
+}
@@ -0,0 +1,290 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include "imagecache.h"
+#include "alloc.h"
+#include "list.h"
+#include "vmm.h"
+#include "elf.h"
+#include "process.h"
+
+/*
+ *  The image cache keeps the read-only segments of running executables in physical memory, so that processes started from the same file
+ *  map the same page frames for their code instead of each getting a private copy. Images are keyed by filesystem node and reference
+ *  counted by the processes using them. The frames are released when the last of those processes is destroyed.
+ *  The frames are filled from the ELF data when the image is created, through the temporary map window. They are mapped read-only
+ *  and CR0.WP is set, so not even a system call writing to a user buffer there can change the text other processes run.
+ */
+
+typedef struct ImageSegment
+{
+    uint32_t v_address;
+    uint32_t page_count;
+    uint32_t* physical_pages;
+} ImageSegment;
+
+struct ExecutableImage
+{
+    filesystem_node* node;
+    uint32_t length;
+    uint32_t reference_count;
+    BOOL detached;
+    List* segments;
+};
+
+static List* g_image_list = NULL;
+
+static void imagecache_destroy(ExecutableImage* image)
+{
+    list_foreach (n, image->segments)
+    {
+        ImageSegment* segment = (ImageSegment*)n->data;
+
+        for (uint32_t i = 0; i < segment->page_count; ++i)
+        {
+            vmm_release_page_frame_4k(segment->physical_pages[i]);
+        }
+
+        kfree(segment->physical_pages);
+        kfree(segment);
+    }
+
+    list_destroy(image->segments);
+
+    kfree(image);
+}
+
+//Copies the file part of the segment to its frames and zeroes the rest, frames may contain data of a previous owner
+static BOOL fill_segment(ImageSegment* segment, const char* elf_data, Elf32_Phdr* p_entry)
+{
+    for (uint32_t i = 0; i < segment->page_count; ++i)
+    {
+        uint8_t* data = (uint8_t*)vmm_map_temporary(segment->physical_pages[i]);
+        if (NULL == data)
+        {
+            return FALSE;
+        }
+
+        memset(data, 0, PAGESIZE_4K);
+
+        uint32_t offset = i * PAGESIZE_4K;
+        if (offset < p_entry->p_filesz)
+        {
+            memcpy(data, (uint8_t*)elf_data + p_entry->p_offset + offset, MIN(PAGESIZE_4K, p_entry->p_filesz - offset));
+        }
+
+        vmm_unmap_temporary(data);
+    }
+
+    return TRUE;
+}
+
+static ExecutableImage* imagecache_create(filesystem_node* node, const char* elf_data)
+{
+    ExecutableImage* image = (ExecutableImage*)kmalloc(sizeof(ExecutableImage));
+    memset((uint8_t*)image, 0, sizeof(ExecutableImage));
+    image->node = node;
+    image->length = node->length;
+    image->segments = list_create();
+
+    Elf32_Ehdr *hdr = (Elf32_Ehdr *) elf_data;
+    Elf32_Phdr *p_entry = (Elf32_Phdr *) (elf_data + hdr->e_phoff);
+
+    for (int pe = 0; pe < hdr->e_phnum; pe++, p_entry++)
+    {
+        if (elf_is_segment_shareable(elf_data, p_entry))
+        {
+            uint32_t page_count = PAGE_COUNT(p_entry->p_memsz);
+
+            if ((uint32_t)page_count + 1 > vmm_get_free_page_count())
+            {
+                //All shareable segments must be cached or none, as elf_load skips all of them for a populated image.
+                imagecache_destroy(image);
+
+                return NULL;
+            }
+
+            ImageSegment* segment = (ImageSegment*)kmalloc(sizeof(ImageSegment));
+            segment->v_address = p_entry->p_vaddr;
+            segment->page_count = page_count;
+            segment->physical_pages = (uint32_t*)kmalloc(page_count * sizeof(uint32_t));
+
+            for (uint32_t i = 0; i < page_count; ++i)
+            {
+                segment->physical_pages[i] = vmm_acquire_page_frame_4k();
+            }
+
+            list_append(image->segments, segment);
+
+            if (!fill_segment(segment, elf_data, p_entry))
+            {
+                imagecache_destroy(image);
+
+                return NULL;
+            }
+        }
+    }
+
+    return image;
+}
+
+static void imagecache_detach(ExecutableImage* image)
+{
+    list_remove_first_occurrence(g_image_list, image);
+
+    image->detached = TRUE;
+}
+
+ExecutableImage* imagecache_acquire(filesystem_node* node, const char* elf_data)
+{
+    if (NULL == node || FALSE == elf_is_valid(elf_data))
+    {
+        return NULL;
+    }
+
+    begin_critical_section();
+
+    if (NULL == g_image_list)
+    {
+        g_image_list = list_create();
+    }
+
+    ExecutableImage* image = NULL;
+
+    list_foreach (n, g_image_list)
+    {
+        ExecutableImage* i = (ExecutableImage*)n->data;
+
+        if (i->node == node)
+        {
+            image = i;
+            break;
+        }
+    }
+
+    if (image && image->length != node->length)
+    {
+        //The file changed under us. Running processes keep the old pages.
+        imagecache_detach(image);
+        image = NULL;
+    }
+
+    if (NULL == image)
+    {
+        image = imagecache_create(node, elf_data);
+
+        if (image)
+        {
+            list_append(g_image_list, image);
+        }
+    }
+
+    if (image)
+    {
+        ++image->reference_count;
+    }
+
+    end_critical_section();
+
+    return image;
+}
+
+void imagecache_release(ExecutableImage* image)
+{
+    if (NULL == image)
+    {
+        return;
+    }
+
+    begin_critical_section();
+
+    if (image->reference_count > 0)
+    {
+        --image->reference_count;
+    }
+
+    if (image->reference_count == 0)
+    {
+        if (FALSE == image->detached)
+        {
+            list_remove_first_occurrence(g_image_list, image);
+        }
+
+        imagecache_destroy(image);
+    }
+
+    end_critical_section();
+}
+
+//Called when the contents of node change, so that the next execution loads fresh pages.
+void imagecache_invalidate(filesystem_node* node)
+{
+    if (NULL == g_image_list)
+    {
+        return;
+    }
+
+    begin_critical_section();
+
+    list_foreach (n, g_image_list)
+    {
+        ExecutableImage* image = (ExecutableImage*)n->data;
+
+        if (image->node == node)
+        {
+            imagecache_detach(image);
+            break;
+        }
+    }
+
+    end_critical_section();
+}
+
+//This function must be called within the page directory of process. The shared pages already hold the segment data.
+void imagecache_map(ExecutableImage* image, Process* process)
+{
+    list_foreach (n, image->segments)
+    {
+        ImageSegment* segment = (ImageSegment*)n->data;
+
+        uint32_t v = segment->v_address;
+        for (uint32_t i = 0; i < segment->page_count; ++i)
+        {
+            vmm_add_page_to_pd((char*)v, segment->physical_pages[i], PG_USER | PG_READONLY);
+
+            SET_PAGEFRAME_USED(process->mmapped_virtual_memory, PAGE_INDEX_4K(v));
+
+            v += PAGESIZE_4K;
+        }
+    }
+}
@@ -0,0 +1,763 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+ 
+#include "ioring.h"
+#include "alloc.h"
+#include "errno.h"
+#include "list.h"
+#include "process.h"
+#include "socket.h"
+#include "syscall_select.h"
+#include "vmm.h"
+
+/*
+ *  Asynchronous I/O through submission and completion queues in memory shared with the process (see IoRingHeader).
+ *  io_ring_enter takes submissions into a kernel list, worker threads of the process run them in kernel mode through the usual fs_read, fs_write and
+ *  socket paths and post the results to the completion queue. No more requests are taken than the completion queue has room for, so it never overflows.
+ *  Heads and tails the kernel advances and the queue sizes are kept in the IoRing as well, the process can't make the kernel read or write outside the queues.
+ *  The ring holds its frames and reaches them through a kernel mapping, so unmapping them from the process doesn't pull them from under a worker.
+ *  Each taken request holds a reference to its File, a close of the descriptor meanwhile leaves the File to the worker until it completes.
+ *  The ring is a descriptor, closing it lets the workers exit once they finish what they run. Workers go away with the process anyway, but only
+ *  at a safe point: a request runs with kill deferred, so a destroyed process waits for the fs and driver calls to return and doesn't strand
+ *  their locks and waiters. Waiting for a request or for a descriptor to be ready holds nothing and stays killable.
+ *  The IoRing is freed when it is closed and no worker or waiting thread uses it any more.
+ */
+
+#define IORING_MAX_PAGES PAGE_COUNT(sizeof(IoRingHeader) + IORING_MAX_ENTRIES * (sizeof(IoRingSubmission) + 2 * sizeof(IoRingCompletion)))
+
+typedef struct IoRingRequest
+{
+    IoRingSubmission submission;
+    File* file; //referenced, NULL for a nop
+    struct IoRingRequest* next;
+} IoRingRequest;
+
+typedef struct IoRing
+{
+    Process* process;
+    filesystem_node* node;
+    IoRingHeader* header; //kernel mapping of the shared pages
+    uint32_t user_address; //where the process sees them
+    uint32_t frames[IORING_MAX_PAGES];
+    uint32_t page_count;
+    IoRingSubmission* submissions;
+    IoRingCompletion* completions;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_head;
+    uint32_t cq_tail;
+    uint32_t in_flight; //taken but not completed
+    IoRingRequest* pending_first;
+    IoRingRequest* pending_last;
+    Thread* workers[IORING_WORKER_COUNT];
+    uint32_t worker_ids[IORING_WORKER_COUNT];
+    IoRingRequest* running[IORING_WORKER_COUNT]; //the request each worker runs
+    uint32_t worker_count; //alive after closing
+    List* waiters; //threads waiting for completions
+    BOOL closing;
+} IoRing;
+
+static BOOL ioring_open(File *file, uint32_t flags);
+static void ioring_close(File *file);
+
+static const filesystem_ops g_ioring_ops =
+{
+    .open = ioring_open,
+    .close = ioring_close
+};
+
+static IoRing* get_ring(File* file)
+{
+    if (NULL == file || file->node->ops != &g_ioring_ops)
+    {
+        return NULL;
+    }
+
+    return (IoRing*)file->node->private_node_data;
+}
+
+static void free_request(IoRingRequest* request)
+{
+    if (request->file)
+    {
+        fs_release_file(request->file);
+    }
+
+    kfree(request);
+}
+
+static void release_frames(IoRing* ring)
+{
+    vmm_unmap_temporary_range(ring->header, ring->page_count);
+
+    for (uint32_t i = 0; i < ring->page_count; ++i)
+    {
+        vmm_release_page_frame_4k(ring->frames[i]);
+    }
+}
+
+static void destroy_ring(IoRing* ring)
+{
+    while (ring->pending_first)
+    {
+        IoRingRequest* request = ring->pending_first;
+        ring->pending_first = request->next;
+
+        free_request(request);
+    }
+
+    release_frames(ring);
+
+    list_destroy(ring->waiters);
+
+    kfree(ring->node);
+    kfree(ring);
+}
+
+static void release_if_unused(IoRing* ring)
+{
+    if (ring->closing && 0 == ring->worker_count && 0 == list_get_count(ring->waiters))
+    {
+        destroy_ring(ring);
+    }
+}
+
+//Interrupts must be disabled
+static void complete(IoRing* ring, uint64_t user_data, int32_t result)
+{
+    ring->in_flight--;
+
+    if (ring->closing)
+    {
+        //The queues are unmapped
+        return;
+    }
+
+    IoRingCompletion* completion = &ring->completions[ring->cq_tail & (ring->cq_entries - 1)];
+    completion->user_data = user_data;
+    completion->result = result;
+    completion->reserved = 0;
+
+    ring->cq_tail++;
+    ring->header->cq_tail = ring->cq_tail;
+
+    list_foreach (n, ring->waiters)
+    {
+        Thread* thread = (Thread*)n->data;
+
+        if (thread->state == TS_WAITIO && thread->state_privateData == ring->waiters)
+        {
+            thread_resume(thread);
+        }
+    }
+}
+
+//Pipes and terminals put the thread that opened the file to sleep when they have to wait. Workers wait here like select does instead, so the driver won't block.
+static int32_t wait_ready(IoRing* ring, Thread* thread, int32_t fd, File* file, BOOL write)
+{
+    ReadWriteTestFunction test_ready = write ? file->node->ops->write_test_ready : file->node->ops->read_test_ready;
+
+    if (NULL == test_ready)
+    {
+        return 0;
+    }
+
+    while (!test_ready(file))
+    {
+        if (ring->closing)
+        {
+            return -ECANCELED;
+        }
+
+        if (ring->process->fd[fd] != file)
+        {
+            //Closed meanwhile, select can't watch it any more
+            return -EBADF;
+        }
+
+        memset((uint8_t*)&thread->select, 0, sizeof(thread->select));
+        thread->select.select_state = SS_STARTED;
+        thread->select.nfds = fd + 1;
+        thread->select.result = -1;
+        FD_SET(fd, write ? &thread->select.write_set : &thread->select.read_set);
+
+        //Nothing is held while waiting, the worker may go away with the process here
+        thread_allow_kill();
+
+        thread_change_state(thread, TS_SELECT, NULL);
+        enable_interrupts();
+        halt();
+        disable_interrupts();
+
+        thread_defer_kill();
+
+        memset((uint8_t*)&thread->select, 0, sizeof(thread->select));
+    }
+
+    return 0;
+}
+
+//Positioned requests go to the fs layer with their offset, so the file position is neither used nor changed
+static int32_t transfer(File* file, const IoRingSubmission* submission, BOOL vector, BOOL write)
+{
+    struct iovec single = {(void*)submission->address, submission->length};
+    const struct iovec* iovs = &single;
+    uint32_t count = 1;
+
+    if (vector)
+    {
+        iovs = (const struct iovec*)submission->address;
+        count = submission->length;
+
+        if (!check_user_access((void*)iovs))
+        {
+            return -EFAULT;
+        }
+
+        if (count > IOV_MAX)
+        {
+            return -EINVAL;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (!check_user_access(iovs[i].iov_base))
+        {
+            return -EFAULT;
+        }
+    }
+
+    int32_t offset = FS_OFFSET_CURRENT;
+    if (submission->offset != IORING_OFFSET_CURRENT)
+    {
+        if (submission->offset > 0x7FFFFFFF)
+        {
+            return -EINVAL;
+        }
+
+        offset = (int32_t)submission->offset;
+    }
+
+    if (write)
+    {
+        return fs_writev(file, iovs, count, offset);
+    }
+
+    return fs_readv(file, iovs, count, offset);
+}
+
+//Runs in a worker with interrupts disabled, the file system and drivers may enable them
+static int32_t execute(IoRing* ring, Thread* thread, const IoRingRequest* request)
+{
+    const IoRingSubmission* submission = &request->submission;
+    int32_t fd = submission->fd;
+    File* file = request->file;
+
+    switch (submission->operation)
+    {
+    case IORING_OP_SEND:
+    case IORING_OP_RECV:
+    {
+        //Sockets are found by descriptor, which must still be the one taken. Waiting first keeps a blocking receive out of the deferred section.
+        int32_t result = wait_ready(ring, thread, fd, file, submission->operation == IORING_OP_SEND);
+        if (result < 0)
+        {
+            return result;
+        }
+
+        if (ring->process->fd[fd] != file)
+        {
+            return -EBADF;
+        }
+
+        if (submission->operation == IORING_OP_SEND)
+        {
+            return syscall_send(fd, (const void*)submission->address, submission->length, submission->flags);
+        }
+
+        return syscall_recv(fd, (void*)submission->address, submission->length, submission->flags);
+    }
+    default:
+        break;
+    }
+
+    if (submission->operation == IORING_OP_FSYNC)
+    {
+        return fs_fsync(file, (submission->flags & IORING_FSYNC_DATASYNC) != 0);
+    }
+
+    BOOL write = FALSE;
+    BOOL vector = FALSE;
+
+    switch (submission->operation)
+    {
+    case IORING_OP_READ:
+        break;
+    case IORING_OP_WRITE:
+        write = TRUE;
+        break;
+    case IORING_OP_READV:
+        vector = TRUE;
+        break;
+    case IORING_OP_WRITEV:
+        write = TRUE;
+        vector = TRUE;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    int32_t result = wait_ready(ring, thread, fd, file, write);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    return transfer(file, submission, vector, write);
+}
+
+static void worker(void* argument)
+{
+    IoRing* ring = (IoRing*)argument;
+    Thread* thread = thread_get_current();
+
+    disable_interrupts();
+
+    uint32_t index = 0;
+    while (ring->workers[index] != thread)
+    {
+        //Set by io_ring_setup before the worker runs
+        ++index;
+    }
+
+    while (TRUE)
+    {
+        if (ring->process->destroy_pending)
+        {
+            //Outside a request, the scheduler destroys the process with this thread when it picks it
+            enable_interrupts();
+            halt();
+            disable_interrupts();
+
+            continue;
+        }
+
+        IoRingRequest* request = ring->pending_first;
+
+        if (NULL == request)
+        {
+            if (ring->closing)
+            {
+                ring->worker_count--;
+
+                release_if_unused(ring);
+
+                thread_exit(thread);
+
+                wait_for_schedule();
+            }
+
+            thread_change_state(thread, TS_WAITIO, ring);
+            enable_interrupts();
+            halt();
+            disable_interrupts();
+
+            continue;
+        }
+
+        ring->pending_first = request->next;
+        if (NULL == ring->pending_first)
+        {
+            ring->pending_last = NULL;
+        }
+
+        ring->running[index] = request;
+
+        thread_defer_kill();
+
+        int32_t result = execute(ring, thread, request);
+
+        disable_interrupts();
+
+        complete(ring, request->submission.user_data, result);
+
+        ring->running[index] = NULL;
+
+        free_request(request);
+
+        disable_interrupts();
+
+        thread_allow_kill();
+    }
+}
+
+static void wake_workers(IoRing* ring)
+{
+    for (uint32_t i = 0; i < IORING_WORKER_COUNT; ++i)
+    {
+        Thread* thread = ring->workers[i];
+
+        if (thread->state == TS_WAITIO && thread->state_privateData == ring)
+        {
+            thread_resume(thread);
+        }
+    }
+}
+
+static BOOL ioring_open(File *file, uint32_t flags)
+{
+    //Only the descriptor io_ring_setup returns
+    return file->node->private_node_data == NULL;
+}
+
+static void ioring_close(File *file)
+{
+    IoRing* ring = (IoRing*)file->node->private_node_data;
+
+    if (NULL == ring)
+    {
+        //io_ring_setup failed to add the descriptor
+        return;
+    }
+
+    ring->closing = TRUE;
+
+    //Also called while the process is destroyed, its page directory is still there but may not be the current one
+    uint32_t cr3 = read_cr3();
+    CHANGE_PD(ring->process->pd);
+
+    for (uint32_t i = 0; i < ring->page_count; ++i)
+    {
+        uint32_t v_address = ring->user_address + i * PAGESIZE_4K;
+
+        //The process may have unmapped them and mapped something else there
+        if (vmm_get_physical_address(v_address) == ring->frames[i])
+        {
+            vmm_unmap_memory(ring->process, v_address, 1);
+        }
+    }
+
+    CHANGE_PD(cr3);
+
+    //Threads are gone if the process is being destroyed
+    ring->worker_count = 0;
+    for (uint32_t i = 0; i < IORING_WORKER_COUNT; ++i)
+    {
+        Thread* thread = ring->workers[i];
+
+        if (thread_is_valid(thread) && thread->threadId == ring->worker_ids[i] && thread->owner == ring->process)
+        {
+            ring->worker_count++;
+        }
+        else if (ring->running[i])
+        {
+            //The worker went away with the process in the middle of a request
+            free_request(ring->running[i]);
+            ring->running[i] = NULL;
+            ring->in_flight--;
+        }
+    }
+
+    ListNode* n = ring->waiters->head;
+    while (NULL != n)
+    {
+        Thread* thread = (Thread*)n->data;
+
+        n = n->next;
+
+        if (!thread_is_valid(thread))
+        {
+            list_remove_first_occurrence(ring->waiters, thread);
+        }
+        else if (thread->state == TS_WAITIO && thread->state_privateData == ring->waiters)
+        {
+            thread_resume(thread);
+        }
+    }
+
+    if (ring->worker_count > 0)
+    {
+        //Waiting ones are woken to exit, the running ones exit when they are done
+        wake_workers(ring);
+    }
+
+    release_if_unused(ring);
+}
+
+int syscall_io_ring_setup(uint32_t entries, IoRingParams* params)
+{
+    if (!check_user_access(params) || NULL == params)
+    {
+        return -EFAULT;
+    }
+
+    if (0 == entries || entries > IORING_MAX_ENTRIES)
+    {
+        return -EINVAL;
+    }
+
+    uint32_t sq_entries = 1;
+    while (sq_entries < entries)
+    {
+        sq_entries <<= 1;
+    }
+
+    uint32_t cq_entries = sq_entries * 2;
+
+    uint32_t sq_offset = sizeof(IoRingHeader);
+    uint32_t cq_offset = sq_offset + sq_entries * sizeof(IoRingSubmission);
+    uint32_t size = cq_offset + cq_entries * sizeof(IoRingCompletion);
+    uint32_t page_count = PAGE_COUNT(size);
+
+    Thread* thread = thread_get_current();
+    Process* process = thread->owner;
+
+    if (page_count + 1 > vmm_get_free_page_count())
+    {
+        return -ENOMEM;
+    }
+
+    IoRing* ring = (IoRing*)kmalloc(sizeof(IoRing));
+    memset((uint8_t*)ring, 0, sizeof(IoRing));
+    ring->process = process;
+    ring->page_count = page_count;
+    ring->sq_entries = sq_entries;
+    ring->cq_entries = cq_entries;
+
+    for (uint32_t i = 0; i < page_count; ++i)
+    {
+        ring->frames[i] = vmm_acquire_page_frame_4k();
+    }
+
+    //The ring keeps the frames, the process mapping doesn't own them
+    IoRingHeader* header = (IoRingHeader*)vmm_map_temporary_range(ring->frames, page_count);
+    ring->header = header;
+
+    void* user_address = NULL;
+    if (header)
+    {
+        user_address = vmm_map_memory(process, USER_MMAP_START, ring->frames, page_count, FALSE);
+    }
+
+    if (NULL == user_address)
+    {
+        if (header)
+        {
+            release_frames(ring);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < page_count; ++i)
+            {
+                vmm_release_page_frame_4k(ring->frames[i]);
+            }
+        }
+
+        kfree(ring);
+
+        return -ENOMEM;
+    }
+
+    ring->user_address = (uint32_t)user_address;
+
+    memset((uint8_t*)header, 0, page_count * PAGESIZE_4K);
+    header->sq_entries = sq_entries;
+    header->cq_entries = cq_entries;
+    header->sq_offset = sq_offset;
+    header->cq_offset = cq_offset;
+
+    ring->submissions = (IoRingSubmission*)((uint8_t*)header + sq_offset);
+    ring->completions = (IoRingCompletion*)((uint8_t*)header + cq_offset);
+    ring->waiters = list_create();
+
+    filesystem_node* node = fs_create_node(NULL, &g_ioring_ops);
+    node->node_type = FT_CHARACTER_DEVICE;
+    ring->node = node;
+
+    File* file = fs_open_for_process(thread, node, O_RDWR);
+    if (NULL == file)
+    {
+        vmm_unmap_memory(process, ring->user_address, page_count);
+        release_frames(ring);
+
+        list_destroy(ring->waiters);
+        kfree(node);
+        kfree(ring);
+
+        return -EMFILE;
+    }
+
+    node->private_node_data = ring;
+
+    for (uint32_t i = 0; i < IORING_WORKER_COUNT; ++i)
+    {
+        ring->workers[i] = thread_create_kthread_in_process(process, worker, ring);
+        ring->worker_ids[i] = ring->workers[i]->threadId;
+    }
+
+    params->sq_entries = sq_entries;
+    params->cq_entries = cq_entries;
+    params->ring = user_address;
+    params->ring_size = page_count * PAGESIZE_4K;
+
+    return file->fd;
+}
+
+//Takes up to `to_submit` submissions, then with IORING_ENTER_GETEVENTS waits until `min_complete` completions are there to be reaped
+static int enter(IoRing* ring, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    IoRingHeader* header = ring->header;
+    uint32_t sq_mask = ring->sq_entries - 1;
+
+    //Only the tail and the head the process advances are taken from the shared header
+    uint32_t queued = header->sq_tail - ring->sq_head;
+    if (queued > ring->sq_entries)
+    {
+        queued = ring->sq_entries;
+    }
+
+    if (to_submit > queued)
+    {
+        to_submit = queued;
+    }
+
+    uint32_t submitted = 0;
+    while (submitted < to_submit)
+    {
+        //Results of everything taken must fit in the completion queue
+        uint32_t unreaped = ring->cq_tail - header->cq_head;
+        if (unreaped > ring->cq_entries || unreaped + ring->in_flight >= ring->cq_entries)
+        {
+            break;
+        }
+
+        IoRingRequest* request = (IoRingRequest*)kmalloc(sizeof(IoRingRequest));
+        memcpy((uint8_t*)&request->submission, (uint8_t*)&ring->submissions[ring->sq_head & sq_mask], sizeof(IoRingSubmission));
+        request->file = NULL;
+        request->next = NULL;
+
+        ring->sq_head++;
+        header->sq_head = ring->sq_head;
+
+        ring->in_flight++;
+        submitted++;
+
+        IoRingSubmission* submission = &request->submission;
+
+        if (submission->operation == IORING_OP_NOP)
+        {
+            complete(ring, submission->user_data, 0);
+            kfree(request);
+            continue;
+        }
+
+        //Held until the request completes, closing the descriptor meanwhile won't free the File
+        request->file = fs_get_file(ring->process, submission->fd);
+        if (NULL == request->file)
+        {
+            complete(ring, submission->user_data, -EBADF);
+            kfree(request);
+            continue;
+        }
+
+        if (ring->pending_last)
+        {
+            ring->pending_last->next = request;
+        }
+        else
+        {
+            ring->pending_first = request;
+        }
+        ring->pending_last = request;
+    }
+
+    if (submitted > 0)
+    {
+        wake_workers(ring);
+    }
+
+    if (flags & IORING_ENTER_GETEVENTS)
+    {
+        Thread* thread = thread_get_current();
+
+        list_append(ring->waiters, thread);
+
+        //Nothing more can come once everything taken is completed
+        while (ring->cq_tail - header->cq_head < min_complete && ring->in_flight > 0)
+        {
+            if (thread->pending_signal_count > 0)
+            {
+                list_remove_first_occurrence(ring->waiters, thread);
+
+                return submitted > 0 ? (int)submitted : -EINTR;
+            }
+
+            thread_change_state(thread, TS_WAITIO, ring->waiters);
+            enable_interrupts();
+            halt();
+            disable_interrupts();
+
+            if (ring->closing)
+            {
+                //The ring was closed by another thread
+                list_remove_first_occurrence(ring->waiters, thread);
+
+                release_if_unused(ring);
+
+                return -EBADF;
+            }
+        }
+
+        list_remove_first_occurrence(ring->waiters, thread);
+    }
+
+    return submitted;
+}
+
+int syscall_io_ring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+
+    IoRing* ring = get_ring(file);
+
+    int result = ring ? enter(ring, to_submit, min_complete, flags) : -EBADF;
+
+    if (file)
+    {
+        fs_release_file(file);
+    }
+
+    return result;
+}
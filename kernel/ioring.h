@@ -0,0 +1,104 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+ 
+#pragma once
+
+#include "common.h"
+#include "fs.h"
+
+#define IORING_MAX_ENTRIES 256
+#define IORING_WORKER_COUNT 4
+
+#define IORING_OFFSET_CURRENT 0xFFFFFFFF //use and advance the file position
+
+#define IORING_ENTER_GETEVENTS 1
+
+#define IORING_FSYNC_DATASYNC 1
+
+typedef enum IoRingOperation
+{
+    IORING_OP_NOP,
+    IORING_OP_READ,
+    IORING_OP_WRITE,
+    IORING_OP_READV,
+    IORING_OP_WRITEV,
+    IORING_OP_SEND,
+    IORING_OP_RECV,
+    IORING_OP_FSYNC,
+} IoRingOperation;
+
+//Submission queue entry, written by the process
+typedef struct IoRingSubmission
+{
+    uint8_t operation;
+    uint8_t reserved[3];
+    int32_t fd;
+    uint32_t offset; //IORING_OFFSET_CURRENT or a position for file reads and writes
+    uint32_t address; //buffer or iovec array
+    uint32_t length; //bytes or iovec count
+    uint32_t flags; //send/recv flags or IORING_FSYNC_DATASYNC
+    uint64_t user_data; //given back in the completion
+} IoRingSubmission;
+
+//Completion queue entry, written by the kernel
+typedef struct IoRingCompletion
+{
+    uint64_t user_data;
+    int32_t result; //what the corresponding system call would return
+    uint32_t reserved;
+} IoRingCompletion;
+
+//Start of the memory shared with the process, the queues follow at the given offsets. Entry counts are powers of two, heads and tails wrap around.
+typedef struct IoRingHeader
+{
+    volatile uint32_t sq_head; //advanced by the kernel
+    volatile uint32_t sq_tail; //advanced by the process
+    volatile uint32_t cq_head; //advanced by the process
+    volatile uint32_t cq_tail; //advanced by the kernel
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t sq_offset;
+    uint32_t cq_offset;
+} IoRingHeader;
+
+typedef struct IoRingParams
+{
+    uint32_t sq_entries; //out
+    uint32_t cq_entries; //out
+    void* ring; //out, the IoRingHeader
+    uint32_t ring_size; //out
+} IoRingParams;
+
+int syscall_io_ring_setup(uint32_t entries, IoRingParams* params);
+int syscall_io_ring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags);
@@ -40,11 +40,63 @@ IsrFunction g_interrupt_handlers[256];
 uint32_t g_isr_count = 0;
 uint32_t g_irq_count = 0;
 
+//Handlers of lines PCI devices may share, each one checks whether its device raised the interrupt
+typedef struct SharedHandler
+{
+    uint8_t n;
+    IsrFunction handler;
+} SharedHandler;
+
+static SharedHandler g_shared_handlers[ISR_MAX_SHARED_HANDLERS];
+static uint32_t g_shared_handler_count = 0;
+
 void interrupt_register(uint8_t n, IsrFunction handler)
 {
     g_interrupt_handlers[n] = handler;
 }
 
+static void handle_shared(Registers* regs)
+{
+    for (uint32_t i = 0; i < g_shared_handler_count; ++i)
+    {
+        if (g_shared_handlers[i].n == (regs->interruptNumber & 0xFF))
+        {
+            g_shared_handlers[i].handler(regs);
+        }
+    }
+}
+
+//Adds the handler to the ones on line `n`. Fails if the line has a handler from interrupt_register or too many are registered.
+BOOL interrupt_register_shared(uint8_t n, IsrFunction handler)
+{
+    if (g_interrupt_handlers[n] != 0 && g_interrupt_handlers[n] != handle_shared)
+    {
+        return FALSE;
+    }
+
+    for (uint32_t i = 0; i < g_shared_handler_count; ++i)
+    {
+        if (g_shared_handlers[i].n == n && g_shared_handlers[i].handler == handler)
+        {
+            //Drivers with several devices on the line register once per device
+            return TRUE;
+        }
+    }
+
+    if (g_shared_handler_count == ISR_MAX_SHARED_HANDLERS)
+    {
+        return FALSE;
+    }
+
+    g_shared_handlers[g_shared_handler_count].n = n;
+    g_shared_handlers[g_shared_handler_count].handler = handler;
+    g_shared_handler_count++;
+
+    g_interrupt_handlers[n] = handle_shared;
+
+    return TRUE;
+}
+
 void handle_isr(Registers regs)
 {
     //Screen_PrintF("handle_isr interrupt no:%d\n", regs.int_no);
@@ -65,9 +65,12 @@ typedef struct Registers
 
 typedef void (*IsrFunction)(Registers*);
 
+#define ISR_MAX_SHARED_HANDLERS 16
+
 extern IsrFunction g_interrupt_handlers[];
 
 extern uint32_t g_isr_count;
 extern uint32_t g_irq_count;
 
-void interrupt_register(uint8_t n, IsrFunction handler);
\ No newline at end of file
+void interrupt_register(uint8_t n, IsrFunction handler);
+BOOL interrupt_register_shared(uint8_t n, IsrFunction handler);
\ No newline at end of file
@@ -66,25 +66,32 @@ typedef struct Reader
 } Reader;
 
 static List* g_readers = NULL;
+static List* g_waiting_threads = NULL; //blocked in keyboard_read, a File can be shared by several threads
 
 static void handle_keyboard_interrupt(Registers *regs);
 
+static const filesystem_ops g_keyboard_ops =
+{
+    .open = keyboard_open,
+    .close = keyboard_close,
+    .read = keyboard_read,
+    .read_test_ready = keyboard_read_test_ready,
+    .ioctl = keyboard_ioctl
+};
+
 void keyboard_initialize()
 {
     Device device;
     memset((uint8_t*)&device, 0, sizeof(Device));
     strcpy(device.name, "keyboard");
     device.device_type = FT_CHARACTER_DEVICE;
-    device.open = keyboard_open;
-    device.close = keyboard_close;
-    device.read = keyboard_read;
-    device.read_test_ready = keyboard_read_test_ready;
-    device.ioctl = keyboard_ioctl;
+    device.ops = &g_keyboard_ops;
 
     g_key_buffer = kmalloc(KEYBUFFER_SIZE);
     memset((uint8_t*)g_key_buffer, 0, KEYBUFFER_SIZE);
 
     g_readers = list_create();
+    g_waiting_threads = list_create();
 
     devfs_register_device(&device);
 
@@ -135,10 +142,7 @@ static int32_t keyboard_read(File *file, uint32_t size, uint8_t *buffer)
     {
         while (read_index == g_key_buffer_write_index)
         {
-            thread_change_state(file->thread, TS_WAITIO, keyboard_read);
-            
-            enable_interrupts();
-            halt();
+            thread_wait_listed(g_waiting_threads, keyboard_read);
         }
     }
 
@@ -220,19 +224,7 @@ static void handle_keyboard_interrupt(Registers *regs)
     g_key_buffer_write_index++;
     g_key_buffer_write_index %= KEYBUFFER_SIZE;
 
-    //Wake readers
-    list_foreach(n, g_readers)
-    {
-        File* file = n->data;
-
-        if (file->thread->state == TS_WAITIO)
-        {
-            if (file->thread->state_privateData == keyboard_read)
-            {
-                thread_resume(file->thread);
-            }
-        }
-    }
+    thread_wake_listed(g_waiting_threads, keyboard_read);
 
     console_send_key(scancode);
 }
@@ -0,0 +1,374 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include "lz4.h"
+#include "alloc.h"
+
+/*
+ *  Decoder for the LZ4 frame format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md). Blocks are decoded into a
+ *  window that keeps the last 64KB of output for linked blocks, so the whole stream is never held in memory at once.
+ *  Header, block and content checksums are skipped, not verified.
+ */
+
+#define LZ4_MAGIC 0x184D2204
+#define LZ4_SKIPPABLE_MAGIC 0x184D2A50
+#define LZ4_SKIPPABLE_MAGIC_MASK 0xFFFFFFF0
+#define LZ4_HISTORY_SIZE 65536
+#define LZ4_MIN_MATCH 4
+
+#define LZ4_FLG_VERSION_MASK 0xC0
+#define LZ4_FLG_VERSION 0x40
+#define LZ4_FLG_BLOCK_INDEPENDENT 0x20
+#define LZ4_FLG_BLOCK_CHECKSUM 0x10
+#define LZ4_FLG_CONTENT_SIZE 0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_DICTIONARY_ID 0x01
+
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000
+
+typedef struct Lz4FrameHeader
+{
+    uint8_t flags;
+    uint32_t block_max_size;
+    uint32_t header_size;
+    BOOL has_content_size;
+    uint64_t content_size;
+} Lz4FrameHeader;
+
+static uint32_t read32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//Reads the 255-terminated length extension of a literal or match length
+static BOOL read_length(const uint8_t** ip, const uint8_t* iend, uint32_t* length)
+{
+    uint32_t b = 0;
+    do
+    {
+        if (*ip >= iend)
+        {
+            return FALSE;
+        }
+
+        b = *(*ip)++;
+        *length += b;
+    } while (b == 255);
+
+    return TRUE;
+}
+
+int32_t lz4_decompress_block(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t dst_capacity, uint32_t history)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_capacity;
+
+    while (ip < iend)
+    {
+        uint32_t token = *ip++;
+
+        uint32_t length = token >> 4;
+        if (length == 15 && !read_length(&ip, iend, &length))
+        {
+            return -1;
+        }
+
+        if (length > (uint32_t)(iend - ip) || length > (uint32_t)(oend - op))
+        {
+            return -1;
+        }
+
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+
+        if (ip == iend)
+        {
+            //The last sequence has literals only
+            break;
+        }
+
+        if (iend - ip < 2)
+        {
+            return -1;
+        }
+
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > (uint32_t)(op - dst) + history)
+        {
+            return -1;
+        }
+
+        length = token & 15;
+        if (length == 15 && !read_length(&ip, iend, &length))
+        {
+            return -1;
+        }
+        length += LZ4_MIN_MATCH;
+
+        if (length > (uint32_t)(oend - op))
+        {
+            return -1;
+        }
+
+        const uint8_t* match = op - offset;
+
+        if (offset >= length)
+        {
+            memcpy(op, match, length);
+            op += length;
+        }
+        else
+        {
+            //Overlapping match repeats the last `offset` bytes
+            uint8_t* end = op + length;
+            while (op < end)
+            {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return op - dst;
+}
+
+static int32_t parse_header(const uint8_t* src, uint32_t src_size, Lz4FrameHeader* header)
+{
+    if (src_size < 7 || read32(src) != LZ4_MAGIC)
+    {
+        return -1;
+    }
+
+    header->flags = src[4];
+
+    if ((header->flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION)
+    {
+        return -1;
+    }
+
+    uint32_t block_size_id = (src[5] >> 4) & 7;
+    if (block_size_id < 4)
+    {
+        return -1;
+    }
+
+    //64KB, 256KB, 1MB, 4MB
+    header->block_max_size = 1 << (2 * block_size_id + 8);
+
+    uint32_t position = 6;
+
+    header->has_content_size = (header->flags & LZ4_FLG_CONTENT_SIZE) != 0;
+    header->content_size = 0;
+    if (header->has_content_size)
+    {
+        if (src_size < position + 8 + 1)
+        {
+            return -1;
+        }
+
+        header->content_size = read32(src + position) | ((uint64_t)read32(src + position + 4) << 32);
+        position += 8;
+    }
+
+    if (header->flags & LZ4_FLG_DICTIONARY_ID)
+    {
+        //External dictionaries are not supported
+        return -1;
+    }
+
+    //Header checksum
+    position += 1;
+
+    if (position > src_size)
+    {
+        return -1;
+    }
+
+    header->header_size = position;
+
+    return position;
+}
+
+BOOL lz4_is_frame(const uint8_t* src, uint32_t src_size)
+{
+    Lz4FrameHeader header;
+
+    return parse_header(src, src_size, &header) > 0;
+}
+
+BOOL lz4_get_content_size(const uint8_t* src, uint32_t src_size, uint32_t* content_size)
+{
+    Lz4FrameHeader header;
+
+    if (parse_header(src, src_size, &header) < 0 || !header.has_content_size || header.content_size > 0xFFFFFFFF)
+    {
+        return FALSE;
+    }
+
+    *content_size = (uint32_t)header.content_size;
+
+    return TRUE;
+}
+
+//Decodes the blocks of one frame, returns the number of input bytes consumed or -1
+static int32_t decompress_frame(const uint8_t* src, uint32_t src_size, Lz4OutputFunction output, void* context, uint32_t* total)
+{
+    Lz4FrameHeader header;
+
+    int32_t header_size = parse_header(src, src_size, &header);
+    if (header_size < 0)
+    {
+        return -1;
+    }
+
+    BOOL linked = (header.flags & LZ4_FLG_BLOCK_INDEPENDENT) == 0;
+    uint32_t history_size = linked ? LZ4_HISTORY_SIZE : 0;
+
+    uint8_t* window = (uint8_t*)kmalloc(history_size + header.block_max_size);
+    uint32_t filled = 0;
+
+    uint32_t position = header_size;
+    int32_t result = -1;
+
+    while (position + 4 <= src_size)
+    {
+        uint32_t block_size = read32(src + position);
+        position += 4;
+
+        if (block_size == 0)
+        {
+            if (header.flags & LZ4_FLG_CONTENT_CHECKSUM)
+            {
+                position += 4;
+            }
+
+            if (position <= src_size)
+            {
+                result = position;
+            }
+            break;
+        }
+
+        BOOL uncompressed = (block_size & LZ4_BLOCK_UNCOMPRESSED) != 0;
+        block_size &= ~LZ4_BLOCK_UNCOMPRESSED;
+
+        if (block_size > header.block_max_size || block_size > src_size - position)
+        {
+            break;
+        }
+
+        int32_t decompressed = 0;
+        if (uncompressed)
+        {
+            memcpy(window + filled, src + position, block_size);
+            decompressed = block_size;
+        }
+        else
+        {
+            decompressed = lz4_decompress_block(src + position, block_size, window + filled, header.block_max_size, filled);
+        }
+
+        if (decompressed < 0 || output(context, window + filled, decompressed) < 0)
+        {
+            break;
+        }
+
+        *total += decompressed;
+
+        position += block_size;
+        if (header.flags & LZ4_FLG_BLOCK_CHECKSUM)
+        {
+            position += 4;
+        }
+
+        if (linked)
+        {
+            //Keep the last 64KB at the start of the window for the next block to refer to
+            filled += decompressed;
+            if (filled > LZ4_HISTORY_SIZE)
+            {
+                memmove(window, window + filled - LZ4_HISTORY_SIZE, LZ4_HISTORY_SIZE);
+                filled = LZ4_HISTORY_SIZE;
+            }
+        }
+    }
+
+    kfree(window);
+
+    return result;
+}
+
+int32_t lz4_decompress_frame(const uint8_t* src, uint32_t src_size, Lz4OutputFunction output, void* context)
+{
+    uint32_t total = 0;
+    uint32_t position = 0;
+    BOOL decoded = FALSE;
+
+    while (src_size - position >= 8)
+    {
+        uint32_t magic = read32(src + position);
+
+        if (magic == LZ4_MAGIC)
+        {
+            int32_t consumed = decompress_frame(src + position, src_size - position, output, context, &total);
+            if (consumed < 0)
+            {
+                return -1;
+            }
+
+            position += consumed;
+            decoded = TRUE;
+        }
+        else if ((magic & LZ4_SKIPPABLE_MAGIC_MASK) == LZ4_SKIPPABLE_MAGIC)
+        {
+            uint32_t skip = read32(src + position + 4);
+            if (skip > src_size - position - 8)
+            {
+                return -1;
+            }
+
+            position += 8 + skip;
+        }
+        else
+        {
+            //Anything after the frames (such as padding) is ignored
+            break;
+        }
+    }
+
+    return decoded ? (int32_t)total : -1;
+}
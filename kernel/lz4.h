@@ -0,0 +1,52 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#pragma once
+
+#include "common.h"
+
+//Receives decompressed data in order, a negative return stops decompression
+typedef int32_t (*Lz4OutputFunction)(void* context, const uint8_t* data, uint32_t size);
+
+//Decompresses one raw LZ4 block. `history` bytes right before dst are earlier output that matches may refer to.
+//Returns the decompressed size or -1 if the block is malformed or does not fit.
+int32_t lz4_decompress_block(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t dst_capacity, uint32_t history);
+
+BOOL lz4_is_frame(const uint8_t* src, uint32_t src_size);
+
+//Returns TRUE if the first frame declares its content size and it fits in 32 bits
+BOOL lz4_get_content_size(const uint8_t* src, uint32_t src_size, uint32_t* content_size);
+
+//Decompresses a stream of LZ4 frames, passing every block to output as soon as it is decoded.
+//Returns the total decompressed size or -1.
+int32_t lz4_decompress_frame(const uint8_t* src, uint32_t src_size, Lz4OutputFunction output, void* context);
@@ -46,12 +46,21 @@
 #include "systemfs.h"
 #include "pipe.h"
 #include "sharedmemory.h"
+#include "futex.h"
+#include "blockcache.h"
+#include "pagecache.h"
+#include "filemapping.h"
 #include "random.h"
 #include "null.h"
 #include "elf.h"
 #include "log.h"
 #include "ramdisk.h"
+#include "lz4.h"
+#include "pci.h"
+#include "ata.h"
+#include "virtioblk.h"
 #include "fatfilesystem.h"
+#include "tmpfs.h"
 #include "vbe.h"
 #include "fifobuffer.h"
 #include "gfx.h"
@@ -105,7 +114,7 @@ int execute_file(const char *path, char *const argv[], char *const envp[], files
                     {
                         name = argv[0];
                     }
-                    Process* new_process = process_create_from_elf_data(name, image, argv, envp, process, tty);
+                    Process* new_process = process_create_from_elf_file(name, node, image, argv, envp, process, tty);
 
                     if (new_process)
                     {
@@ -145,6 +154,8 @@ int kmain(struct Multiboot *mboot_ptr)
      *  contain anything, but allow us to recieve and send data to...
      */
     fs_initialize();
+    blockcache_initialize();
+    pagecache_initialize();
     devfs_initialize();
 
     /*
@@ -182,6 +193,8 @@ int kmain(struct Multiboot *mboot_ptr)
 
     pipe_initialize();
     sharedmemory_initialize();
+    futex_initialize();
+    filemapping_initialize();
 
     tasking_initialize();
 
@@ -213,10 +226,23 @@ int kmain(struct Multiboot *mboot_ptr)
     random_initialize();
     null_initialize();
 
-    ramdisk_create("ramdisk1", 20*1024*1024);
+    /*
+     *  Find the PCI devices, then the disks on the IDE controller and the virtio disks. Each disk and partition
+     *  becomes a block device in /dev (hda, hda1, ..., vda, ...).
+     */
+    pci_initialize();
+    ata_initialize();
+    virtioblk_initialize();
 
     fatfs_initialize();
 
+    tmpfs_initialize();
+
+    if (!fs_mount("tmpfs", "/tmp", "tmpfs", 0, NULL))
+    {
+        WARNING("Mounting /tmp failed!");
+    }
+
     /*
      *  Initialize sockets (UNIX sockets). This allows different processes to communicate with each other. Do
      *  not confuse this with TCP/IP communication!
@@ -246,7 +272,32 @@ int kmain(struct Multiboot *mboot_ptr)
             kprintf("Initrd must reside below %x !!!\n", KERN_PD_AREA_BEGIN);
             PANIC("Initrd image is too big!");
         }
-        memcpy((uint8_t*)*(uint32_t*)fs_get_node("/dev/ramdisk1")->private_node_data, initrd_location, initrd_size);
+
+        if (lz4_is_frame(initrd_location, initrd_size))
+        {
+            //The timer only ticks with interrupts enabled. The scheduler is not enabled yet, so nothing else runs meanwhile.
+            enable_interrupts();
+            uint32_t start_ms = get_uptime_milliseconds();
+
+            int32_t decompressed_size = ramdisk_create_from_lz4("ramdisk1", initrd_location, initrd_size);
+
+            uint32_t elapsed_ms = get_uptime_milliseconds() - start_ms;
+            disable_interrupts();
+
+            if (decompressed_size < 0)
+            {
+                PANIC("Decompressing initrd failed!\n");
+            }
+
+            kprintf("Initrd decompressed %d -> %d bytes in %d ms (%d KB/s)\n", initrd_size, decompressed_size, elapsed_ms,
+                ((uint32_t)decompressed_size / 1024) * 1000 / MAX(elapsed_ms, 1));
+        }
+        //The module lies in the identity mapped area reserved at boot, so the ramdisk can use it in place
+        else if (!ramdisk_create_from_memory("ramdisk1", initrd_location, initrd_size, FALSE))
+        {
+            PANIC("Creating initrd ramdisk failed!\n");
+        }
+
         BOOL mountSuccess = fs_mount("/dev/ramdisk1", "/initrd", "fat", 0, 0);
 
         if (mountSuccess)
@@ -268,6 +319,9 @@ int kmain(struct Multiboot *mboot_ptr)
 
     pipe_create("pipe0", 8);
 
+    //Writes back dirty blocks in the background
+    blockcache_start_flusher();
+
     scheduler_enable();
 
     enable_interrupts();
@@ -58,19 +58,25 @@ static int32_t mouse_read(File *file, uint32_t size, uint8_t *buffer);
 uint8_t g_mouse_packet[MOUSE_PACKET_SIZE];
 
 static List* g_readers = NULL;
+static List* g_waiting_threads = NULL; //blocked in mouse_read, a File can be shared by several threads
 
 static Spinlock g_readers_lock;
 
+static const filesystem_ops g_mouse_ops =
+{
+    .open = mouse_open,
+    .close = mouse_close,
+    .read_test_ready = mouse_read_test_ready,
+    .read = mouse_read
+};
+
 void initialize_mouse()
 {
     Device device;
     memset((uint8_t*)&device, 0, sizeof(Device));
     strcpy(device.name, "psaux");
     device.device_type = FT_CHARACTER_DEVICE;
-    device.open = mouse_open;
-    device.close = mouse_close;
-    device.read_test_ready = mouse_read_test_ready;
-    device.read = mouse_read;
+    device.ops = &g_mouse_ops;
     interrupt_register(IRQ12, handle_mouse_interrupt);
 
     devfs_register_device(&device);
@@ -78,6 +84,7 @@ void initialize_mouse()
     memset(g_mouse_packet, 0, MOUSE_PACKET_SIZE);
 
     g_readers = list_create();
+    g_waiting_threads = list_create();
 
     spinlock_init(&g_readers_lock);
 
@@ -142,10 +149,7 @@ static int32_t mouse_read(File *file, uint32_t size, uint8_t *buffer)
 
     while (mouse_read_test_ready(file) == FALSE)
     {
-        thread_change_state(file->thread, TS_WAITIO, mouse_read);
-
-        enable_interrupts();
-        halt();
+        thread_wait_listed(g_waiting_threads, mouse_read);
     }
 
     disable_interrupts();
@@ -222,7 +226,6 @@ static void handle_mouse_interrupt(Registers *regs)
 
         spinlock_lock(&g_readers_lock);
 
-        //Wake readers
         list_foreach(n, g_readers)
         {
             File* file = n->data;
@@ -230,16 +233,11 @@ static void handle_mouse_interrupt(Registers *regs)
             FifoBuffer* fifo = (FifoBuffer*)file->private_data;
 
             fifobuffer_enqueue(fifo, g_mouse_packet, MOUSE_PACKET_SIZE);
-
-            if (file->thread->state == TS_WAITIO)
-            {
-                if (file->thread->state_privateData == mouse_read)
-                {
-                    thread_resume(file->thread);
-                }
-            }
         }
 
+        //Wake readers
+        thread_wake_listed(g_waiting_threads, mouse_read);
+
         spinlock_unlock(&g_readers_lock);
     }
 
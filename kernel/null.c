@@ -38,13 +38,18 @@
 
 static BOOL null_open(File *file, uint32_t flags);
 
+static const filesystem_ops g_null_ops =
+{
+    .open = null_open
+};
+
 void null_initialize()
 {
     Device device;
     memset((uint8_t*)&device, 0, sizeof(Device));
     strcpy(device.name, "null");
     device.device_type = FT_CHARACTER_DEVICE;
-    device.open = null_open;
+    device.ops = &g_null_ops;
 
     devfs_register_device(&device);
 }
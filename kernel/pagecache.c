@@ -0,0 +1,690 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+
+#include "pagecache.h"
+#include "alloc.h"
+#include "vmm.h"
+#include "radixtree.h"
+#include "spinlock.h"
+#include "process.h"
+
+/*
+ *  Page cache for regular file data. A node whose filesystem provides `read_pages` gets a PageCache with a radix tree of
+ *  4K page frames indexed by file page number. The frames are not mapped in the kernel, they are accessed through vmm_map_temporary.
+ *  fs_read is served from the cache and fs_write updates the cached pages after writing through to the filesystem.
+ *  Pages are kept in a global LRU list, pages having references are not evicted. The cache also evicts when free frames run low,
+ *  and a read fails instead of taking the last PAGECACHE_RESERVED_FRAMES.
+ *  The lock is not held while a filesystem reads pages in, that may sleep. The pages are in the cache meanwhile but not up to date,
+ *  readers finding them wait for the filler. A write or an invalidation drops such pages, the filler's data is then not kept.
+ */
+
+struct CachedPage
+{
+    PageCache* cache; //NULL after invalidation, then the page is freed when its last reference is dropped
+    uint32_t index;
+    uint32_t physical_address;
+    uint32_t references;
+    BOOL uptodate; //FALSE while being read in
+    struct CachedPage* cache_previous;
+    struct CachedPage* cache_next;
+    struct CachedPage* lru_previous; //more recently used
+    struct CachedPage* lru_next; //less recently used
+};
+
+struct PageCache
+{
+    filesystem_node* node;
+    RadixTree* pages;
+    CachedPage* first_page;
+};
+
+static CachedPage* g_lru_first = NULL; //most recently used
+static CachedPage* g_lru_last = NULL; //next to be evicted
+static uint32_t g_page_count = 0;
+static uint32_t g_capacity = PAGECACHE_DEFAULT_CAPACITY;
+static Spinlock g_pagecache_lock;
+
+void pagecache_initialize()
+{
+    g_lru_first = NULL;
+    g_lru_last = NULL;
+    g_page_count = 0;
+    g_capacity = PAGECACHE_DEFAULT_CAPACITY;
+
+    spinlock_init(&g_pagecache_lock);
+}
+
+//Waiters let interrupts in (system calls run without them), so a holder that was preempted gets scheduled
+static void lock_pagecache()
+{
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    while (!spinlock_try_lock(&g_pagecache_lock))
+    {
+        enable_interrupts();
+        halt();
+        disable_interrupts();
+    }
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+}
+
+static void unlock_pagecache()
+{
+    spinlock_unlock(&g_pagecache_lock);
+}
+
+//Called with the lock held, lets other threads run so a filler gets to finish
+static void wait_for_fill()
+{
+    unlock_pagecache();
+
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    enable_interrupts();
+    halt();
+
+    if (!interrupts_were_enabled)
+    {
+        disable_interrupts();
+    }
+
+    lock_pagecache();
+}
+
+static void lru_remove(CachedPage* page)
+{
+    if (page->lru_previous)
+    {
+        page->lru_previous->lru_next = page->lru_next;
+    }
+    else
+    {
+        g_lru_first = page->lru_next;
+    }
+
+    if (page->lru_next)
+    {
+        page->lru_next->lru_previous = page->lru_previous;
+    }
+    else
+    {
+        g_lru_last = page->lru_previous;
+    }
+
+    page->lru_previous = NULL;
+    page->lru_next = NULL;
+}
+
+static void lru_push_front(CachedPage* page)
+{
+    page->lru_previous = NULL;
+    page->lru_next = g_lru_first;
+
+    if (g_lru_first)
+    {
+        g_lru_first->lru_previous = page;
+    }
+    else
+    {
+        g_lru_last = page;
+    }
+
+    g_lru_first = page;
+}
+
+static void touch(CachedPage* page)
+{
+    if (g_lru_first != page)
+    {
+        lru_remove(page);
+        lru_push_front(page);
+    }
+}
+
+static void free_page(CachedPage* page)
+{
+    vmm_release_page_frame_4k(page->physical_address);
+
+    kfree(page);
+}
+
+//Takes the page out of its cache, it is freed now or when its last reference is dropped
+static void detach(CachedPage* page)
+{
+    PageCache* cache = page->cache;
+
+    radixtree_remove(cache->pages, page->index);
+
+    if (page->cache_previous)
+    {
+        page->cache_previous->cache_next = page->cache_next;
+    }
+    else
+    {
+        cache->first_page = page->cache_next;
+    }
+
+    if (page->cache_next)
+    {
+        page->cache_next->cache_previous = page->cache_previous;
+    }
+
+    lru_remove(page);
+
+    page->cache = NULL;
+    g_page_count--;
+
+    if (0 == page->references)
+    {
+        free_page(page);
+    }
+}
+
+static void put_page(CachedPage* page)
+{
+    page->references--;
+
+    if (0 == page->references && NULL == page->cache)
+    {
+        free_page(page);
+    }
+}
+
+static BOOL evict_one()
+{
+    for (CachedPage* page = g_lru_last; NULL != page; page = page->lru_previous)
+    {
+        if (0 == page->references)
+        {
+            detach(page);
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static PageCache* get_cache(filesystem_node* node)
+{
+    if (NULL == node->page_cache)
+    {
+        PageCache* cache = (PageCache*)kmalloc(sizeof(PageCache));
+        cache->node = node;
+        cache->pages = radixtree_create();
+        cache->first_page = NULL;
+
+        node->page_cache = cache;
+    }
+
+    return node->page_cache;
+}
+
+#define FILL_PAGES_MAX (PAGECACHE_READAHEAD_MAX + 1)
+
+//Reads up to `count` uncached pages starting at `index` with a single read_pages call, so the filesystem can issue them as one
+//multi-block request. Stops early at a page that is already cached. Called with the lock held, which is dropped while reading.
+//Returns the page at `index` with a reference, or NULL if the read failed or no frame could be had for it.
+static CachedPage* fill_pages(File* file, PageCache* cache, uint32_t index, uint32_t count)
+{
+    uint32_t physical_addresses[FILL_PAGES_MAX];
+    CachedPage* pages[FILL_PAGES_MAX];
+
+    count = MIN(count, FILL_PAGES_MAX);
+
+    uint32_t filled = 0;
+    while (filled < count && (0 == filled || NULL == radixtree_lookup(cache->pages, index + filled)))
+    {
+        while ((g_page_count >= g_capacity || !vmm_has_free_page_frames(PAGECACHE_RESERVED_FRAMES + 1)) && evict_one())
+        {
+        }
+
+        //Every cached page is referenced and memory is short, read only what was set up so far
+        if (!vmm_has_free_page_frames(PAGECACHE_RESERVED_FRAMES + 1))
+        {
+            break;
+        }
+
+        CachedPage* page = (CachedPage*)kmalloc(sizeof(CachedPage));
+        memset((uint8_t*)page, 0, sizeof(CachedPage));
+        page->cache = cache;
+        page->index = index + filled;
+        page->physical_address = vmm_acquire_page_frame_4k();
+        page->references = 1; //the filler's
+        page->uptodate = FALSE;
+
+        //In the cache right away, so nobody else reads it in
+        radixtree_insert(cache->pages, page->index, page);
+
+        page->cache_next = cache->first_page;
+        if (cache->first_page)
+        {
+            cache->first_page->cache_previous = page;
+        }
+        cache->first_page = page;
+
+        lru_push_front(page);
+        g_page_count++;
+
+        physical_addresses[filled] = page->physical_address;
+        pages[filled++] = page;
+    }
+
+    if (0 == filled)
+    {
+        return NULL;
+    }
+
+    //Readers of these pages wait until the filler marks them, so it is not killed before that
+    thread_defer_kill();
+
+    unlock_pagecache();
+
+    int32_t bytes = -1;
+
+    uint8_t* data = (uint8_t*)vmm_map_temporary_range(physical_addresses, filled);
+    if (data)
+    {
+        bytes = file->node->ops->read_pages(file, index * PAGESIZE_4K, filled, data);
+
+        if (bytes >= 0 && bytes < filled * PAGESIZE_4K)
+        {
+            memset(data + bytes, 0, filled * PAGESIZE_4K - bytes);
+        }
+
+        vmm_unmap_temporary_range(data, filled);
+    }
+
+    lock_pagecache();
+
+    //`cache` may be gone, a page still has it unless it was dropped meanwhile
+    for (uint32_t i = 0; i < filled; ++i)
+    {
+        CachedPage* page = pages[i];
+
+        if (bytes < 0)
+        {
+            if (page->cache)
+            {
+                detach(page);
+            }
+        }
+        else
+        {
+            page->uptodate = TRUE;
+        }
+
+        if (i > 0 || bytes < 0)
+        {
+            put_page(page);
+        }
+    }
+
+    thread_allow_kill();
+
+    if (bytes < 0)
+    {
+        return NULL;
+    }
+
+    return pages[0];
+}
+
+//Called with the lock held. Returns the page at the index with a reference once it is up to date, reading it in with up to
+//`count` - 1 pages behind it if it is not cached, `missed` tells whether it was.
+static CachedPage* get_page(File* file, uint32_t index, uint32_t count, BOOL* missed)
+{
+    *missed = FALSE;
+
+    while (TRUE)
+    {
+        PageCache* cache = get_cache(file->node);
+
+        CachedPage* page = (CachedPage*)radixtree_lookup(cache->pages, index);
+        if (NULL == page)
+        {
+            *missed = TRUE;
+
+            page = fill_pages(file, cache, index, count);
+
+            if (NULL == page || page->cache)
+            {
+                return page;
+            }
+        }
+        else
+        {
+            touch(page);
+
+            page->references++;
+
+            while (!page->uptodate && page->cache)
+            {
+                wait_for_fill();
+            }
+
+            if (page->cache)
+            {
+                return page;
+            }
+        }
+
+        //The read failed or a write dropped the page meanwhile, look again
+        put_page(page);
+    }
+
+    return NULL;
+}
+
+//Called with the lock held
+static void read_ahead(File* file, uint32_t first_index, uint32_t last_index)
+{
+    for (uint32_t index = first_index; index <= last_index; ++index)
+    {
+        //The cache may have been invalidated while filling
+        PageCache* cache = get_cache(file->node);
+
+        if (NULL == radixtree_lookup(cache->pages, index))
+        {
+            CachedPage* page = fill_pages(file, cache, index, last_index - index + 1);
+
+            if (NULL == page)
+            {
+                break;
+            }
+
+            put_page(page);
+        }
+    }
+}
+
+static int32_t copy_to_buffer(void* context, uint32_t done, uint8_t* data, uint32_t size)
+{
+    memcpy((uint8_t*)context + done, data, size);
+
+    return size;
+}
+
+//Reads at file->offset and advances it like a filesystem read function
+int32_t pagecache_read(File* file, uint32_t size, uint8_t* buffer)
+{
+    return pagecache_read_to(file, size, copy_to_buffer, buffer);
+}
+
+/*
+ *  Same as pagecache_read, but the data is handed to `consume` straight from the cached pages, `done` bytes were consumed before.
+ *  It returns how much it took, reading stops when it takes less than it is given.
+ */
+int32_t pagecache_read_to(File* file, uint32_t size, PageCacheConsumer consume, void* context)
+{
+    if (file->offset < 0)
+    {
+        return -1;
+    }
+
+    int32_t done = pagecache_read_at(file, (uint32_t)file->offset, size, consume, context);
+
+    if (done > 0)
+    {
+        file->offset += done;
+    }
+
+    return done;
+}
+
+//Same as pagecache_read_to at the given offset, file->offset is neither used nor changed
+int32_t pagecache_read_at(File* file, uint32_t offset, uint32_t size, PageCacheConsumer consume, void* context)
+{
+    filesystem_node* node = file->node;
+
+    if (offset >= node->length)
+    {
+        return 0;
+    }
+
+    if (size > node->length - offset)
+    {
+        size = node->length - offset;
+    }
+
+    uint32_t last_file_page = (node->length - 1) / PAGESIZE_4K;
+
+    //The window is kept while reads continue where the previous one stopped
+    if (offset / PAGESIZE_4K == file->readahead_next_page)
+    {
+        if (file->readahead_window < PAGECACHE_READAHEAD_INITIAL)
+        {
+            file->readahead_window = PAGECACHE_READAHEAD_INITIAL;
+        }
+    }
+    else
+    {
+        file->readahead_window = 0;
+    }
+
+    uint32_t done = 0;
+    int32_t error = -1;
+    while (done < size)
+    {
+        uint32_t index = (offset + done) / PAGESIZE_4K;
+        uint32_t page_offset = (offset + done) % PAGESIZE_4K;
+        uint32_t chunk = MIN(PAGESIZE_4K - page_offset, size - done);
+
+        //A missing page and the readahead window behind it are read together
+        uint32_t last_index = MIN(index + file->readahead_window, last_file_page);
+
+        lock_pagecache();
+
+        BOOL missed = FALSE;
+        CachedPage* page = get_page(file, index, last_index - index + 1, &missed);
+
+        if (page && missed && file->readahead_window > 0)
+        {
+            read_ahead(file, index + 1, last_index);
+
+            file->readahead_window = MIN(file->readahead_window * 2, PAGECACHE_READAHEAD_MAX);
+        }
+
+        unlock_pagecache();
+
+        if (NULL == page)
+        {
+            break;
+        }
+
+        //The lock is not held while consuming, the user buffer may fault or the consumer may block
+        int32_t consumed = -1;
+
+        uint8_t* data = (uint8_t*)vmm_map_temporary(page->physical_address);
+        if (data)
+        {
+            consumed = consume(context, done, data + page_offset, chunk);
+
+            vmm_unmap_temporary(data);
+        }
+
+        lock_pagecache();
+        put_page(page);
+        unlock_pagecache();
+
+        if (consumed < 0)
+        {
+            error = consumed;
+        }
+
+        if (consumed <= 0)
+        {
+            break;
+        }
+
+        done += consumed;
+
+        if ((uint32_t)consumed < chunk)
+        {
+            break;
+        }
+    }
+
+    if (0 == done && size > 0)
+    {
+        return error;
+    }
+
+    file->readahead_next_page = (offset + done) / PAGESIZE_4K;
+
+    return done;
+}
+
+//Copies data just written to the filesystem into the pages that are cached, pages not cached are left alone
+void pagecache_update(filesystem_node* node, uint32_t offset, uint32_t size, uint8_t* buffer)
+{
+    uint32_t done = 0;
+    while (done < size)
+    {
+        uint32_t index = (offset + done) / PAGESIZE_4K;
+        uint32_t page_offset = (offset + done) % PAGESIZE_4K;
+        uint32_t chunk = MIN(PAGESIZE_4K - page_offset, size - done);
+
+        lock_pagecache();
+
+        if (NULL == node->page_cache)
+        {
+            unlock_pagecache();
+            return;
+        }
+
+        CachedPage* page = (CachedPage*)radixtree_lookup(node->page_cache->pages, index);
+        if (page && !page->uptodate)
+        {
+            //Being read in, the filler may have read the old data
+            detach(page);
+            page = NULL;
+        }
+        else if (page)
+        {
+            touch(page);
+
+            page->references++;
+        }
+
+        unlock_pagecache();
+
+        if (page)
+        {
+            uint8_t* data = (uint8_t*)vmm_map_temporary(page->physical_address);
+            if (data)
+            {
+                memcpy(data + page_offset, buffer + done, chunk);
+
+                vmm_unmap_temporary(data);
+            }
+
+            lock_pagecache();
+
+            if (NULL == data && page->cache)
+            {
+                //Could not update, drop it to stay coherent
+                detach(page);
+            }
+
+            put_page(page);
+
+            unlock_pagecache();
+        }
+
+        done += chunk;
+    }
+}
+
+//Drops all cached pages of the node
+void pagecache_invalidate(filesystem_node* node)
+{
+    lock_pagecache();
+
+    PageCache* cache = node->page_cache;
+
+    if (cache)
+    {
+        while (cache->first_page)
+        {
+            detach(cache->first_page);
+        }
+
+        radixtree_destroy(cache->pages);
+
+        kfree(cache);
+
+        node->page_cache = NULL;
+    }
+
+    unlock_pagecache();
+}
+
+//Returns the page at the index with a reference held, so it stays cached until pagecache_put_page. Used by file mappings.
+CachedPage* pagecache_get_page(File* file, uint32_t index)
+{
+    filesystem_node* node = file->node;
+
+    if (NULL == node->ops->read_pages || index >= PAGE_COUNT(node->length) || 0 == node->length)
+    {
+        return NULL;
+    }
+
+    lock_pagecache();
+
+    BOOL missed = FALSE;
+    CachedPage* page = get_page(file, index, 1, &missed);
+
+    unlock_pagecache();
+
+    return page;
+}
+
+void pagecache_put_page(CachedPage* page)
+{
+    lock_pagecache();
+
+    put_page(page);
+
+    unlock_pagecache();
+}
+
+uint32_t pagecache_get_physical_address(CachedPage* page)
+{
+    return page->physical_address;
+}
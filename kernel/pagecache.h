@@ -0,0 +1,56 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+
+#pragma once
+
+#include "common.h"
+#include "fs.h"
+
+#define PAGECACHE_DEFAULT_CAPACITY 4096 //pages, 16MB
+#define PAGECACHE_READAHEAD_INITIAL 4 //pages
+#define PAGECACHE_READAHEAD_MAX 32 //pages
+#define PAGECACHE_RESERVED_FRAMES 64 //the cache does not take the last free frames, it evicts instead
+
+typedef struct CachedPage CachedPage;
+typedef int32_t (*PageCacheConsumer)(void* context, uint32_t done, uint8_t* data, uint32_t size);
+
+void pagecache_initialize();
+int32_t pagecache_read(File* file, uint32_t size, uint8_t* buffer);
+int32_t pagecache_read_to(File* file, uint32_t size, PageCacheConsumer consume, void* context);
+int32_t pagecache_read_at(File* file, uint32_t offset, uint32_t size, PageCacheConsumer consume, void* context);
+void pagecache_update(filesystem_node* node, uint32_t offset, uint32_t size, uint8_t* buffer);
+void pagecache_invalidate(filesystem_node* node);
+CachedPage* pagecache_get_page(File* file, uint32_t index);
+void pagecache_put_page(CachedPage* page);
+uint32_t pagecache_get_physical_address(CachedPage* page);
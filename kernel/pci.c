@@ -0,0 +1,188 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include "pci.h"
+#include "alloc.h"
+#include "list.h"
+#include "log.h"
+
+/*
+ *  PCI devices are found once at boot through configuration mechanism #1 (ports 0xCF8/0xCFC) and kept in a list that drivers
+ *  search by class or by vendor and device id.
+ */
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_VENDOR_ID 0x00
+#define PCI_COMMAND 0x04
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0 0x10
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_HEADER_MULTI_FUNCTION 0x80
+
+static List* g_pci_devices = NULL;
+
+static uint32_t config_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+    return 0x80000000 | (bus << 16) | (slot << 11) | (function << 8) | (offset & 0xFC);
+}
+
+static uint32_t read_config(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, slot, function, offset));
+
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_config_read32(const PciDevice* device, uint8_t offset)
+{
+    return read_config(device->bus, device->slot, device->function, offset);
+}
+
+uint16_t pci_config_read16(const PciDevice* device, uint8_t offset)
+{
+    return (uint16_t)(pci_config_read32(device, offset) >> ((offset & 2) * 8));
+}
+
+void pci_config_write32(const PciDevice* device, uint8_t offset, uint32_t value)
+{
+    outl(PCI_CONFIG_ADDRESS, config_address(device->bus, device->slot, device->function, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_config_write16(const PciDevice* device, uint8_t offset, uint16_t value)
+{
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t dword = pci_config_read32(device, offset);
+
+    dword &= ~(0xFFFF << shift);
+    dword |= (uint32_t)value << shift;
+
+    pci_config_write32(device, offset, dword);
+}
+
+static void add_function(uint8_t bus, uint8_t slot, uint8_t function)
+{
+    uint32_t id = read_config(bus, slot, function, PCI_VENDOR_ID);
+    uint32_t class_revision = read_config(bus, slot, function, PCI_CLASS_REVISION);
+
+    PciDevice* device = (PciDevice*)kmalloc(sizeof(PciDevice));
+    memset((uint8_t*)device, 0, sizeof(PciDevice));
+    device->bus = bus;
+    device->slot = slot;
+    device->function = function;
+    device->vendor_id = id & 0xFFFF;
+    device->device_id = id >> 16;
+    device->class_code = class_revision >> 24;
+    device->subclass = (class_revision >> 16) & 0xFF;
+    device->prog_if = (class_revision >> 8) & 0xFF;
+    device->interrupt_line = read_config(bus, slot, function, PCI_INTERRUPT_LINE) & 0xFF;
+
+    list_append(g_pci_devices, device);
+
+    log_printf("PCI %d:%d.%d %x:%x class %x:%x irq %d\r\n", bus, slot, function, device->vendor_id, device->device_id,
+        device->class_code, device->subclass, device->interrupt_line);
+}
+
+void pci_initialize()
+{
+    g_pci_devices = list_create();
+
+    for (uint32_t bus = 0; bus < 256; ++bus)
+    {
+        for (uint32_t slot = 0; slot < 32; ++slot)
+        {
+            if ((read_config(bus, slot, 0, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF)
+            {
+                continue;
+            }
+
+            uint32_t function_count = 1;
+            if ((read_config(bus, slot, 0, PCI_HEADER_TYPE) >> 16) & PCI_HEADER_MULTI_FUNCTION)
+            {
+                function_count = 8;
+            }
+
+            for (uint32_t function = 0; function < function_count; ++function)
+            {
+                if ((read_config(bus, slot, function, PCI_VENDOR_ID) & 0xFFFF) != 0xFFFF)
+                {
+                    add_function(bus, slot, function);
+                }
+            }
+        }
+    }
+}
+
+PciDevice* pci_find_class(uint8_t class_code, uint8_t subclass, uint32_t index)
+{
+    list_foreach (n, g_pci_devices)
+    {
+        PciDevice* device = (PciDevice*)n->data;
+
+        if (device->class_code == class_code && device->subclass == subclass && index-- == 0)
+        {
+            return device;
+        }
+    }
+
+    return NULL;
+}
+
+PciDevice* pci_find_device(uint16_t vendor_id, uint16_t device_id, uint32_t index)
+{
+    list_foreach (n, g_pci_devices)
+    {
+        PciDevice* device = (PciDevice*)n->data;
+
+        if (device->vendor_id == vendor_id && device->device_id == device_id && index-- == 0)
+        {
+            return device;
+        }
+    }
+
+    return NULL;
+}
+
+uint32_t pci_get_bar(const PciDevice* device, uint32_t bar)
+{
+    return pci_config_read32(device, PCI_BAR0 + bar * 4);
+}
+
+void pci_enable(const PciDevice* device, uint16_t command_bits)
+{
+    pci_config_write16(device, PCI_COMMAND, pci_config_read16(device, PCI_COMMAND) | command_bits);
+}
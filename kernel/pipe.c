@@ -58,6 +58,13 @@ static BOOL pipes_open(File *file, uint32_t flags);
 static filesystem_dirent *pipes_readdir(filesystem_node *node, uint32_t index);
 static filesystem_node *pipes_finddir(filesystem_node *node, char *name);
 
+static const filesystem_ops g_pipes_ops =
+{
+    .open = pipes_open,
+    .readdir = pipes_readdir,
+    .finddir = pipes_finddir
+};
+
 void pipe_initialize()
 {
     g_pipe_list = list_create();
@@ -70,9 +77,7 @@ void pipe_initialize()
     }
     else
     {
-        g_pipes_root->open = pipes_open;
-        g_pipes_root->finddir = pipes_finddir;
-        g_pipes_root->readdir = pipes_readdir;
+        g_pipes_root->ops = &g_pipes_ops;
     }
 }
 
@@ -117,20 +122,33 @@ static filesystem_node *pipes_finddir(filesystem_node *node, char *name)
     return NULL;
 }
 
+//Puts the calling thread to sleep until the other side wakes the list. A File shared with another process (spawn's dup2)
+//was opened by a thread of that process, so the caller is listed for the time of the wait only.
 static void block_accessing_threads(Pipe* pipe, List* list)
 {
     disable_interrupts();
 
-    list_foreach (n, list)
-    {
-        Thread* reader = n->data;
+    BOOL listed = (NULL != list_find_first_occurrence(list, g_current_thread));
 
-        thread_change_state(reader, TS_WAITIO, pipe);
+    if (!listed)
+    {
+        list_append(list, g_current_thread);
     }
 
+    thread_change_state(g_current_thread, TS_WAITIO, pipe);
+
     enable_interrupts();
 
     halt();
+
+    if (!listed)
+    {
+        disable_interrupts();
+
+        list_remove_first_occurrence(list, g_current_thread);
+
+        enable_interrupts();
+    }
 }
 
 static void wakeup_accessing_threads(Pipe* pipe, List* list)
@@ -141,7 +159,8 @@ static void wakeup_accessing_threads(Pipe* pipe, List* list)
     {
         Thread* reader = n->data;
 
-        if (reader->state == TS_WAITIO)
+        //A thread killed while waiting is still listed
+        if (thread_is_valid(reader) && reader->state == TS_WAITIO)
         {
             if (reader->state_privateData == pipe)
             {
@@ -224,16 +243,25 @@ static BOOL pipe_read_test_ready(File *file)
     return FALSE;
 }
 
-static int32_t pipe_read(File *file, uint32_t size, uint8_t *buffer)
+static BOOL pipe_write_test_ready(File *file)
 {
-    if (0 == size || NULL == buffer || !CHECK_ACCESS(file->flags, O_RDONLY))
+    Pipe* pipe = file->node->private_node_data;
+
+    begin_critical_section();
+    int readerCount = list_get_count(pipe->readers);
+    end_critical_section();
+
+    if (fifobuffer_get_free(pipe->buffer) > 0 && readerCount > 0)
     {
-        return -1;
+        return TRUE;
     }
 
-    Pipe* pipe = file->node->private_node_data;
+    return FALSE;
+}
 
-    uint32_t used = 0;
+//Returns 0 once the pipe has data
+static int32_t wait_for_data(File *file, Pipe* pipe)
+{
     while (pipe_read_test_ready(file) == FALSE)
     {
         if (pipe->isBroken)
@@ -255,71 +283,210 @@ static int32_t pipe_read(File *file, uint32_t size, uint8_t *buffer)
         return -EINTR;
     }
 
-    disable_interrupts();
+    return 0;
+}
 
+//Returns 0 once the pipe has room and a reader
+static int32_t wait_for_room(File *file, Pipe* pipe)
+{
+    while (pipe_write_test_ready(file) == FALSE)
+    {
+        if (pipe->isBroken)
+        {
+            disable_interrupts();
+            return -EPIPE;
+        }
 
+        if (g_current_thread->pending_signal_count > 0)
+        {
+            return -EINTR;
+        }
 
-    int32_t readBytes = fifobuffer_dequeue(pipe->buffer, buffer, size);
+        block_accessing_threads(pipe, pipe->writers);
+    }
 
-    wakeup_accessing_threads(pipe, pipe->writers);
+    if (g_current_thread->pending_signal_count > 0)
+    {
+        return -EINTR;
+    }
 
-    return readBytes;
+    return 0;
 }
 
-static BOOL pipe_write_test_ready(File *file)
+//Waits once for data, then fills the buffers in order. Pipes cannot seek, so the fs layer never passes an offset here.
+static int32_t pipe_readv(File *file, const struct iovec* iovs, uint32_t count, int32_t offset)
 {
+    if (!CHECK_ACCESS(file->flags, O_RDONLY))
+    {
+        return -1;
+    }
+
     Pipe* pipe = file->node->private_node_data;
 
-    begin_critical_section();
-    int readerCount = list_get_count(pipe->readers);
-    end_critical_section();
+    int32_t result = wait_for_data(file, pipe);
+    if (result < 0)
+    {
+        return result;
+    }
 
-    if (fifobuffer_get_free(pipe->buffer) > 0 && readerCount > 0)
+    disable_interrupts();
+
+    int32_t readBytes = 0;
+    for (uint32_t i = 0; i < count; ++i)
     {
-        return TRUE;
+        if (0 == iovs[i].iov_len)
+        {
+            continue;
+        }
+
+        int32_t bytes = fifobuffer_dequeue(pipe->buffer, (uint8_t*)iovs[i].iov_base, iovs[i].iov_len);
+
+        if (bytes > 0)
+        {
+            readBytes += bytes;
+        }
+
+        if (bytes < (int32_t)iovs[i].iov_len)
+        {
+            break;
+        }
     }
 
-    return FALSE;
+    wakeup_accessing_threads(pipe, pipe->writers);
+
+    return readBytes;
 }
 
-static int32_t pipe_write(File *file, uint32_t size, uint8_t *buffer)
+static int32_t pipe_read(File *file, uint32_t size, uint8_t *buffer)
+{
+    if (0 == size || NULL == buffer)
+    {
+        return -1;
+    }
+
+    struct iovec iov = {buffer, size};
+
+    return pipe_readv(file, &iov, 1, FS_OFFSET_CURRENT);
+}
+
+//Waits once for room, then queues the buffers in order until the pipe is full
+static int32_t pipe_writev(File *file, const struct iovec* iovs, uint32_t count, int32_t offset)
 {
-    if (0 == size || NULL == buffer || !CHECK_ACCESS(file->flags, O_WRONLY))
+    if (!CHECK_ACCESS(file->flags, O_WRONLY))
     {
         return -1;
     }
 
     Pipe* pipe = file->node->private_node_data;
 
-    uint32_t free = 0;
-    while (pipe_write_test_ready(file) == FALSE)
+    int32_t result = wait_for_room(file, pipe);
+    if (result < 0)
     {
-        if (pipe->isBroken)
+        return result;
+    }
+
+    disable_interrupts();
+
+    int32_t bytesWritten = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (0 == iovs[i].iov_len)
         {
-            disable_interrupts();
-            return -EPIPE;
+            continue;
         }
 
-        if (g_current_thread->pending_signal_count > 0)
+        int32_t bytes = fifobuffer_enqueue(pipe->buffer, (uint8_t*)iovs[i].iov_base, iovs[i].iov_len);
+
+        if (bytes > 0)
         {
-            return -EINTR;
+            bytesWritten += bytes;
         }
 
-        block_accessing_threads(pipe, pipe->writers);
+        if (bytes < (int32_t)iovs[i].iov_len)
+        {
+            break;
+        }
     }
 
-    if (g_current_thread->pending_signal_count > 0)
+    wakeup_accessing_threads(pipe, pipe->readers);
+
+    return bytesWritten;
+}
+
+static int32_t pipe_write(File *file, uint32_t size, uint8_t *buffer)
+{
+    if (0 == size || NULL == buffer)
     {
-        return -EINTR;
+        return -1;
     }
 
-    disable_interrupts();
+    struct iovec iov = {buffer, size};
 
-    int32_t bytesWritten = fifobuffer_enqueue(pipe->buffer, buffer, size);
+    return pipe_writev(file, &iov, 1, FS_OFFSET_CURRENT);
+}
 
-    wakeup_accessing_threads(pipe, pipe->readers);
+//Moves data from one pipe's buffer straight into the other's. Waits like pipe_read for data and like pipe_write for room.
+int32_t pipe_splice(File* in, File* out, uint32_t size)
+{
+    if (0 == size || !CHECK_ACCESS(in->flags, O_RDONLY) || !CHECK_ACCESS(out->flags, O_WRONLY))
+    {
+        return -1;
+    }
 
-    return bytesWritten;
+    Pipe* source = in->node->private_node_data;
+    Pipe* destination = out->node->private_node_data;
+
+    if (source == destination)
+    {
+        return -EINVAL;
+    }
+
+    while (TRUE)
+    {
+        int32_t result = wait_for_data(in, source);
+        if (0 == result)
+        {
+            result = wait_for_room(out, destination);
+        }
+
+        if (result < 0)
+        {
+            return result;
+        }
+
+        disable_interrupts();
+
+        int32_t moved = fifobuffer_move(destination->buffer, source->buffer, size);
+
+        if (moved > 0)
+        {
+            wakeup_accessing_threads(source, source->writers);
+            wakeup_accessing_threads(destination, destination->readers);
+
+            return moved;
+        }
+
+        //Another reader emptied the source while waiting for room
+    }
+
+    return -1;
+}
+
+static const filesystem_ops g_pipe_ops =
+{
+    .open = pipe_open,
+    .close = pipe_close,
+    .read = pipe_read,
+    .write = pipe_write,
+    .readv = pipe_readv,
+    .writev = pipe_writev,
+    .read_test_ready = pipe_read_test_ready,
+    .write_test_ready = pipe_write_test_ready
+};
+
+BOOL pipe_is_pipe(filesystem_node* node)
+{
+    return node->ops == &g_pipe_ops;
 }
 
 BOOL pipe_create(const char* name, uint32_t bufferSize)
@@ -344,15 +511,8 @@ BOOL pipe_create(const char* name, uint32_t bufferSize)
     pipe->readers = list_create();
     pipe->writers = list_create();
 
-    pipe->fsNode = (filesystem_node*)kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)pipe->fsNode, 0, sizeof(filesystem_node));
+    pipe->fsNode = fs_create_node(name, &g_pipe_ops);
     pipe->fsNode->private_node_data = pipe;
-    pipe->fsNode->open = pipe_open;
-    pipe->fsNode->close = pipe_close;
-    pipe->fsNode->read = pipe_read;
-    pipe->fsNode->write = pipe_write;
-    pipe->fsNode->read_test_ready = pipe_read_test_ready;
-    pipe->fsNode->write_test_ready = pipe_write_test_ready;
 
     list_append(g_pipe_list, pipe);
 
@@ -34,8 +34,11 @@
 #pragma once
 
 #include "common.h"
+#include "fs.h"
 
 void pipe_initialize();
 BOOL pipe_create(const char* name, uint32_t bufferSize);
 BOOL pipe_destroy(const char* name);
-BOOL pipe_exists(const char* name);
\ No newline at end of file
+BOOL pipe_exists(const char* name);
+BOOL pipe_is_pipe(filesystem_node* node);
+int32_t pipe_splice(File* in, File* out, uint32_t size);
\ No newline at end of file
@@ -44,6 +44,9 @@
 #include "list.h"
 #include "ttydev.h"
 #include "sharedmemory.h"
+#include "tmpfs.h"
+#include "filemapping.h"
+#include "futex.h"
 
 #define MESSAGE_QUEUE_SIZE 64
 
@@ -136,11 +139,20 @@ void tasking_initialize()
 }
 
 void thread_create_kthread(Function0 func)
+{
+    thread_create_kthread_in_process(g_kernel_process, (Function1)func, NULL);
+}
+
+/*
+ *  Creates a thread that runs `func(argument)` in kernel mode in the address space of the process, so it can reach the process' memory and descriptors
+ *  like a system call does. It is destroyed with the process, `func` must not return.
+ */
+Thread* thread_create_kthread_in_process(Process* process, Function1 func, void* argument)
 {
     Thread* thread = (Thread*)kmalloc(sizeof(Thread));
     memset((uint8_t*)thread, 0, sizeof(Thread));
 
-    thread->owner = g_kernel_process;
+    thread->owner = process;
 
     thread->threadId = generate_thread_id();
 
@@ -171,7 +183,12 @@ void thread_create_kthread(Function0 func)
 
     uint8_t* stack = (uint8_t*)kmalloc(KERN_STACK_SIZE);
 
-    thread->regs.esp = (uint32_t)(stack + KERN_STACK_SIZE - 4);
+    //The argument above a return address that is never used
+    uint32_t* stack_top = (uint32_t*)(stack + KERN_STACK_SIZE - 4);
+    stack_top[0] = (uint32_t)argument;
+    stack_top[-1] = 0;
+
+    thread->regs.esp = (uint32_t)(stack_top - 1);
 
     thread->kstack.ss0 = 0x10;
     thread->kstack.esp0 = 0;//For kernel threads, this is not required
@@ -185,6 +202,8 @@ void thread_create_kthread(Function0 func)
     }
 
     p->next = thread;
+
+    return thread;
 }
 
 static int get_string_array_item_count(char *const array[])
@@ -204,90 +223,66 @@ static int get_string_array_item_count(char *const array[])
     return i;
 }
 
-static char** clone_string_array(char *const array[])
+static BOOL pack_string_array(uint8_t* page, uint32_t location, char *const array[], int* destination_index, uint32_t* string_offset)
 {
-    int item_count = get_string_array_item_count(array);
+    char** destination = (char**)page;
 
-    char** new_array = kmalloc(sizeof(char*) * (item_count + 1));
+    int item_count = get_string_array_item_count(array);
 
     for (int i = 0; i < item_count; ++i)
     {
-        const char* str = array[i];
-        int len = strlen(str);
-
-        char* newStr = kmalloc(len + 1);
-        strcpy(newStr, str);
-
-        new_array[i] = newStr;
-    }
+        uint32_t size = strlen(array[i]) + 1;
 
-    new_array[item_count] = NULL;
-
-    return new_array;
-}
-
-static void destroy_string_array(char** array)
-{
-    char* a = array[0];
+        if (*string_offset + size > PAGESIZE_4K)
+        {
+            return FALSE;
+        }
 
-    int i = 0;
+        memcpy(page + *string_offset, (uint8_t*)array[i], size);
 
-    while (NULL != a)
-    {
-        kfree(a);
+        destination[(*destination_index)++] = (char*)(location + *string_offset);
 
-        a = array[++i];
+        *string_offset += size;
     }
 
-    kfree(array);
+    destination[(*destination_index)++] = NULL;
+
+    return TRUE;
 }
 
-//This function must be called within the correct page directory for target process
-static void copy_argv_env_to_process(uint32_t location, void* elfData, char *const argv[], char *const envp[])
+/*
+ *  Builds the argument page of a new process in a single pass: argv pointers, envp pointers, room for the auxiliary vector and the string table, laid out
+ *  exactly as they will appear at `location` in the new process, so it only has to be copied once. The strings are read from the calling process, so this
+ *  must be called before changing the page directory. Returns NULL if the arguments and the environment don't fit in one page.
+ */
+static uint8_t* pack_argv_env(uint32_t location, char *const argv[], char *const envp[], uint32_t* aux_vector_offset)
 {
-    char** destination = (char**)location;
-    int destination_index = 0;
-
-    //kprintf("ARGVENV: destination:%x\n", destination);
-
     int argv_count = get_string_array_item_count(argv);
     int envp_count = get_string_array_item_count(envp);
 
-    //kprintf("ARGVENV: argv_count:%d envp_count:%d\n", argv_count, envp_count);
-
-    char* string_table = (char*)location + sizeof(char*) * (argv_count + envp_count + 3) + AUX_VECTOR_SIZE_BYTES;
-
-    uint32_t aux_vector_location = location + sizeof(char*) * (argv_count + envp_count + 2);
+    uint32_t string_offset = sizeof(char*) * (argv_count + envp_count + 3) + AUX_VECTOR_SIZE_BYTES;
 
-    //kprintf("ARGVENV: string_table:%x\n", string_table);
-
-    for (int i = 0; i < argv_count; ++i)
+    if (string_offset > PAGESIZE_4K)
     {
-        strcpy(string_table, argv[i]);
-
-        destination[destination_index] = string_table;
-
-        string_table += strlen(argv[i]) + 2;
-
-        destination_index++;
+        return NULL;
     }
 
-    destination[destination_index++] = NULL;
-
-    for (int i = 0; i < envp_count; ++i)
-    {
-        strcpy(string_table, envp[i]);
+    uint8_t* page = (uint8_t*)kmalloc(PAGESIZE_4K);
+    memset(page, 0, PAGESIZE_4K);
 
-        destination[destination_index] = string_table;
+    int destination_index = 0;
 
-        string_table += strlen(envp[i]) + 2;
+    if (!pack_string_array(page, location, argv, &destination_index, &string_offset) ||
+        !pack_string_array(page, location, envp, &destination_index, &string_offset))
+    {
+        kfree(page);
 
-        destination_index++;
+        return NULL;
     }
 
-    destination[destination_index++] = NULL;
+    *aux_vector_offset = sizeof(char*) * (argv_count + envp_count + 2);
 
-    fill_auxilary_vector(aux_vector_location, elfData);
+    return page;
 }
 
 static void fill_auxilary_vector(uint32_t location, void* elf_data)
@@ -364,7 +359,16 @@ static void fill_auxilary_vector(uint32_t location, void* elf_data)
  */
 Process* process_create_from_elf_data(const char* name, uint8_t* elf_data, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty)
 {
-    return process_create_ex(name, generate_process_id(), generate_thread_id(), NULL, elf_data, argv, envp, parent, tty);
+    return process_create_ex(name, generate_process_id(), generate_thread_id(), NULL, elf_data, NULL, argv, envp, parent, tty, NULL);
+}
+
+/*
+ *  Same as above, but `image_node` is the file that `elf_data` was read from. Processes created from the same file share the physical pages
+ *  of its read-only segments through the image cache (see `imagecache.c`).
+ */
+Process* process_create_from_elf_file(const char* name, filesystem_node* image_node, uint8_t* elf_data, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty)
+{
+    return process_create_ex(name, generate_process_id(), generate_thread_id(), NULL, elf_data, image_node, argv, envp, parent, tty, NULL);
 }
 
 /*
@@ -372,16 +376,17 @@ Process* process_create_from_elf_data(const char* name, uint8_t* elf_data, char
  */
 Process* process_create_from_function(const char* name, Function0 func, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty)
 {
-    return process_create_ex(name, generate_process_id(), generate_thread_id(), func, NULL, argv, envp, parent, tty);
+    return process_create_ex(name, generate_process_id(), generate_thread_id(), func, NULL, NULL, argv, envp, parent, tty, NULL);
 }
 
 /*
  *  This function creates a process. When using this function, make sure that you set either `func` or `elf_data`, not both or none of them. I
  *  recommend using the functions `process_create_from_elf_data` or `process_create_from_function`. Use the function `process_create_from_elf_data`
  *  for creating a process using the ELF data (use this if you want to execute an executable stored as a file). You can also create a process using
- *  the function `process_create_from_function`, which allows you to create a process using a defined function.
+ *  the function `process_create_from_function`, which allows you to create a process using a defined function. `startup` describes the working directory and the
+ *  file descriptor table of the new process (see `ProcessStartup`), pass NULL to get the defaults.
  */
-Process* process_create_ex(const char* name, uint32_t process_id, uint32_t thread_id, Function0 func, uint8_t* elf_data, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty)
+Process* process_create_ex(const char* name, uint32_t process_id, uint32_t thread_id, Function0 func, uint8_t* elf_data, filesystem_node* image_node, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty, const ProcessStartup* startup)
 {
     uint32_t image_data_end_in_memory = elf_get_end_in_memory((char*)elf_data);
 
@@ -391,6 +396,15 @@ Process* process_create_ex(const char* name, uint32_t process_id, uint32_t threa
         return NULL;
     }
 
+    //pack to kernel space since we are changing page directory soon
+    uint32_t aux_vector_offset = 0;
+    uint8_t* argv_env_page = pack_argv_env(USER_STACK, argv, envp, &aux_vector_offset);
+    if (NULL == argv_env_page)
+    {
+        kprintf("Could not start the process. Arguments and environment don't fit in a page! %s\n", name);
+        return NULL;
+    }
+
     /*
      *  If the process's ID isn't known, then generate a process ID. In this case, the function `generate_process_id` just increments an integer, and returns that
      *  integer's value.
@@ -456,6 +470,13 @@ Process* process_create_ex(const char* name, uint32_t process_id, uint32_t threa
         process->working_directory = parent->working_directory;
 
         process->tty = parent->tty;
+
+        process->stack_limit = parent->stack_limit;
+    }
+
+    if (0 == process->stack_limit)
+    {
+        process->stack_limit = USER_STACK_RESERVE;
     }
 
     if (tty)
@@ -463,6 +484,13 @@ Process* process_create_ex(const char* name, uint32_t process_id, uint32_t threa
         process->tty = tty;
     }
 
+    if (startup && startup->working_directory)
+    {
+        process->working_directory = startup->working_directory;
+    }
+
+    fs_acquire_node(process->working_directory);
+
     if (process->tty)
     {
         //TODO: unlock below when the old TTY system removed
@@ -481,15 +509,24 @@ Process* process_create_ex(const char* name, uint32_t process_id, uint32_t threa
         */
     }
 
-    //clone to kernel space since we are changing page directory soon
-    char** new_argv = clone_string_array(argv);
-    char** new_envp = clone_string_array(envp);
-
     //Change memory view (page directory)
     CHANGE_PD(process->pd);
 
     vmm_initialize_process_pages(process);
 
+    /*
+     *  Map the shared read-only pages first, the program break below only allocates private pages for what is left of the image.
+     */
+    if (elf_data && image_node)
+    {
+        process->image = imagecache_acquire(image_node, (char*)elf_data);
+
+        if (process->image)
+        {
+            imagecache_map(process->image, process);
+        }
+    }
+
     uint32_t size_in_memory = image_data_end_in_memory - USER_OFFSET;
 
     //kprintf("image size_in_memory:%d\n", size_in_memory);
@@ -497,21 +534,10 @@ Process* process_create_ex(const char* name, uint32_t process_id, uint32_t threa
     initialize_program_break(process, size_in_memory);
 
 
-    const uint32_t stack_page_count = 50;
-    char* v_address_stack_page = (char *) (USER_STACK - PAGESIZE_4K * stack_page_count);
-    uint32_t stack_frames[stack_page_count];
-    for (uint32_t i = 0; i < stack_page_count; ++i)
-    {
-        stack_frames[i] = vmm_acquire_page_frame_4k();
-    }
-    void* stack_v_mem = vmm_map_memory(process, (uint32_t)v_address_stack_page, stack_frames, stack_page_count, TRUE);
-    if (NULL == stack_v_mem)
-    {
-        for (uint32_t i = 0; i < stack_page_count; ++i)
-        {
-            vmm_release_page_frame_4k(stack_frames[i]);
-        }
-    }
+    /*
+     *  Only the top of the stack is mapped now, it grows on demand up to the stack limit.
+     */
+    vmm_reserve_stack(process);
 
     uint32_t p_address_args_env_aux[1];
     p_address_args_env_aux[0] = vmm_acquire_page_frame_4k();
@@ -523,11 +549,12 @@ Process* process_create_ex(const char* name, uint32_t process_id, uint32_t threa
     }
     else
     {
-        copy_argv_env_to_process(USER_STACK, elf_data, new_argv, new_envp);
+        memcpy((uint8_t*)USER_STACK, argv_env_page, PAGESIZE_4K);
+
+        fill_auxilary_vector(USER_STACK + aux_vector_offset, elf_data);
     }
 
-    destroy_string_array(new_argv);
-    destroy_string_array(new_envp);
+    kfree(argv_env_page);
 
     uint32_t selector = 0x23;
 
@@ -566,7 +593,7 @@ Process* process_create_ex(const char* name, uint32_t process_id, uint32_t threa
      */
     if (elf_data)
     {
-        uint32_t start_location = elf_load((char*)elf_data);
+        uint32_t start_location = elf_load((char*)elf_data, process->image != NULL);
 
         //kprintf("process start location:%x\n", start_location);
 
@@ -583,13 +610,144 @@ Process* process_create_ex(const char* name, uint32_t process_id, uint32_t threa
     //Restore memory view (page directory)
     CHANGE_PD(g_current_thread->regs.cr3);
 
-    fs_open_for_process(thread, process->tty, 0); /* 0, known as standard input or `stdin`... */
-    fs_open_for_process(thread, process->tty, 0); /* 1, known as standard output or `stdout`... */
-    fs_open_for_process(thread, process->tty, 0); /* 2, known as standard error, or `stderr`... */
+    if (startup)
+    {
+        /*
+         *  Build the descriptor table exactly as described, each descriptor lands in its own slot even if lower ones stay closed.
+         *  Shared Files keep their position and open state, the child holds a reference for each descriptor. A descriptor that
+         *  can't be installed fails the whole process.
+         */
+        BOOL installed = TRUE;
+
+        for (int32_t i = 0; i < ASTERISK_MAX_OPENED_FILES && installed; ++i)
+        {
+            if (startup->shared_files[i])
+            {
+                fs_acquire_file(startup->shared_files[i]);
+
+                if (process_add_file_at(process, startup->shared_files[i], i) < 0)
+                {
+                    fs_release_file(startup->shared_files[i]);
+
+                    installed = FALSE;
+                }
+            }
+            else if (startup->files[i])
+            {
+                File* file = fs_open_for_process_at(thread, startup->files[i], startup->file_flags[i], i);
+
+                if (NULL == file)
+                {
+                    installed = FALSE;
+                }
+                else if (startup->file_offsets[i] > 0)
+                {
+                    fs_lseek(file, startup->file_offsets[i], 0); //SEEK_SET
+                }
+            }
+        }
+
+        if (!installed)
+        {
+            process_destroy(process);
+
+            return NULL;
+        }
+    }
+    else
+    {
+        fs_open_for_process(thread, process->tty, 0); /* 0, known as standard input or `stdin`... */
+        fs_open_for_process(thread, process->tty, 0); /* 1, known as standard output or `stdout`... */
+        fs_open_for_process(thread, process->tty, 0); /* 2, known as standard error, or `stderr`... */
+    }
 
     return process;
 }
 
+/*
+ *  Creates a thread for clone() in the process of `parent`. The new thread shares the page directory, the file descriptors and the signal handling of the
+ *  process, and continues from the clone() call being served by `parent` with `eax` cleared and its stack pointer at `stack` (or the parent's if 0).
+ */
+Thread* thread_clone(Thread* parent, uint32_t stack)
+{
+    Process* process = parent->owner;
+    Registers* registers = parent->syscall_registers;
+
+    Thread* thread = (Thread*)kmalloc(sizeof(Thread));
+    memset((uint8_t*)thread, 0, sizeof(Thread));
+
+    thread->owner = process;
+
+    thread->threadId = generate_thread_id();
+
+    thread->user_mode = 1;
+
+    thread_resume(thread);
+
+    thread->birth_time = get_uptime_milliseconds();
+
+    thread->message_queue = fifobuffer_create(sizeof(AsteriskMessage) * MESSAGE_QUEUE_SIZE);
+    spinlock_init(&(thread->message_queue_lock));
+
+    thread->signals = fifobuffer_create(SIGNAL_QUEUE_SIZE);
+
+    thread->regs.cr3 = (uint32_t) process->pd;
+
+    thread->regs.eax = 0; //clone() returns 0 in the child
+    thread->regs.ecx = registers->ecx;
+    thread->regs.edx = registers->edx;
+    thread->regs.ebx = registers->ebx;
+    thread->regs.ebp = registers->ebp;
+    thread->regs.esi = registers->esi;
+    thread->regs.edi = registers->edi;
+    thread->regs.eip = registers->eip;
+    thread->regs.eflags = registers->eflags;
+    thread->regs.cs = registers->cs;
+    thread->regs.ss = registers->ss;
+    thread->regs.ds = registers->ds;
+    thread->regs.es = registers->es;
+    thread->regs.fs = registers->fs;
+    thread->regs.gs = registers->gs;
+
+    thread->regs.esp = stack ? stack : registers->userEsp;
+
+    thread->tls_base = parent->tls_base;
+
+    thread->kstack.ss0 = 0x10;
+    uint8_t* kernel_stack = (uint8_t*)kmalloc(KERN_STACK_SIZE);
+    thread->kstack.esp0 = (uint32_t)(kernel_stack + KERN_STACK_SIZE - 4);
+    thread->kstack.stack_start = (uint32_t)kernel_stack;
+
+    Thread* p = g_current_thread;
+
+    while (p->next != NULL)
+    {
+        p = p->next;
+    }
+
+    p->next = thread;
+
+    return thread;
+}
+
+/*
+ *  Ends one thread of a process that keeps running. The word registered with set_tid_address is cleared and woken as a futex, this is how a joining thread
+ *  learns about the exit. Must be called by the exiting thread itself in interrupts disabled state, followed by `wait_for_schedule`.
+ */
+void thread_exit(Thread* thread)
+{
+    uint32_t* clear_child_tid = thread->clear_child_tid;
+
+    if (clear_child_tid && vmm_get_physical_address((uint32_t)clear_child_tid) != 0)
+    {
+        *clear_child_tid = 0;
+
+        futex_wake(clear_child_tid, 1);
+    }
+
+    thread_destroy(thread);
+}
+
 /*
  *  As the function name implies, this function destroys a thread, by providing the function with the struct that represents the thread. There was a previous comment
  *  that was left here by the creator of soso:
@@ -603,6 +761,9 @@ void thread_destroy(Thread* thread)
     {
         previous_thread->next = thread->next;
 
+        //its wait bucket entry lives on the kernel stack freed below
+        futex_cancel(thread);
+
         kfree((void*)thread->kstack.stack_start);
 
         spinlock_lock(&(thread->message_queue_lock));
@@ -626,6 +787,19 @@ void thread_destroy(Thread* thread)
     }
 }
 
+static BOOL has_kill_deferred_thread(Process* process)
+{
+    for (Thread* thread = g_first_thread; NULL != thread; thread = thread->next)
+    {
+        if (process == thread->owner && thread->kill_deferred > 0)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
 /*
  *  As the function name implies, this function destroys an entire process, by providing the function with the struct that represents the process. There was a previous
  *  comment that was left here by the creator of soso:
@@ -633,8 +807,29 @@ void thread_destroy(Thread* thread)
  */
 void process_destroy(Process* process)
 {
+    if (has_kill_deferred_thread(process))
+    {
+        //The rest of the process stops now, the scheduler destroys it once the last of those threads has left its section
+        process->destroy_pending = TRUE;
+
+        Thread* thread = g_first_thread;
+        while (thread)
+        {
+            if (process == thread->owner && 0 == thread->kill_deferred)
+            {
+                thread_change_state(thread, TS_SUSPEND, NULL);
+            }
+
+            thread = thread->next;
+        }
+
+        return;
+    }
+
     sharedmemory_unmap_for_process_all(process);
-    
+    tmpfs_unmap_for_process_all(process);
+    filemapping_unmap_for_process_all(process);
+
     Thread* thread = g_first_thread;
     Thread* previous = NULL;
     while (thread)
@@ -645,6 +840,8 @@ void process_destroy(Process* process)
             {
                 previous->next = thread->next;
 
+                futex_cancel(thread);
+
                 kfree((void*)thread->kstack.stack_start);
 
                 spinlock_lock(&(thread->message_queue_lock));
@@ -675,7 +872,7 @@ void process_destroy(Process* process)
     {
         if (process->fd[i] != NULL)
         {
-            fs_close(process->fd[i]);
+            fs_close_descriptor(process, i);
         }
     }
 
@@ -696,13 +893,20 @@ void process_destroy(Process* process)
         }
     }
 
+    fs_release_node(process->working_directory);
+
     log_printf("destroying process %d\r\n", process->pid);
 
     uint32_t physical_pd = (uint32_t)process->pd;
 
+    ExecutableImage* image = process->image;
+
     kfree(process);
 
     vmm_destroy_page_directory_with_memory(physical_pd);
+
+    //Shared executable pages are not owned by the page directory, they go away with the last process using them.
+    imagecache_release(image);
 }
 
 void process_change_state(Process* process, thread_state_t state)
@@ -732,6 +936,93 @@ void thread_resume(Thread* thread)
     thread->state_privateData = NULL;
 }
 
+/*
+ *  For drivers whose Files may be used by any thread of any process sharing them: the caller is listed on `list` only while it
+ *  sleeps in TS_WAITIO on `object`, thread_wake_listed resumes the listed threads still sleeping on it. A thread destroyed meanwhile
+ *  stays listed, the waker skips it and the next waiter drops it, as wakers run in interrupt handlers and don't free memory.
+ */
+void thread_wait_listed(List* list, void* object)
+{
+    Thread* thread = g_current_thread;
+
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    disable_interrupts();
+
+    ListNode* node = list->head;
+    while (node)
+    {
+        ListNode* next = node->next;
+
+        if (!thread_is_valid((Thread*)node->data))
+        {
+            list_remove_node(list, node);
+        }
+
+        node = next;
+    }
+
+    list_append(list, thread);
+
+    thread_change_state(thread, TS_WAITIO, object);
+
+    enable_interrupts();
+    halt();
+    disable_interrupts();
+
+    list_remove_first_occurrence(list, thread);
+
+    if (thread->state == TS_WAITIO && thread->state_privateData == object)
+    {
+        thread_resume(thread);
+    }
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+}
+
+//Interrupts must be disabled
+void thread_wake_listed(List* list, void* object)
+{
+    list_foreach (n, list)
+    {
+        Thread* thread = (Thread*)n->data;
+
+        if (thread_is_valid(thread) && thread->state == TS_WAITIO && thread->state_privateData == object)
+        {
+            thread_resume(thread);
+        }
+    }
+}
+
+/*
+ *  A thread sleeping in a driver or holding a lock that others sleep on (a disk channel, the block cache, a volume) must not be
+ *  destroyed there, nobody would release what it holds. Between thread_defer_kill and the matching thread_allow_kill the scheduler
+ *  leaves the thread's signals queued and process_destroy only marks the process. Both are carried out when the thread is next
+ *  scheduled outside such a section. Calls nest.
+ */
+void thread_defer_kill()
+{
+    Thread* thread = g_current_thread;
+
+    if (thread)
+    {
+        thread->kill_deferred++;
+    }
+}
+
+void thread_allow_kill()
+{
+    Thread* thread = g_current_thread;
+
+    if (thread && thread->kill_deferred > 0)
+    {
+        thread->kill_deferred--;
+    }
+}
+
 //must be called in interrupts disabled
 BOOL thread_signal(Thread* thread, uint8_t signal)
 {
@@ -754,7 +1045,7 @@ BOOL thread_signal(Thread* thread, uint8_t signal)
             fifobuffer_enqueue(thread->signals, &signal, 1);
             thread->pending_signal_count = fifobuffer_get_size(thread->signals);
 
-            if (thread->state == TS_WAITIO)
+            if (thread->state == TS_WAITIO || thread->state == TS_FUTEX)
             {
                 thread->state = TS_RUN;
                 //it should wake and it should return -EINTR
@@ -825,6 +1116,9 @@ void thread_state_to_string(thread_state_t state, uint8_t* buffer, uint32_t buff
     case TS_UNINTERRUPTIBLE:
         strncpy_null((char*)buffer, "uninterruptible", buffer_size);
         break;
+    case TS_FUTEX:
+        strncpy_null((char*)buffer, "futex", buffer_size);
+        break;
     default:
         break;
     }
@@ -863,6 +1157,24 @@ int32_t process_get_empty_fd(Process* process)
     return result;
 }
 
+uint32_t process_get_thread_count(Process* process)
+{
+    uint32_t count = 0;
+
+    Thread* thread = g_first_thread;
+    while (thread)
+    {
+        if (process == thread->owner)
+        {
+            ++count;
+        }
+
+        thread = thread->next;
+    }
+
+    return count;
+}
+
 int32_t process_add_file(Process* process, File* file)
 {
     int32_t result = -1;
@@ -877,7 +1189,6 @@ int32_t process_add_file(Process* process, File* file)
         if (process->fd[i] == NULL)
         {
             result = i;
-            file->fd = i;
             process->fd[i] = file;
             break;
         }
@@ -888,6 +1199,28 @@ int32_t process_add_file(Process* process, File* file)
     return result;
 }
 
+int32_t process_add_file_at(Process* process, File* file, int32_t fd)
+{
+    int32_t result = -1;
+
+    if (fd < 0 || fd >= ASTERISK_MAX_OPENED_FILES)
+    {
+        return result;
+    }
+
+    begin_critical_section();
+
+    if (process->fd[fd] == NULL)
+    {
+        result = fd;
+        process->fd[fd] = file;
+    }
+
+    end_critical_section();
+
+    return result;
+}
+
 int32_t process_remove_file(Process* process, File* file)
 {
     int32_t result = -1;
@@ -1046,6 +1379,10 @@ static void thread_update_state(Thread* t)
             thread_resume(t);
         }
     }
+    else if (t->state == TS_FUTEX)
+    {
+        futex_update(t);
+    }
 }
 
 static Thread* look_threads(Thread* current)
@@ -1190,7 +1527,15 @@ void schedule(TimerInt_Registers* registers)
         ready_thread = look_threads(g_first_thread);
     }
 
-    if (ready_thread != g_first_thread)
+    //A thread whose process waits in process_destroy for other threads does not run again, unless it is one of those
+    while (ready_thread != g_first_thread && ready_thread->owner->destroy_pending && 0 == ready_thread->kill_deferred)
+    {
+        process_destroy(ready_thread->owner);
+
+        ready_thread = look_threads(g_first_thread);
+    }
+
+    if (ready_thread != g_first_thread && 0 == ready_thread->kill_deferred)
     {
         if (fifobuffer_get_size(ready_thread->signals) > 0)
         {
@@ -1246,6 +1591,9 @@ static void thread_switch_to(Thread* thread, int mode)
     uint32_t kesp, eflags;
     uint16_t kss, ss, cs;
 
+    //Point the TLS segment to the thread's own block, the segment register is reloaded by switch_task
+    descriptor_tables_set_tls_base(thread->tls_base);
+
     //Set TSS values
     g_tss.ss0 = thread->kstack.ss0;
     g_tss.esp0 = thread->kstack.esp0;
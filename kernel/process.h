@@ -46,6 +46,8 @@
 #include "fifobuffer.h"
 #include "spinlock.h"
 #include "signal.h"
+#include "imagecache.h"
+#include "list.h"
 
 typedef enum
 {
@@ -58,6 +60,7 @@ typedef enum
     TS_CRITICAL,
     TS_UNINTERRUPTIBLE,
     TS_DEAD,
+    TS_FUTEX,
 } thread_state_t;
 
 typedef enum SelectState
@@ -86,6 +89,9 @@ struct Process
     char *brk_end;
     char *brk_next_unallocated_page_begin;
 
+    uint32_t stack_bottom; //lowest mapped address of the main stack
+    uint32_t stack_limit; //RLIMIT_STACK, the main stack doesn't grow below USER_STACK - stack_limit
+
     uint8_t mmapped_virtual_memory[RAM_AS_4K_PAGES / 8];
 
     filesystem_node* tty;
@@ -96,6 +102,10 @@ struct Process
 
     File* fd[ASTERISK_MAX_OPENED_FILES];
 
+    ExecutableImage* image;
+
+    BOOL destroy_pending; //process_destroy waits for threads in thread_defer_kill sections, see there
+
 } __attribute__ ((packed));
 
 typedef struct Process Process;
@@ -151,6 +161,13 @@ struct Thread
     uint32_t usage_cpu; //FromPrevMark
     uint32_t called_syscall_count;
 
+    uint32_t tls_base; //base address of the TLS segment (GDT entry 6) while this thread runs, set by set_thread_area
+    uint32_t* clear_child_tid; //set by set_tid_address, zeroed and woken as a futex when the thread exits
+
+    struct Registers* syscall_registers; //user registers of the system call being served
+
+    uint32_t kill_deferred; //nesting of thread_defer_kill, the thread holds something other threads wait for
+
 
     FifoBuffer* message_queue;
     Spinlock message_queue_lock;
@@ -169,23 +186,50 @@ typedef struct TimerInt_Registers
 } TimerInt_Registers;
 
 typedef void (*Function0)();
+typedef void (*Function1)(void* argument);
+
+/*
+ *  Describes the start-up state of a process created by `process_create_ex`. Descriptor `i` of the new process gets `shared_files[i]` itself,
+ *  with a reference of its own, or else a new File opened on `files[i]` with `file_flags[i]` and positioned at `file_offsets[i]`. Entries NULL
+ *  in both leave the descriptor closed. Passing NULL instead of this structure gives the usual start-up state: the parent's working directory
+ *  and the TTY on descriptors 0, 1 and 2.
+ */
+typedef struct ProcessStartup
+{
+    filesystem_node* working_directory;
+
+    filesystem_node* files[ASTERISK_MAX_OPENED_FILES];
+    uint32_t file_flags[ASTERISK_MAX_OPENED_FILES];
+    int32_t file_offsets[ASTERISK_MAX_OPENED_FILES];
+    File* shared_files[ASTERISK_MAX_OPENED_FILES]; //Files installed as they are (spawn's dup2), the caller keeps its references
+} ProcessStartup;
 
 void tasking_initialize();
 void thread_create_kthread(Function0 func);
+Thread* thread_create_kthread_in_process(Process* process, Function1 func, void* argument);
 Process* process_create_from_elf_data(const char* name, uint8_t* elf_data, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty);
+Process* process_create_from_elf_file(const char* name, filesystem_node* image_node, uint8_t* elf_data, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty);
 Process* process_create_from_function(const char* name, Function0 func, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty);
-Process* process_create_ex(const char* name, uint32_t process_id, uint32_t thread_id, Function0 func, uint8_t* elf_data, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty);
+Process* process_create_ex(const char* name, uint32_t process_id, uint32_t thread_id, Function0 func, uint8_t* elf_data, filesystem_node* image_node, char *const argv[], char *const envp[], Process* parent, filesystem_node* tty, const ProcessStartup* startup);
+Thread* thread_clone(Thread* parent, uint32_t stack);
+void thread_exit(Thread* thread);
 void thread_destroy(Thread* thread);
 void process_destroy(Process* process);
 void process_change_state(Process* process, thread_state_t state);
 void thread_change_state(Thread* thread, thread_state_t state, void* private_data);
 void thread_resume(Thread* thread);
+void thread_defer_kill();
+void thread_allow_kill();
+void thread_wait_listed(List* list, void* object);
+void thread_wake_listed(List* list, void* object);
 BOOL thread_signal(Thread* thread, uint8_t signal);
 BOOL process_signal(uint32_t pid, uint8_t signal);
 void thread_state_to_string(thread_state_t state, uint8_t* buffer, uint32_t buffer_size);
 void wait_for_schedule();
 int32_t process_get_empty_fd(Process* process);
+uint32_t process_get_thread_count(Process* process);
 int32_t process_add_file(Process* process, File* file);
+int32_t process_add_file_at(Process* process, File* file, int32_t fd);
 int32_t process_remove_file(Process* process, File* file);
 File* process_find_file(Process* process, filesystem_node* node);
 Thread* thread_get_by_id(uint32_t thread_id);
@@ -0,0 +1,257 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+
+#include "radixtree.h"
+#include "alloc.h"
+
+/*
+ *  Sparse array of pointers indexed by a 32 bit number. Each node has 64 slots, so a tree of height h holds the indices below 64^h.
+ *  The tree grows upwards when a larger index is inserted and nodes are freed as soon as they become empty.
+ */
+
+#define RADIXTREE_SHIFT 6
+#define RADIXTREE_SLOTS (1 << RADIXTREE_SHIFT)
+#define RADIXTREE_MASK (RADIXTREE_SLOTS - 1)
+#define RADIXTREE_MAX_HEIGHT ((32 + RADIXTREE_SHIFT - 1) / RADIXTREE_SHIFT)
+
+typedef struct RadixTreeNode
+{
+    void* slots[RADIXTREE_SLOTS];
+    uint32_t count;
+} RadixTreeNode;
+
+struct RadixTree
+{
+    RadixTreeNode* root;
+    uint32_t height;
+};
+
+static RadixTreeNode* create_node()
+{
+    RadixTreeNode* node = (RadixTreeNode*)kmalloc(sizeof(RadixTreeNode));
+    memset((uint8_t*)node, 0, sizeof(RadixTreeNode));
+
+    return node;
+}
+
+static void destroy_node(RadixTreeNode* node, uint32_t height)
+{
+    if (height > 1)
+    {
+        for (uint32_t i = 0; i < RADIXTREE_SLOTS; ++i)
+        {
+            if (node->slots[i])
+            {
+                destroy_node((RadixTreeNode*)node->slots[i], height - 1);
+            }
+        }
+    }
+
+    kfree(node);
+}
+
+static uint32_t get_max_index(uint32_t height)
+{
+    uint32_t shift = height * RADIXTREE_SHIFT;
+
+    if (shift >= 32)
+    {
+        return 0xFFFFFFFF;
+    }
+
+    return (1 << shift) - 1;
+}
+
+RadixTree* radixtree_create()
+{
+    RadixTree* tree = (RadixTree*)kmalloc(sizeof(RadixTree));
+    memset((uint8_t*)tree, 0, sizeof(RadixTree));
+
+    return tree;
+}
+
+//Items are not freed
+void radixtree_destroy(RadixTree* tree)
+{
+    if (tree->root)
+    {
+        destroy_node(tree->root, tree->height);
+    }
+
+    kfree(tree);
+}
+
+void* radixtree_lookup(RadixTree* tree, uint32_t index)
+{
+    if (NULL == tree->root || index > get_max_index(tree->height))
+    {
+        return NULL;
+    }
+
+    RadixTreeNode* node = tree->root;
+
+    for (uint32_t level = tree->height - 1; level > 0; --level)
+    {
+        node = (RadixTreeNode*)node->slots[(index >> (level * RADIXTREE_SHIFT)) & RADIXTREE_MASK];
+
+        if (NULL == node)
+        {
+            return NULL;
+        }
+    }
+
+    return node->slots[index & RADIXTREE_MASK];
+}
+
+//Returns FALSE if there is already an item at the index
+BOOL radixtree_insert(RadixTree* tree, uint32_t index, void* item)
+{
+    if (NULL == item)
+    {
+        return FALSE;
+    }
+
+    if (NULL == tree->root)
+    {
+        tree->height = 1;
+        while (index > get_max_index(tree->height))
+        {
+            tree->height++;
+        }
+
+        tree->root = create_node();
+    }
+
+    while (index > get_max_index(tree->height))
+    {
+        RadixTreeNode* new_root = create_node();
+        new_root->slots[0] = tree->root;
+        new_root->count = 1;
+
+        tree->root = new_root;
+        tree->height++;
+    }
+
+    RadixTreeNode* node = tree->root;
+
+    for (uint32_t level = tree->height - 1; level > 0; --level)
+    {
+        uint32_t slot = (index >> (level * RADIXTREE_SHIFT)) & RADIXTREE_MASK;
+
+        if (NULL == node->slots[slot])
+        {
+            node->slots[slot] = create_node();
+            node->count++;
+        }
+
+        node = (RadixTreeNode*)node->slots[slot];
+    }
+
+    uint32_t slot = index & RADIXTREE_MASK;
+
+    if (node->slots[slot])
+    {
+        return FALSE;
+    }
+
+    node->slots[slot] = item;
+    node->count++;
+
+    return TRUE;
+}
+
+//Returns the removed item or NULL if there was nothing at the index
+void* radixtree_remove(RadixTree* tree, uint32_t index)
+{
+    if (NULL == tree->root || index > get_max_index(tree->height))
+    {
+        return NULL;
+    }
+
+    RadixTreeNode* path[RADIXTREE_MAX_HEIGHT];
+    uint32_t slots[RADIXTREE_MAX_HEIGHT];
+
+    RadixTreeNode* node = tree->root;
+
+    for (uint32_t level = tree->height - 1; ; --level)
+    {
+        uint32_t slot = (index >> (level * RADIXTREE_SHIFT)) & RADIXTREE_MASK;
+
+        path[level] = node;
+        slots[level] = slot;
+
+        if (0 == level)
+        {
+            break;
+        }
+
+        node = (RadixTreeNode*)node->slots[slot];
+
+        if (NULL == node)
+        {
+            return NULL;
+        }
+    }
+
+    void* item = path[0]->slots[slots[0]];
+
+    if (NULL == item)
+    {
+        return NULL;
+    }
+
+    //Clear the slot and free the nodes that became empty on the way up
+    for (uint32_t level = 0; level < tree->height; ++level)
+    {
+        node = path[level];
+
+        node->slots[slots[level]] = NULL;
+        node->count--;
+
+        if (node->count > 0)
+        {
+            break;
+        }
+
+        kfree(node);
+
+        if (node == tree->root)
+        {
+            tree->root = NULL;
+            tree->height = 0;
+        }
+    }
+
+    return item;
+}
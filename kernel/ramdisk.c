@@ -35,11 +35,26 @@
 #include "alloc.h"
 #include "fs.h"
 #include "devfs.h"
+#include "vmm.h"
+#include "errno.h"
+#include "blockcache.h"
+#include "lz4.h"
+#include "process.h"
+
+/*
+ *  A ramdisk is an array of page frames indexed by disk page number. Frames are acquired on the first write to a page, so a
+ *  page that was never written reads as zeros and costs no memory.
+ *  A ramdisk can also sit on top of memory that is already filled (the initrd module). Without copy-on-write there is no page
+ *  array and the memory is used directly, with copy-on-write a page is copied into its own frame before it is first written.
+ */
 
 typedef struct Ramdisk
 {
     uint8_t* buffer;
     uint32_t size;
+    uint32_t* pages;
+    uint32_t page_count;
+    uint32_t owner_pid; //process that created it through the system call, 0 for the kernel
 } Ramdisk;
 
 #define RAMDISK_BLOCKSIZE 512
@@ -50,65 +65,420 @@ static int32_t read_block(filesystem_node* node, uint32_t block_number, uint32_t
 static int32_t write_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer);
 static int32_t ioctl(File *node, int32_t request, void * argp);
 
-BOOL ramdisk_create(const char* devName, uint32_t size)
+static const filesystem_ops g_ramdisk_ops =
 {
-    Ramdisk* ramdisk = kmalloc(sizeof(Ramdisk));
-    ramdisk->size = size;
-    ramdisk->buffer = kmalloc(size);
+    .open = open,
+    .close = close,
+    .read_block = read_block,
+    .write_block = write_block,
+    .ioctl = ioctl
+};
 
+static BOOL register_ramdisk(const char* devName, Ramdisk* ramdisk)
+{
     Device device;
     memset((uint8_t*)&device, 0, sizeof(device));
     strcpy(device.name, devName);
     device.device_type = FT_BLOCK_DEVICE;
-    device.open = open;
-    device.close = close;
-    device.read_block = read_block;
-    device.write_block = write_block;
-    device.ioctl = ioctl;
+    device.ops = &g_ramdisk_ops;
     device.private_data = ramdisk;
 
-    if (devfs_register_device(&device))
+    return devfs_register_device(&device) != NULL;
+}
+
+//Grows or shrinks the page array, pages past the new end are released
+static int32_t resize(Ramdisk* ramdisk, uint32_t size)
+{
+    uint32_t page_count = size > 0 ? PAGE_COUNT(size) : 0;
+
+    uint32_t* pages = NULL;
+    if (page_count > 0)
+    {
+        pages = (uint32_t*)kmalloc(page_count * sizeof(uint32_t));
+        memset((uint8_t*)pages, 0, page_count * sizeof(uint32_t));
+    }
+
+    begin_critical_section();
+
+    for (uint32_t i = 0; i < ramdisk->page_count; ++i)
+    {
+        if (i < page_count)
+        {
+            pages[i] = ramdisk->pages[i];
+        }
+        else if (ramdisk->pages[i])
+        {
+            vmm_release_page_frame_4k(ramdisk->pages[i]);
+        }
+    }
+
+    uint32_t* old_pages = ramdisk->pages;
+
+    ramdisk->pages = pages;
+    ramdisk->page_count = page_count;
+    ramdisk->size = size;
+
+    end_critical_section();
+
+    if (old_pages)
+    {
+        kfree(old_pages);
+    }
+
+    return 0;
+}
+
+//Frames are acquired lazily, a disk that could never be filled is refused up front
+static BOOL fits_in_memory(uint32_t size)
+{
+    return PAGE_COUNT(size) <= vmm_get_free_page_count();
+}
+
+BOOL ramdisk_create(const char* devName, uint32_t size, uint32_t owner_pid)
+{
+    if (size < RAMDISK_BLOCKSIZE || !fits_in_memory(size) || strlen(devName) >= sizeof(((Device*)0)->name))
+    {
+        return FALSE;
+    }
+
+    Ramdisk* ramdisk = kmalloc(sizeof(Ramdisk));
+    memset((uint8_t*)ramdisk, 0, sizeof(Ramdisk));
+    ramdisk->owner_pid = owner_pid;
+    resize(ramdisk, size - size % RAMDISK_BLOCKSIZE);
+
+    if (register_ramdisk(devName, ramdisk))
     {
         return TRUE;
     }
 
-    kfree(ramdisk->buffer);
+    resize(ramdisk, 0);
     kfree(ramdisk);
 
     return FALSE;
 }
 
-static BOOL open(File *file, uint32_t flags)
+BOOL ramdisk_create_from_memory(const char* devName, uint8_t* buffer, uint32_t size, BOOL copy_on_write)
 {
-    return TRUE;
+    if (size < RAMDISK_BLOCKSIZE)
+    {
+        return FALSE;
+    }
+
+    Ramdisk* ramdisk = kmalloc(sizeof(Ramdisk));
+    memset((uint8_t*)ramdisk, 0, sizeof(Ramdisk));
+    ramdisk->buffer = buffer;
+    //Only whole blocks are addressable
+    ramdisk->size = size - size % RAMDISK_BLOCKSIZE;
+
+    if (copy_on_write)
+    {
+        resize(ramdisk, ramdisk->size);
+    }
+
+    if (register_ramdisk(devName, ramdisk))
+    {
+        return TRUE;
+    }
+
+    resize(ramdisk, 0);
+    kfree(ramdisk);
+
+    return FALSE;
 }
 
-static void close(File *file)
+static filesystem_node* find_ramdisk(const char* devName)
 {
+    char path[128];
+    sprintf(path, sizeof(path), "/dev/%s", devName);
+
+    filesystem_node* node = fs_get_node(path);
+
+    //The block cache replaces the node's table with its own copy, so the ioctl identifies a ramdisk
+    if (NULL == node || node->ops->ioctl != ioctl)
+    {
+        return NULL;
+    }
+
+    return node;
 }
 
-static int32_t read_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
+static int32_t resize_device(filesystem_node* node, uint32_t size, uint32_t caller_pid)
 {
     Ramdisk* ramdisk = (Ramdisk*)node->private_node_data;
 
-    uint32_t location = block_number * RAMDISK_BLOCKSIZE;
-    uint32_t size = count * RAMDISK_BLOCKSIZE;
+    //Only the creator, kernel made disks can't be resized
+    if (0 == ramdisk->owner_pid || ramdisk->owner_pid != caller_pid)
+    {
+        return -EPERM;
+    }
 
-    if (location + size > ramdisk->size)
+    if (ramdisk->buffer || size < RAMDISK_BLOCKSIZE)
     {
-        return -1;
+        //The size of adopted memory is fixed
+        return -EINVAL;
+    }
+
+    size -= size % RAMDISK_BLOCKSIZE;
+
+    if (size > ramdisk->size && !fits_in_memory(size - ramdisk->size))
+    {
+        return -ENOMEM;
+    }
+
+    //Cached blocks past a new end would be read back (or written) at the old size
+    if (size < ramdisk->size)
+    {
+        blockcache_invalidate(node, size / RAMDISK_BLOCKSIZE);
+    }
+
+    return resize(ramdisk, size);
+}
+
+BOOL ramdisk_exists(const char* devName)
+{
+    return find_ramdisk(devName) != NULL;
+}
+
+int32_t ramdisk_resize(const char* devName, uint32_t size, uint32_t caller_pid)
+{
+    filesystem_node* node = find_ramdisk(devName);
+    if (NULL == node)
+    {
+        return -ENODEV;
+    }
+
+    return resize_device(node, size, caller_pid);
+}
+
+//Returns the frame holding the page, acquiring it on first write. Returns 0 if the page has none.
+static uint32_t get_frame(Ramdisk* ramdisk, uint32_t index, BOOL write)
+{
+    uint32_t frame = ramdisk->pages[index];
+    if (frame || !write)
+    {
+        return frame;
+    }
+
+    if (vmm_get_free_page_count() < 2)
+    {
+        return 0;
+    }
+
+    frame = vmm_acquire_page_frame_4k();
+
+    uint8_t* data = (uint8_t*)vmm_map_temporary(frame);
+    if (NULL == data)
+    {
+        vmm_release_page_frame_4k(frame);
+        return 0;
+    }
+
+    if (ramdisk->buffer)
+    {
+        uint32_t page_begin = index * PAGESIZE_4K;
+        uint32_t page_size = MIN(PAGESIZE_4K, ramdisk->size - page_begin);
+
+        memcpy(data, ramdisk->buffer + page_begin, page_size);
     }
+    else
+    {
+        memset(data, 0, PAGESIZE_4K);
+    }
+
+    vmm_unmap_temporary(data);
 
     begin_critical_section();
 
-    memcpy(buffer, ramdisk->buffer + location, size);
+    if (ramdisk->pages[index])
+    {
+        //Someone else filled it meanwhile
+        vmm_release_page_frame_4k(frame);
+        frame = ramdisk->pages[index];
+    }
+    else
+    {
+        ramdisk->pages[index] = frame;
+    }
 
     end_critical_section();
 
+    return frame;
+}
+
+//Copies page by page so that interrupts are disabled only while a page array entry changes
+static int32_t copy(Ramdisk* ramdisk, uint32_t location, uint8_t* buffer, uint32_t size, BOOL to_disk)
+{
+    if (NULL == ramdisk->pages)
+    {
+        if (to_disk)
+        {
+            memcpy(ramdisk->buffer + location, buffer, size);
+        }
+        else
+        {
+            memcpy(buffer, ramdisk->buffer + location, size);
+        }
+
+        return 0;
+    }
+
+    uint32_t done = 0;
+    while (done < size)
+    {
+        uint32_t index = (location + done) / PAGESIZE_4K;
+        uint32_t page_offset = (location + done) % PAGESIZE_4K;
+        uint32_t chunk = MIN(PAGESIZE_4K - page_offset, size - done);
+
+        uint32_t frame = get_frame(ramdisk, index, to_disk);
+        if (0 == frame)
+        {
+            if (to_disk)
+            {
+                return -1;
+            }
+
+            if (ramdisk->buffer)
+            {
+                memcpy(buffer + done, ramdisk->buffer + location + done, chunk);
+            }
+            else
+            {
+                memset(buffer + done, 0, chunk);
+            }
+        }
+        else
+        {
+            uint8_t* data = (uint8_t*)vmm_map_temporary(frame);
+            if (NULL == data)
+            {
+                return -1;
+            }
+
+            if (to_disk)
+            {
+                memcpy(data + page_offset, buffer + done, chunk);
+            }
+            else
+            {
+                memcpy(buffer + done, data + page_offset, chunk);
+            }
+
+            vmm_unmap_temporary(data);
+        }
+
+        done += chunk;
+    }
+
     return 0;
 }
 
-static int32_t write_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
+typedef struct Lz4Target
+{
+    Ramdisk* ramdisk;
+    uint32_t offset;
+} Lz4Target;
+
+static BOOL is_zero(const uint8_t* data, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        if (data[i])
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static int32_t write_decompressed(void* context, const uint8_t* data, uint32_t size)
+{
+    Lz4Target* target = (Lz4Target*)context;
+    Ramdisk* ramdisk = target->ramdisk;
+
+    if (size > 0xFFFFFFFF - target->offset)
+    {
+        return -1;
+    }
+
+    if (target->offset + size > ramdisk->size)
+    {
+        //The frame did not declare its size, so the disk grows as it is decompressed
+        resize(ramdisk, MAX(target->offset + size, ramdisk->size * 2));
+    }
+
+    uint32_t done = 0;
+    while (done < size)
+    {
+        uint32_t location = target->offset + done;
+        uint32_t chunk = MIN(PAGESIZE_4K - location % PAGESIZE_4K, size - done);
+
+        //Zero filled pages are left without frames as they read as zeros anyway
+        if (ramdisk->pages[location / PAGESIZE_4K] || !is_zero(data + done, chunk))
+        {
+            if (copy(ramdisk, location, (uint8_t*)data + done, chunk, TRUE) < 0)
+            {
+                return -1;
+            }
+        }
+
+        done += chunk;
+    }
+
+    target->offset += size;
+
+    return 0;
+}
+
+int32_t ramdisk_create_from_lz4(const char* devName, const uint8_t* image, uint32_t size)
+{
+    if (strlen(devName) >= sizeof(((Device*)0)->name))
+    {
+        return -1;
+    }
+
+    Ramdisk* ramdisk = kmalloc(sizeof(Ramdisk));
+    memset((uint8_t*)ramdisk, 0, sizeof(Ramdisk));
+
+    uint32_t content_size = 0;
+    if (lz4_get_content_size(image, size, &content_size) && content_size > 0)
+    {
+        resize(ramdisk, content_size);
+    }
+
+    Lz4Target target;
+    target.ramdisk = ramdisk;
+    target.offset = 0;
+
+    int32_t result = lz4_decompress_frame(image, size, write_decompressed, &target);
+
+    if (result >= RAMDISK_BLOCKSIZE)
+    {
+        //Only whole blocks are addressable
+        resize(ramdisk, target.offset - target.offset % RAMDISK_BLOCKSIZE);
+
+        if (register_ramdisk(devName, ramdisk))
+        {
+            return result;
+        }
+    }
+
+    resize(ramdisk, 0);
+    kfree(ramdisk);
+
+    return -1;
+}
+
+static BOOL open(File *file, uint32_t flags)
+{
+    return TRUE;
+}
+
+static void close(File *file)
+{
+}
+
+static int32_t read_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
 {
     Ramdisk* ramdisk = (Ramdisk*)node->private_node_data;
 
@@ -120,13 +490,22 @@ static int32_t write_block(filesystem_node* node, uint32_t block_number, uint32_
         return -1;
     }
 
-    begin_critical_section();
+    return copy(ramdisk, location, buffer, size, FALSE);
+}
 
-    memcpy(ramdisk->buffer + location, buffer, size);
+static int32_t write_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
+{
+    Ramdisk* ramdisk = (Ramdisk*)node->private_node_data;
 
-    end_critical_section();
+    uint32_t location = block_number * RAMDISK_BLOCKSIZE;
+    uint32_t size = count * RAMDISK_BLOCKSIZE;
 
-    return 0;
+    if (location + size > ramdisk->size)
+    {
+        return -1;
+    }
+
+    return copy(ramdisk, location, buffer, size, TRUE);
 }
 
 static int32_t ioctl(File *node, int32_t request, void * argp)
@@ -145,6 +524,13 @@ static int32_t ioctl(File *node, int32_t request, void * argp)
         *result = RAMDISK_BLOCKSIZE;
         return 0;
         break;
+    case IC_SET_SECTOR_COUNT:
+        if (*result > 0xFFFFFFFF / RAMDISK_BLOCKSIZE)
+        {
+            return -1;
+        }
+        return resize_device(node->node, *result * RAMDISK_BLOCKSIZE, thread_get_current()->owner->pid);
+        break;
     default:
         break;
     }
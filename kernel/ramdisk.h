@@ -35,4 +35,17 @@
 
 #include "common.h"
 
-BOOL ramdisk_create(const char* devName, uint32_t size);
\ No newline at end of file
+//Creates a sparse ramdisk, memory is used only for blocks that have been written. The size has to fit in the free memory.
+//owner_pid is the process allowed to resize it, 0 for none.
+BOOL ramdisk_create(const char* devName, uint32_t size, uint32_t owner_pid);
+
+//Uses memory that is already filled (such as a boot module) as the disk without copying it.
+//With copy_on_write the memory is never modified; written pages are copied first.
+BOOL ramdisk_create_from_memory(const char* devName, uint8_t* buffer, uint32_t size, BOOL copy_on_write);
+//Decompresses an LZ4 frame image into a new sparse ramdisk in one pass. Returns the decompressed size or -1.
+int32_t ramdisk_create_from_lz4(const char* devName, const uint8_t* image, uint32_t size);
+
+BOOL ramdisk_exists(const char* devName);
+
+//Changes the size of a ramdisk made by ramdisk_create for caller_pid, blocks past a smaller size are released
+int32_t ramdisk_resize(const char* devName, uint32_t size, uint32_t caller_pid);
@@ -41,14 +41,19 @@
 static BOOL random_open(File *file, uint32_t flags);
 static int32_t random_read(File *file, uint32_t size, uint8_t *buffer);
 
+static const filesystem_ops g_random_ops =
+{
+    .open = random_open,
+    .read = random_read
+};
+
 void random_initialize()
 {
     Device device;
     memset((uint8_t*)&device, 0, sizeof(Device));
     strcpy(device.name, "random");
     device.device_type = FT_CHARACTER_DEVICE;
-    device.open = random_open;
-    device.read = random_read;
+    device.ops = &g_random_ops;
 
     devfs_register_device(&device);
 }
@@ -40,16 +40,19 @@ static filesystem_node *rootfs_finddir(filesystem_node *node, char *name);
 static struct filesystem_dirent *rootfs_readdir(filesystem_node *node, uint32_t index);
 static BOOL rootfs_mkdir(filesystem_node *node, const char *name, uint32_t flags);
 
+static const filesystem_ops g_rootfs_ops =
+{
+    .open = rootfs_open,
+    .close = rootfs_close,
+    .readdir = rootfs_readdir,
+    .finddir = rootfs_finddir,
+    .mkdir = rootfs_mkdir
+};
+
 filesystem_node* rootfs_initialize()
 {
-    filesystem_node* root = (filesystem_node*)kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)root, 0, sizeof(filesystem_node));
+    filesystem_node* root = fs_create_node("", &g_rootfs_ops);
     root->node_type = FT_DIRECTORY;
-    root->open = rootfs_open;
-    root->close = rootfs_close;
-    root->readdir = rootfs_readdir;
-    root->finddir = rootfs_finddir;
-    root->mkdir = rootfs_mkdir;
 
     return root;
 }
@@ -114,15 +117,8 @@ static BOOL rootfs_mkdir(filesystem_node *node, const char *name, uint32_t flags
         n = n->next_sibling;
     }
 
-    filesystem_node* new_node = (filesystem_node*)kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)new_node, 0, sizeof(filesystem_node));
-    strcpy(new_node->name, name);
+    filesystem_node* new_node = fs_create_node(name, &g_rootfs_ops);
     new_node->node_type = FT_DIRECTORY;
-    new_node->open = rootfs_open;
-    new_node->close = rootfs_close;
-    new_node->readdir = rootfs_readdir;
-    new_node->finddir = rootfs_finddir;
-    new_node->mkdir = rootfs_mkdir;
     new_node->parent = node;
 
     if (node->first_child == NULL)
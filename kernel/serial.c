@@ -43,7 +43,7 @@
 #define PORT 0x3f8   //COM1
 
 static FifoBuffer* g_buffer_com1 = NULL;
-static List* g_accessing_threads = NULL;
+static List* g_accessing_threads = NULL; //blocked in serial_read
 
 static void handle_serial_interrupt(Registers *regs);
 
@@ -54,6 +54,16 @@ static int32_t serial_read(File *file, uint32_t size, uint8_t *buffer);
 static BOOL serial_write_test_ready(File *file);
 static int32_t serial_write(File *file, uint32_t size, uint8_t *buffer);
 
+static const filesystem_ops g_serial_ops =
+{
+    .open = serial_open,
+    .close = serial_close,
+    .read = serial_read,
+    .write = serial_write,
+    .read_test_ready = serial_read_test_ready,
+    .write_test_ready = serial_write_test_ready
+};
+
 //TODO: support more than one serial devices
 
 void serial_initialize()
@@ -76,12 +86,7 @@ void serial_initialize()
     memset((uint8_t*)&device, 0, sizeof(Device));
     strcpy(device.name, "com1");
     device.device_type = FT_CHARACTER_DEVICE;
-    device.open = serial_open;
-    device.close = serial_close;
-    device.read = serial_read;
-    device.write = serial_write;
-    device.read_test_ready = serial_read_test_ready;
-    device.write_test_ready = serial_write_test_ready;
+    device.ops = &g_serial_ops;
 
     devfs_register_device(&device);
 }
@@ -125,18 +130,7 @@ static void handle_serial_interrupt(Registers *regs)
     //if buffer is full, we miss the data
     fifobuffer_enqueue(g_buffer_com1, &c, 1);
 
-    list_foreach (n, g_accessing_threads)
-    {
-        Thread* reader = n->data;
-
-        if (reader->state == TS_WAITIO)
-        {
-            if (reader->state_privateData == serial_read)
-            {
-                thread_resume(reader);
-            }
-        }
-    }
+    thread_wake_listed(g_accessing_threads, serial_read);
 }
 
 void serial_printf(const char *format, ...)
@@ -199,14 +193,11 @@ void serial_printf(const char *format, ...)
 
 static BOOL serial_open(File *file, uint32_t flags)
 {
-    list_append(g_accessing_threads, file->thread);
-
     return TRUE;
 }
 
 static void serial_close(File *file)
 {
-    list_remove_first_occurrence(g_accessing_threads, file->thread);
 }
 
 static BOOL serial_read_test_ready(File *file)
@@ -228,15 +219,11 @@ static int32_t serial_read(File *file, uint32_t size, uint8_t *buffer)
 
     while (serial_read_test_ready(file) == FALSE)
     {
-        thread_change_state(file->thread, TS_WAITIO, serial_read);
-        enable_interrupts();
-        halt();
+        thread_wait_listed(g_accessing_threads, serial_read);
     }
 
     disable_interrupts();
 
-    thread_resume(file->thread);
-
     int32_t read_bytes = fifobuffer_dequeue(g_buffer_com1, buffer, size);
 
     return read_bytes;
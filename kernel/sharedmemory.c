@@ -50,6 +50,13 @@ static BOOL sharedmemorydir_open(File *file, uint32_t flags);
 static filesystem_dirent *sharedmemorydir_readdir(filesystem_node *node, uint32_t index);
 static filesystem_node *sharedmemorydir_finddir(filesystem_node *node, char *name);
 
+static const filesystem_ops g_shm_root_ops =
+{
+    .open = sharedmemorydir_open,
+    .readdir = sharedmemorydir_readdir,
+    .finddir = sharedmemorydir_finddir
+};
+
 typedef struct MapInfo
 {
     Process* process;
@@ -83,9 +90,7 @@ void sharedmemory_initialize()
     }
     else
     {
-        g_shm_root->open = sharedmemorydir_open;
-        g_shm_root->finddir = sharedmemorydir_finddir;
-        g_shm_root->readdir = sharedmemorydir_readdir;
+        g_shm_root->ops = &g_shm_root_ops;
     }
 }
 
@@ -213,7 +218,7 @@ static int32_t sharedmemory_ftruncate(File *file, int32_t length)
     return 0;
 }
 
-static void* sharedmemory_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags)
+static void* sharedmemory_mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags, uint32_t protection)
 {
     void* result = NULL;
 
@@ -232,7 +237,7 @@ static void* sharedmemory_mmap(File* file, uint32_t size, uint32_t offset, uint3
 
             ++i;
         }
-        result = vmm_map_memory(file->thread->owner, USER_MMAP_START, physical_address_array, count, FALSE);
+        result = vmm_map_memory(g_current_thread->owner, USER_MMAP_START, physical_address_array, count, FALSE);
 
         MapInfo* info = (MapInfo*)kmalloc(sizeof(MapInfo));
         memset((uint8_t*)info, 0, sizeof(MapInfo));
@@ -330,6 +335,14 @@ filesystem_node* sharedmemory_get_node(const char* name)
     return result;
 }
 
+static const filesystem_ops g_shm_ops =
+{
+    .open = sharedmemory_open,
+    .unlink = sharedmemory_unlink,
+    .ftruncate = sharedmemory_ftruncate,
+    .mmap = sharedmemory_mmap
+};
+
 filesystem_node* sharedmemory_create(const char* name)
 {
     if (sharedmemory_get_node(name) != NULL)
@@ -340,15 +353,9 @@ filesystem_node* sharedmemory_create(const char* name)
     SharedMemory* shared_mem = (SharedMemory*)kmalloc(sizeof(SharedMemory));
     memset((uint8_t*)shared_mem, 0, sizeof(SharedMemory));
 
-    filesystem_node* node = (filesystem_node*)kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)node, 0, sizeof(filesystem_node));
+    filesystem_node* node = fs_create_node(name, &g_shm_ops);
 
-    strcpy(node->name, name);
     node->node_type = FT_CHARACTER_DEVICE;
-    node->open = sharedmemory_open;
-    node->unlink = sharedmemory_unlink;
-    node->ftruncate = sharedmemory_ftruncate;
-    node->mmap = sharedmemory_mmap;
     node->private_node_data = shared_mem;
 
     shared_mem->node = node;
@@ -127,7 +127,7 @@ static void socket_destroy(Socket* socket)
     kfree(socket);
 }
 
-static BOOL socket_fs_open(File* file, uint32_t flags)
+BOOL socket_fs_open(File* file, uint32_t flags)
 {
     Socket* socket = (Socket*)file->node->private_node_data;
 
@@ -141,7 +141,7 @@ static BOOL socket_fs_open(File* file, uint32_t flags)
     return TRUE;
 }
 
-static void socket_fs_close(File* file)
+void socket_fs_close(File* file)
 {
     Socket* socket = (Socket*)file->node->private_node_data;
 
@@ -164,6 +164,12 @@ static void socket_fs_close(File* file)
     socket_destroy(socket);
 }
 
+static const filesystem_ops g_socket_ops =
+{
+    .open = socket_fs_open,
+    .close = socket_fs_close
+};
+
 int syscall_socket(int domain, int type, int protocol)
 {
     //kprintf("socket %d %d %d\n", domain, type, protocol);
@@ -174,8 +180,7 @@ int syscall_socket(int domain, int type, int protocol)
 
         socket->domain = domain;
 
-        filesystem_node* node = (filesystem_node*)kmalloc(sizeof(filesystem_node));
-        memset((uint8_t*)node, 0, sizeof(filesystem_node));
+        filesystem_node* node = fs_create_node(NULL, &g_socket_ops);
 
         socket->last_thread = g_current_thread;
 
@@ -184,9 +189,6 @@ int syscall_socket(int domain, int type, int protocol)
 
         node->node_type = FT_SOCKET;
 
-        node->open = socket_fs_open;
-        node->close = socket_fs_close;
-
         File* file = fs_open_for_process(g_current_thread, node, O_RDWR);
 
         if (file)
@@ -396,4 +396,8 @@ typedef struct Socket
 
 typedef struct List List;
 
-extern List* g_socket_list;
\ No newline at end of file
+extern List* g_socket_list;
+
+//Domains replace the node's operations on setup, their tables keep these two
+BOOL socket_fs_open(File* file, uint32_t flags);
+void socket_fs_close(File* file);
\ No newline at end of file
@@ -0,0 +1,284 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+ 
+#include "splice.h"
+#include "fs.h"
+#include "alloc.h"
+#include "errno.h"
+#include "pagecache.h"
+#include "pipe.h"
+#include "process.h"
+
+/*
+ *  sendfile and splice move data between descriptors without passing it through the process.
+ *  Regular files are read from the page cache, each cached page is written to the output as it is, so a file goes into a pipe's or a socket's
+ *  buffer with a single copy. Pipe to pipe moves data from one FifoBuffer to the other. Other sources are read into a kernel buffer one chunk
+ *  at a time, like a read would, and written from there.
+ *  Offsets given by pointer are used instead of the file position and updated, the file position is not touched (fs_pread, fs_pwrite and
+ *  pagecache_read_at), so other threads sharing the File never see it change.
+ */
+
+//Where write_all writes
+typedef struct SpliceTarget
+{
+    File* file;
+    int32_t offset; //FS_OFFSET_CURRENT for the file position, advanced otherwise
+} SpliceTarget;
+
+//Pipes take what fits, the rest is written once there is room again
+static int32_t write_all(void* context, uint32_t done, uint8_t* data, uint32_t size)
+{
+    SpliceTarget* out = (SpliceTarget*)context;
+
+    uint32_t written = 0;
+    while (written < size)
+    {
+        int32_t result = 0;
+
+        if (FS_OFFSET_CURRENT == out->offset)
+        {
+            result = (int32_t)fs_write(out->file, size - written, data + written);
+        }
+        else
+        {
+            result = fs_pwrite(out->file, size - written, data + written, out->offset);
+        }
+
+        if (result <= 0)
+        {
+            return written > 0 ? (int32_t)written : result;
+        }
+
+        if (out->offset != FS_OFFSET_CURRENT)
+        {
+            out->offset += result;
+        }
+
+        written += result;
+    }
+
+    return (int32_t)written;
+}
+
+//Moves up to `count` bytes from `in` at `in_offset` (FS_OFFSET_CURRENT for its position, which is advanced then) to `out`
+static int32_t transfer(File* in, int32_t in_offset, SpliceTarget* out, uint32_t count)
+{
+    //Pipes have no offsets
+    if (pipe_is_pipe(in->node) && pipe_is_pipe(out->file->node))
+    {
+        return pipe_splice(in, out->file, count);
+    }
+
+    if (in->node->node_type == FT_FILE && in->node->ops->read_pages != NULL)
+    {
+        //Like fs_read, the page cache doesn't check the access mode itself
+        if (CHECK_ACCESS(in->flags, O_WRONLY))
+        {
+            return -EBADF;
+        }
+
+        if (FS_OFFSET_CURRENT == in_offset)
+        {
+            return pagecache_read_to(in, count, write_all, out);
+        }
+
+        return pagecache_read_at(in, in_offset, count, write_all, out);
+    }
+
+    uint32_t size = MIN(count, SPLICE_BUFFER_SIZE);
+    uint8_t* buffer = (uint8_t*)kmalloc(size);
+
+    int32_t result = 0;
+
+    if (FS_OFFSET_CURRENT == in_offset)
+    {
+        result = (int32_t)fs_read(in, size, buffer);
+    }
+    else
+    {
+        result = fs_pread(in, size, buffer, in_offset);
+    }
+
+    if (result > 0)
+    {
+        result = write_all(out, 0, buffer, result);
+    }
+
+    kfree(buffer);
+
+    return result;
+}
+
+//Moves like `transfer`, at `*offset` and `*out_offset` instead of the file positions if they are given and advances them
+static int32_t transfer_at(File* in, int64_t* offset, File* out, int64_t* out_offset, uint32_t count)
+{
+    SpliceTarget target = {out, out_offset ? (int32_t)*out_offset : FS_OFFSET_CURRENT};
+
+    int32_t result = transfer(in, offset ? (int32_t)*offset : FS_OFFSET_CURRENT, &target, count);
+
+    if (offset && result > 0)
+    {
+        *offset += result;
+    }
+
+    if (out_offset)
+    {
+        *out_offset = target.offset;
+    }
+
+    return result;
+}
+
+static BOOL is_valid_offset(int64_t* offset)
+{
+    return NULL == offset || (*offset >= 0 && *offset <= 0x7FFFFFFF);
+}
+
+static int32_t sendfile(File* out, File* in, int32_t* offset, uint32_t count)
+{
+    if (offset && in->node->node_type != FT_FILE)
+    {
+        return -ESPIPE;
+    }
+
+    if (offset && *offset < 0)
+    {
+        return -EINVAL;
+    }
+
+    if (0 == count)
+    {
+        return 0;
+    }
+
+    if (NULL == offset)
+    {
+        return transfer_at(in, NULL, out, NULL, count);
+    }
+
+    int64_t position = *offset;
+
+    int32_t result = transfer_at(in, &position, out, NULL, count);
+
+    *offset = (int32_t)position;
+
+    return result;
+}
+
+static void release_files(File* in, File* out)
+{
+    if (in)
+    {
+        fs_release_file(in);
+    }
+
+    if (out)
+    {
+        fs_release_file(out);
+    }
+}
+
+//The Files are held for the whole transfer, another thread may close the descriptors meanwhile
+int syscall_sendfile(int out_fd, int in_fd, int32_t* offset, uint32_t count)
+{
+    if (!check_user_access(offset))
+    {
+        return -EFAULT;
+    }
+
+    Process* process = thread_get_current()->owner;
+
+    File* in = fs_get_file(process, in_fd);
+    File* out = fs_get_file(process, out_fd);
+
+    int32_t result = (NULL == in || NULL == out) ? -EBADF : sendfile(out, in, offset, count);
+
+    release_files(in, out);
+
+    return result;
+}
+
+//One of the Files has to be a pipe, offsets can only be given for the other one
+static int32_t splice(File* in, int64_t* off_in, File* out, int64_t* off_out, uint32_t length)
+{
+    BOOL in_pipe = pipe_is_pipe(in->node);
+    BOOL out_pipe = pipe_is_pipe(out->node);
+
+    if (!in_pipe && !out_pipe)
+    {
+        return -EINVAL;
+    }
+
+    if ((in_pipe && off_in) || (out_pipe && off_out))
+    {
+        return -ESPIPE;
+    }
+
+    if (!is_valid_offset(off_in) || !is_valid_offset(off_out))
+    {
+        return -EINVAL;
+    }
+
+    if (0 == length)
+    {
+        return 0;
+    }
+
+    return transfer_at(in, off_in, out, off_out, length);
+}
+
+int syscall_splice(int fd_in, int64_t* off_in, int fd_out, int64_t* off_out, uint32_t length, uint32_t flags)
+{
+    if (!check_user_access(off_in) || !check_user_access(off_out))
+    {
+        return -EFAULT;
+    }
+
+    //Only hints here, pipes always block
+    if (flags & ~(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT))
+    {
+        return -EINVAL;
+    }
+
+    Process* process = thread_get_current()->owner;
+
+    File* in = fs_get_file(process, fd_in);
+    File* out = fs_get_file(process, fd_out);
+
+    int32_t result = (NULL == in || NULL == out) ? -EBADF : splice(in, off_in, out, off_out, length);
+
+    release_files(in, out);
+
+    return result;
+}
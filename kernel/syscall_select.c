@@ -55,7 +55,7 @@ void select_update(Thread* thread)
         {
             if (FD_ISSET(fd, &thread->select.read_set))
             {
-                if (file->node->read_test_ready && file->node->read_test_ready(file))
+                if (file->node->ops->read_test_ready && file->node->ops->read_test_ready(file))
                 {
                     FD_SET(fd, &thread->select.read_set_result);
 
@@ -65,7 +65,7 @@ void select_update(Thread* thread)
 
             if (FD_ISSET(fd, &thread->select.write_set))
             {
-                if (file->node->write_test_ready && file->node->write_test_ready(file))
+                if (file->node->ops->write_test_ready && file->node->ops->write_test_ready(file))
                 {
                     FD_SET(fd, &thread->select.write_set_result);
 
@@ -0,0 +1,255 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include "process.h"
+#include "fs.h"
+#include "alloc.h"
+#include "common.h"
+#include "errno.h"
+#include "syscall_spawn.h"
+
+//Drops the references apply_file_actions took, process_create_ex takes its own for the child
+static void release_shared_files(ProcessStartup* startup)
+{
+    for (int32_t i = 0; i < ASTERISK_MAX_OPENED_FILES; ++i)
+    {
+        if (startup->shared_files[i])
+        {
+            fs_release_file(startup->shared_files[i]);
+
+            startup->shared_files[i] = NULL;
+        }
+    }
+}
+
+//Each shared File is held from here on, another thread of the caller may close its descriptor while the executable is read
+static int32_t apply_file_actions(Process* process, ProcessStartup* startup, const SpawnFileAction* actions, uint32_t action_count)
+{
+    for (uint32_t i = 0; i < action_count; ++i)
+    {
+        const SpawnFileAction* action = actions + i;
+
+        if (action->new_fd < 0 || action->new_fd >= ASTERISK_MAX_OPENED_FILES)
+        {
+            return -EBADF;
+        }
+
+        File* file = NULL;
+
+        switch (action->command)
+        {
+        case SPAWN_FILE_ACTION_CLOSE:
+            break;
+        case SPAWN_FILE_ACTION_DUP2:
+            //The child gets the same File, so the position and the open state are shared like after a real dup2
+            file = fs_get_file(process, action->fd);
+            if (NULL == file)
+            {
+                return -EBADF;
+            }
+            break;
+        default:
+            return -EINVAL;
+        }
+
+        if (startup->shared_files[action->new_fd])
+        {
+            fs_release_file(startup->shared_files[action->new_fd]);
+        }
+
+        startup->files[action->new_fd] = NULL;
+        startup->file_flags[action->new_fd] = 0;
+        startup->file_offsets[action->new_fd] = 0;
+        startup->shared_files[action->new_fd] = file;
+    }
+
+    return 0;
+}
+
+/*
+ *  Starts `path` as a child of the calling process in one call: the working directory, the TTY and the whole descriptor table of the child are described up
+ *  front, and the child's descriptor table and argument page are built while it is created instead of being fixed up afterwards. Returns the PID of the child.
+ */
+int32_t syscall_spawn(const char* path, char *const argv[], char *const envp[], const SpawnAttributes* attributes)
+{
+    if (NULL == path || !check_user_access((char*)path))
+    {
+        return -EFAULT;
+    }
+
+    if (!check_user_access((char*)argv) || (argv && !check_user_access_string_array(argv)))
+    {
+        return -EFAULT;
+    }
+
+    if (!check_user_access((char*)envp) || (envp && !check_user_access_string_array(envp)))
+    {
+        return -EFAULT;
+    }
+
+    if (!check_user_access((void*)attributes))
+    {
+        return -EFAULT;
+    }
+
+    Process* process = thread_get_current()->owner;
+    if (NULL == process)
+    {
+        PANIC("Process is NULL!\n");
+    }
+
+    ProcessStartup startup;
+    memset((uint8_t*)&startup, 0, sizeof(ProcessStartup));
+    startup.working_directory = process->working_directory;
+
+    filesystem_node* tty = process->tty;
+
+    if (attributes)
+    {
+        if (attributes->working_directory)
+        {
+            if (!check_user_access((char*)attributes->working_directory))
+            {
+                return -EFAULT;
+            }
+
+            filesystem_node* node = fs_get_node_absolute_or_relative(attributes->working_directory, process);
+            if (NULL == node)
+            {
+                return -ENOENT;
+            }
+
+            if ((node->node_type & (FT_DIRECTORY | FT_MOUNT_POINT)) == 0)
+            {
+                return -ENOTDIR;
+            }
+
+            startup.working_directory = node;
+        }
+
+        if (attributes->tty)
+        {
+            if (!check_user_access((char*)attributes->tty))
+            {
+                return -EFAULT;
+            }
+
+            tty = fs_get_node_absolute_or_relative(attributes->tty, process);
+            if (NULL == tty)
+            {
+                return -ENOENT;
+            }
+        }
+    }
+
+    startup.files[0] = tty; /* stdin */
+    startup.files[1] = tty; /* stdout */
+    startup.files[2] = tty; /* stderr */
+
+    if (attributes && attributes->file_action_count > 0)
+    {
+        uint32_t count = attributes->file_action_count;
+
+        if (count > ASTERISK_MAX_OPENED_FILES)
+        {
+            return -EINVAL;
+        }
+
+        const uint8_t* first = (const uint8_t*)attributes->file_actions;
+        const uint8_t* last = first + count * sizeof(SpawnFileAction) - 1;
+
+        if (NULL == first || !check_user_access((void*)first) || !check_user_access((void*)last) || last < first)
+        {
+            return -EFAULT;
+        }
+
+        int32_t error = apply_file_actions(process, &startup, attributes->file_actions, count);
+        if (error < 0)
+        {
+            release_shared_files(&startup);
+
+            return error;
+        }
+    }
+
+    //Looking the executable up may make the filesystem evict nodes, the working directory must stay
+    fs_acquire_node(startup.working_directory);
+
+    filesystem_node* node = fs_get_node_absolute_or_relative(path, process);
+    if (NULL == node)
+    {
+        fs_release_node(startup.working_directory);
+
+        release_shared_files(&startup);
+
+        return -ENOENT;
+    }
+
+    int32_t result = -1;
+
+    File* f = fs_open(node, 0);
+    if (f)
+    {
+        void* image = kmalloc(node->length);
+
+        int32_t bytes_read = fs_read(f, node->length, image);
+
+        disable_interrupts(); //just in case if a file operation left interrupts enabled.
+
+        if (bytes_read > 0)
+        {
+            char* name = "UserProcess";
+            if (NULL != argv && NULL != argv[0])
+            {
+                name = argv[0];
+            }
+
+            Process* new_process = process_create_ex(name, 0, 0, NULL, image, node, argv, envp, process, tty, &startup);
+
+            if (new_process)
+            {
+                result = new_process->pid;
+            }
+        }
+
+        fs_close(f);
+
+        kfree(image);
+    }
+
+    fs_release_node(startup.working_directory);
+
+    release_shared_files(&startup);
+
+    return result;
+}
@@ -0,0 +1,67 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#pragma once
+
+#include "stdint.h"
+#include "process.h"
+
+#define SPAWN_FILE_ACTION_CLOSE 1
+#define SPAWN_FILE_ACTION_DUP2  2
+
+/*
+ *  One entry of the file action list given to `syscall_spawn`. The actions are applied in order to the descriptor table of the child, which starts out with
+ *  its TTY on descriptors 0, 1 and 2.
+ *
+ *  SPAWN_FILE_ACTION_CLOSE: leave the child's descriptor `new_fd` closed, `fd` is ignored.
+ *  SPAWN_FILE_ACTION_DUP2:  install the caller's File at descriptor `fd` as the child's descriptor `new_fd`. Like after dup2 both share the
+ *                           File, its position and flags.
+ *
+ *  At most ASTERISK_MAX_OPENED_FILES actions are taken.
+ */
+typedef struct SpawnFileAction
+{
+    int32_t command;
+    int32_t fd;
+    int32_t new_fd;
+} SpawnFileAction;
+
+typedef struct SpawnAttributes
+{
+    const char* working_directory; //NULL: the caller's working directory
+    const char* tty;               //NULL: the caller's TTY
+    const SpawnFileAction* file_actions;
+    uint32_t file_action_count;
+} SpawnAttributes;
+
+int32_t syscall_spawn(const char* path, char *const argv[], char *const envp[], const SpawnAttributes* attributes);
@@ -46,6 +46,7 @@
 #include "syscalltable.h"
 #include "isr.h"
 #include "sharedmemory.h"
+#include "tmpfs.h"
 #include "serial.h"
 #include "vmm.h"
 #include "list.h"
@@ -55,11 +56,14 @@
 #include "ipc.h"
 #include "socket.h"
 #include "syscall_getthreads.h"
-
-struct iovec {
-               void  *iov_base;    /* Starting address */
-               size_t iov_len;     /* Number of bytes to transfer */
-           };
+#include "syscall_spawn.h"
+#include "futex.h"
+#include "descriptortables.h"
+#include "filemapping.h"
+#include "ramdisk.h"
+#include "blockcache.h"
+#include "ioring.h"
+#include "splice.h"
 
 struct statx {
     uint32_t stx_mask;
@@ -93,6 +97,36 @@ struct k_sigaction {
 	unsigned mask[2];
 };
 
+struct user_desc {
+    uint32_t entry_number;
+    uint32_t base_addr;
+    uint32_t limit;
+    uint32_t seg_32bit:1;
+    uint32_t contents:2;
+    uint32_t read_exec_only:1;
+    uint32_t limit_in_pages:1;
+    uint32_t seg_not_present:1;
+    uint32_t useable:1;
+};
+
+#define CLONE_VM             0x00000100
+#define CLONE_FS             0x00000200
+#define CLONE_FILES          0x00000400
+#define CLONE_SIGHAND        0x00000800
+#define CLONE_THREAD         0x00010000
+#define CLONE_SETTLS         0x00080000
+#define CLONE_PARENT_SETTID  0x00100000
+#define CLONE_CHILD_CLEARTID 0x00200000
+#define CLONE_CHILD_SETTID   0x01000000
+
+struct rlimit {
+    unsigned long rlim_cur;
+    unsigned long rlim_max;
+};
+
+#define RLIMIT_STACK  3
+#define RLIM_INFINITY (~0UL)
+
 struct shmid_ds;
 
 /**************
@@ -138,7 +172,9 @@ int syscall_sleep_ms(int ms);
 int syscall_execute_on_tty(const char *path, char *const argv[], char *const envp[], const char *tty_path);
 int syscall_manage_message(int command, void* message);
 int syscall_rt_sigaction(int signum, const struct k_sigaction *act, struct k_sigaction *oldact, uint32_t sigsetsize);
-void* syscall_mmap(void *addr, int length, int flags, int prot, int fd, int offset);
+void* syscall_mmap(void *addr, int length, int prot, int flags, int fd, int offset);
+static void* syscall_mmap_with_offset(void *addr, int length, int prot, int flags, int fd);
+static int syscall_splice_with_flags(int fd_in, int64_t* off_in, int fd_out, int64_t* off_out, uint32_t length);
 int syscall_munmap(void *addr, int length);
 int syscall_shm_open(const char *name, int oflag, int mode);
 int syscall_unlink(const char *name);
@@ -148,7 +184,11 @@ int syscall_ptsname_r(int fd, char *buf, int buflen);
 int syscall_printk(const char *str, int num);
 int syscall_readv(int fd, const struct iovec *iovs, int iovcnt);
 int syscall_writev(int fd, const struct iovec *iovs, int iovcnt);
-int syscall_set_thread_area(void *p);
+int syscall_preadv(int fd, const struct iovec *iovs, int iovcnt, unsigned int offset_low, unsigned int offset_high);
+int syscall_pwritev(int fd, const struct iovec *iovs, int iovcnt, unsigned int offset_low, unsigned int offset_high);
+int syscall_pread64(int fd, void *buf, int nbytes, unsigned int offset_low, unsigned int offset_high);
+int syscall_pwrite64(int fd, void *buf, int nbytes, unsigned int offset_low, unsigned int offset_high);
+int syscall_set_thread_area(struct user_desc *u_info);
 int syscall_set_tid_address(void* p);
 int syscall_exit_group(int status);
 int syscall_llseek(unsigned int fd, unsigned int offset_high, unsigned int offset_low, int64_t *result, unsigned int whence);
@@ -163,6 +203,15 @@ void * syscall_shmat(int shmid, const void *shmaddr, int shmflg);
 int syscall_shmdt(const void *shmaddr);
 int syscall_shmctl(int shmid, int cmd, struct shmid_ds *buf);
 int syscall_nanosleep(struct timespec *req, struct timespec *rem);
+int syscall_futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout, uint32_t *uaddr2);
+int syscall_clone(uint32_t flags, void *stack, int *parent_tid, struct user_desc *tls, int *child_tid);
+int syscall_getrlimit(int resource, struct rlimit *rlim);
+int syscall_setrlimit(int resource, const struct rlimit *rlim);
+int syscall_msync(void *addr, int length, int flags);
+int syscall_manage_ramdisk(const char *name, int operation, uint32_t size);
+int syscall_fsync(int fd);
+int syscall_fdatasync(int fd);
+int syscall_sync();
 
 void syscalls_initialize()
 {
@@ -199,7 +248,7 @@ void syscalls_initialize()
     g_syscall_table[SYS_execute_on_tty] = syscall_execute_on_tty;
     g_syscall_table[SYS_manage_message] = syscall_manage_message;
     g_syscall_table[SYS_rt_sigaction] = syscall_rt_sigaction;
-    g_syscall_table[SYS_mmap] = syscall_mmap;
+    g_syscall_table[SYS_mmap] = syscall_mmap_with_offset;
     g_syscall_table[SYS_munmap] = syscall_munmap;
     g_syscall_table[SYS_shm_open] = syscall_shm_open;
     g_syscall_table[SYS_unlink] = syscall_unlink;
@@ -242,6 +291,24 @@ void syscalls_initialize()
     g_syscall_table[SYS_nanosleep] = syscall_nanosleep;
     g_syscall_table[SYS_getthreads] = syscall_getthreads;
     g_syscall_table[SYS_getprocs] = syscall_getprocs;
+    g_syscall_table[SYS_spawn] = syscall_spawn;
+    g_syscall_table[SYS_futex] = syscall_futex;
+    g_syscall_table[SYS_clone] = syscall_clone;
+    g_syscall_table[SYS_getrlimit] = syscall_getrlimit;
+    g_syscall_table[SYS_setrlimit] = syscall_setrlimit;
+    g_syscall_table[SYS_msync] = syscall_msync;
+    g_syscall_table[SYS_manage_ramdisk] = syscall_manage_ramdisk;
+    g_syscall_table[SYS_fsync] = syscall_fsync;
+    g_syscall_table[SYS_fdatasync] = syscall_fdatasync;
+    g_syscall_table[SYS_sync] = syscall_sync;
+    g_syscall_table[SYS_io_ring_setup] = syscall_io_ring_setup;
+    g_syscall_table[SYS_io_ring_enter] = syscall_io_ring_enter;
+    g_syscall_table[SYS_sendfile] = syscall_sendfile;
+    g_syscall_table[SYS_splice] = syscall_splice_with_flags;
+    g_syscall_table[SYS_pread64] = syscall_pread64;
+    g_syscall_table[SYS_pwrite64] = syscall_pwrite64;
+    g_syscall_table[SYS_preadv] = syscall_preadv;
+    g_syscall_table[SYS_pwritev] = syscall_pwritev;
 
     // Register our syscall handler.
     interrupt_register(0x80, &handle_syscall);
@@ -279,6 +346,8 @@ static void handle_syscall(Registers* regs)
 
     //I think it is better to enable interrupts in syscall implementations if it is needed.
 
+    thread->syscall_registers = regs;
+
     int ret;
     asm volatile (" \
       pushl %1; \
@@ -308,6 +377,52 @@ int syscall_printk(const char *str, int num)
     return 0;
 }
 
+//Creates the last component of the path in its parent directory, for O_CREAT
+static filesystem_node* create_file(const char* pathname, int flags, Process* process)
+{
+    char parent_path[128];
+    const char* name = pathname;
+
+    int length = strlen(pathname);
+    for (int i = length - 1; i >= 0; --i)
+    {
+        if (pathname[i] == '/')
+        {
+            if (i >= (int)sizeof(parent_path))
+            {
+                return NULL;
+            }
+
+            name = pathname + i + 1;
+            strncpy(parent_path, pathname, i);
+            parent_path[i] = '\0';
+            break;
+        }
+    }
+
+    filesystem_node* parent = NULL;
+
+    if (name == pathname)
+    {
+        parent = process->working_directory;
+    }
+    else if (name == pathname + 1)
+    {
+        parent = fs_get_root_node();
+    }
+    else
+    {
+        parent = fs_get_node_absolute_or_relative(parent_path, process);
+    }
+
+    if (NULL == parent || strlen(name) == 0)
+    {
+        return NULL;
+    }
+
+    return fs_create(parent, name, flags);
+}
+
 int syscall_open(const char *pathname, int flags)
 {
     if (!check_user_access((char*)pathname))
@@ -319,12 +434,23 @@ int syscall_open(const char *pathname, int flags)
     if (process)
     {
         filesystem_node* node = fs_get_node_absolute_or_relative(pathname, process);
+
+        if (NULL == node && (flags & O_CREAT) == O_CREAT)
+        {
+            node = create_file(pathname, flags, process);
+        }
+
         if (node)
         {
             File* file = fs_open(node, flags);
 
             if (file)
             {
+                if ((flags & O_TRUNC) == O_TRUNC && !CHECK_ACCESS(flags, O_RDONLY) && node->node_type == FT_FILE)
+                {
+                    fs_ftruncate(file, 0);
+                }
+
                 return file->fd;
             }
         }
@@ -338,25 +464,7 @@ int syscall_close(int fd)
     Process* process = thread_get_current()->owner;
     if (process)
     {
-        if (fd < ASTERISK_MAX_OPENED_FILES)
-        {
-            File* file = process->fd[fd];
-
-            if (file)
-            {
-                fs_close(file);
-
-                return 0;
-            }
-            else
-            {
-                return -EBADF;
-            }
-        }
-        else
-        {
-            return -EBADF;
-        }
+        return fs_close_descriptor(process, fd);
     }
     else
     {
@@ -375,157 +483,210 @@ int syscall_read(int fd, void *buf, int nbytes)
 
     //Screen_PrintF("syscall_read: begin - nbytes:%d\n", nbytes);
 
-    Process* process = thread_get_current()->owner;
-    if (process)
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
     {
-        if (fd < ASTERISK_MAX_OPENED_FILES)
-        {
-            File* file = process->fd[fd];
+        return -EBADF;
+    }
 
-            if (file)
-            {
-                //log_printf("syscall_read(%d): %s\n", process->pid, buf);
+    //Each handler is free to enable interrupts.
+    //We don't enable them here.
 
-                //enable_interrupts();
+    int ret = fs_read(file, nbytes, buf);
 
-                //Each handler is free to enable interrupts.
-                //We don't enable them here.
+    fs_release_file(file);
 
-                int ret = fs_read(file, nbytes, buf);
+    return ret;
+}
 
-                return ret;
-            }
-            else
-            {
-                return -EBADF;
-            }
-        }
-        else
-        {
-            return -EBADF;
-        }
+int syscall_write(int fd, void *buf, int nbytes)
+{
+    if (!check_user_access(buf))
+    {
+        return -EFAULT;
     }
-    else
+
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
     {
-        PANIC("Process is NULL!\n");
+        return -EBADF;
     }
 
-    return -1;
+    uint32_t writeResult = fs_write(file, nbytes, buf);
+
+    fs_release_file(file);
+
+    return writeResult;
 }
 
-int syscall_write(int fd, void *buf, int nbytes)
+//64 bit offsets come split in two registers, files are limited to 2GB
+static int32_t get_position(unsigned int offset_low, unsigned int offset_high)
 {
-    if (!check_user_access(buf))
+    if (offset_high != 0 || offset_low > 0x7FFFFFFF)
+    {
+        return -EINVAL;
+    }
+
+    return offset_low;
+}
+
+//Checks the vector and the fd once, then hands the whole vector to the fs layer
+static int transfer_vector(int fd, const struct iovec *iovs, int iovcnt, int32_t offset, BOOL write)
+{
+    if (!check_user_access((void*)iovs))
     {
         return -EFAULT;
     }
 
-    Process* process = thread_get_current()->owner;
-    if (process)
+    if (iovcnt < 0 || iovcnt > IOV_MAX)
     {
-        //Screen_PrintF("syscall_write() called from process: %d. fd:%d\n", process->pid, fd);
+        return -EINVAL;
+    }
 
-        if (fd < ASTERISK_MAX_OPENED_FILES)
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        if (!check_user_access(iovs[i].iov_base))
         {
-            File* file = process->fd[fd];
+            return -EFAULT;
+        }
+    }
 
-            if (file)
-            {
-                /*
-                for (int i = 0; i < nbytes; ++i)
-                {
-                    log_printf("pid:%d syscall_write:buf[%d]=%c\n", process->pid, i, ((char*)buf)[i]);
-                }
-                */
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
+    {
+        return -EBADF;
+    }
 
-                uint32_t writeResult = fs_write(file, nbytes, buf);
+    int result = write ? fs_writev(file, iovs, iovcnt, offset) : fs_readv(file, iovs, iovcnt, offset);
 
-                return writeResult;
-            }
-            else
-            {
-                return -EBADF;
-            }
-        }
-        else
-        {
-            return -EBADF;
-        }
+    fs_release_file(file);
+
+    return result;
+}
+
+int syscall_readv(int fd, const struct iovec *iovs, int iovcnt)
+{
+    return transfer_vector(fd, iovs, iovcnt, FS_OFFSET_CURRENT, FALSE);
+}
+
+int syscall_writev(int fd, const struct iovec *iovs, int iovcnt)
+{
+    return transfer_vector(fd, iovs, iovcnt, FS_OFFSET_CURRENT, TRUE);
+}
+
+int syscall_preadv(int fd, const struct iovec *iovs, int iovcnt, unsigned int offset_low, unsigned int offset_high)
+{
+    int32_t offset = get_position(offset_low, offset_high);
+    if (offset < 0)
+    {
+        return offset;
     }
-    else
+
+    return transfer_vector(fd, iovs, iovcnt, offset, FALSE);
+}
+
+int syscall_pwritev(int fd, const struct iovec *iovs, int iovcnt, unsigned int offset_low, unsigned int offset_high)
+{
+    int32_t offset = get_position(offset_low, offset_high);
+    if (offset < 0)
     {
-        PANIC("Process is NULL!\n");
+        return offset;
     }
 
-    return -1;
+    return transfer_vector(fd, iovs, iovcnt, offset, TRUE);
 }
 
-int syscall_readv(int fd, const struct iovec *iovs, int iovcnt)
+int syscall_pread64(int fd, void *buf, int nbytes, unsigned int offset_low, unsigned int offset_high)
 {
-    if (!check_user_access((void*)iovs))
+    if (!check_user_access(buf))
     {
         return -EFAULT;
     }
 
-    int result = 0;
-    for (int i = 0; i < iovcnt; ++i)
+    int32_t offset = get_position(offset_low, offset_high);
+    if (offset < 0)
     {
-        const struct iovec *iov = iovs + i;
+        return offset;
+    }
 
-        if (iov->iov_len > 0)
-        {
-            int bytes = syscall_read(fd, iov->iov_base, iov->iov_len);
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
+    {
+        return -EBADF;
+    }
 
-            if (bytes < 0)
-            {
-                return  bytes;
-            }
+    int result = fs_pread(file, nbytes, buf, offset);
 
-            result += bytes;
-        }
-    }
+    fs_release_file(file);
 
     return result;
 }
 
-int syscall_writev(int fd, const struct iovec *iovs, int iovcnt)
+int syscall_pwrite64(int fd, void *buf, int nbytes, unsigned int offset_low, unsigned int offset_high)
 {
-    if (!check_user_access((void*)iovs))
+    if (!check_user_access(buf))
     {
         return -EFAULT;
     }
 
-    int result = 0;
-    for (int i = 0; i < iovcnt; ++i)
+    int32_t offset = get_position(offset_low, offset_high);
+    if (offset < 0)
     {
-        const struct iovec *iov = iovs + i;
+        return offset;
+    }
 
-        if (iov->iov_len > 0)
-        {
-            int bytes = syscall_write(fd, iov->iov_base, iov->iov_len);
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
+    {
+        return -EBADF;
+    }
 
-            if (bytes < 0)
-            {
-                return  bytes;
-            }
+    int result = fs_pwrite(file, nbytes, buf, offset);
 
-            result += bytes;
-        }
-    }
+    fs_release_file(file);
 
     return result;
 }
 
-int syscall_set_thread_area(void *p)
+/*
+ *  There is a single TLS descriptor (GDT entry 6) whose base is switched along with the running thread, so the only entry handed out is GDT_TLS_ENTRY.
+ */
+static int set_tls(Thread* thread, struct user_desc *u_info)
 {
-    if (!check_user_access(p))
+    if (NULL == u_info || !check_user_access(u_info))
     {
         return -EFAULT;
     }
 
+    if (u_info->entry_number == (uint32_t)-1)
+    {
+        u_info->entry_number = GDT_TLS_ENTRY;
+    }
+    else if (u_info->entry_number != GDT_TLS_ENTRY)
+    {
+        return -EINVAL;
+    }
+
+    thread->tls_base = u_info->base_addr;
+
     return 0;
 }
 
+int syscall_set_thread_area(struct user_desc *u_info)
+{
+    Thread* thread = thread_get_current();
+
+    int result = set_tls(thread, u_info);
+
+    if (0 == result)
+    {
+        //the caller loads its segment register right after this returns
+        descriptor_tables_set_tls_base(thread->tls_base);
+    }
+
+    return result;
+}
+
 int syscall_set_tid_address(void* p)
 {
     if (!check_user_access(p))
@@ -533,45 +694,90 @@ int syscall_set_tid_address(void* p)
         return -EFAULT;
     }
 
-    return thread_get_current()->threadId;
+    Thread* thread = thread_get_current();
+
+    thread->clear_child_tid = (uint32_t*)p;
+
+    return thread->threadId;
 }
 
 int syscall_exit_group(int status)
 {
-    return syscall_exit();
+    Thread* thread = thread_get_current();
+
+    //Terminates every thread, the scheduler destroys the whole process
+    thread_signal(thread, SIGTERM);
+
+    wait_for_schedule();
+
+    return -1;
 }
 
-int syscall_lseek(int fd, int offset, int whence)
+/*
+ *  Only threads are supported: the child must share the address space, the file descriptors and the signal handlers of the caller, there is no fork.
+ */
+int syscall_clone(uint32_t flags, void *stack, int *parent_tid, struct user_desc *tls, int *child_tid)
 {
-    Process* process = thread_get_current()->owner;
-    if (process)
+    const uint32_t thread_flags = CLONE_VM | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD;
+
+    if ((flags & thread_flags) != thread_flags)
     {
-        if (fd < ASTERISK_MAX_OPENED_FILES)
-        {
-            File* file = process->fd[fd];
+        return -EINVAL;
+    }
 
-            if (file)
-            {
-                int result = fs_lseek(file, offset, whence);
+    if (!check_user_access(stack) || !check_user_access(parent_tid) || !check_user_access(child_tid))
+    {
+        return -EFAULT;
+    }
 
-                return result;
-            }
-            else
-            {
-                return -EBADF;
-            }
-        }
-        else
+    Thread* thread = thread_get_current();
+
+    Thread* child = thread_clone(thread, (uint32_t)stack);
+
+    if (flags & CLONE_SETTLS)
+    {
+        int result = set_tls(child, tls);
+
+        if (result < 0)
         {
-            return -EBADF;
+            thread_destroy(child);
+
+            return result;
         }
     }
-    else
+
+    //same address space, so these are written once for both threads
+    if ((flags & CLONE_PARENT_SETTID) && parent_tid)
     {
-        PANIC("Process is NULL!\n");
+        *parent_tid = child->threadId;
     }
 
-    return -1;
+    if ((flags & CLONE_CHILD_SETTID) && child_tid)
+    {
+        *child_tid = child->threadId;
+    }
+
+    if (flags & CLONE_CHILD_CLEARTID)
+    {
+        child->clear_child_tid = (uint32_t*)child_tid;
+    }
+
+    return child->threadId;
+}
+
+int syscall_lseek(int fd, int offset, int whence)
+{
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
+    {
+        return -EBADF;
+    }
+
+    int result = fs_lseek(file, offset, whence);
+
+    fs_release_file(file);
+
+    return result;
 }
 
 int syscall_llseek(unsigned int fd, unsigned int offset_high,
@@ -642,33 +848,17 @@ int syscall_fstat(int fd, struct stat *buf)
         return -EFAULT;
     }
 
-    Process* process = thread_get_current()->owner;
-    if (process)
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
     {
-        if (fd < ASTERISK_MAX_OPENED_FILES)
-        {
-            File* file = process->fd[fd];
-
-            if (file)
-            {
-                return fs_stat(file->node, buf);
-            }
-            else
-            {
-                return -EBADF;
-            }
-        }
-        else
-        {
-            return -EBADF;
-        }
-    }
-    else
-    {
-        PANIC("Process is NULL!\n");
+        return -EBADF;
     }
 
-    return -1;
+    int result = fs_stat(file->node, buf);
+
+    fs_release_file(file);
+
+    return result;
 }
 
 int syscall_ioctl(int fd, int32_t request, void *arg)
@@ -677,41 +867,33 @@ int syscall_ioctl(int fd, int32_t request, void *arg)
     //We don't check_user_access() for arg here. Because it is not always a pointer.
     //So it is driver's responsibility to check_user_access(arg) for using it as a pointer.
 
-    Process* process = thread_get_current()->owner;
-    if (process)
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
     {
-        //serial_printf("syscall_ioctl fd:%d request:%d(%x) arg:%d(%x) pid:%d\n", fd, request, request, arg, arg, process->pid);
+        return -EBADF;
+    }
 
-        if (fd < ASTERISK_MAX_OPENED_FILES)
-        {
-            File* file = process->fd[fd];
+    int result = fs_ioctl(file, request, arg);
 
-            if (file)
-            {
-                return fs_ioctl(file, request, arg);
-            }
-            else
-            {
-                return -EBADF;
-            }
-        }
-        else
-        {
-            return -EBADF;
-        }
-    }
-    else
-    {
-        PANIC("Process is NULL!\n");
-    }
+    fs_release_file(file);
 
-    return -1;
+    return result;
 }
 
 int syscall_exit()
 {
     Thread* thread = thread_get_current();
 
+    if (process_get_thread_count(thread->owner) > 1)
+    {
+        //Only this thread exits, the process goes on with the others
+        thread_exit(thread);
+
+        wait_for_schedule();
+
+        return -1;
+    }
+
     thread_signal(thread, SIGTERM);
     
     wait_for_schedule();
@@ -802,7 +984,7 @@ int syscall_execute(const char *path, char *const argv[], char *const envp[])
                     {
                         name = argv[0];
                     }
-                    Process* new_process = process_create_from_elf_data(name, image, argv, envp, process, NULL);
+                    Process* new_process = process_create_from_elf_file(name, node, image, argv, envp, process, NULL);
 
                     if (new_process)
                     {
@@ -873,7 +1055,7 @@ int syscall_execute_on_tty(const char *path, char *const argv[], char *const env
                     {
                         name = argv[0];
                     }
-                    Process* new_process = process_create_from_elf_data(name, image, argv, envp, process, tty_node);
+                    Process* new_process = process_create_from_elf_file(name, node, image, argv, envp, process, tty_node);
 
                     if (new_process)
                     {
@@ -926,7 +1108,7 @@ int syscall_execve(const char *path, char *const argv[], char *const envp[])
             {
                 disable_interrupts(); //just in case if a file operation left interrupts enabled.
 
-                Process* new_process = process_create_ex("fromExecve", calling_process->pid, 0, NULL, image, argv, envp, NULL, calling_process->tty);
+                Process* new_process = process_create_ex("fromExecve", calling_process->pid, 0, NULL, image, node, argv, envp, NULL, calling_process->tty, NULL);
 
                 fs_close(f);
 
@@ -934,6 +1116,9 @@ int syscall_execve(const char *path, char *const argv[], char *const envp[])
 
                 if (new_process)
                 {
+                    //Resource limits survive exec, the image has no parent to take it from. The new thread doesn't run before this returns.
+                    new_process->stack_limit = calling_process->stack_limit;
+
                     process_destroy(calling_process);
 
                     wait_for_schedule();
@@ -1211,50 +1396,34 @@ int syscall_getdents(int fd, char *buf, int nbytes)
         return -EFAULT;
     }
 
-    Process* process = thread_get_current()->owner;
-    if (process)
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
     {
-        if (fd < ASTERISK_MAX_OPENED_FILES)
-        {
-            File* file = process->fd[fd];
-
-            if (file)
-            {
-                //Screen_PrintF("syscall_getdents(%d): %s\n", process->pid, buf);
-
-                int byte_counter = 0;
-
-                int index = 0;
-                filesystem_dirent* dirent = fs_readdir(file->node, index);
-
-                while (NULL != dirent && (byte_counter + sizeof(filesystem_dirent) <= nbytes))
-                {
-                    memcpy((uint8_t*)buf + byte_counter, (uint8_t*)dirent, sizeof(filesystem_dirent));
+        return -EBADF;
+    }
 
-                    byte_counter += sizeof(filesystem_dirent);
+    int result = -EINVAL;
 
-                    index += 1;
-                    dirent = fs_readdir(file->node, index);
-                }
+    //Continues from the offset of the File, so a listing can be read in several calls
+    if (file->offset >= 0 && nbytes >= (int)sizeof(filesystem_dirent))
+    {
+        int32_t count = fs_getdents(file, file->offset, (filesystem_dirent*)buf, nbytes / sizeof(filesystem_dirent));
 
-                return byte_counter;
-            }
-            else
-            {
-                return -EBADF;
-            }
+        if (count < 0)
+        {
+            result = -ENOTDIR;
         }
         else
         {
-            return -EBADF;
+            file->offset += count;
+
+            result = count * sizeof(filesystem_dirent);
         }
     }
-    else
-    {
-        PANIC("Process is NULL!\n");
-    }
 
-    return -1;//on error
+    fs_release_file(file);
+
+    return result;
 }
 
 int syscall_read_dir(int fd, void *dirent, int index)
@@ -1264,40 +1433,22 @@ int syscall_read_dir(int fd, void *dirent, int index)
         return -EFAULT;
     }
 
-    Process* process = thread_get_current()->owner;
-    if (process)
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
     {
-        if (fd < ASTERISK_MAX_OPENED_FILES)
-        {
-            File* file = process->fd[fd];
-
-            if (file)
-            {
-                filesystem_dirent* dirent_fs = fs_readdir(file->node, index);
+        return -EBADF;
+    }
 
-                if (dirent_fs)
-                {
-                    memcpy((uint8_t*)dirent, (uint8_t*)dirent_fs, sizeof(filesystem_dirent));
+    int result = -1;//on error
 
-                    return 1;
-                }
-            }
-            else
-            {
-                return -EBADF;
-            }
-        }
-        else
-        {
-            return -EBADF;
-        }
-    }
-    else
+    if (index >= 0 && fs_getdents(file, index, (filesystem_dirent*)dirent, 1) == 1)
     {
-        PANIC("Process is NULL!\n");
+        result = 1;
     }
 
-    return -1;//on error
+    fs_release_file(file);
+
+    return result;
 }
 
 int syscall_getcwd(char *buf, size_t size)
@@ -1337,6 +1488,9 @@ int syscall_chdir(const char *path)
 
         if (node)
         {
+            fs_acquire_node(node);
+            fs_release_node(process->working_directory);
+
             process->working_directory = node;
 
             return 0; //success
@@ -1426,7 +1580,19 @@ int syscall_rt_sigaction(int signum, const struct k_sigaction *act, struct k_sig
     return -1;
 }
 
-void* syscall_mmap(void *addr, int length, int flags, int prot, int fd, int offset)
+//Only five arguments are passed to syscall functions, the sixth one (offset) is in ebp like Linux
+static void* syscall_mmap_with_offset(void *addr, int length, int prot, int flags, int fd)
+{
+    return syscall_mmap(addr, length, prot, flags, fd, (int)thread_get_current()->syscall_registers->ebp);
+}
+
+//The sixth argument comes in ebp, like mmap's offset
+static int syscall_splice_with_flags(int fd_in, int64_t* off_in, int fd_out, int64_t* off_out, uint32_t length)
+{
+    return syscall_splice(fd_in, off_in, fd_out, off_out, length, thread_get_current()->syscall_registers->ebp);
+}
+
+void* syscall_mmap(void *addr, int length, int prot, int flags, int fd, int offset)
 {
     uint32_t v_address_hint = (uint32_t)addr;
 
@@ -1480,27 +1646,28 @@ void* syscall_mmap(void *addr, int length, int flags, int prot, int fd, int offs
         }
         else
         {
-            if (fd < ASTERISK_MAX_OPENED_FILES)
+            File* file = fs_get_file(process, fd);
+            if (NULL == file)
             {
-                File* file = process->fd[fd];
+                return (void*)-EBADF;
+            }
 
-                if (file)
-                {
-                    void* ret = fs_mmap(file, length, offset, flags);
+            void* ret = NULL;
 
-                    if (ret)
-                    {
-                        return ret;
-                    }
-                }
-                else
-                {
-                    return (void*)-EBADF;
-                }
+            if (file->node->node_type == FT_FILE && file->node->ops->read_pages != NULL)
+            {
+                ret = filemapping_map(process, file, v_address_hint, length, offset, flags, prot);
             }
             else
             {
-                return (void*)-EBADF;
+                ret = fs_mmap(file, length, offset, flags, prot);
+            }
+
+            fs_release_file(file);
+
+            if (ret)
+            {
+                return ret;
             }
         }
     }
@@ -1529,8 +1696,15 @@ int syscall_munmap(void *addr, int length)
             return -1;
         }
 
+        if (filemapping_unmap(process, (uint32_t)addr))
+        {
+            return 0;
+        }
+
         sharedmemory_unmap_if_exists(process, (uint32_t)addr);
 
+        tmpfs_unmap_if_exists(process, (uint32_t)addr, PAGE_COUNT(length));
+
         if (TRUE == vmm_unmap_memory(process, (uint32_t)addr, PAGE_COUNT(length)))
         {
             return 0;
@@ -1634,8 +1808,6 @@ int syscall_statx(int dirfd, const char *pathname, int flags, unsigned int mask,
     return -1;
 }
 
-#define O_CREAT 0x200
-
 int syscall_shm_open(const char *name, int oflag, int mode)
 {
     if (!check_user_access((char*)name))
@@ -1685,9 +1857,9 @@ int syscall_unlink(const char *name)
         node = sharedmemory_get_node(name);
     }
 
-    if (node && node->unlink)
+    if (node)
     {
-        return node->unlink(node, 0);
+        return fs_unlink(node, 0);
     }
 
     return -1;
@@ -1695,33 +1867,17 @@ int syscall_unlink(const char *name)
 
 int syscall_ftruncate(int fd, int size)
 {
-    Process* process = thread_get_current()->owner;
-    if (process)
-    {
-        if (fd < ASTERISK_MAX_OPENED_FILES)
-        {
-            File* file = process->fd[fd];
-
-            if (file)
-            {
-                return fs_ftruncate(file, size);
-            }
-            else
-            {
-                return -EBADF;
-            }
-        }
-        else
-        {
-            return -EBADF;
-        }
-    }
-    else
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
     {
-        PANIC("Process is NULL!\n");
+        return -EBADF;
     }
 
-    return -1;
+    int result = fs_ftruncate(file, size);
+
+    fs_release_file(file);
+
+    return result;
 }
 
 //Old way of shared memory, modern systems prefer shm_open/mmap
@@ -1928,4 +2084,223 @@ int syscall_nanosleep(struct timespec *req, struct timespec *rem)
     }
 
     return -1;
-}
\ No newline at end of file
+}
+
+/*
+ *  For FUTEX_REQUEUE, `timeout` carries the maximum number of waiters to requeue like in Linux. The last argument of Linux (val3) is not supported as we only
+ *  have five syscall arguments, so neither is FUTEX_CMP_REQUEUE.
+ */
+int syscall_futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout, uint32_t *uaddr2)
+{
+    if (NULL == uaddr || !check_user_access(uaddr) || ((uint32_t)uaddr & 3) != 0)
+    {
+        return -EFAULT;
+    }
+
+    switch (op & FUTEX_CMD_MASK)
+    {
+    case FUTEX_WAIT:
+    {
+        int32_t timeout_ms = -1;
+
+        if (timeout)
+        {
+            if (!check_user_access((void*)timeout))
+            {
+                return -EFAULT;
+            }
+
+            //A negative tv_nsec shows up above the limit too
+            if ((int64_t)timeout->tv_sec < 0 || timeout->tv_nsec >= 1000000000)
+            {
+                return -EINVAL;
+            }
+
+            //Longer than fits is as good as the longest wait
+            if (timeout->tv_sec >= 0x7FFFFFFF / 1000)
+            {
+                timeout_ms = 0x7FFFFFFF;
+            }
+            else
+            {
+                timeout_ms = (int32_t)timeout->tv_sec * 1000 + timeout->tv_nsec / 1000000;
+            }
+        }
+
+        return futex_wait(g_current_thread, uaddr, val, timeout_ms);
+    }
+    case FUTEX_WAKE:
+        return futex_wake(uaddr, val);
+    case FUTEX_REQUEUE:
+        if (NULL == uaddr2 || !check_user_access(uaddr2) || ((uint32_t)uaddr2 & 3) != 0)
+        {
+            return -EFAULT;
+        }
+
+        return futex_requeue(uaddr, val, (uint32_t)timeout, uaddr2);
+    default:
+        break;
+    }
+
+    return -ENOSYS;
+}
+
+//Only RLIMIT_STACK is enforced, everything else is reported as unlimited
+int syscall_getrlimit(int resource, struct rlimit *rlim)
+{
+    if (NULL == rlim || !check_user_access(rlim))
+    {
+        return -EFAULT;
+    }
+
+    if (RLIMIT_STACK == resource)
+    {
+        rlim->rlim_cur = thread_get_current()->owner->stack_limit;
+        rlim->rlim_max = USER_STACK_RESERVE;
+    }
+    else
+    {
+        rlim->rlim_cur = RLIM_INFINITY;
+        rlim->rlim_max = RLIM_INFINITY;
+    }
+
+    return 0;
+}
+
+int syscall_setrlimit(int resource, const struct rlimit *rlim)
+{
+    if (NULL == rlim || !check_user_access((void*)rlim))
+    {
+        return -EFAULT;
+    }
+
+    if (RLIMIT_STACK != resource)
+    {
+        return -EINVAL;
+    }
+
+    if (rlim->rlim_cur > rlim->rlim_max)
+    {
+        return -EINVAL;
+    }
+
+    //The reserved stack region can't be made larger. The hard limit is always the size of that region.
+    if (rlim->rlim_max > USER_STACK_RESERVE)
+    {
+        return -EPERM;
+    }
+
+    if (rlim->rlim_cur < PAGESIZE_4K * USER_STACK_INITIAL_PAGES)
+    {
+        return -EINVAL;
+    }
+
+    //Lowering the limit doesn't unmap what is already grown, it only stops further growth
+    thread_get_current()->owner->stack_limit = rlim->rlim_cur;
+
+    return 0;
+}
+
+int syscall_msync(void *addr, int length, int flags)
+{
+    if ((uint32_t)addr < USER_OFFSET || ((uint32_t)addr & (PAGESIZE_4K - 1)) != 0 || length < 0)
+    {
+        return -EINVAL;
+    }
+
+    if ((flags & MS_ASYNC) && (flags & MS_SYNC))
+    {
+        return -EINVAL;
+    }
+
+    Process* process = thread_get_current()->owner;
+
+    if (process)
+    {
+        //Write back is always synchronous
+        return filemapping_sync(process, (uint32_t)addr, length);
+    }
+    else
+    {
+        PANIC("Process is NULL!\n");
+    }
+
+    return -1;
+}
+
+//Same operations as manage_pipe: 0 checks existence, 1 creates, 2 resizes. Sizes are in bytes.
+int syscall_manage_ramdisk(const char *name, int operation, uint32_t size)
+{
+    if (!check_user_access((char*)name))
+    {
+        return -EFAULT;
+    }
+
+    Process* process = thread_get_current()->owner;
+
+    int result = -EINVAL;
+
+    switch (operation)
+    {
+    case 0:
+        result = ramdisk_exists(name);
+        break;
+    case 1:
+        if (ramdisk_exists(name))
+        {
+            result = -EEXIST;
+        }
+        else
+        {
+            result = ramdisk_create(name, size, process->pid) ? 0 : -EINVAL;
+        }
+        break;
+    case 2:
+        //There are no users, only the process that created the disk may resize it
+        result = ramdisk_resize(name, size, process->pid);
+        break;
+    }
+
+    return result;
+}
+
+int syscall_fsync(int fd)
+{
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
+    {
+        return -EBADF;
+    }
+
+    int result = fs_fsync(file, FALSE);
+
+    fs_release_file(file);
+
+    return result;
+}
+
+int syscall_fdatasync(int fd)
+{
+    File* file = fs_get_file(thread_get_current()->owner, fd);
+    if (NULL == file)
+    {
+        return -EBADF;
+    }
+
+    int result = fs_fsync(file, TRUE);
+
+    fs_release_file(file);
+
+    return result;
+}
+
+int syscall_sync()
+{
+    //File systems move what they keep in memory to the block cache first
+    filemapping_write_pending();
+
+    fs_sync();
+
+    //Also reports write backs that failed in the background
+    return blockcache_flush(NULL) < 0 ? -EIO : 0;
+}
@@ -116,6 +116,24 @@ enum
     SYS_nanosleep,
     SYS_getthreads,
     SYS_getprocs,
+    SYS_spawn,
+    SYS_futex,
+    SYS_clone,
+    SYS_getrlimit,
+    SYS_setrlimit,
+    SYS_msync,
+    SYS_manage_ramdisk,
+    SYS_fsync,
+    SYS_fdatasync,
+    SYS_sync,
+    SYS_io_ring_setup,
+    SYS_io_ring_enter,
+    SYS_sendfile,
+    SYS_splice,
+    SYS_pread64,
+    SYS_pwrite64,
+    SYS_preadv,
+    SYS_pwritev,
 
     SYSCALL_COUNT
 };
\ No newline at end of file
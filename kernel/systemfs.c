@@ -38,6 +38,9 @@
 #include "device.h"
 #include "vmm.h"
 #include "process.h"
+#include "blockcache.h"
+#include "tmpfs.h"
+#include "blockqueue.h"
 
 static filesystem_node* g_systemfs_root = NULL;
 
@@ -52,16 +55,61 @@ static filesystem_dirent g_dirent;
 
 static int32_t systemfs_read_meminfo_totalpages(File *file, uint32_t size, uint8_t *buffer);
 static int32_t systemfs_read_meminfo_usedpages(File *file, uint32_t size, uint8_t *buffer);
+static int32_t systemfs_read_blockcache(File *file, uint32_t size, uint8_t *buffer);
+static int32_t systemfs_write_blockcache(File *file, uint32_t size, uint8_t *buffer);
+static int32_t systemfs_read_tmpfs(File *file, uint32_t size, uint8_t *buffer);
+static int32_t systemfs_read_blockqueue(File *file, uint32_t size, uint8_t *buffer);
 static BOOL systemfs_open_threads_dir(File *file, uint32_t flags);
 static void systemfs_close_threads_dir(File *file);
 
-void systemfs_initialize()
+static const filesystem_ops g_systemfs_dir_ops =
+{
+    .open = systemfs_open,
+    .readdir = systemfs_readdir,
+    .finddir = systemfs_finddir
+};
+
+static const filesystem_ops g_meminfo_totalpages_ops =
+{
+    .open = systemfs_open,
+    .read = systemfs_read_meminfo_totalpages
+};
+
+static const filesystem_ops g_meminfo_usedpages_ops =
+{
+    .open = systemfs_open,
+    .read = systemfs_read_meminfo_usedpages
+};
+
+static const filesystem_ops g_threads_dir_ops =
 {
-    g_systemfs_root = kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)g_systemfs_root, 0, sizeof(filesystem_node));
+    .open = systemfs_open_threads_dir,
+    .close = systemfs_close_threads_dir,
+    .readdir = systemfs_readdir,
+    .finddir = systemfs_finddir
+};
 
-    g_systemfs_root->node_type = FT_DIRECTORY;
+static const filesystem_ops g_blockcache_ops =
+{
+    .open = systemfs_open,
+    .read = systemfs_read_blockcache,
+    .write = systemfs_write_blockcache
+};
+
+static const filesystem_ops g_tmpfs_ops =
+{
+    .open = systemfs_open,
+    .read = systemfs_read_tmpfs
+};
 
+static const filesystem_ops g_blockqueue_ops =
+{
+    .open = systemfs_open,
+    .read = systemfs_read_blockqueue
+};
+
+void systemfs_initialize()
+{
     filesystem_node* root_fs = fs_get_root_node();
 
     fs_mkdir(root_fs, "system", 0);
@@ -70,79 +118,56 @@ void systemfs_initialize()
 
     if (system_node)
     {
+        g_systemfs_root = fs_create_node(system_node->name, &g_systemfs_dir_ops);
+        g_systemfs_root->node_type = FT_DIRECTORY;
+
         system_node->node_type |= FT_MOUNT_POINT;
         system_node->mount_point = g_systemfs_root;
         g_systemfs_root->parent = system_node->parent;
-        strcpy(g_systemfs_root->name, system_node->name);
     }
     else
     {
         PANIC("Could not create /system !");
     }
 
-    g_systemfs_root->open = systemfs_open;
-    g_systemfs_root->finddir = systemfs_finddir;
-    g_systemfs_root->readdir = systemfs_readdir;
-
     create_nodes();
 }
 
 static void create_nodes()
 {
-    filesystem_node* node_mem_info = kmalloc(sizeof(filesystem_node));
+    filesystem_node* node_mem_info = fs_create_node("meminfo", &g_systemfs_dir_ops);
 
-    memset((uint8_t*)node_mem_info, 0, sizeof(filesystem_node));
-
-    strcpy(node_mem_info->name, "meminfo");
     node_mem_info->node_type = FT_DIRECTORY;
-    node_mem_info->open = systemfs_open;
-    node_mem_info->finddir = systemfs_finddir;
-    node_mem_info->readdir = systemfs_readdir;
     node_mem_info->parent = g_systemfs_root;
 
     g_systemfs_root->first_child = node_mem_info;
 
-    filesystem_node* node_mem_info_total_pages = kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)node_mem_info_total_pages, 0, sizeof(filesystem_node));
-    strcpy(node_mem_info_total_pages->name, "totalpages");
+    filesystem_node* node_mem_info_total_pages = fs_create_node("totalpages", &g_meminfo_totalpages_ops);
     node_mem_info_total_pages->node_type = FT_FILE;
-    node_mem_info_total_pages->open = systemfs_open;
-    node_mem_info_total_pages->read = systemfs_read_meminfo_totalpages;
     node_mem_info_total_pages->parent = node_mem_info;
 
     node_mem_info->first_child = node_mem_info_total_pages;
 
-    filesystem_node* node_mem_info_used_pages = kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)node_mem_info_used_pages, 0, sizeof(filesystem_node));
-    strcpy(node_mem_info_used_pages->name, "usedpages");
+    filesystem_node* node_mem_info_used_pages = fs_create_node("usedpages", &g_meminfo_usedpages_ops);
     node_mem_info_used_pages->node_type = FT_FILE;
-    node_mem_info_used_pages->open = systemfs_open;
-    node_mem_info_used_pages->read = systemfs_read_meminfo_usedpages;
     node_mem_info_used_pages->parent = node_mem_info;
 
     node_mem_info_total_pages->next_sibling = node_mem_info_used_pages;
 
     //
 
-    filesystem_node* node_threads = kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)node_threads, 0, sizeof(filesystem_node));
+    filesystem_node* node_threads = fs_create_node("threads", &g_threads_dir_ops);
 
-    strcpy(node_threads->name, "threads");
     node_threads->node_type = FT_DIRECTORY;
-    node_threads->open = systemfs_open_threads_dir;
-    node_threads->close = systemfs_close_threads_dir;
-    node_threads->finddir = systemfs_finddir;
-    node_threads->readdir = systemfs_readdir;
     node_threads->parent = g_systemfs_root;
 
     node_mem_info->next_sibling = node_threads;
 
     //
 
-    filesystem_node* node_pipes = kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)node_pipes, 0, sizeof(filesystem_node));
+    //The pipe and shared memory drivers set the operations of these two
+    filesystem_node* node_pipes = fs_create_node("pipes", NULL);
 
-    strcpy(node_pipes->name, "pipes");
     node_pipes->node_type = FT_DIRECTORY;
     node_pipes->parent = g_systemfs_root;
 
@@ -150,14 +175,39 @@ static void create_nodes()
 
     //
 
-    filesystem_node* node_shm = kmalloc(sizeof(filesystem_node));
-    memset((uint8_t*)node_shm, 0, sizeof(filesystem_node));
+    filesystem_node* node_shm = fs_create_node("shm", NULL);
 
-    strcpy(node_shm->name, "shm");
     node_shm->node_type = FT_DIRECTORY;
     node_shm->parent = g_systemfs_root;
 
     node_pipes->next_sibling = node_shm;
+
+    //
+
+    filesystem_node* node_block_cache = fs_create_node("blockcache", &g_blockcache_ops);
+
+    node_block_cache->node_type = FT_FILE;
+    node_block_cache->parent = g_systemfs_root;
+
+    node_shm->next_sibling = node_block_cache;
+
+    //
+
+    filesystem_node* node_tmpfs = fs_create_node("tmpfs", &g_tmpfs_ops);
+
+    node_tmpfs->node_type = FT_FILE;
+    node_tmpfs->parent = g_systemfs_root;
+
+    node_block_cache->next_sibling = node_tmpfs;
+
+    //
+
+    filesystem_node* node_block_queue = fs_create_node("blockqueue", &g_blockqueue_ops);
+
+    node_block_queue->node_type = FT_FILE;
+    node_block_queue->parent = g_systemfs_root;
+
+    node_tmpfs->next_sibling = node_block_queue;
 }
 
 static BOOL systemfs_open(File *file, uint32_t flags)
@@ -256,6 +306,126 @@ static int32_t systemfs_read_meminfo_usedpages(File *file, uint32_t size, uint8_
     return -1;
 }
 
+static int32_t systemfs_read_blockcache(File *file, uint32_t size, uint8_t *buffer)
+{
+    if (size >= 128)
+    {
+        if (file->offset == 0)
+        {
+            BlockCacheStats stats;
+            blockcache_get_stats(&stats);
+
+            uint32_t char_index = 0;
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "capacity:%d\n", stats.capacity);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "blocks:%d\n", stats.block_count);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "dirty:%d\n", stats.dirty_count);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "hits:%d\n", stats.hits);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "misses:%d\n", stats.misses);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "evictions:%d\n", stats.evictions);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "writebacks:%d\n", stats.writebacks);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "flusher_writebacks:%d\n", stats.flusher_writebacks);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "throttled_writes:%d\n", stats.throttled_writes);
+
+            int len = char_index;
+
+            file->offset += len;
+
+            return len;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//Writing a number sets the capacity of the block cache in blocks
+static int32_t systemfs_write_blockcache(File *file, uint32_t size, uint8_t *buffer)
+{
+    char number[16];
+
+    uint32_t length = size < sizeof(number) - 1 ? size : sizeof(number) - 1;
+    memcpy((uint8_t*)number, buffer, length);
+    number[length] = '\0';
+
+    int capacity = atoi(number);
+    if (capacity <= 0)
+    {
+        return -1;
+    }
+
+    blockcache_set_capacity(capacity);
+
+    return size;
+}
+
+//Counters of all block request queues, depth is the number of queued requests
+static int32_t systemfs_read_blockqueue(File *file, uint32_t size, uint8_t *buffer)
+{
+    if (size >= 128)
+    {
+        if (file->offset == 0)
+        {
+            BlockQueueStats stats;
+            blockqueue_get_stats(&stats);
+
+            uint32_t char_index = 0;
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "submitted:%d\n", stats.submitted);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "merged:%d\n", stats.merged);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "dispatched:%d\n", stats.dispatched);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "depth:%d\n", stats.depth);
+            char_index += sprintf((char*)buffer + char_index, size - char_index, "max_depth:%d\n", stats.max_depth);
+
+            int len = char_index;
+
+            file->offset += len;
+
+            return len;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//One line per tmpfs mount, sizes are in pages
+static int32_t systemfs_read_tmpfs(File *file, uint32_t size, uint8_t *buffer)
+{
+    if (size >= 128)
+    {
+        if (file->offset == 0)
+        {
+            char path[128];
+            TmpfsStats stats;
+
+            uint32_t char_index = 0;
+            for (uint32_t i = 0; tmpfs_get_stats(i, &stats) && size - char_index >= 128; ++i)
+            {
+                if (fs_get_node_path(stats.root, path, sizeof(path)) < 0)
+                {
+                    strcpy(path, "?");
+                }
+
+                char_index += sprintf((char*)buffer + char_index, size - char_index, "%s used:%d limit:%d nodes:%d\n", path, stats.used, stats.limit, stats.node_count);
+            }
+
+            int len = char_index;
+
+            file->offset += len;
+
+            return len;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
 static BOOL systemfs_open_thread_file(File *file, uint32_t flags)
 {
     return TRUE;
@@ -325,6 +495,15 @@ static void clean_thread_nodes(File *file)
     }
 }
 
+static const filesystem_ops g_thread_file_ops =
+{
+    .open = systemfs_open_thread_file,
+    .close = systemfs_close_thread_file,
+    .read = systemfs_read_thread_file,
+    .readdir = systemfs_readdir,
+    .finddir = systemfs_finddir
+};
+
 static BOOL systemfs_open_threads_dir(File *file, uint32_t flags)
 {
     char buffer[16];
@@ -339,18 +518,10 @@ static BOOL systemfs_open_threads_dir(File *file, uint32_t flags)
 
     while (NULL != thread)
     {
-        filesystem_node* node_thread = kmalloc(sizeof(filesystem_node));
-        memset((uint8_t*)node_thread, 0, sizeof(filesystem_node));
-
         sprintf(buffer, 16, "%d", thread->threadId);
 
-        strcpy(node_thread->name, buffer);
+        filesystem_node* node_thread = fs_create_node(buffer, &g_thread_file_ops);
         node_thread->node_type = FT_FILE;
-        node_thread->open = systemfs_open_thread_file;
-        node_thread->close = systemfs_close_thread_file;
-        node_thread->read = systemfs_read_thread_file;
-        node_thread->finddir = systemfs_finddir;
-        node_thread->readdir = systemfs_readdir;
         node_thread->parent = file->node;
 
         if (node_previous)
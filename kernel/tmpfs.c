@@ -0,0 +1,888 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+
+#include "tmpfs.h"
+#include "common.h"
+#include "fs.h"
+#include "alloc.h"
+#include "list.h"
+#include "vmm.h"
+#include "process.h"
+#include "dcache.h"
+#include "imagecache.h"
+#include "errno.h"
+#include "filemapping.h"
+
+/*
+ *  tmpfs keeps file data in page frames. A file is an array of physical addresses indexed by file page number, so reads, writes
+ *  and appends go straight to the frame, truncation releases the frames past the new end and mmap maps the same frames into
+ *  the process (read-only without PROT_WRITE, MAP_PRIVATE gets copies of the frames instead).
+ *  Frames count against the limit of their mount, given as "size=<bytes>[k|m]" in the mount data.
+ *  A node unlinked while it is open or mapped is freed when its last File is closed and its last mapping is removed.
+ */
+
+#define SEEK_SET	0	/* Seek from beginning of file.  */
+#define SEEK_CUR	1	/* Seek from current position.  */
+#define SEEK_END	2
+
+typedef struct TmpfsMount
+{
+    filesystem_node* root;
+    uint32_t limit; //pages
+    uint32_t used; //pages
+    uint32_t node_count;
+} TmpfsMount;
+
+typedef struct TmpfsMapping
+{
+    Process* process;
+    uint32_t v_address;
+    uint32_t page_count;
+} TmpfsMapping;
+
+typedef struct TmpfsNode
+{
+    TmpfsMount* mount;
+    uint32_t* pages; //physical addresses
+    uint32_t page_count;
+    uint32_t page_capacity; //size of the pages array
+    List* mappings;
+    BOOL unlinked;
+} TmpfsNode;
+
+static List* g_mounts = NULL;
+static List* g_mapped_nodes = NULL; //nodes having mappings, searched on munmap
+
+static filesystem_dirent g_dirent;
+
+static BOOL mount(const char* source_path, const char* target_path, uint32_t flags, void *data);
+static BOOL check_mount(const char* source_path, const char* target_path, uint32_t flags, void *data);
+static BOOL open(File *file, uint32_t flags);
+static void close(File *file);
+static int32_t read(File *file, uint32_t size, uint8_t *buffer);
+static int32_t write(File *file, uint32_t size, uint8_t *buffer);
+static int32_t readv(File *file, const struct iovec* iovs, uint32_t count, int32_t offset);
+static int32_t writev(File *file, const struct iovec* iovs, uint32_t count, int32_t offset);
+static int32_t lseek(File *file, int32_t offset, int32_t whence);
+static int32_t ftruncate(File *file, int32_t length);
+static int32_t unlink(filesystem_node* node, uint32_t flags);
+static int32_t stat(filesystem_node *node, struct stat* buf);
+static filesystem_dirent* readdir(filesystem_node *node, uint32_t index);
+static filesystem_node* finddir(filesystem_node *node, char *name);
+static BOOL mkdir(filesystem_node *node, const char *name, uint32_t flags);
+static filesystem_node* create(filesystem_node *node, const char *name, uint32_t flags);
+static void* mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags, uint32_t protection);
+
+static const filesystem_ops g_directory_ops =
+{
+    .open = open,
+    .close = close,
+    .unlink = unlink,
+    .stat = stat,
+    .readdir = readdir,
+    .finddir = finddir,
+    .mkdir = mkdir,
+    .create = create
+};
+
+static const filesystem_ops g_file_ops =
+{
+    .open = open,
+    .close = close,
+    .read = read,
+    .write = write,
+    .readv = readv,
+    .writev = writev,
+    .lseek = lseek,
+    .ftruncate = ftruncate,
+    .unlink = unlink,
+    .stat = stat,
+    .mmap = mmap
+};
+
+void tmpfs_initialize()
+{
+    g_mounts = list_create();
+    g_mapped_nodes = list_create();
+
+    FileSystem fs;
+    memset((uint8_t*)&fs, 0, sizeof(fs));
+    strcpy(fs.name, "tmpfs");
+    fs.mount = mount;
+    fs.check_mount = check_mount;
+
+    fs_register(&fs);
+}
+
+//Reads "size=<bytes>[k|m]", returns the limit in pages
+static uint32_t parse_limit(const char* options)
+{
+    if (NULL == options || strncmp(options, "size=", 5) != 0)
+    {
+        return TMPFS_DEFAULT_LIMIT;
+    }
+
+    uint32_t bytes = 0;
+
+    const char* c = options + 5;
+    while (*c >= '0' && *c <= '9')
+    {
+        bytes = bytes * 10 + (*c - '0');
+        ++c;
+    }
+
+    if ('k' == *c || 'K' == *c)
+    {
+        bytes *= 1024;
+    }
+    else if ('m' == *c || 'M' == *c)
+    {
+        bytes *= 1024 * 1024;
+    }
+
+    if (0 == bytes)
+    {
+        return TMPFS_DEFAULT_LIMIT;
+    }
+
+    return PAGE_COUNT(bytes);
+}
+
+static filesystem_node* create_node(TmpfsMount* mount, const char* name, uint32_t node_type)
+{
+    TmpfsNode* tmpfs_node = (TmpfsNode*)kmalloc(sizeof(TmpfsNode));
+    memset((uint8_t*)tmpfs_node, 0, sizeof(TmpfsNode));
+    tmpfs_node->mount = mount;
+
+    filesystem_node* node = fs_create_node(name, node_type == FT_DIRECTORY ? &g_directory_ops : &g_file_ops);
+    node->node_type = node_type;
+    node->private_node_data = tmpfs_node;
+
+    mount->node_count++;
+
+    return node;
+}
+
+static void add_child(filesystem_node* parent, filesystem_node* node)
+{
+    node->parent = parent;
+    node->next_sibling = parent->first_child;
+    parent->first_child = node;
+}
+
+static void remove_child(filesystem_node* parent, filesystem_node* node)
+{
+    filesystem_node** link = &parent->first_child;
+    while (*link)
+    {
+        if (*link == node)
+        {
+            *link = node->next_sibling;
+            break;
+        }
+
+        link = &(*link)->next_sibling;
+    }
+
+    node->next_sibling = NULL;
+    node->parent = NULL;
+}
+
+static filesystem_node* find_child(filesystem_node* parent, const char* name)
+{
+    for (filesystem_node* n = parent->first_child; NULL != n; n = n->next_sibling)
+    {
+        if (strcmp(name, n->name) == 0)
+        {
+            return n;
+        }
+    }
+
+    return NULL;
+}
+
+static BOOL mount(const char* source_path, const char* target_path, uint32_t flags, void *data)
+{
+    filesystem_node* target_node = fs_get_node(target_path);
+    if (NULL == target_node || target_node->node_type != FT_DIRECTORY)
+    {
+        return FALSE;
+    }
+
+    TmpfsMount* tmpfs_mount = (TmpfsMount*)kmalloc(sizeof(TmpfsMount));
+    memset((uint8_t*)tmpfs_mount, 0, sizeof(TmpfsMount));
+    tmpfs_mount->limit = parse_limit((const char*)data);
+
+    filesystem_node* root = create_node(tmpfs_mount, target_node->name, FT_DIRECTORY);
+    root->parent = target_node->parent;
+    tmpfs_mount->root = root;
+
+    target_node->node_type |= FT_MOUNT_POINT;
+    target_node->mount_point = root;
+
+    list_append(g_mounts, tmpfs_mount);
+
+    return TRUE;
+}
+
+static BOOL check_mount(const char* source_path, const char* target_path, uint32_t flags, void *data)
+{
+    filesystem_node* target_node = fs_get_node(target_path);
+
+    return target_node && target_node->node_type == FT_DIRECTORY;
+}
+
+//Grows or shrinks the frame array to cover `length` bytes, new frames are zeroed
+static int32_t resize(filesystem_node* node, uint32_t length)
+{
+    TmpfsNode* tmpfs_node = (TmpfsNode*)node->private_node_data;
+    TmpfsMount* tmpfs_mount = tmpfs_node->mount;
+
+    uint32_t page_count = length > 0 ? PAGE_COUNT(length) : 0;
+
+    if (page_count > tmpfs_node->page_count)
+    {
+        uint32_t needed = page_count - tmpfs_node->page_count;
+
+        if (tmpfs_mount->used + needed > tmpfs_mount->limit || needed + 1 > vmm_get_free_page_count())
+        {
+            return -ENOSPC;
+        }
+
+        if (page_count > tmpfs_node->page_capacity)
+        {
+            //Doubled so appending stays O(1) amortized
+            uint32_t capacity = MAX(page_count, tmpfs_node->page_capacity * 2);
+
+            uint32_t* pages = (uint32_t*)kmalloc(capacity * sizeof(uint32_t));
+            if (tmpfs_node->pages)
+            {
+                memcpy((uint8_t*)pages, (uint8_t*)tmpfs_node->pages, tmpfs_node->page_count * sizeof(uint32_t));
+                kfree(tmpfs_node->pages);
+            }
+
+            tmpfs_node->pages = pages;
+            tmpfs_node->page_capacity = capacity;
+        }
+
+        while (tmpfs_node->page_count < page_count)
+        {
+            uint32_t physical_address = vmm_acquire_page_frame_4k();
+
+            uint8_t* data = (uint8_t*)vmm_map_temporary(physical_address);
+            if (NULL == data)
+            {
+                vmm_release_page_frame_4k(physical_address);
+                return -ENOMEM;
+            }
+
+            memset(data, 0, PAGESIZE_4K);
+            vmm_unmap_temporary(data);
+
+            tmpfs_node->pages[tmpfs_node->page_count++] = physical_address;
+            tmpfs_mount->used++;
+        }
+    }
+    else if (page_count < tmpfs_node->page_count)
+    {
+        if (tmpfs_node->mappings && !list_is_empty(tmpfs_node->mappings))
+        {
+            //Frames being released could be mapped
+            return -EBUSY;
+        }
+
+        while (tmpfs_node->page_count > page_count)
+        {
+            vmm_release_page_frame_4k(tmpfs_node->pages[--tmpfs_node->page_count]);
+            tmpfs_mount->used--;
+        }
+    }
+
+    if (length < node->length && (length % PAGESIZE_4K) != 0)
+    {
+        //The rest of the last page must read as zeros if the file grows again
+        uint8_t* data = (uint8_t*)vmm_map_temporary(tmpfs_node->pages[length / PAGESIZE_4K]);
+        if (data)
+        {
+            memset(data + length % PAGESIZE_4K, 0, PAGESIZE_4K - length % PAGESIZE_4K);
+            vmm_unmap_temporary(data);
+        }
+    }
+
+    node->length = length;
+
+    return 0;
+}
+
+static void copy(TmpfsNode* tmpfs_node, uint32_t offset, uint8_t* buffer, uint32_t size, BOOL to_file)
+{
+    uint32_t done = 0;
+    while (done < size)
+    {
+        uint32_t index = (offset + done) / PAGESIZE_4K;
+        uint32_t page_offset = (offset + done) % PAGESIZE_4K;
+        uint32_t chunk = MIN(PAGESIZE_4K - page_offset, size - done);
+
+        uint8_t* data = (uint8_t*)vmm_map_temporary(tmpfs_node->pages[index]);
+        if (NULL == data)
+        {
+            break;
+        }
+
+        if (to_file)
+        {
+            memcpy(data + page_offset, buffer + done, chunk);
+        }
+        else
+        {
+            memcpy(buffer + done, data + page_offset, chunk);
+        }
+
+        vmm_unmap_temporary(data);
+
+        done += chunk;
+    }
+}
+
+static void destroy_if_unused(filesystem_node* node)
+{
+    TmpfsNode* tmpfs_node = (TmpfsNode*)node->private_node_data;
+
+    if (!tmpfs_node->unlinked || node->reference_count > 0 ||
+        (tmpfs_node->mappings && !list_is_empty(tmpfs_node->mappings)))
+    {
+        return;
+    }
+
+    TmpfsMount* tmpfs_mount = tmpfs_node->mount;
+
+    for (uint32_t i = 0; i < tmpfs_node->page_count; ++i)
+    {
+        vmm_release_page_frame_4k(tmpfs_node->pages[i]);
+    }
+    tmpfs_mount->used -= tmpfs_node->page_count;
+    tmpfs_mount->node_count--;
+
+    if (tmpfs_node->pages)
+    {
+        kfree(tmpfs_node->pages);
+    }
+
+    if (tmpfs_node->mappings)
+    {
+        list_destroy(tmpfs_node->mappings);
+    }
+
+    dcache_remove_node(node);
+    imagecache_invalidate(node);
+
+    kfree(tmpfs_node);
+    kfree(node);
+}
+
+static BOOL open(File *file, uint32_t flags)
+{
+    return TRUE;
+}
+
+static void close(File *file)
+{
+    destroy_if_unused(file->node);
+}
+
+static int32_t read_at(filesystem_node* node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+    if (offset >= node->length)
+    {
+        return 0;
+    }
+
+    size = MIN(size, node->length - offset);
+
+    copy((TmpfsNode*)node->private_node_data, offset, buffer, size, FALSE);
+
+    return size;
+}
+
+static int32_t write_at(filesystem_node* node, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+    if (offset + size < offset)
+    {
+        return -EFBIG;
+    }
+
+    if (offset + size > node->length)
+    {
+        int32_t result = resize(node, offset + size);
+
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    copy((TmpfsNode*)node->private_node_data, offset, buffer, size, TRUE);
+
+    return size;
+}
+
+static int32_t read(File *file, uint32_t size, uint8_t *buffer)
+{
+    if (file->offset < 0)
+    {
+        return -EINVAL;
+    }
+
+    int32_t result = read_at(file->node, (uint32_t)file->offset, size, buffer);
+
+    if (result > 0)
+    {
+        file->offset += result;
+    }
+
+    return result;
+}
+
+static int32_t write(File *file, uint32_t size, uint8_t *buffer)
+{
+    if ((file->flags & O_APPEND) == O_APPEND)
+    {
+        file->offset = file->node->length;
+    }
+
+    if (file->offset < 0)
+    {
+        return -EINVAL;
+    }
+
+    int32_t result = write_at(file->node, (uint32_t)file->offset, size, buffer);
+
+    if (result > 0)
+    {
+        file->offset += result;
+    }
+
+    return result;
+}
+
+//Transfers the buffers in order at the offset, file->offset is only used and advanced for FS_OFFSET_CURRENT
+static int32_t transfer_vector(File *file, const struct iovec* iovs, uint32_t count, int32_t offset, BOOL write)
+{
+    BOOL current = (FS_OFFSET_CURRENT == offset);
+
+    if (current)
+    {
+        if (write && (file->flags & O_APPEND) == O_APPEND)
+        {
+            file->offset = file->node->length;
+        }
+
+        offset = file->offset;
+    }
+
+    if (offset < 0)
+    {
+        return -EINVAL;
+    }
+
+    uint32_t position = (uint32_t)offset;
+    int32_t done = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        int32_t bytes = write ? write_at(file->node, position, iovs[i].iov_len, (uint8_t*)iovs[i].iov_base) :
+                                read_at(file->node, position, iovs[i].iov_len, (uint8_t*)iovs[i].iov_base);
+
+        if (bytes < 0)
+        {
+            if (0 == done)
+            {
+                return bytes;
+            }
+            break;
+        }
+
+        done += bytes;
+        position += bytes;
+
+        if ((uint32_t)bytes < iovs[i].iov_len)
+        {
+            break;
+        }
+    }
+
+    if (current)
+    {
+        file->offset = position;
+    }
+
+    return done;
+}
+
+static int32_t readv(File *file, const struct iovec* iovs, uint32_t count, int32_t offset)
+{
+    return transfer_vector(file, iovs, count, offset, FALSE);
+}
+
+static int32_t writev(File *file, const struct iovec* iovs, uint32_t count, int32_t offset)
+{
+    return transfer_vector(file, iovs, count, offset, TRUE);
+}
+
+static int32_t lseek(File *file, int32_t offset, int32_t whence)
+{
+    int32_t position = -1;
+
+    switch (whence)
+    {
+    case SEEK_SET:
+        position = offset;
+        break;
+    case SEEK_CUR:
+        position = file->offset + offset;
+        break;
+    case SEEK_END:
+        position = file->node->length + offset;
+        break;
+    default:
+        break;
+    }
+
+    if (position < 0)
+    {
+        return -EINVAL;
+    }
+
+    file->offset = position;
+
+    return position;
+}
+
+static int32_t ftruncate(File *file, int32_t length)
+{
+    if (length < 0)
+    {
+        return -EINVAL;
+    }
+
+    return resize(file->node, (uint32_t)length);
+}
+
+static int32_t unlink(filesystem_node* node, uint32_t flags)
+{
+    TmpfsNode* tmpfs_node = (TmpfsNode*)node->private_node_data;
+
+    if (node == tmpfs_node->mount->root)
+    {
+        return -EBUSY;
+    }
+
+    if (node->first_child)
+    {
+        return -ENOTEMPTY;
+    }
+
+    if (node->parent)
+    {
+        remove_child(node->parent, node);
+    }
+
+    tmpfs_node->unlinked = TRUE;
+
+    destroy_if_unused(node);
+
+    return 0;
+}
+
+static int32_t stat(filesystem_node *node, struct stat* buf)
+{
+    //1 lets fs_stat fill the type and size
+    return 1;
+}
+
+static filesystem_dirent* readdir(filesystem_node *node, uint32_t index)
+{
+    uint32_t i = 0;
+    for (filesystem_node* n = node->first_child; NULL != n; n = n->next_sibling)
+    {
+        if (index == i)
+        {
+            strcpy(g_dirent.name, n->name);
+            g_dirent.file_type = n->node_type;
+            g_dirent.inode = i;
+
+            return &g_dirent;
+        }
+
+        ++i;
+    }
+
+    return NULL;
+}
+
+static filesystem_node* finddir(filesystem_node *node, char *name)
+{
+    return find_child(node, name);
+}
+
+static BOOL mkdir(filesystem_node *node, const char *name, uint32_t flags)
+{
+    if (find_child(node, name))
+    {
+        return FALSE;
+    }
+
+    TmpfsNode* tmpfs_node = (TmpfsNode*)node->private_node_data;
+
+    add_child(node, create_node(tmpfs_node->mount, name, FT_DIRECTORY));
+
+    return TRUE;
+}
+
+static filesystem_node* create(filesystem_node *node, const char *name, uint32_t flags)
+{
+    filesystem_node* existing = find_child(node, name);
+    if (existing)
+    {
+        return existing->node_type == FT_FILE ? existing : NULL;
+    }
+
+    TmpfsNode* tmpfs_node = (TmpfsNode*)node->private_node_data;
+
+    filesystem_node* new_node = create_node(tmpfs_node->mount, name, FT_FILE);
+
+    add_child(node, new_node);
+
+    return new_node;
+}
+
+//Maps the file's own frames, so every mapping shares the data with the File interface
+static void* mmap(File* file, uint32_t size, uint32_t offset, uint32_t flags, uint32_t protection)
+{
+    TmpfsNode* tmpfs_node = (TmpfsNode*)file->node->private_node_data;
+
+    if (0 == size || (offset % PAGESIZE_4K) != 0 || offset / PAGESIZE_4K >= tmpfs_node->page_count)
+    {
+        return NULL;
+    }
+
+    uint32_t first_page = offset / PAGESIZE_4K;
+    uint32_t page_count = MIN(PAGE_COUNT(size), tmpfs_node->page_count - first_page);
+
+    BOOL private = (flags & MAP_PRIVATE) == MAP_PRIVATE;
+
+    if (!private && (protection & PROT_WRITE) && CHECK_ACCESS(file->flags, O_RDONLY))
+    {
+        return NULL;
+    }
+
+    if (private && page_count + 1 > vmm_get_free_page_count())
+    {
+        return NULL;
+    }
+
+    Process* process = g_current_thread->owner;
+
+    void* result = vmm_reserve_memory(process, USER_MMAP_START, page_count);
+
+    if (NULL == result)
+    {
+        return NULL;
+    }
+
+    int page_flags = PG_USER;
+
+    if ((protection & PROT_WRITE) == 0)
+    {
+        page_flags |= PG_READONLY;
+    }
+
+    for (uint32_t i = 0; i < page_count; ++i)
+    {
+        uint32_t frame = tmpfs_node->pages[first_page + i];
+
+        if (private)
+        {
+            //The copy belongs to the process and is released with the mapping
+            uint32_t copy = vmm_acquire_page_frame_4k();
+
+            uint8_t* source = (uint8_t*)vmm_map_temporary(frame);
+            uint8_t* destination = (uint8_t*)vmm_map_temporary(copy);
+            memcpy(destination, source, PAGESIZE_4K);
+            vmm_unmap_temporary(destination);
+            vmm_unmap_temporary(source);
+
+            vmm_add_page_to_pd((char*)result + i * PAGESIZE_4K, copy, page_flags | PG_OWNED);
+        }
+        else
+        {
+            vmm_add_page_to_pd((char*)result + i * PAGESIZE_4K, frame, page_flags);
+        }
+    }
+
+    //Copies don't change with the file, there is nothing to track
+    if (!private)
+    {
+        TmpfsMapping* mapping = (TmpfsMapping*)kmalloc(sizeof(TmpfsMapping));
+        mapping->process = process;
+        mapping->v_address = (uint32_t)result;
+        mapping->page_count = page_count;
+
+        if (NULL == tmpfs_node->mappings)
+        {
+            tmpfs_node->mappings = list_create();
+        }
+
+        if (list_is_empty(tmpfs_node->mappings))
+        {
+            list_append(g_mapped_nodes, file->node);
+        }
+
+        list_append(tmpfs_node->mappings, mapping);
+    }
+
+    return result;
+}
+
+//Forgets the parts of the process's mappings in pages [first_page, end_page), trimming or splitting the ones it only covers in part
+static BOOL forget_mappings(Process* process, uint32_t first_page, uint32_t end_page)
+{
+    BOOL found = FALSE;
+
+    ListNode* n = g_mapped_nodes->head;
+    while (n)
+    {
+        ListNode* next_node = n->next;
+
+        filesystem_node* node = (filesystem_node*)n->data;
+        TmpfsNode* tmpfs_node = (TmpfsNode*)node->private_node_data;
+
+        ListNode* m = tmpfs_node->mappings->head;
+        while (m)
+        {
+            ListNode* next_mapping = m->next;
+
+            TmpfsMapping* mapping = (TmpfsMapping*)m->data;
+
+            uint32_t mapping_first = mapping->v_address / PAGESIZE_4K;
+            uint32_t mapping_end = mapping_first + mapping->page_count;
+
+            if (mapping->process == process && first_page < mapping_end && end_page > mapping_first)
+            {
+                found = TRUE;
+
+                if (first_page > mapping_first && end_page < mapping_end)
+                {
+                    //A hole in the middle, the part after it becomes a mapping of its own
+                    TmpfsMapping* tail = (TmpfsMapping*)kmalloc(sizeof(TmpfsMapping));
+                    tail->process = process;
+                    tail->v_address = end_page * PAGESIZE_4K;
+                    tail->page_count = mapping_end - end_page;
+
+                    list_append(tmpfs_node->mappings, tail);
+
+                    mapping->page_count = first_page - mapping_first;
+                }
+                else if (first_page > mapping_first)
+                {
+                    mapping->page_count = first_page - mapping_first;
+                }
+                else if (end_page < mapping_end)
+                {
+                    mapping->v_address = end_page * PAGESIZE_4K;
+                    mapping->page_count = mapping_end - end_page;
+                }
+                else
+                {
+                    list_remove_node(tmpfs_node->mappings, m);
+                    kfree(mapping);
+                }
+            }
+
+            m = next_mapping;
+        }
+
+        if (list_is_empty(tmpfs_node->mappings))
+        {
+            list_remove_node(g_mapped_nodes, n);
+
+            destroy_if_unused(node);
+        }
+
+        n = next_node;
+    }
+
+    return found;
+}
+
+//Forgets what the mappings have in the range, the caller unmaps the pages. The frames stay with the file.
+BOOL tmpfs_unmap_if_exists(Process* process, uint32_t address, uint32_t page_count)
+{
+    uint32_t first_page = address / PAGESIZE_4K;
+
+    return forget_mappings(process, first_page, first_page + page_count);
+}
+
+void tmpfs_unmap_for_process_all(Process* process)
+{
+    forget_mappings(process, 0, 0xFFFFFFFF / PAGESIZE_4K + 1);
+}
+
+uint32_t tmpfs_get_mount_count()
+{
+    return list_get_count(g_mounts);
+}
+
+BOOL tmpfs_get_stats(uint32_t index, TmpfsStats* stats)
+{
+    uint32_t i = 0;
+
+    list_foreach (n, g_mounts)
+    {
+        if (index == i)
+        {
+            TmpfsMount* tmpfs_mount = (TmpfsMount*)n->data;
+
+            stats->root = tmpfs_mount->root;
+            stats->limit = tmpfs_mount->limit;
+            stats->used = tmpfs_mount->used;
+            stats->node_count = tmpfs_mount->node_count;
+
+            return TRUE;
+        }
+
+        ++i;
+    }
+
+    return FALSE;
+}
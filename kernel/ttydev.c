@@ -68,6 +68,27 @@ static BOOL is_erase_character(TtyDev* tty, uint8_t character)
     return FALSE;
 }
 
+static const filesystem_ops g_master_ops =
+{
+    .open = master_open,
+    .close = master_close,
+    .read = master_read,
+    .write = master_write,
+    .read_test_ready = master_read_rest_ready,
+    .write_test_ready = master_write_test_ready
+};
+
+static const filesystem_ops g_slave_ops =
+{
+    .open = slave_open,
+    .close = slave_close,
+    .read = slave_read,
+    .write = slave_write,
+    .read_test_ready = slave_read_test_ready,
+    .write_test_ready = slave_write_test_ready,
+    .ioctl = slave_ioctl
+};
+
 filesystem_node* ttydev_create()
 {
     TtyDev* tty_dev = kmalloc(sizeof(TtyDev));
@@ -112,25 +133,14 @@ filesystem_node* ttydev_create()
     memset((uint8_t*)&master, 0, sizeof(Device));
     sprintf(master.name, 16, "ptty%d-m", g_name_generator);
     master.device_type = FT_CHARACTER_DEVICE;
-    master.open = master_open;
-    master.close = master_close;
-    master.read = master_read;
-    master.write = master_write;
-    master.read_test_ready = master_read_rest_ready;
-    master.write_test_ready = master_write_test_ready;
+    master.ops = &g_master_ops;
     master.private_data = tty_dev;
 
     Device slave;
     memset((uint8_t*)&slave, 0, sizeof(Device));
     sprintf(slave.name, 16, "ptty%d", g_name_generator);
     slave.device_type = FT_CHARACTER_DEVICE;
-    slave.open = slave_open;
-    slave.close = slave_close;
-    slave.read = slave_read;
-    slave.write = slave_write;
-    slave.read_test_ready = slave_read_test_ready;
-    slave.write_test_ready = slave_write_test_ready;
-    slave.ioctl = slave_ioctl;
+    slave.ops = &g_slave_ops;
     slave.private_data = tty_dev;
 
     filesystem_node* master_node = devfs_register_device(&master);
@@ -215,8 +225,8 @@ static int32_t master_read(File *file, uint32_t size, uint8_t *buffer)
                 return read_size;
             }
 
-            tty->master_reader = file->thread;
-            thread_change_state(file->thread, TS_WAITIO, tty);
+            tty->master_reader = g_current_thread;
+            thread_change_state(g_current_thread, TS_WAITIO, tty);
             halt();
         }
     }
@@ -641,11 +651,11 @@ static int32_t slave_read(File *file, uint32_t size, uint8_t *buffer)
 
             //TODO: remove reader from list
             spinlock_lock(&tty->slave_readers_lock);
-            list_remove_first_occurrence(tty->slave_readers, file->thread);
-            list_append(tty->slave_readers, file->thread);
+            list_remove_first_occurrence(tty->slave_readers, g_current_thread);
+            list_append(tty->slave_readers, g_current_thread);
             spinlock_unlock(&tty->slave_readers_lock);
 
-            thread_change_state(file->thread, TS_WAITIO, tty);
+            thread_change_state(g_current_thread, TS_WAITIO, tty);
             halt();
         }
     }
@@ -58,6 +58,15 @@ static BOOL unixsocket_fs_read_test_ready(File *file);
 static int32_t unixsocket_fs_read(File *file, uint32_t len, uint8_t *buf);
 static int32_t unixsocket_fs_write(File *file, uint32_t len, uint8_t *buf);
 
+static const filesystem_ops g_unixsocket_ops =
+{
+    .open = socket_fs_open,
+    .close = socket_fs_close,
+    .read = unixsocket_fs_read,
+    .write = unixsocket_fs_write,
+    .read_test_ready = unixsocket_fs_read_test_ready
+};
+
 void unixsocket_setup(Socket* socket)
 {
     //kprintf("unixsocket_setup\n");
@@ -76,9 +85,7 @@ void unixsocket_setup(Socket* socket)
     socket->socket_send = unixsocket_send;
     socket->socket_recv = unixsocket_recv;
 
-    socket->node->read_test_ready = unixsocket_fs_read_test_ready;
-    socket->node->read = unixsocket_fs_read;
-    socket->node->write = unixsocket_fs_write;
+    socket->node->ops = &g_unixsocket_ops;
 }
 
 static int unixsocket_bind(Socket* socket, int sockfd, const struct sockaddr *addr, socklen_t addrlen)
@@ -201,7 +208,7 @@ static int unixsocket_connect(Socket* socket, int sockfd, const struct sockaddr
     {
         queue_enqueue(accepting_socket->accept_queue, socket);
 
-        if (accepting_socket->last_thread->state == TS_WAITIO && accepting_socket->last_thread->state_privateData == unixsocket_accept)
+        if (thread_is_valid(accepting_socket->last_thread) && accepting_socket->last_thread->state == TS_WAITIO && accepting_socket->last_thread->state_privateData == unixsocket_accept)
         {
             thread_resume(accepting_socket->last_thread);
         }
@@ -242,9 +249,11 @@ static ssize_t unixsocket_send(Socket* socket, int sockfd, const void *buf, size
 
             uint32_t written = fifobuffer_enqueue(socket->connection->buffer_in, (uint8_t*)buf, smaller);
 
-            if (socket->connection->last_thread->state == TS_WAITIO && socket->connection->last_thread->state_privateData == unixsocket_recv)
+            Thread* peer = socket->connection->last_thread;
+
+            if (thread_is_valid(peer) && peer->state == TS_WAITIO && peer->state_privateData == unixsocket_recv)
             {
-                thread_resume(socket->connection->last_thread);
+                thread_resume(peer);
             }
 
             return written;
@@ -284,9 +293,11 @@ static ssize_t unixsocket_recv(Socket* socket, int sockfd, void *buf, size_t len
 
             uint32_t read = fifobuffer_dequeue(socket->buffer_in, (uint8_t*)buf, smaller);
 
-            if (socket->connection->last_thread->state == TS_WAITIO && socket->connection->last_thread->state_privateData == unixsocket_send)
+            Thread* peer = socket->connection->last_thread;
+
+            if (thread_is_valid(peer) && peer->state == TS_WAITIO && peer->state_privateData == unixsocket_send)
             {
-                thread_resume(socket->connection->last_thread);
+                thread_resume(peer);
             }
 
             return read;
@@ -339,12 +350,17 @@ static int32_t unixsocket_fs_read(File *file, uint32_t len, uint8_t *buf)
 {
     Socket* socket = (Socket*)file->node->private_node_data;
 
-    return unixsocket_recv(socket, file->fd, buf, len, 0);
+    //The File may be shared, the caller is the thread to wake and send/recv don't use the descriptor
+    socket->last_thread = g_current_thread;
+
+    return unixsocket_recv(socket, -1, buf, len, 0);
 }
 
 static int32_t unixsocket_fs_write(File *file, uint32_t len, uint8_t *buf)
 {
     Socket* socket = (Socket*)file->node->private_node_data;
 
-    return unixsocket_send(socket, file->fd, (const uint8_t *)buf, len, 0);
+    socket->last_thread = g_current_thread;
+
+    return unixsocket_send(socket, -1, (const uint8_t *)buf, len, 0);
 }
\ No newline at end of file
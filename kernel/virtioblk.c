@@ -0,0 +1,737 @@
+/*
+ *      dP      Asterisk is an operating system written fully in C and Intel-syntax
+ *  8b. 88 .d8  assembly. It strives to be POSIX-compliant, and a faster & lightweight
+ *   `8b88d8'   alternative to Linux for i386 processors.
+ *   .8P88Y8.   
+ *  8P' 88 `Y8  
+ *      dP      
+ *
+ *  BSD 2-Clause License
+ *  Copyright (c) 2017, ozkl, Nexuss
+ *  
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *  
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+ 
+#include "virtioblk.h"
+#include "alloc.h"
+#include "device.h"
+#include "devfs.h"
+#include "fs.h"
+#include "isr.h"
+#include "list.h"
+#include "log.h"
+#include "pci.h"
+#include "process.h"
+#include "timer.h"
+#include "vmm.h"
+
+/*
+ *  Legacy virtio-pci block devices, registered as /dev/vda, /dev/vdb and so on.
+ *  Every read_block/write_block call of up to 64KB becomes one request: a descriptor chain of the request header, the physical
+ *  pages of the caller's buffer and the status byte. Larger calls are split, and all parts are put on the available ring before
+ *  the caller sleeps. The interrupt handler walks the used ring and wakes the thread of every completed request. A caller that finds too few
+ *  free descriptors sleeps until a completion frees some. A request not completed within VIRTIO_BLK_TIMEOUT_MS fails, its chain stays
+ *  with the device until the device returns it.
+ *  Devices behind the block cache are only reached with the cache lock held (blockcache.c), so in practice the requests in
+ *  flight are the parts of one call. Parallel callers would need the cache to drop its lock while waiting for the device.
+ */
+
+#define VIRTIO_VENDOR_ID 0x1AF4
+#define VIRTIO_BLK_LEGACY_DEVICE_ID 0x1001
+
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES 0x04
+#define VIRTIO_REG_QUEUE_ADDRESS 0x08
+#define VIRTIO_REG_QUEUE_SIZE 0x0C
+#define VIRTIO_REG_QUEUE_SELECT 0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10
+#define VIRTIO_REG_DEVICE_STATUS 0x12
+#define VIRTIO_REG_ISR_STATUS 0x13
+#define VIRTIO_REG_BLK_CAPACITY 0x14 //Device configuration starts here without MSI-X
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+#define VIRTIO_BLK_F_RO (1 << 5)
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_PENDING 0xFF
+
+#define VIRTIO_BLK_SECTOR_SIZE 512
+#define VIRTIO_BLK_MAX_SECTORS 128 //64KB, at most 17 data descriptors
+#define VIRTIO_BLK_MAX_DATA_DESCRIPTORS (VIRTIO_BLK_MAX_SECTORS * VIRTIO_BLK_SECTOR_SIZE / PAGESIZE_4K + 1)
+#define VIRTIO_BLK_MAX_PENDING 16 //parts of one call in flight at a time
+#define VIRTIO_BLK_TIMEOUT_MS 5000
+
+#define ALIGN_4K(x) (((x) + PAGESIZE_4K - 1) & ~(PAGESIZE_4K - 1))
+
+typedef struct VirtqDescriptor
+{
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) VirtqDescriptor;
+
+typedef struct VirtqAvailable
+{
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring[];
+} __attribute__((packed)) VirtqAvailable;
+
+typedef struct VirtqUsedElement
+{
+    uint32_t id;
+    uint32_t length;
+} __attribute__((packed)) VirtqUsedElement;
+
+typedef struct VirtqUsed
+{
+    uint16_t flags;
+    uint16_t index;
+    VirtqUsedElement ring[];
+} __attribute__((packed)) VirtqUsed;
+
+//Header and status of the request whose chain starts at the same descriptor index. Lives in device visible memory.
+typedef struct VirtioBlkSlot
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+    uint8_t status;
+    uint8_t padding[15];
+} __attribute__((packed)) VirtioBlkSlot;
+
+typedef struct VirtioBlkRequest
+{
+    Thread* waiter;
+    volatile BOOL done;
+    BOOL abandoned; //timed out, the chain is freed if the device ever completes it
+} VirtioBlkRequest;
+
+typedef struct VirtioBlk
+{
+    PciDevice* pci;
+    uint16_t io_base;
+    uint8_t interrupt;
+    BOOL read_only;
+    uint32_t sector_count;
+
+    uint16_t queue_size;
+    uint8_t* memory;
+    uint32_t memory_physical;
+    uint32_t memory_page_count;
+    volatile VirtqDescriptor* descriptors;
+    volatile VirtqAvailable* available;
+    volatile VirtqUsed* used;
+    VirtioBlkSlot* slots;
+    uint32_t slots_physical;
+    VirtioBlkRequest* requests;
+
+    uint16_t free_head;
+    uint16_t free_count;
+    uint16_t last_used;
+
+    List* descriptor_waiters;
+} VirtioBlk;
+
+static List* g_virtio_blk_devices = NULL;
+
+static BOOL virtioblk_open(File *file, uint32_t flags);
+static void virtioblk_close(File *file);
+static int32_t virtioblk_read_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer);
+static int32_t virtioblk_write_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer);
+static int32_t virtioblk_ioctl(File *file, int32_t request, void * argp);
+
+static const filesystem_ops g_virtioblk_ops =
+{
+    .open = virtioblk_open,
+    .close = virtioblk_close,
+    .read_block = virtioblk_read_block,
+    .write_block = virtioblk_write_block,
+    .ioctl = virtioblk_ioctl
+};
+
+static void free_chain(VirtioBlk* device, uint16_t head);
+
+//Marks the requests the device has completed and wakes their threads. Interrupts must be disabled.
+static void collect_used(VirtioBlk* device)
+{
+    while (device->last_used != device->used->index)
+    {
+        uint16_t head = device->used->ring[device->last_used % device->queue_size].id;
+        device->last_used++;
+
+        VirtioBlkRequest* request = &device->requests[head];
+        request->done = TRUE;
+
+        if (request->abandoned)
+        {
+            request->abandoned = FALSE;
+
+            free_chain(device, head);
+        }
+        else if (request->waiter && thread_is_valid(request->waiter) && request->waiter->state == TS_SLEEP)
+        {
+            thread_resume(request->waiter);
+        }
+    }
+}
+
+static void handle_virtioblk_interrupt(Registers *regs)
+{
+    list_foreach (n, g_virtio_blk_devices)
+    {
+        VirtioBlk* device = (VirtioBlk*)n->data;
+
+        if (device->interrupt != regs->interruptNumber)
+        {
+            continue;
+        }
+
+        //Reading the ISR status acknowledges the interrupt. Bit 0 means the used ring changed.
+        if (!(inb(device->io_base + VIRTIO_REG_ISR_STATUS) & 1))
+        {
+            continue;
+        }
+
+        collect_used(device);
+    }
+}
+
+//Must be called with interrupts disabled
+static void sleep_on(void* object, List* wait_list)
+{
+    Thread* thread = thread_get_current();
+
+    if (thread)
+    {
+        if (wait_list)
+        {
+            list_append(wait_list, thread);
+        }
+
+        thread_change_state(thread, TS_WAITIO, object);
+    }
+
+    enable_interrupts();
+    halt();
+    disable_interrupts();
+
+    if (thread)
+    {
+        if (wait_list)
+        {
+            list_remove_first_occurrence(wait_list, thread);
+        }
+
+        if (thread->state == TS_WAITIO && thread->state_privateData == object)
+        {
+            thread_resume(thread);
+        }
+    }
+}
+
+//Returns the chain to the free list and wakes threads waiting for descriptors. Interrupts must be disabled.
+static void free_chain(VirtioBlk* device, uint16_t head)
+{
+    uint16_t index = head;
+    uint16_t count = 1;
+
+    while (device->descriptors[index].flags & VIRTQ_DESC_F_NEXT)
+    {
+        index = device->descriptors[index].next;
+        count++;
+    }
+
+    device->descriptors[index].flags = VIRTQ_DESC_F_NEXT;
+    device->descriptors[index].next = device->free_head;
+    device->free_head = head;
+    device->free_count += count;
+
+    list_foreach (n, device->descriptor_waiters)
+    {
+        Thread* thread = (Thread*)n->data;
+
+        if (thread->state == TS_WAITIO && thread->state_privateData == device)
+        {
+            thread_resume(thread);
+        }
+    }
+}
+
+static uint16_t allocate_descriptor(VirtioBlk* device)
+{
+    uint16_t index = device->free_head;
+
+    device->free_head = device->descriptors[index].next;
+    device->free_count--;
+
+    return index;
+}
+
+//Puts the request on the available ring and notifies the device without waiting for it.
+//Returns the head of the chain, or -1. Interrupts must be disabled.
+static int32_t issue(VirtioBlk* device, uint32_t sector, uint32_t count, uint8_t* buffer, BOOL write)
+{
+    uint32_t size = count * VIRTIO_BLK_SECTOR_SIZE;
+
+    //Physical pieces are looked up before touching the queue, in the address space of the caller
+    uint32_t physical[VIRTIO_BLK_MAX_DATA_DESCRIPTORS];
+    uint32_t lengths[VIRTIO_BLK_MAX_DATA_DESCRIPTORS];
+    uint32_t piece_count = 0;
+
+    for (uint32_t done = 0; done < size; ++piece_count)
+    {
+        uint32_t address = (uint32_t)buffer + done;
+        uint32_t chunk = MIN(PAGESIZE_4K - address % PAGESIZE_4K, size - done);
+
+        physical[piece_count] = vmm_get_physical_address(address);
+        lengths[piece_count] = chunk;
+
+        if (0 == physical[piece_count])
+        {
+            return -1;
+        }
+
+        done += chunk;
+    }
+
+    if (piece_count + 2 > device->queue_size)
+    {
+        return -1;
+    }
+
+    while (device->free_count < piece_count + 2)
+    {
+        sleep_on(device, device->descriptor_waiters);
+    }
+
+    uint16_t head = allocate_descriptor(device);
+
+    VirtioBlkSlot* slot = &device->slots[head];
+    slot->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    slot->reserved = 0;
+    slot->sector = sector;
+    slot->status = VIRTIO_BLK_S_PENDING;
+
+    uint32_t slot_physical = device->slots_physical + head * sizeof(VirtioBlkSlot);
+
+    device->descriptors[head].address = slot_physical;
+    device->descriptors[head].length = 16;
+    device->descriptors[head].flags = VIRTQ_DESC_F_NEXT;
+
+    uint16_t previous = head;
+
+    for (uint32_t i = 0; i < piece_count; ++i)
+    {
+        uint16_t index = allocate_descriptor(device);
+
+        device->descriptors[index].address = physical[i];
+        device->descriptors[index].length = lengths[i];
+        device->descriptors[index].flags = VIRTQ_DESC_F_NEXT | (write ? 0 : VIRTQ_DESC_F_WRITE);
+
+        device->descriptors[previous].next = index;
+        previous = index;
+    }
+
+    uint16_t status_index = allocate_descriptor(device);
+
+    device->descriptors[status_index].address = slot_physical + 16;
+    device->descriptors[status_index].length = 1;
+    device->descriptors[status_index].flags = VIRTQ_DESC_F_WRITE;
+
+    device->descriptors[previous].next = status_index;
+
+    VirtioBlkRequest* request = &device->requests[head];
+    request->waiter = thread_get_current();
+    request->done = FALSE;
+
+    device->available->ring[device->available->index % device->queue_size] = head;
+
+    //The device must see the ring entry before the new index
+    asm volatile("" ::: "memory");
+    device->available->index++;
+    asm volatile("" ::: "memory");
+
+    outw(device->io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+
+    return head;
+}
+
+//Waits for the request and frees its chain, the deadline ends the wait if the interrupt never comes. Interrupts must be disabled.
+static int32_t complete(VirtioBlk* device, uint16_t head)
+{
+    VirtioBlkRequest* request = &device->requests[head];
+
+    Thread* thread = thread_get_current();
+
+    uint32_t deadline = get_uptime_milliseconds() + VIRTIO_BLK_TIMEOUT_MS;
+
+    while (!request->done && (int32_t)(deadline - get_uptime_milliseconds()) > 0)
+    {
+        if (thread)
+        {
+            thread_change_state(thread, TS_SLEEP, (void*)deadline);
+        }
+
+        enable_interrupts();
+        halt();
+        disable_interrupts();
+    }
+
+    if (thread && thread->state == TS_SLEEP)
+    {
+        thread_resume(thread);
+    }
+
+    //The interrupt may have been lost while the used ring has the request
+    collect_used(device);
+
+    if (!request->done)
+    {
+        //The device still owns the chain and the buffer
+        log_printf("virtio-blk: request at sector %d timed out\r\n", (uint32_t)device->slots[head].sector);
+
+        request->waiter = NULL;
+        request->abandoned = TRUE;
+
+        return -1;
+    }
+
+    int32_t result = device->slots[head].status == VIRTIO_BLK_S_OK ? 0 : -1;
+
+    request->waiter = NULL;
+
+    free_chain(device, head);
+
+    return result;
+}
+
+//Descriptors a part at `buffer` needs at most: the header, one per page touched and the status
+static uint32_t get_descriptor_count(uint8_t* buffer, uint32_t count)
+{
+    uint32_t first = (uint32_t)buffer / PAGESIZE_4K;
+    uint32_t last = ((uint32_t)buffer + count * VIRTIO_BLK_SECTOR_SIZE - 1) / PAGESIZE_4K;
+
+    return last - first + 1 + 2;
+}
+
+static int32_t transfer(VirtioBlk* device, uint32_t block_number, uint32_t count, uint8_t* buffer, BOOL write)
+{
+    if (block_number >= device->sector_count || count > device->sector_count - block_number)
+    {
+        return -1;
+    }
+
+    if (write && device->read_only)
+    {
+        return -1;
+    }
+
+    int32_t result = 0;
+
+    uint16_t pending[VIRTIO_BLK_MAX_PENDING];
+    uint32_t pending_first = 0;
+    uint32_t pending_count = 0;
+
+    BOOL interrupts_were_enabled = is_interrupts_enabled();
+
+    disable_interrupts();
+
+    //Killed with parts in flight, their descriptors would never be freed
+    thread_defer_kill();
+
+    while (count > 0 && 0 == result)
+    {
+        uint32_t chunk = MIN(count, VIRTIO_BLK_MAX_SECTORS);
+
+        //Only we free the descriptors of our own parts, so wait for those instead of sleeping for free descriptors
+        while (pending_count > 0 &&
+               (pending_count == VIRTIO_BLK_MAX_PENDING || device->free_count < get_descriptor_count(buffer, chunk)))
+        {
+            if (complete(device, pending[pending_first]) < 0)
+            {
+                result = -1;
+            }
+
+            pending_first = (pending_first + 1) % VIRTIO_BLK_MAX_PENDING;
+            pending_count--;
+        }
+
+        if (result < 0)
+        {
+            break;
+        }
+
+        int32_t head = issue(device, block_number, chunk, buffer, write);
+
+        if (head < 0)
+        {
+            result = -1;
+            break;
+        }
+
+        pending[(pending_first + pending_count) % VIRTIO_BLK_MAX_PENDING] = (uint16_t)head;
+        pending_count++;
+
+        block_number += chunk;
+        buffer += chunk * VIRTIO_BLK_SECTOR_SIZE;
+        count -= chunk;
+    }
+
+    while (pending_count > 0)
+    {
+        if (complete(device, pending[pending_first]) < 0)
+        {
+            result = -1;
+        }
+
+        pending_first = (pending_first + 1) % VIRTIO_BLK_MAX_PENDING;
+        pending_count--;
+    }
+
+    thread_allow_kill();
+
+    if (interrupts_were_enabled)
+    {
+        enable_interrupts();
+    }
+
+    return result;
+}
+
+static BOOL setup_queue(VirtioBlk* device)
+{
+    outw(device->io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+
+    uint16_t queue_size = inw(device->io_base + VIRTIO_REG_QUEUE_SIZE);
+    if (queue_size == 0)
+    {
+        return FALSE;
+    }
+
+    //Legacy layout: descriptors and available ring, then the used ring on the next page boundary
+    uint32_t used_offset = ALIGN_4K(queue_size * sizeof(VirtqDescriptor) + 6 + queue_size * 2);
+    uint32_t slots_offset = used_offset + ALIGN_4K(6 + queue_size * sizeof(VirtqUsedElement));
+    uint32_t total_size = slots_offset + queue_size * sizeof(VirtioBlkSlot);
+
+    device->memory_page_count = PAGE_COUNT(total_size);
+    device->memory_physical = vmm_acquire_page_frames_contiguous(device->memory_page_count);
+    if (0 == device->memory_physical)
+    {
+        return FALSE;
+    }
+
+    uint32_t* frames = (uint32_t*)kmalloc(device->memory_page_count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < device->memory_page_count; ++i)
+    {
+        frames[i] = device->memory_physical + i * PAGESIZE_4K;
+    }
+
+    //The rings are kept mapped for the life of the device
+    device->memory = (uint8_t*)vmm_map_temporary_range(frames, device->memory_page_count);
+
+    kfree(frames);
+
+    if (NULL == device->memory)
+    {
+        for (uint32_t i = 0; i < device->memory_page_count; ++i)
+        {
+            vmm_release_page_frame_4k(device->memory_physical + i * PAGESIZE_4K);
+        }
+        return FALSE;
+    }
+
+    memset(device->memory, 0, device->memory_page_count * PAGESIZE_4K);
+
+    device->queue_size = queue_size;
+    device->descriptors = (volatile VirtqDescriptor*)device->memory;
+    device->available = (volatile VirtqAvailable*)(device->memory + queue_size * sizeof(VirtqDescriptor));
+    device->used = (volatile VirtqUsed*)(device->memory + used_offset);
+    device->slots = (VirtioBlkSlot*)(device->memory + slots_offset);
+    device->slots_physical = device->memory_physical + slots_offset;
+
+    device->requests = (VirtioBlkRequest*)kmalloc(queue_size * sizeof(VirtioBlkRequest));
+    memset((uint8_t*)device->requests, 0, queue_size * sizeof(VirtioBlkRequest));
+
+    for (uint16_t i = 0; i < queue_size; ++i)
+    {
+        device->descriptors[i].next = i + 1;
+        device->descriptors[i].flags = VIRTQ_DESC_F_NEXT;
+    }
+    device->free_head = 0;
+    device->free_count = queue_size;
+    device->last_used = 0;
+
+    outl(device->io_base + VIRTIO_REG_QUEUE_ADDRESS, device->memory_physical / PAGESIZE_4K);
+
+    return TRUE;
+}
+
+static BOOL initialize_device(VirtioBlk* device, const char* name)
+{
+    uint32_t bar0 = pci_get_bar(device->pci, 0);
+    if (!(bar0 & 1))
+    {
+        //Legacy devices have their registers in I/O space
+        return FALSE;
+    }
+
+    device->io_base = bar0 & ~3;
+    device->interrupt = IRQ0 + device->pci->interrupt_line;
+
+    //The handler only looks at devices on the list, this one is added once it is set up
+    if (!interrupt_register_shared(device->interrupt, handle_virtioblk_interrupt))
+    {
+        log_printf("virtio-blk: interrupt %d is taken, /dev/%s is not used\r\n", device->pci->interrupt_line, name);
+        return FALSE;
+    }
+
+    pci_enable(device->pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    outb(device->io_base + VIRTIO_REG_DEVICE_STATUS, 0);
+    outb(device->io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(device->io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    //No optional feature is used
+    uint32_t features = inl(device->io_base + VIRTIO_REG_DEVICE_FEATURES);
+    outl(device->io_base + VIRTIO_REG_GUEST_FEATURES, 0);
+
+    device->read_only = (features & VIRTIO_BLK_F_RO) != 0;
+
+    uint32_t capacity_low = inl(device->io_base + VIRTIO_REG_BLK_CAPACITY);
+    uint32_t capacity_high = inl(device->io_base + VIRTIO_REG_BLK_CAPACITY + 4);
+
+    //Sector numbers are 32 bit in the block interface
+    device->sector_count = capacity_high ? 0xFFFFFFFF : capacity_low;
+
+    if (device->sector_count == 0 || !setup_queue(device))
+    {
+        outb(device->io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return FALSE;
+    }
+
+    device->descriptor_waiters = list_create();
+
+    list_append(g_virtio_blk_devices, device);
+
+    outb(device->io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    Device dev;
+    memset((uint8_t*)&dev, 0, sizeof(Device));
+    strcpy(dev.name, name);
+    dev.device_type = FT_BLOCK_DEVICE;
+    dev.ops = &g_virtioblk_ops;
+    dev.private_data = device;
+
+    devfs_register_device(&dev);
+
+    log_printf("virtio-blk: /dev/%s %d sectors, queue size %d%s\r\n", name, device->sector_count, device->queue_size,
+        device->read_only ? ", read-only" : "");
+
+    return TRUE;
+}
+
+void virtioblk_initialize()
+{
+    g_virtio_blk_devices = list_create();
+
+    uint32_t registered = 0;
+
+    for (uint32_t i = 0; registered < 26; ++i)
+    {
+        PciDevice* pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_LEGACY_DEVICE_ID, i);
+        if (NULL == pci)
+        {
+            break;
+        }
+
+        VirtioBlk* device = (VirtioBlk*)kmalloc(sizeof(VirtioBlk));
+        memset((uint8_t*)device, 0, sizeof(VirtioBlk));
+        device->pci = pci;
+
+        char name[8];
+        strcpy(name, "vda");
+        name[2] = 'a' + registered;
+
+        if (initialize_device(device, name))
+        {
+            registered++;
+        }
+        else
+        {
+            kfree(device);
+        }
+    }
+}
+
+static BOOL virtioblk_open(File *file, uint32_t flags)
+{
+    return TRUE;
+}
+
+static void virtioblk_close(File *file)
+{
+}
+
+static int32_t virtioblk_read_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
+{
+    return transfer((VirtioBlk*)node->private_node_data, block_number, count, buffer, FALSE);
+}
+
+static int32_t virtioblk_write_block(filesystem_node* node, uint32_t block_number, uint32_t count, uint8_t* buffer)
+{
+    return transfer((VirtioBlk*)node->private_node_data, block_number, count, buffer, TRUE);
+}
+
+static int32_t virtioblk_ioctl(File *file, int32_t request, void * argp)
+{
+    VirtioBlk* device = (VirtioBlk*)file->node->private_node_data;
+
+    uint32_t* result = (uint32_t*)argp;
+
+    switch (request)
+    {
+    case IC_GET_SECTOR_COUNT:
+        *result = device->sector_count;
+        return 0;
+        break;
+    case IC_GET_SECTOR_SIZE_BYTES:
+        *result = VIRTIO_BLK_SECTOR_SIZE;
+        return 0;
+        break;
+    default:
+        break;
+    }
+
+    return -1;
+}
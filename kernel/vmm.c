@@ -39,12 +39,16 @@
 #include "list.h"
 #include "log.h"
 #include "serial.h"
+#include "filemapping.h"
 
 uint32_t *g_kernel_page_directory = (uint32_t *)KERN_PAGE_DIRECTORY;
 uint8_t g_physical_page_frame_bitmap[RAM_AS_4K_PAGES / 8];
 
 static int g_total_page_count = 0;
 
+#define TEMPORARY_MAP_SLOT_COUNT 1024
+static uint32_t g_temporary_map_slots[TEMPORARY_MAP_SLOT_COUNT / 32];
+
 static void handle_page_fault(Registers *regs);
 static void vmm_sync_all_from_kernel();
 
@@ -87,6 +91,13 @@ void vmm_initialize(uint32_t high_mem)
         g_kernel_page_directory[i] = 0;
     }
 
+    //The page table of the temporary mapping window is created before any process exists, so every page directory shares it
+    //and vmm_map_temporary can write its entries without syncing page directories.
+    uint32_t temporary_map_table = vmm_acquire_page_frame_4k();
+    memset((uint8_t*)temporary_map_table, 0, PAGESIZE_4K);
+    g_kernel_page_directory[PAGE_INDEX_4M(KERN_TEMPORARY_MAP_AREA)] = temporary_map_table | PG_PRESENT | PG_WRITE;
+    memset((uint8_t*)g_temporary_map_slots, 0, sizeof(g_temporary_map_slots));
+
     //Recursive page directory strategy
     g_kernel_page_directory[1023] = (uint32_t)g_kernel_page_directory | PG_PRESENT | PG_WRITE;
 
@@ -101,7 +112,7 @@ void vmm_initialize(uint32_t high_mem)
         mov %%eax, %%cr4 \n \
         mov %%cr0, %%eax \n \
         or %1, %%eax \n \
-        mov %%eax, %%cr0"::"m"(g_kernel_page_directory), "i"(PAGING_FLAG), "i"(PSE_FLAG));
+        mov %%eax, %%cr0"::"m"(g_kernel_page_directory), "i"(PAGING_FLAG | WRITE_PROTECT_FLAG), "i"(PSE_FLAG));
 
     initialize_kernel_heap();
 }
@@ -146,6 +157,35 @@ uint32_t vmm_acquire_page_frame_4k()
     return (uint32_t)-1;
 }
 
+//For devices that need physically contiguous memory. Returns 0 if there is no run of `count` free frames.
+uint32_t vmm_acquire_page_frames_contiguous(uint32_t count)
+{
+    uint32_t run = 0;
+
+    for (uint32_t page = 0; page < RAM_AS_4K_PAGES && count > 0; ++page)
+    {
+        if (IS_PAGEFRAME_USED(g_physical_page_frame_bitmap, page))
+        {
+            run = 0;
+            continue;
+        }
+
+        if (++run == count)
+        {
+            uint32_t first = page + 1 - count;
+
+            for (uint32_t i = first; i <= page; ++i)
+            {
+                SET_PAGEFRAME_USED(g_physical_page_frame_bitmap, i);
+            }
+
+            return first * PAGESIZE_4K;
+        }
+    }
+
+    return 0;
+}
+
 void vmm_release_page_frame_4k(uint32_t p_addr)
 {
     //log_printf("DEBUG: Released 4K Physical %x\n", p_addr);
@@ -265,8 +305,15 @@ BOOL vmm_add_page_to_pd(char *v_addr, uint32_t p_addr, int flags)
         //serial_printf("vmm_add_page_to_pd 2");
         uint32_t tablePhysical = vmm_acquire_page_frame_4k();
 
+        //User page tables always belong to the process, even if the first page mapped into them is not owned (shared memory, executable text).
+        uint32_t table_flags = flags & 0xFFF & ~PG_READONLY;
+        if (v_addr >= (char*)(KERN_HEAP_END))
+        {
+            table_flags |= PG_OWNED;
+        }
+
         //serial_printf("vmm_add_page_to_pd 3");
-        pd[pd_index] = (tablePhysical) | (flags & 0xFFF) | (PG_PRESENT | PG_WRITE);
+        pd[pd_index] = (tablePhysical) | table_flags | (PG_PRESENT | PG_WRITE);
 
         //serial_printf("vmm_add_page_to_pd 4");
 
@@ -294,7 +341,14 @@ BOOL vmm_add_page_to_pd(char *v_addr, uint32_t p_addr, int flags)
         return FALSE;
     }
 
-    pt[pt_index] = (p_addr) | (flags & 0xFFF) | (PG_PRESENT | PG_WRITE);
+    uint32_t write_flag = PG_WRITE;
+    if ((flags & PG_READONLY) == PG_READONLY)
+    {
+        //CR0.WP is set, so system calls can't write through such pages either. Populate them through vmm_map_temporary.
+        write_flag = 0;
+    }
+
+    pt[pt_index] = (p_addr) | (flags & 0xFFF) | (PG_PRESENT | write_flag);
 
     //serial_printf("vmm_add_page_to_pd 7");
 
@@ -318,6 +372,129 @@ BOOL vmm_add_page_to_pd(char *v_addr, uint32_t p_addr, int flags)
     return TRUE;
 }
 
+//Returns the physical address that v_addr is mapped to, or 0 if it is not mapped.
+//Works for active Page Directory!
+uint32_t vmm_get_physical_address(uint32_t v_addr)
+{
+    int pd_index = v_addr >> 22;
+    int pt_index = (v_addr >> 12) & 0x03FF;
+
+    uint32_t* pd = (uint32_t*)0xFFFFF000;
+
+    if ((pd[pd_index] & PG_PRESENT) != PG_PRESENT)
+    {
+        return 0;
+    }
+
+    if (pd[pd_index] & PG_4MB)
+    {
+        //The identity mapped area has no page tables
+        return (pd[pd_index] & 0xFFC00000) | (v_addr & 0x3FFFFF);
+    }
+
+    uint32_t* pt = ((uint32_t*)0xFFC00000) + (0x400 * pd_index);
+
+    if ((pt[pt_index] & PG_PRESENT) != PG_PRESENT)
+    {
+        return 0;
+    }
+
+    return (pt[pt_index] & ~0xFFF) | (v_addr & 0xFFF);
+}
+
+//Maps the page frame into the kernel window at KERN_TEMPORARY_MAP_AREA, so frames outside the identity mapped area can be accessed.
+//Returns NULL if all slots are in use. Unmap with vmm_unmap_temporary as soon as possible.
+void* vmm_map_temporary(uint32_t p_addr)
+{
+    return vmm_map_temporary_range(&p_addr, 1);
+}
+
+void vmm_unmap_temporary(void* v_addr)
+{
+    vmm_unmap_temporary_range(v_addr, 1);
+}
+
+//Maps the frames to consecutive slots, so callers get a virtually contiguous buffer over scattered frames
+void* vmm_map_temporary_range(const uint32_t* p_addrs, uint32_t count)
+{
+    uint32_t* pt = ((uint32_t*)0xFFC00000) + (0x400 * PAGE_INDEX_4M(KERN_TEMPORARY_MAP_AREA));
+
+    void* v_addr = NULL;
+
+    if (0 == count || count > TEMPORARY_MAP_SLOT_COUNT)
+    {
+        return NULL;
+    }
+
+    begin_critical_section();
+
+    uint32_t run = 0;
+
+    for (uint32_t slot = 0; slot < TEMPORARY_MAP_SLOT_COUNT; ++slot)
+    {
+        if (g_temporary_map_slots[slot / 32] & (1 << (slot % 32)))
+        {
+            run = 0;
+            continue;
+        }
+
+        if (++run < count)
+        {
+            continue;
+        }
+
+        uint32_t first_slot = slot + 1 - count;
+
+        v_addr = (void*)(KERN_TEMPORARY_MAP_AREA + first_slot * PAGESIZE_4K);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint32_t s = first_slot + i;
+            char* v = (char*)v_addr + i * PAGESIZE_4K;
+
+            g_temporary_map_slots[s / 32] |= (1 << (s % 32));
+
+            pt[s] = (p_addrs[i] & ~0xFFF) | PG_PRESENT | PG_WRITE;
+
+            asm volatile("invlpg (%0)"::"r"(v):"memory");
+        }
+
+        break;
+    }
+
+    end_critical_section();
+
+    return v_addr;
+}
+
+void vmm_unmap_temporary_range(void* v_addr, uint32_t count)
+{
+    uint32_t* pt = ((uint32_t*)0xFFC00000) + (0x400 * PAGE_INDEX_4M(KERN_TEMPORARY_MAP_AREA));
+
+    uint32_t first_slot = ((uint32_t)v_addr - KERN_TEMPORARY_MAP_AREA) / PAGESIZE_4K;
+
+    if ((uint32_t)v_addr < KERN_TEMPORARY_MAP_AREA || first_slot + count > TEMPORARY_MAP_SLOT_COUNT)
+    {
+        return;
+    }
+
+    begin_critical_section();
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t s = first_slot + i;
+        char* v = (char*)v_addr + i * PAGESIZE_4K;
+
+        pt[s] = 0;
+
+        asm volatile("invlpg (%0)"::"r"(v):"memory");
+
+        g_temporary_map_slots[s / 32] &= ~(1 << (s % 32));
+    }
+
+    end_critical_section();
+}
+
 //Works for active Page Directory!
 BOOL vmm_remove_page_from_pd(char *v_addr)
 {
@@ -446,6 +623,22 @@ uint32_t vmm_get_free_page_count()
     return g_total_page_count - vmm_get_used_page_count();
 }
 
+//Cheaper than vmm_get_free_page_count for small counts, as it stops at the count'th free frame
+BOOL vmm_has_free_page_frames(uint32_t count)
+{
+    uint32_t found = 0;
+
+    for (uint32_t i = 0; i < g_total_page_count && found < count; ++i)
+    {
+        if (!IS_PAGEFRAME_USED(g_physical_page_frame_bitmap, i))
+        {
+            ++found;
+        }
+    }
+
+    return found >= count;
+}
+
 static void print_page_fault_info(uint32_t faulting_address, Registers *regs)
 {
     int present = regs->errorCode & 0x1;
@@ -471,6 +664,51 @@ static void print_page_fault_info(uint32_t faulting_address, Registers *regs)
     log_printf("CPU was in %s\r\n", us ? "user-mode" : "supervisor mode");
 }
 
+//Between the guard page and the lowest mapped page of the main stack, where it grows into
+static BOOL is_below_stack(Process* process, uint32_t address)
+{
+    const uint32_t guard_page = USER_STACK - USER_STACK_RESERVE - PAGESIZE_4K;
+
+    return address >= guard_page && address < process->stack_bottom;
+}
+
+//Returns TRUE if the fault was a stack growth and it has been handled
+static BOOL handle_stack_fault(Process* process, uint32_t faulting_address, Registers *regs)
+{
+    if ((regs->errorCode & 1) != 0 || !is_below_stack(process, faulting_address))
+    {
+        //Protection violation or not below the stack
+        return FALSE;
+    }
+
+    //Faults from user code must be near the stack pointer (push, call, enter) so stray pointers into the region still fault. Those from the kernel are
+    //accesses to user buffers.
+    if (regs->cs != 0x08 && faulting_address + 65536 + 32 * sizeof(uint32_t) < regs->userEsp)
+    {
+        return FALSE;
+    }
+
+    //Fails past the stack limit or when memory is full, either way the fault becomes a SIGSEGV
+    return vmm_grow_stack(process, faulting_address);
+}
+
+//Makes the page at `address` present like a fault from the kernel would, without the fault. FALSE if nothing can be mapped there.
+//Works for active Page Directory!
+BOOL vmm_fault_in(Process* process, uint32_t address)
+{
+    if (vmm_get_physical_address(address) != 0)
+    {
+        return TRUE;
+    }
+
+    if (is_below_stack(process, address))
+    {
+        return vmm_grow_stack(process, address);
+    }
+
+    return filemapping_handle_fault(process, address);
+}
+
 static void handle_page_fault(Registers *regs)
 {
     // A page fault has occurred.
@@ -485,6 +723,18 @@ static void handle_page_fault(Registers *regs)
     Thread* faulting_thread = thread_get_current();
     if (NULL != faulting_thread)
     {
+        if (faulting_thread->user_mode && handle_stack_fault(faulting_thread->owner, faulting_address, regs))
+        {
+            //Stack grown, retry the faulting instruction
+            return;
+        }
+
+        if ((regs->errorCode & 1) == 0 && filemapping_handle_fault(faulting_thread->owner, faulting_address))
+        {
+            //File page mapped in, retry
+            return;
+        }
+
         Thread* main_thread = thread_get_first();
 
         if (main_thread == faulting_thread)
@@ -558,16 +808,70 @@ void vmm_initialize_process_pages(Process* process)
     //Page Tables position marked as used. It is after MEMORY_END.
 }
 
-//if this fails (return NULL), the caller should clean up physical page frames
-void* vmm_map_memory(Process* process, uint32_t v_address_search_start, uint32_t* p_address_array, uint32_t page_count, BOOL own)
+/*
+ *  The main stack of a process lives in a region of USER_STACK_RESERVE bytes below USER_STACK. The region and the guard page under it are marked as used
+ *  so mmap never places anything there, but only the top USER_STACK_INITIAL_PAGES are mapped. Faults below the mapped part are handled by `vmm_grow_stack`.
+ *  Works for active Page Directory!
+ */
+void vmm_reserve_stack(Process* process)
 {
-    int page_index = 0;
+    for (uint32_t v = USER_STACK - USER_STACK_RESERVE - PAGESIZE_4K; v < USER_STACK; v += PAGESIZE_4K)
+    {
+        SET_PAGEFRAME_USED(process->mmapped_virtual_memory, PAGE_INDEX_4K(v));
+    }
 
-    if (NULL == p_address_array || page_count == 0)
+    process->stack_bottom = USER_STACK;
+
+    vmm_grow_stack(process, USER_STACK - PAGESIZE_4K * USER_STACK_INITIAL_PAGES);
+}
+
+//Maps the main stack down to the page containing `address`. Fails if that is beyond the process's stack limit or memory is full.
+//Works for active Page Directory!
+BOOL vmm_grow_stack(Process* process, uint32_t address)
+{
+    address &= 0xFFFFF000;
+
+    if (address >= process->stack_bottom)
     {
-        return NULL;
+        return TRUE;
+    }
+
+    if (address < USER_STACK - process->stack_limit)
+    {
+        log_printf("Stack overflow pid:%d address:%x limit:%x\r\n", process->pid, address, process->stack_limit);
+
+        return FALSE;
+    }
+
+    //The stack pages plus up to two page tables for the region. Without them the faulting process is killed instead of the kernel.
+    uint32_t needed = (process->stack_bottom - address) / PAGESIZE_4K + 2;
+
+    if (!vmm_has_free_page_frames(needed))
+    {
+        log_printf("Out of memory growing stack pid:%d address:%x\r\n", process->pid, address);
+
+        return FALSE;
+    }
+
+    for (uint32_t v = address; v < process->stack_bottom; v += PAGESIZE_4K)
+    {
+        uint32_t p = vmm_acquire_page_frame_4k();
+
+        vmm_add_page_to_pd((char*)v, p, PG_USER | PG_OWNED);
+
+        memset((uint8_t*)v, 0, PAGESIZE_4K);
     }
 
+    process->stack_bottom = address;
+
+    return TRUE;
+}
+
+//Returns the first address of page_count free adjacent pages at or above v_address_search_start, or 0
+static uint32_t find_free_memory(Process* process, uint32_t v_address_search_start, uint32_t page_count)
+{
+    int page_index = 0;
+
     uint32_t found_adjacent = 0;
 
     uint32_t v_mem = 0;
@@ -590,13 +894,78 @@ void* vmm_map_memory(Process* process, uint32_t v_address_search_start, uint32_t
 
         if (found_adjacent == page_count)
         {
-            break;
+            return v_mem;
         }
     }
 
-    //log_printf("vmm_map_memory: needed:%d foundAdjacent:%d v_mem:%x\n", neededPages, foundAdjacent, v_mem);
+    return 0;
+}
+
+//Marks page_count adjacent pages as used without mapping them, the pages are mapped later (on page fault).
+//vmm_unmap_memory releases them.
+void* vmm_reserve_memory(Process* process, uint32_t v_address_search_start, uint32_t page_count)
+{
+    if (page_count == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t v_mem = find_free_memory(process, v_address_search_start, page_count);
+
+    if (0 == v_mem)
+    {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < page_count; ++i)
+    {
+        SET_PAGEFRAME_USED(process->mmapped_virtual_memory, PAGE_INDEX_4K(v_mem) + i);
+    }
+
+    return (void*)v_mem;
+}
+
+//Returns TRUE if the page was written since the last call (or since it was mapped), and clears its dirty bit.
+//Works for active Page Directory!
+BOOL vmm_clear_page_dirty(uint32_t v_addr)
+{
+    int pd_index = v_addr >> 22;
+    int pt_index = (v_addr >> 12) & 0x03FF;
+
+    uint32_t* pd = (uint32_t*)0xFFFFF000;
+
+    if ((pd[pd_index] & PG_PRESENT) != PG_PRESENT)
+    {
+        return FALSE;
+    }
+
+    uint32_t* pt = ((uint32_t*)0xFFC00000) + (0x400 * pd_index);
+
+    if ((pt[pt_index] & (PG_PRESENT | PG_DIRTY)) != (PG_PRESENT | PG_DIRTY))
+    {
+        return FALSE;
+    }
+
+    pt[pt_index] &= ~PG_DIRTY;
+
+    asm volatile("invlpg (%0)"::"r"(v_addr & 0xFFFFF000):"memory");
+
+    return TRUE;
+}
+
+//if this fails (return NULL), the caller should clean up physical page frames
+void* vmm_map_memory(Process* process, uint32_t v_address_search_start, uint32_t* p_address_array, uint32_t page_count, BOOL own)
+{
+    if (NULL == p_address_array || page_count == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t v_mem = find_free_memory(process, v_address_search_start, page_count);
+
+    //log_printf("vmm_map_memory: needed:%d v_mem:%x\n", page_count, v_mem);
 
-    if (found_adjacent == page_count)
+    if (0 != v_mem)
     {
         int own_flag = 0;
         if (own)
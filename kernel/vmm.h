@@ -50,6 +50,7 @@ extern uint32_t *g_kernel_page_directory;
 
 uint32_t vmm_acquire_page_frame_4k();
 void vmm_release_page_frame_4k(uint32_t p_addr);
+uint32_t vmm_acquire_page_frames_contiguous(uint32_t count);
 
 void vmm_initialize(uint32_t high_mem);
 
@@ -58,6 +59,11 @@ void vmm_destroy_page_directory_with_memory(uint32_t physical_pd);
 
 BOOL vmm_add_page_to_pd(char *v_addr, uint32_t p_addr, int flags);
 BOOL vmm_remove_page_from_pd(char *v_addr);
+uint32_t vmm_get_physical_address(uint32_t v_addr);
+void* vmm_map_temporary(uint32_t p_addr);
+void vmm_unmap_temporary(void* v_addr);
+void* vmm_map_temporary_range(const uint32_t* p_addrs, uint32_t count);
+void vmm_unmap_temporary_range(void* v_addr, uint32_t count);
 
 void enable_paging();
 void disable_paging();
@@ -65,7 +71,13 @@ void disable_paging();
 uint32_t vmm_get_total_page_count();
 uint32_t vmm_get_used_page_count();
 uint32_t vmm_get_free_page_count();
+BOOL vmm_has_free_page_frames(uint32_t count);
 
 void vmm_initialize_process_pages(Process* process);
 void* vmm_map_memory(Process* process, uint32_t v_address_search_start, uint32_t* p_address_array, uint32_t page_count, BOOL own);
-BOOL vmm_unmap_memory(Process* process, uint32_t v_address, uint32_t page_count);
\ No newline at end of file
+BOOL vmm_unmap_memory(Process* process, uint32_t v_address, uint32_t page_count);
+void* vmm_reserve_memory(Process* process, uint32_t v_address_search_start, uint32_t page_count);
+BOOL vmm_clear_page_dirty(uint32_t v_addr);
+void vmm_reserve_stack(Process* process);
+BOOL vmm_grow_stack(Process* process, uint32_t address);
+BOOL vmm_fault_in(Process* process, uint32_t address);
\ No newline at end of file
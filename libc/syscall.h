@@ -15,7 +15,9 @@
 #define O_RDONLY 0
 #define O_WRONLY 1
 #define O_RDWR 2
-#define O_CREAT 100
+#define O_APPEND 0x0008
+#define O_CREAT 0x0200
+#define O_TRUNC 0x0400
 
 enum
 {
@@ -92,6 +94,24 @@ enum
     SYS_nanosleep,
     SYS_getthreads,
     SYS_getprocs,
+    SYS_spawn,
+    SYS_futex,
+    SYS_clone,
+    SYS_getrlimit,
+    SYS_setrlimit,
+    SYS_msync,
+    SYS_manage_ramdisk,
+    SYS_fsync,
+    SYS_fdatasync,
+    SYS_sync,
+    SYS_io_ring_setup,
+    SYS_io_ring_enter,
+    SYS_sendfile,
+    SYS_splice,
+    SYS_pread64,
+    SYS_pwrite64,
+    SYS_preadv,
+    SYS_pwritev,
     SYSCALL_COUNT
 };
 
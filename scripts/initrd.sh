@@ -22,4 +22,11 @@ cp -r initrd/* /mnt
 sudo umount /mnt
 sudo losetup -d $LOOP
 sync
-sudo chown $SUDO_USER:$SUDO_USER initrd.fat
\ No newline at end of file
+sudo chown $SUDO_USER:$SUDO_USER initrd.fat
+
+# The kernel also accepts an LZ4 frame image and decompresses it at boot
+if command -v lz4 > /dev/null
+then
+    lz4 -q -f -9 -BD --content-size initrd.fat initrd.fat.lz4
+    sudo chown $SUDO_USER:$SUDO_USER initrd.fat.lz4
+fi
\ No newline at end of file